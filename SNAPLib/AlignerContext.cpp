@@ -36,6 +36,7 @@ Revision History:
 #include "Error.h"
 #include "Util.h"
 #include "CommandProcessor.h"
+#include "BigAlloc.h"
 
 using std::max;
 using std::min;
@@ -46,6 +47,88 @@ using std::min;
 GenomeIndex *g_index = NULL;
 char *g_indexDirectory = NULL;
 
+//
+// Set by the daemon when it runs several jobs at once, so that jobs starting together load the index only once.
+//
+ExclusiveLock *g_indexLock = NULL;
+
+//
+// With -numa replicate, one copy of the index per NUMA node.  g_indexReplicas[0] is g_index.
+//
+static GenomeIndex *g_indexReplicas[MaxNumaNodes];
+static int g_nIndexReplicas = 0;
+
+extern bool BigAllocUseHugePages;
+
+//
+// Load the index, placing it on the NUMA nodes as the options ask.  Interleaving sets the loading thread's memory
+// policy so that the pages it reads the index into are spread across the nodes.  Replicating loads the index once per
+// node with the policy bound to that node; each aligner thread then uses the copy local to the processor it's bound to.
+//
+static GenomeIndex *LoadIndexWithPlacement(AlignerOptions *options)
+{
+    NumaIndexPlacement placement = options->numaPlacement;
+    int nNodes = GetNumberOfNumaNodes();
+
+    if (placement != NumaDefaultPlacement && options->mapIndex) {
+        WriteErrorMessage("-numa doesn't apply to a mapped index (-map), so the index is loaded without NUMA placement.\n");
+        placement = NumaDefaultPlacement;
+    }
+
+    if (placement == NumaReplicateIndex) {
+        if (!options->bindToProcessors) {
+            WriteErrorMessage("-numa replicate needs threads bound to processors to keep them on their copy; interleaving the index instead.\n");
+            placement = NumaInterleaveIndex;
+        } else {
+            _int64 indexSize = GenomeIndex::getLoadedSize(options->indexDir);
+            for (int node = 0; node < nNodes; node++) {
+                _int64 freeMemory = GetNumaNodeFreeMemory(node);
+                if (freeMemory >= 0 && indexSize >= 0 && freeMemory < indexSize + indexSize / 10) {
+                    WriteErrorMessage("NUMA node %d has %lldMB free, not enough for a %lldMB copy of the index; interleaving the index instead.\n",
+                        node, freeMemory / (1024 * 1024), indexSize / (1024 * 1024));
+                    placement = NumaInterleaveIndex;
+                    break;
+                }
+            }
+        }
+    }
+
+    bool savedUseHugePages = BigAllocUseHugePages;
+    if (placement != NumaDefaultPlacement) {
+        BigAllocUseHugePages = true;
+    }
+
+    GenomeIndex *index = NULL;
+    if (placement == NumaReplicateIndex && nNodes > 1) {
+        for (int node = 0; node < nNodes; node++) {
+            if (!BindThreadMemoryToNumaNode(node)) {
+                WriteErrorMessage("Unable to bind memory to NUMA node %d; loading the copy for that node without placement.\n", node);
+            }
+            g_indexReplicas[node] = GenomeIndex::loadFromDirectory((char*) options->indexDir, false, false, options->packGenome);
+            ResetThreadMemoryPlacement();
+
+            if (NULL == g_indexReplicas[node]) {
+                for (int i = 0; i < node; i++) {
+                    delete g_indexReplicas[i];
+                }
+                BigAllocUseHugePages = savedUseHugePages;
+                return NULL;
+            }
+        }
+        g_nIndexReplicas = nNodes;
+        index = g_indexReplicas[0];
+    } else {
+        if (placement == NumaInterleaveIndex && !InterleaveThreadMemoryAcrossNumaNodes()) {
+            WriteErrorMessage("Unable to interleave memory across NUMA nodes; loading the index without placement.\n");
+        }
+        index = GenomeIndex::loadFromDirectory((char*) options->indexDir, options->mapIndex, options->prefetchIndex, options->packGenome);
+        ResetThreadMemoryPlacement();
+    }
+
+    BigAllocUseHugePages = savedUseHugePages;
+    return index;
+}
+
 AlignerContext::AlignerContext(int i_argc, const char **i_argv, const char *i_version, AlignerExtension* i_extension)
     :
     index(NULL),
@@ -57,7 +140,10 @@ AlignerContext::AlignerContext(int i_argc, const char **i_argv, const char *i_ve
     argc(i_argc),
     argv(i_argv),
     version(i_version),
-    perfFile(NULL)
+    perfFile(NULL),
+    threadLimit(0),
+    allowBinding(true),
+    echoToCommandPipe(true)
 {
 }
 
@@ -71,6 +157,7 @@ AlignerContext::~AlignerContext()
 
 void AlignerContext::runAlignment(int argc, const char **argv, const char *version, unsigned *argsConsumed)
 {
+    SetCommandPipeEchoForThisThread(echoToCommandPipe);
     options = parseOptions(argc, argv, version, argsConsumed, isPaired());
 
 	if (NULL == options) {	// Didn't parse correctly
@@ -78,6 +165,13 @@ void AlignerContext::runAlignment(int argc, const char **argv, const char *versi
 		return;
 	}
 
+    if (threadLimit > 0 && options->numThreads > threadLimit) {
+        options->numThreads = threadLimit;
+    }
+    if (!allowBinding) {
+        options->bindToProcessors = false;
+    }
+
 #ifdef _MSC_VER
 	useTimingBarrier = options->useTimingBarrier;
 #endif
@@ -111,6 +205,9 @@ AlignerContext::initializeThread()
 {
     stats = newStats(); // separate copy per thread
     stats->extra = extension->extraStats();
+    if (g_nIndexReplicas > 1 && index == g_index && bindToProcessors) {
+        index = g_indexReplicas[GetNumaNodeOfProcessor(threadNum) % g_nIndexReplicas];
+    }
     readWriter = writerSupplier != NULL ? writerSupplier->getWriter() : NULL;
     extension = extension->copy();
 }
@@ -118,6 +215,7 @@ AlignerContext::initializeThread()
     void
 AlignerContext::runThread()
 {
+    SetCommandPipeEchoForThisThread(echoToCommandPipe);
     extension->beginThread();
     runIterationThread();
     if (readWriter != NULL) {
@@ -138,12 +236,16 @@ AlignerContext::finishThread(AlignerContext* common)
 }
 
     bool
-AlignerContext::initialize()
+AlignerContext::loadIndex()
 {
     if (g_indexDirectory == NULL || strcmp(g_indexDirectory, options->indexDir) != 0) {
+        for (int i = 1; i < g_nIndexReplicas; i++) {
+            delete g_indexReplicas[i];
+        }
+        g_nIndexReplicas = 0;
         delete g_index;
         g_index = NULL;
-        delete g_indexDirectory;
+        delete [] g_indexDirectory;
         g_indexDirectory = new char [strlen(options->indexDir) + 1];
         strcpy(g_indexDirectory, options->indexDir);
 
@@ -152,16 +254,18 @@ AlignerContext::initialize()
  
             fflush(stdout);
             _int64 loadStart = timeInMillis();
-            index = GenomeIndex::loadFromDirectory((char*) options->indexDir, options->mapIndex, options->prefetchIndex);
+            index = LoadIndexWithPlacement(options);
             if (index == NULL) {
                 WriteErrorMessage("Index load failed, aborting.\n");
+                delete [] g_indexDirectory;
+                g_indexDirectory = NULL;
 				return false;
             }
             g_index = index;
 
             _int64 loadTime = timeInMillis() - loadStart;
-             WriteStatusMessage("%llds.  %u bases, seed size %d\n",
-                    loadTime / 1000, index->getGenome()->getCountOfBases(), index->getSeedLength());
+             WriteStatusMessage("%llds.  %u bases, seed size %d%s\n",
+                    loadTime / 1000, index->getGenome()->getCountOfBases(), index->getSeedLength(), g_nIndexReplicas > 1 ? ", one copy per NUMA node" : "");
          } else {
             WriteStatusMessage("no alignment, input/output only\n");
         }
@@ -169,6 +273,26 @@ AlignerContext::initialize()
         index = g_index;
     }
 
+    return true;
+}
+
+    bool
+AlignerContext::initialize()
+{
+    if (NULL != g_indexLock) {
+        AcquireExclusiveLock(g_indexLock);
+    }
+
+    bool loaded = loadIndex();
+
+    if (NULL != g_indexLock) {
+        ReleaseExclusiveLock(g_indexLock);
+    }
+
+    if (!loaded) {
+        return false;
+    }
+
     maxHits_ = options->maxHits;
     maxDist_ = options->maxDist;
     extraSearchDepth = options->extraSearchDepth;
@@ -403,6 +527,44 @@ AlignerContext::printStats()
     }
 #endif // TIME_HISTOGRAM
 
+    if (stats->seedLookups > 0) {
+        //
+        // Batching looks up seeds that reads finish without: ones past what the exact match tier needed for reads that it
+        // finishes, and the end of the last batch for the others.  Compare -slb settings by reads per second; the sampled
+        // time per lookup shows how much of the stall on the index batching hides, but with more threads than cores it
+        // also includes time that a thread was descheduled.
+        //
+        char seedLookups[strBufLen];
+        char unusedSeedLookups[strBufLen];
+        char seedLookupsPastExactMatch[strBufLen];
+        WriteStatusMessage("Seed lookups: %s in batches of %.1f, %s unused (%s of them past what the exact match tier needed)\n",
+            FormatUIntWithCommas(stats->seedLookups, seedLookups, strBufLen),
+            (double)stats->seedLookups / max(stats->seedLookupBatches, (_int64)1),
+            FormatUIntWithCommas(stats->unusedSeedLookups, unusedSeedLookups, strBufLen),
+            FormatUIntWithCommas(stats->seedLookupsPastExactMatch, seedLookupsPastExactMatch, strBufLen));
+
+        if (stats->seedsInTimedLookupBatches > 0) {
+            WriteStatusMessage("Seed lookup time (sampled): %.0f ns per seed\n",
+                (double)stats->nanosInTimedLookupBatches / stats->seedsInTimedLookupBatches);
+        }
+    }
+
+    if (stats->exactMatchTierReads > 0) {
+        char exactMatchTierReads[strBufLen];
+        char fullSearchReads[strBufLen];
+        WriteStatusMessage("Exact match tier finished %s reads (%.2f%%), full search %s\n",
+            FormatUIntWithCommas(stats->exactMatchTierReads, exactMatchTierReads, strBufLen),
+            100.0 * stats->exactMatchTierReads / (stats->exactMatchTierReads + stats->fullSearchReads),
+            FormatUIntWithCommas(stats->fullSearchReads, fullSearchReads, strBufLen));
+    }
+
+    if (stats->alignmentCacheLookups > 0) {
+        char alignmentCacheLookups[strBufLen];
+        WriteStatusMessage("Alignment cache: %s lookups, %.2f%% hits, %.2fs of alignment time saved\n",
+            FormatUIntWithCommas(stats->alignmentCacheLookups, alignmentCacheLookups, strBufLen),
+            100.0 * stats->alignmentCacheHits / stats->alignmentCacheLookups,
+            (double)stats->alignmentCacheNanosSaved / 1000000000);
+    }
 
     stats->printHistograms(stdout);
 
@@ -518,7 +680,16 @@ AlignerContext::parseOptions(
 		return NULL;
     }
 
-    if (options->maxDist + options->extraSearchDepth >= MAX_K) {
+    //
+    // In LONG_READS builds the single-end aligner can score past MAX_K with BitParallelEditDistance.  The paired-end
+    // aligner only uses LandauVishkin.
+    //
+#ifdef LONG_READS
+    bool limitedByLandauVishkin = options->isPaired();
+#else   // LONG_READS
+    bool limitedByLandauVishkin = true;
+#endif  // LONG_READS
+    if (limitedByLandauVishkin && options->maxDist + options->extraSearchDepth >= MAX_K) {
         WriteErrorMessage("You specified too large of a maximum edit distance combined with extra search depth.  The must add up to less than %d.\n", MAX_K);
         WriteErrorMessage("Either reduce their sum, or change MAX_K in LandauVishkin.h and recompile.\n");
 		delete options;
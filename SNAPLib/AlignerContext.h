@@ -43,7 +43,7 @@ public:
 
     AlignerContext(int i_argc, const char **i_argv, const char *i_version, AlignerExtension* i_extension = NULL);
 
-    ~AlignerContext();
+    virtual ~AlignerContext();
 
     // running alignment
 
@@ -74,6 +74,9 @@ public:
     // initialize from options
     virtual bool initialize();
 
+    // load the index named in the options, or reuse the one loaded by the previous run
+    bool loadIndex();
+
     // new stats object
     virtual AlignerStats* newStats() = 0;
     
@@ -119,6 +122,11 @@ public:
     int                                  maxSecondaryAlignmentsPerContig;
 	unsigned							 minReadLength;
 
+    // set by the daemon's job scheduler before runAlignment
+    int                                  threadLimit;       // caps -t when > 0
+    bool                                 allowBinding;      // false when other jobs share the cores
+    bool                                 echoToCommandPipe; // false for background jobs, whose client has gone
+
 
     // iteration variables
     int                 maxHits_;
@@ -49,6 +49,7 @@ AlignerOptions::AlignerOptions(
     noDuplicateMarking(false),
     noQualityCalibration(false),
     sortMemory(0),
+    sortMergeFanIn(0),
     filterFlags(0),
     explorePopularSeeds(false),
     stopOnFirstHit(false),
@@ -72,10 +73,17 @@ AlignerOptions::AlignerOptions(
     noUkkonen(false),
     noOrderedEvaluation(false),
 	noTruncation(false),
+    seedRanking(false),
+    noExactMatchTier(false),
 	minReadLength(DEFAULT_MIN_READ_LENGTH),
     maxDistFraction(0.0),
 	mapIndex(false),
 	prefetchIndex(false),
+    packGenome(false),
+    numaPlacement(NumaDefaultPlacement),
+    seedLookupBatchSize(8),
+    alignmentCacheMegabytes(0),
+    reuseTracebacks(false),
     writeBufferSize(16 * 1024 * 1024)
 {
     if (forPairedEnd) {
@@ -120,6 +128,8 @@ AlignerOptions::usageMessage()
         "       with small caches or lots of cores/cache\n"
         "  -so  sort output file by alignment location\n"
         "  -sm  memory to use for sorting in Gb\n"
+        "  -sbm merge sorted output in the background while aligning, this many runs at a time (default: off, 8 is reasonable).\n"
+        "       The final merge after aligning then has only a few large runs to merge.\n"
         "  -x   explore some hits of overly popular seeds (useful for filtering)\n"
         "  -f   stop on first match within edit distance limit (filtering mode)\n"
         "  -F   filter output (a=aligned only, s=single hit only (MAPQ >= %d), u=unaligned only, l=long enough to align (see -mrl))\n"
@@ -174,6 +184,14 @@ AlignerOptions::usageMessage()
 		"  -pre Prefetch the index into system cache.  This is only meaningful with -map, and only helps if the index is not\n"
 		"       already in memory and your operating system is slow at reading mapped files (i.e., some versions of Linux,\n"
 		"       but not Windows).\n"
+        "  -pg  Pack the genome into memory at two bits per base rather than one byte.  This cuts the memory used by the genome\n"
+        "       (but not the hash tables) by 4x, at the cost of unpacking each candidate location before scoring it.  The index\n"
+        "       directory is the same either way.  Implies not using -map for the genome itself.\n"
+        " -numa Place the index for a multi-socket (NUMA) machine.  -numa interleave spreads the index across all nodes so\n"
+        "       every thread sees the same average latency.  -numa replicate loads a copy of the index on each node and has each\n"
+        "       thread use the copy on its own node; it needs processor binding (the default) and enough free memory on every\n"
+        "       node, and falls back to interleave otherwise.  Either way the index uses huge pages (1GB pages if the system has\n"
+        "       them reserved).  Not compatible with -map.  In daemon mode this applies when the index is first loaded.\n"
         "  -lp  Run SNAP at low scheduling priority (Only implemented on Windows)\n"
 #ifdef LONG_READS
         "  -dp  Edit distance as a percentage of read length (single only, overrides -d)\n"
@@ -186,6 +204,22 @@ AlignerOptions::usageMessage()
 		"       down execution without improving alignments.\n"
 		"  -nt  Don't truncate searches based on missed seed hits.  This option is purely for evaluating the performance effect\n"
 		"       of candidate truncation, and specifying it will slow down execution without improving alignments.\n"
+        "  -sr  Seed Ranking: look up each pass of a read's seeds from the fewest expected hits to the most, using the seed\n"
+        "       popularity sketch that indices built by this version of SNAP have.  This looks up fewer seeds, but a read\n"
+        "       can finish before the moderately popular seeds that would have found its second best alignment, which\n"
+        "       gives it a higher MAPQ than it would otherwise get.  So it's off by default, and seeds go in read order.\n"
+        " -net  No Exact-match Tier: always do the full search, rather than first looking up a read's non-overlapping seeds\n"
+        "       all at once and finishing it right there if they all point to one place that matches well enough.  The\n"
+        "       alignments are the same either way.  Single-end only.  This option is for evaluating the performance effect\n"
+        "       of the tier.\n"
+        " -slb  Seed lookup batch size: how many of a read's seeds to look up in the index at once, so that their cache misses\n"
+        "       overlap.  1 looks them up one at a time.  Single-end only.  Default %d, maximum %d\n"
+        "  -ac  Alignment cache size in megabytes.  Reads (or pairs) whose bases and qualities exactly match an earlier one\n"
+        "       reuse its alignment rather than aligning again, which helps with libraries that have many PCR or optical duplicates.\n"
+        "       Reads with secondary alignments (-om) aren't cached.  Default 0 (no cache)\n"
+        "  -rt  Reuse Tracebacks: keep the edits that the aligner finds when it scores a location, and write the CIGAR strings\n"
+        "       of the results from them rather than computing the edit distance again.  Only results with no indels and at most\n"
+        "       one substitution use them, since those are the ones where the output is sure to be the same as without -rt.\n"
         " -wbs  Write buffer size in megabytes.  Don't specify this unless you've gotten an error message saying to make it bigger.  Default 16.\n"
 		,
             commandLine,
@@ -194,7 +228,8 @@ AlignerOptions::usageMessage()
 			minWeightToCheck,
             MAPQ_LIMIT_FOR_SINGLE_HIT, MAPQ_LIMIT_FOR_SINGLE_HIT, MAPQ_LIMIT_FOR_SINGLE_HIT,
             expansionFactor,
-			DEFAULT_MIN_READ_LENGTH);
+			DEFAULT_MIN_READ_LENGTH,
+            seedLookupBatchSize, BaseAligner::maxSeedLookupBatchSize);
 
     if (extra != NULL) {
         extra->usageMessage();
@@ -335,6 +370,22 @@ AlignerOptions::parse(
 	} else if (strcmp(argv[n], "-pre") == 0) {
 		prefetchIndex = true;
 		return true;
+	} else if (strcmp(argv[n], "-pg") == 0) {
+		packGenome = true;
+		return true;
+	} else if (strcmp(argv[n], "-numa") == 0) {
+		if (n + 1 < argc) {
+			n++;
+			if (strcmp(argv[n], "interleave") == 0) {
+				numaPlacement = NumaInterleaveIndex;
+				return true;
+			} else if (strcmp(argv[n], "replicate") == 0) {
+				numaPlacement = NumaReplicateIndex;
+				return true;
+			}
+			WriteErrorMessage("-numa must be followed by interleave or replicate\n");
+		}
+		return false;
 	}
 	else if (strcmp(argv[n], "-S") == 0) {
         if (n + 1 < argc) {
@@ -362,6 +413,12 @@ AlignerOptions::parse(
             n++;
             return true;
         }
+    } else if (strcmp(argv[n], "-sbm") == 0) {
+        if (n + 1 < argc && argv[n+1][0] >= '0' && argv[n+1][0] <= '9') {
+            sortMergeFanIn = atoi(argv[n+1]);
+            n++;
+            return sortMergeFanIn == 0 || sortMergeFanIn >= 2;
+        }
     } else if (strcmp(argv[n], "-F") == 0) {
         if (n + 1 < argc) {
             n++;
@@ -534,6 +591,21 @@ AlignerOptions::parse(
         } else {
             WriteErrorMessage("Must have the gap penalty value after -G\n");
         }
+    } else if (strcmp(argv[n], "-slb") == 0) {
+        if (n + 1 < argc) {
+            n++;
+            seedLookupBatchSize = atoi(argv[n]);
+            return seedLookupBatchSize > 0 && seedLookupBatchSize <= BaseAligner::maxSeedLookupBatchSize;
+        }
+    } else if (strcmp(argv[n], "-ac") == 0) {
+        if (n + 1 < argc && argv[n + 1][0] >= '0' && argv[n + 1][0] <= '9') {
+            n++;
+            alignmentCacheMegabytes = atoi(argv[n]);
+            return true;
+        }
+    } else if (strcmp(argv[n], "-rt") == 0) {
+        reuseTracebacks = true;
+        return true;
     } else if (strcmp(argv[n], "-mrl") == 0) {
         if (n + 1 < argc) {
             n++;
@@ -719,6 +791,12 @@ AlignerOptions::parse(
 	} else if (strcmp(argv[n], "-nt") == 0) {
 		noTruncation = true;
 		return true;
+    } else if (strcmp(argv[n], "-sr") == 0) {
+        seedRanking = true;
+        return true;
+    } else if (strcmp(argv[n], "-net") == 0) {
+        noExactMatchTier = true;
+        return true;
 	} else if (strcmp(argv[n], "-D") == 0) {
         if (n + 1 < argc) {
             extraSearchDepth = atoi(argv[n+1]);
@@ -54,6 +54,8 @@ struct SNAPFile {
     static bool generateFromCommandLine(const char **args, int nArgs, int *argsConsumed, SNAPFile *snapFile, bool paired, bool isInput);
 };
 
+enum NumaIndexPlacement {NumaDefaultPlacement, NumaInterleaveIndex, NumaReplicateIndex};
+
 struct AlignerOptions : public AbstractOptions
 {
     AlignerOptions(const char* i_commandLine, bool forPairedEnd = false);
@@ -80,6 +82,7 @@ struct AlignerOptions : public AbstractOptions
     bool                noDuplicateMarking;
     bool                noQualityCalibration;
     unsigned            sortMemory; // total output sorting buffer size in Gb
+    unsigned            sortMergeFanIn; // if nonzero, merge sorted blocks this many at a time in the background while aligning
     unsigned            filterFlags;
     bool                explorePopularSeeds;
     bool                stopOnFirstHit;
@@ -100,9 +103,16 @@ struct AlignerOptions : public AbstractOptions
     bool                noUkkonen;
     bool                noOrderedEvaluation;
 	bool				noTruncation;
+    bool                seedRanking;
+    bool                noExactMatchTier;
 	unsigned			minReadLength;
 	bool				mapIndex;
 	bool				prefetchIndex;
+    bool                packGenome;
+    NumaIndexPlacement  numaPlacement;
+    unsigned            seedLookupBatchSize;
+    unsigned            alignmentCacheMegabytes;    // 0 means no alignment cache
+    bool                reuseTracebacks;            // Make CIGAR strings from the aligners' tracebacks rather than running LV again
     size_t              writeBufferSize;
     
     static bool         useHadoopErrorMessages; // This is static because it's global (and I didn't want to push the options object to every place in the code)
@@ -40,7 +40,18 @@ AlignerStats::AlignerStats(AbstractStats* i_extra)
     extra(i_extra),
     lvCalls(0),
     filtered(0),
-    extraAlignments(0)
+    extraAlignments(0),
+    seedLookups(0),
+    unusedSeedLookups(0),
+    seedLookupBatches(0),
+    seedsInTimedLookupBatches(0),
+    nanosInTimedLookupBatches(0),
+    seedLookupsPastExactMatch(0),
+    exactMatchTierReads(0),
+    fullSearchReads(0),
+    alignmentCacheLookups(0),
+    alignmentCacheHits(0),
+    alignmentCacheNanosSaved(0)
 {
     for (int i = 0; i <= AlignerStats::maxMapq; i++) {
         mapqHistogram[i] = 0;
@@ -91,6 +102,17 @@ AlignerStats::add(
     lvCalls += other->lvCalls;
     filtered += other->filtered;
     extraAlignments += other->extraAlignments;
+    seedLookups += other->seedLookups;
+    unusedSeedLookups += other->unusedSeedLookups;
+    seedLookupBatches += other->seedLookupBatches;
+    seedsInTimedLookupBatches += other->seedsInTimedLookupBatches;
+    nanosInTimedLookupBatches += other->nanosInTimedLookupBatches;
+    seedLookupsPastExactMatch += other->seedLookupsPastExactMatch;
+    exactMatchTierReads += other->exactMatchTierReads;
+    fullSearchReads += other->fullSearchReads;
+    alignmentCacheLookups += other->alignmentCacheLookups;
+    alignmentCacheHits += other->alignmentCacheHits;
+    alignmentCacheNanosSaved += other->alignmentCacheNanosSaved;
 
     if (extra != NULL && other->extra != NULL) {
         extra->add(other->extra);
@@ -53,6 +53,17 @@ struct AlignerStats : public AbstractStats
     _int64 lvCalls;
     _int64 filtered;
     _int64 extraAlignments;
+    _int64 seedLookups;         // Seeds looked up in the index, including ones looked up in a batch that weren't used
+    _int64 unusedSeedLookups;
+    _int64 seedLookupBatches;
+    _int64 seedsInTimedLookupBatches;   // The sample of batches that the aligners timed (see BaseAligner::lookupSeedBatch)
+    _int64 nanosInTimedLookupBatches;
+    _int64 seedLookupsPastExactMatch;   // Unused ones that the exact match tier looked up
+    _int64 exactMatchTierReads;         // Reads that the single-end aligner finished with just its first pass of seeds
+    _int64 fullSearchReads;             // and with its full search
+    _int64 alignmentCacheLookups;
+    _int64 alignmentCacheHits;
+    _int64 alignmentCacheNanosSaved;    // What the hits took to align the first time
     static const unsigned maxMapq = 70;
     unsigned mapqHistogram[maxMapq+1];
 
@@ -0,0 +1,88 @@
+/*++
+
+Module Name:
+
+    AlignmentCache.cpp
+
+Abstract:
+
+    Read fingerprints for the alignment cache.
+
+Environment:
+
+    User mode service.
+
+--*/
+
+#include "stdafx.h"
+#include "AlignmentCache.h"
+
+//
+// Two independent 64 bit multiply/rotate hashes over the read eight bytes at a time.  This is about as fast as
+// copying the read, which matters because it's done for every read when the cache is on.
+//
+static inline _uint64 mixIn(_uint64 hash, _uint64 value, _uint64 multiplier)
+{
+    hash ^= value * multiplier;
+    hash = (hash << 31) | (hash >> 33);
+    return hash * 0x9e3779b97f4a7c15ull;
+}
+
+static inline _uint64 finish(_uint64 hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static void hashBytes(_uint64 *hash, const char *bytes, unsigned length)
+{
+    unsigned i = 0;
+    for (; i + 8 <= length; i += 8) {
+        _uint64 word;
+        memcpy(&word, bytes + i, 8);
+        hash[0] = mixIn(hash[0], word, 0x87c37b91114253d5ull);
+        hash[1] = mixIn(hash[1], word, 0x4cf5ad432745937full);
+    }
+
+    if (i < length) {
+        _uint64 word = 0;
+        memcpy(&word, bytes + i, length - i);
+        hash[0] = mixIn(hash[0], word, 0x87c37b91114253d5ull);
+        hash[1] = mixIn(hash[1], word, 0x4cf5ad432745937full);
+    }
+}
+
+    void
+AlignmentCacheKey::add(Read *read)
+{
+    unsigned length = read->getDataLength();
+    hash[0] = mixIn(hash[0], length, 0x87c37b91114253d5ull);
+    hash[1] = mixIn(hash[1], length, 0x4cf5ad432745937full);
+    hashBytes(hash, read->getData(), length);
+    hashBytes(hash, read->getQuality(), length);
+}
+
+    void
+AlignmentCacheKey::computeFor(Read *read)
+{
+    hash[0] = 0x243f6a8885a308d3ull;
+    hash[1] = 0x13198a2e03707344ull;
+    add(read);
+    hash[0] = finish(hash[0]) | 1;  // Never all zero, which marks an empty entry
+    hash[1] = finish(hash[1]);
+}
+
+    void
+AlignmentCacheKey::computeFor(Read *read0, Read *read1)
+{
+    hash[0] = 0xa4093822299f31d0ull;
+    hash[1] = 0x082efa98ec4e6c89ull;
+    add(read0);
+    add(read1);
+    hash[0] = finish(hash[0]) | 1;
+    hash[1] = finish(hash[1]);
+}
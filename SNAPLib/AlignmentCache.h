@@ -0,0 +1,134 @@
+/*++
+
+Module Name:
+
+    AlignmentCache.h
+
+Abstract:
+
+    A cache of alignment results keyed by read contents, so that exact duplicate reads (and pairs) in a library
+    don't each get aligned from scratch.
+
+Environment:
+
+    User mode service.
+
+--*/
+
+#pragma once
+
+#include "Compat.h"
+#include "BigAlloc.h"
+#include "Read.h"
+
+//
+// The key is a 128 bit fingerprint of the bases and qualities of the read (or both reads of a pair).  Qualities are
+// included because they feed the match probabilities and so MAPQ.  Rather than keep a copy of each read to compare
+// against, we rely on the fingerprint: with 128 bits the chance of two different reads colliding is negligible
+// next to, say, the chance of a bit flip in memory.
+//
+struct AlignmentCacheKey {
+    _uint64 hash[2];
+
+    bool operator==(const AlignmentCacheKey &peer) const {
+        return hash[0] == peer.hash[0] && hash[1] == peer.hash[1];
+    }
+
+    void computeFor(Read *read);
+    void computeFor(Read *read0, Read *read1);
+
+private:
+    void add(Read *read);
+};
+
+//
+// RESULT is SingleAlignmentResult or PairedAlignmentResult.  The cache is shared by all of the aligner threads of a run.
+// It's a set-associative table of four entries per bucket, with the buckets protected by a fixed number of striped
+// locks, so threads only contend when they hit the same stripe at the same time.  When a bucket is full, a new entry
+// replaces one chosen from the fingerprint, which is as good as random.
+//
+// Callers only cache results that are a pure function of the read, i.e., ones without secondary alignments (which
+// would need more space than an entry has).  Each entry also remembers how long its read took to align, so that hits
+// can report the time they saved.
+//
+template<class RESULT> class AlignmentCache {
+public:
+    AlignmentCache(size_t bytes)
+    {
+        nBuckets = __max((_uint64)1, (_uint64)(bytes / sizeof(Bucket)));
+        buckets = (Bucket *)BigAlloc(nBuckets * sizeof(Bucket));
+        memset(buckets, 0, nBuckets * sizeof(Bucket));   // An all zero key is empty; computeFor never generates one
+
+        for (unsigned i = 0; i < nLocks; i++) {
+            InitializeExclusiveLock(&locks[i]);
+        }
+    }
+
+    ~AlignmentCache()
+    {
+        for (unsigned i = 0; i < nLocks; i++) {
+            DestroyExclusiveLock(&locks[i]);
+        }
+        BigDealloc(buckets);
+    }
+
+    bool lookup(const AlignmentCacheKey &key, RESULT *result, _int64 *nanosToAlign)
+    {
+        _uint64 whichBucket = key.hash[0] % nBuckets;
+        Bucket *bucket = &buckets[whichBucket];
+        bool found = false;
+
+        AcquireExclusiveLock(&locks[whichBucket % nLocks]);
+        for (unsigned i = 0; i < entriesPerBucket; i++) {
+            if (bucket->entries[i].key == key) {
+                *result = bucket->entries[i].result;
+                *nanosToAlign = bucket->entries[i].nanosToAlign;
+                found = true;
+                break;
+            }
+        }
+        ReleaseExclusiveLock(&locks[whichBucket % nLocks]);
+
+        return found;
+    }
+
+    void insert(const AlignmentCacheKey &key, const RESULT &result, _int64 nanosToAlign)
+    {
+        _uint64 whichBucket = key.hash[0] % nBuckets;
+        Bucket *bucket = &buckets[whichBucket];
+
+        AcquireExclusiveLock(&locks[whichBucket % nLocks]);
+        unsigned victim = (unsigned)(key.hash[1] % entriesPerBucket);
+        for (unsigned i = 0; i < entriesPerBucket; i++) {
+            if (bucket->entries[i].key == key) {
+                victim = i;         // Another thread aligned the same read at the same time
+                break;
+            }
+            if (0 == bucket->entries[i].key.hash[0] && 0 == bucket->entries[i].key.hash[1]) {
+                victim = i;
+            }
+        }
+        bucket->entries[victim].key = key;
+        bucket->entries[victim].result = result;
+        bucket->entries[victim].nanosToAlign = nanosToAlign;
+        ReleaseExclusiveLock(&locks[whichBucket % nLocks]);
+    }
+
+private:
+    static const unsigned entriesPerBucket = 4;
+    static const unsigned nLocks = 1024;
+
+    struct Entry {
+        AlignmentCacheKey   key;
+        _int64              nanosToAlign;
+        RESULT              result;
+    };
+
+    struct Bucket {
+        Entry entries[entriesPerBucket];
+    };
+
+    Bucket         *buckets;
+    _uint64         nBuckets;
+    ExclusiveLock   locks[nLocks];
+};
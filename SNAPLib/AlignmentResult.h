@@ -28,6 +28,7 @@ Revision History:
 #pragma once
 #include "Genome.h"
 #include "directions.h"
+#include "AlignmentTraceback.h"
 
 class Read;
 
@@ -55,6 +56,8 @@ struct SingleAlignmentResult {
 
     int             mapq;		// mapping quality, encoded like a Phred score (but as an integer, not ASCII Phred + 33).
 
+    AlignmentTraceback traceback;   // The edits the aligner found, if it's keeping them (-rt).  ops is NULL otherwise.
+
     static int compareByContigAndScore(const void *first, const void *second);      // qsort()-style compare routine
     static int compareByScore(const void *first, const void *second);               // qsort()-style compare routine
 };
@@ -82,6 +85,8 @@ struct PairedAlignmentResult {
 
 	int mapq[NUM_READS_PER_PAIR];               // mapping quality of each end, encoded like a Phred score (but as an integer, not ASCII Phred + 33).
 
+	AlignmentTraceback traceback[NUM_READS_PER_PAIR];   // The edits the aligner found for each end, if it's keeping them (-rt).  ops is NULL otherwise.
+
 	bool fromAlignTogether;                     // Was this alignment created by aligning both reads together, rather than from some combination of single-end aligners?
 	bool alignedAsPair;                         // Were the reads aligned as a pair, or separately?
 	_int64 nanosInAlignTogether;
@@ -0,0 +1,111 @@
+/*++
+
+Module Name:
+
+    AlignmentTraceback.cpp
+
+Abstract:
+
+    Storage for the tracebacks that the aligners keep for their results.
+
+Environment:
+
+    User mode service.
+
+--*/
+
+#include "stdafx.h"
+#include "AlignmentTraceback.h"
+
+TracebackBuffer::TracebackBuffer() : currentChunk(0), used(0), tracebackStart(0)
+{
+    chunks.push_back(new char[ChunkSize]);
+    chunkSizes.push_back((int)ChunkSize);
+}
+
+TracebackBuffer::~TracebackBuffer()
+{
+    for (size_t i = 0; i < chunks.size(); i++) {
+        delete [] chunks[i];
+    }
+}
+
+    void
+TracebackBuffer::clear()
+{
+    currentChunk = 0;
+    used = 0;
+    tracebackStart = 0;
+}
+
+    void
+TracebackBuffer::start()
+{
+    tracebackStart = used;
+}
+
+    void
+TracebackBuffer::makeRoom(int bytes)
+{
+    if (used + bytes <= chunkSizes[currentChunk]) {
+        return;
+    }
+
+    //
+    // Move the traceback that's being built to the start of the next chunk, making a new one (big enough for it) if
+    // we've never needed this many.
+    //
+    int tracebackSoFar = used - tracebackStart;
+    int needed = tracebackSoFar + bytes;
+    currentChunk++;
+    if (currentChunk == chunks.size() || chunkSizes[currentChunk] < needed) {
+        int size = __max((int)ChunkSize, 2 * needed);
+        if (currentChunk == chunks.size()) {
+            chunks.push_back(new char[size]);
+            chunkSizes.push_back(size);
+        } else {
+            delete [] chunks[currentChunk];
+            chunks[currentChunk] = new char[size];
+            chunkSizes[currentChunk] = size;
+        }
+    }
+
+    memcpy(chunks[currentChunk], chunks[currentChunk - 1] + tracebackStart, tracebackSoFar);
+    tracebackStart = 0;
+    used = tracebackSoFar;
+}
+
+    void
+TracebackBuffer::append(char op, int count)
+{
+    while (count > 0) {
+        if (used - tracebackStart >= 2) {
+            char *last = chunks[currentChunk] + used - 2;
+            if (last[1] == op && (unsigned char)last[0] < 255) {
+                int extend = __min(count, 255 - (unsigned char)last[0]);
+                last[0] = (char)((unsigned char)last[0] + extend);
+                count -= extend;
+                continue;
+            }
+        }
+
+        makeRoom(2);
+        char *next = chunks[currentChunk] + used;
+        int thisCount = __min(count, 255);
+        next[0] = (char)thisCount;
+        next[1] = op;
+        used += 2;
+        count -= thisCount;
+    }
+}
+
+    AlignmentTraceback
+TracebackBuffer::finish()
+{
+    AlignmentTraceback traceback;
+    traceback.ops = chunks[currentChunk] + tracebackStart;
+    traceback.opsLength = used - tracebackStart;
+    tracebackStart = used;
+
+    return traceback;
+}
@@ -0,0 +1,73 @@
+/*++
+
+Module Name:
+
+    AlignmentTraceback.h
+
+Abstract:
+
+    The edits of an alignment as the aligner found them while scoring it, so that the writer doesn't have to find
+    them again.
+
+Environment:
+
+    User mode service.
+
+--*/
+
+#pragma once
+
+#include "Compat.h"
+#include <vector>
+
+//
+// The edits that the aligner found for a result when it scored it, so that the writer can make the CIGAR string from
+// them rather than running LandauVishkinWithCigar over the same bases a second time (-rt), when they're sure to come out
+// the same (see LandauVishkinWithCigar::computeCigarFromTraceback).  ops covers the whole
+// (clipped) read in the direction in which it aligned, starting at the result's location, in COMPACT_CIGAR_BINARY
+// format: a count byte followed by one of '=', 'X', 'I' or 'D'.  The ops belong to the TracebackBuffer of the aligner
+// that found them, so they're only good until that buffer is next cleared.  NULL ops means that there's no traceback,
+// and the writer computes the CIGAR string the usual way.
+//
+struct AlignmentTraceback {
+    const char     *ops;
+    int             opsLength;      // In bytes, so twice the number of operations
+
+    void clear() {ops = NULL; opsLength = 0;}
+};
+
+//
+// Where an aligner keeps the tracebacks for the locations it scores.  The space comes in chunks that never move, so
+// a traceback stays put while more are added after it.  The chunks are kept and reused after clear().
+//
+// This class is NOT thread safe.  Each aligner has its own.
+//
+class TracebackBuffer {
+public:
+    TracebackBuffer();
+    ~TracebackBuffer();
+
+    //
+    // Forget all of the tracebacks.  Whoever gives the buffer to the aligner does this before each read (or pair).
+    //
+    void clear();
+
+    //
+    // Build a traceback: start it, append its operations in order and then finish it.  Appending the same operation
+    // as the last one just extends it, and appending a count of zero does nothing.
+    //
+    void start();
+    void append(char op, int count);
+    AlignmentTraceback finish();
+
+private:
+    static const int ChunkSize = 64 * 1024;
+
+    void makeRoom(int bytes);
+
+    std::vector<char *> chunks;
+    std::vector<int>    chunkSizes;
+    size_t              currentChunk;
+    int                 used;               // Bytes used in the current chunk, including the traceback being built
+    int                 tracebackStart;     // Where the traceback being built starts in the current chunk
+};
@@ -39,12 +39,14 @@ using std::max;
 using std::min;
 using util::strnchr;
 
-BAMReader::BAMReader(const ReaderContext& i_context) : ReadReader(i_context)
+BAMReader::BAMReader(const ReaderContext& i_context) : ReadReader(i_context), data(NULL), fileName(NULL), started(false)
 {
 }
 
 BAMReader::~BAMReader()
 {
+    delete data;
+    delete [] fileName;
 }
 
     bool
@@ -60,23 +62,15 @@ BAMReader::getNextReadPair(
 
     void
 BAMReader::init(
-    const char *fileName,
-    int bufferCount,
+    const char *i_fileName,
+    int i_bufferCount,
     _int64 startingOffset,
     _int64 amountOfFileToProcess)
 {
-    // todo: integrate supplier models
-    // might need up to 3x extra for expanded sequence + quality + cigar data
-    if (!strcmp("-", fileName)) {
-        data = DataSupplier::GzipBamStdio->getDataReader(bufferCount, MAX_RECORD_LENGTH, 3.0 * DataSupplier::ExpansionFactor, 0);
-    } else {
-        data = DataSupplier::GzipBamDefault->getDataReader(bufferCount, MAX_RECORD_LENGTH, 3.0 * DataSupplier::ExpansionFactor, 0);
-    }
-
-    if (! data->init(fileName)) {
-        WriteErrorMessage("Unable to read file %s\n", fileName);
-        soft_exit(1);
-    }
+    fileName = new char[strlen(i_fileName) + 1];
+    strcpy(fileName, i_fileName);
+    bufferCount = i_bufferCount;
+    data = createDataReader();
 
     if (startingOffset == 0) {
         readHeader(fileName);
@@ -84,8 +78,8 @@ BAMReader::init(
 
     _ASSERT(context.headerBytes > 0);
     reinit(startingOffset, amountOfFileToProcess);
-    if ((size_t) startingOffset < context.headerBytes) {
-		_int64 bytesToSkip = context.headerBytes - startingOffset;
+    if (startingOffset == 0) {
+		_int64 bytesToSkip = context.headerBytes;
 
 		while (bytesToSkip > 0) {
 			char* p;
@@ -108,6 +102,25 @@ BAMReader::init(
     }
 }
 
+    DataReader*
+BAMReader::createDataReader()
+{
+    // todo: integrate supplier models
+    // might need up to 3x extra for expanded sequence + quality + cigar data
+    DataReader* result;
+    if (!strcmp("-", fileName)) {
+        result = DataSupplier::GzipBamStdio->getDataReader(bufferCount, MAX_RECORD_LENGTH, 3.0 * DataSupplier::ExpansionFactor, 0);
+    } else {
+        result = DataSupplier::GzipBamDefault->getDataReader(bufferCount, MAX_RECORD_LENGTH, 3.0 * DataSupplier::ExpansionFactor, 0);
+    }
+
+    if (! result->init(fileName)) {
+        WriteErrorMessage("Unable to read file %s\n", fileName);
+        soft_exit(1);
+    }
+    return result;
+}
+
     void
 BAMReader::readHeader(
     const char* fileName)
@@ -193,16 +206,120 @@ BAMReader::reinit(
     _int64 startingOffset,
     _int64 amountOfFileToProcess)
 {
+    // the decompressor only goes through one range of the file, so the next range needs a new one
+    if (started) {
+        delete data;
+        data = createDataReader();
+    }
+    started = true;
     data->reinit(startingOffset, amountOfFileToProcess);
     extraOffset = 0;
+    if (startingOffset > 0) {
+        skipToFirstRecord();
+    }
 }
 
+    void
+BAMReader::skipToFirstRecord()
+{
+    char* buffer;
+    _int64 validBytes, startBytes;
+    if (! data->getData(&buffer, &validBytes, &startBytes)) {
+        return;
+    }
+    _int64 skip = 0;
+    while (skip < startBytes && ! looksLikeRecords(buffer + skip, buffer + validBytes)) {
+        skip++;
+    }
+    data->advance(skip);
+}
+
+//
+// Records have nothing to find them by, so look for a run of them that all make sense: sizes that agree with each
+// other, printable NUL-terminated names and real CIGAR operations.  It takes several in a row, or all of them up to
+// the end of the buffer.
+//
+    bool
+BAMReader::looksLikeRecords(
+    char* buffer,
+    char* end)
+{
+    const int RecordsToCheck = 8;
+    char* p = buffer;
+    for (int i = 0; i < RecordsToCheck; i++) {
+        if (p >= end) {
+            return i > 0;
+        }
+        if (end - p < (_int64) sizeof(BAMAlignment)) {
+            return i > 0;
+        }
+        BAMAlignment* bam = (BAMAlignment*) p;
+        if (bam->block_size < (_int32) (sizeof(BAMAlignment) - sizeof(bam->block_size)) || bam->size() > (size_t) MAX_RECORD_LENGTH ||
+                bam->refID < -1 || bam->pos < -1 || bam->next_refID < -1 || bam->next_pos < -1 ||
+                bam->l_read_name < 2 || bam->l_seq < 0 || (bam->FLAG & ~0xfff) != 0 ||
+                BAMAlignment::size(bam->l_read_name, bam->n_cigar_op, bam->l_seq, 0) > bam->size()) {
+            return false;
+        }
+        char* name = bam->read_name();
+        for (int j = 0; j < bam->l_read_name && name + j < end; j++) {
+            if (j == bam->l_read_name - 1 ? name[j] != 0 : (name[j] < '!' || name[j] > '~')) {
+                return false;
+            }
+        }
+        _uint32* cigar = bam->cigar();
+        for (int j = 0; j < bam->n_cigar_op && (char*) (cigar + j + 1) <= end; j++) {
+            if (BAMAlignment::GetCigarOpCode(cigar[j]) > 8) {
+                return false;
+            }
+        }
+        p += bam->size();
+    }
+    return true;
+}
+
+    _int64
+BAMReader::getFirstRecordBlockOffset(
+    const char* fileName,
+    size_t headerBytes)
+{
+    FILE* file = fopen(fileName, "rb");
+    if (file == NULL) {
+        WriteErrorMessage("Unable to read file %s\n", fileName);
+        soft_exit(1);
+    }
+    char* block = new char[BAM_BLOCK];
+    _int64 offset = 0;
+    size_t decompressedBytes = 0;
+    while (_fseek64bit(file, offset, SEEK_SET) == 0) {
+        size_t bytes = fread(block, 1, BAM_BLOCK, file);
+        if (! BgzfHeader::isWholeBlock(block, bytes)) {
+            break;
+        }
+        BgzfHeader* header = (BgzfHeader*) block;
+        if (decompressedBytes + header->ISIZE() > headerBytes) {
+            break;
+        }
+        decompressedBytes += header->ISIZE();
+        offset += header->BSIZE() + 1;
+    }
+    delete [] block;
+    fclose(file);
+    return offset;
+}
+
+//
+// Single-end BAM files are split into ranges of BGZF blocks for each thread to decompress and parse, like SAM and
+// FASTQ, except from stdin, which has to go through a queue.
+//
     ReadSupplierGenerator *
 BAMReader::createReadSupplierGenerator(
     const char *fileName,
     int numThreads,
     const ReaderContext& context)
 {
+    if (strcmp(fileName, "-")) {
+        return new RangeSplittingReadSupplierGenerator(fileName, BAMFile, numThreads, context);
+    }
     BAMReader* reader = create(fileName, ReadSupplierQueue::BufferCount(numThreads), 0, 0, context);
     ReadSupplierQueue* queue = new ReadSupplierQueue((ReadReader*)reader);
     queue->startReaders();
@@ -685,7 +802,7 @@ public:
         int mapQuality, GenomeLocation genomeLocation, Direction direction, bool secondaryAlignment, int * o_addFrontClipping,
         bool hasMate = false, bool firstInPair = false, Read * mate = NULL,
         AlignmentResult mateResult = NotFound, GenomeLocation mateLocation = 0, Direction mateDirection = FORWARD,
-        bool alignedAsPair = false) const;
+        bool alignedAsPair = false, const AlignmentTraceback *traceback = NULL) const;
 
 private:
 
@@ -693,7 +810,8 @@ private:
         char * cigarBuf, int cigarBufLen,
         const char * data, unsigned dataLength, unsigned basesClippedBefore, unsigned extraBasesClippedBefore, unsigned basesClippedAfter,
         unsigned frontHardClipping, unsigned backHardClipping,
-        GenomeLocation genomeLocation, bool isRC, bool useM, int * o_editDistance, int * o_addFrontClipping);
+        GenomeLocation genomeLocation, bool isRC, bool useM, int * o_editDistance, int * o_addFrontClipping,
+        const AlignmentTraceback *traceback);
 
     const bool useM;
 };
@@ -763,7 +881,7 @@ BAMFormat::getWriterSupplier(
         dataSupplier = DataWriterSupplier::sorted(this, genome, tempFileName,
             options->sortMemory * (1ULL << 30),
             options->numThreads, options->outputFile.fileName, filters, options->writeBufferSize,
-            FileEncoder::gzip(gzipSupplier, options->numThreads, options->bindToProcessors));
+            options->sortMergeFanIn, FileEncoder::gzip(gzipSupplier, options->numThreads, options->bindToProcessors));
     } else {
         dataSupplier = DataWriterSupplier::create(options->outputFile.fileName, options->writeBufferSize, gzipSupplier);
     }
@@ -849,7 +967,8 @@ BAMFormat::writeRead(
     AlignmentResult mateResult,
     GenomeLocation mateLocation,
     Direction mateDirection,
-    bool alignedAsPair) const
+    bool alignedAsPair,
+    const AlignmentTraceback *traceback) const
 {
     const int MAX_READ = MAX_READ_LENGTH;
     const int cigarBufSize = MAX_READ;
@@ -893,7 +1012,7 @@ BAMFormat::writeRead(
         cigarOps = computeCigarOps(context.genome, lv, (char*)cigarBuf, cigarBufSize * sizeof(_uint32),
                                    clippedData, clippedLength, basesClippedBefore, (unsigned)extraBasesClippedBefore, basesClippedAfter,
                                    read->getOriginalFrontHardClipping(), read->getOriginalBackHardClipping(),
-                                   genomeLocation, direction == RC, useM, &editDistance, o_addFrontClipping);
+                                   genomeLocation, direction == RC, useM, &editDistance, o_addFrontClipping, traceback);
         if (*o_addFrontClipping != 0) {
             return false;
         }
@@ -1051,7 +1170,8 @@ BAMFormat::computeCigarOps(
     bool                        isRC,
 	bool						useM,
     int *                       o_editDistance,
-    int *                       o_addFrontClipping
+    int *                       o_addFrontClipping,
+    const AlignmentTraceback *  traceback
 )
 {
     GenomeDistance extraBasesClippedAfter = 0;
@@ -1061,7 +1181,7 @@ BAMFormat::computeCigarOps(
     unsigned clippingWordsAfter = ((basesClippedAfter + extraBasesClippedAfter > 0) ? 1 : 0) + ((backHardClipping > 0) ? 1 : 0);
 
     SAMFormat::computeCigar(BAM_CIGAR_OPS, genome, lv, cigarBuf + 4 * clippingWordsBefore, cigarBufLen - 4 * (clippingWordsBefore + clippingWordsAfter), data, dataLength, basesClippedBefore, extraBasesClippedBefore,
-        basesClippedAfter, &extraBasesClippedAfter, genomeLocation, useM, o_editDistance, &used,  o_addFrontClipping);
+        basesClippedAfter, &extraBasesClippedAfter, genomeLocation, useM, o_editDistance, &used,  o_addFrontClipping, traceback);
 
     if (*o_addFrontClipping != 0) {
         return 0;
@@ -1826,6 +1946,44 @@ BgzfHeader::validate(char* buffer, size_t bytes)
     return p == buffer + bytes;
 }
 
+    bool
+BgzfHeader::isWholeBlock(
+    char* buffer,
+    _int64 bytes)
+{
+    BgzfHeader* h = (BgzfHeader*) buffer;
+    if (bytes < (_int64) sizeof(BgzfHeader) || h->ID1 != 0x1f || h->ID2 != 0x8b || h->CM != 8 || h->FLG != 4 ||
+            bytes < (_int64) sizeof(BgzfHeader) + h->XLEN) {
+        return false;
+    }
+    char* extraEnd = (char*) h->firstExtra() + h->XLEN;
+    for (BgzfExtra* x = h->firstExtra(); (char*) x->data() <= extraEnd && (char*) x->data() + x->SLEN <= extraEnd; x = x->nextExtra()) {
+        if (x->SI1 == 66 && x->SI2 == 67 && x->SLEN == 2) {
+            _int64 blockBytes = *(_uint16*) x->data() + 1;
+            return blockBytes >= (_int64) sizeof(BgzfHeader) + h->XLEN + 8 && blockBytes <= bytes &&
+                *(_uint32*) (buffer + blockBytes - 4) <= BAM_BLOCK;
+        }
+    }
+    return false;
+}
+
+    _int64
+BgzfHeader::findBlock(
+    char* buffer,
+    _int64 bytes,
+    _int64 limit)
+{
+    for (_int64 offset = 0; offset < min(limit, bytes); offset++) {
+        if (isWholeBlock(buffer + offset, bytes - offset)) {
+            _int64 next = offset + ((BgzfHeader*) (buffer + offset))->BSIZE() + 1;
+            if (bytes - next < BAM_BLOCK || isWholeBlock(buffer + next, bytes - next)) {
+                return offset;
+            }
+        }
+    }
+    return -1;
+}
+
     bool
 BgzfHeader::validate(
     size_t compressed,
@@ -355,6 +355,12 @@ struct BgzfHeader
     bool validate(size_t compressed, size_t uncompressed);
 
     static bool validate(char* buffer, size_t bytes);
+
+    // whether a whole block that looks like BGZF is at the start of buffer, without trusting any of it
+    static bool isWholeBlock(char* buffer, _int64 bytes);
+
+    // offset of the first block starting before limit, checking the block after it too if it's there; -1 if none
+    static _int64 findBlock(char* buffer, _int64 bytes, _int64 limit);
 };
 
 
@@ -414,6 +420,9 @@ public:
         static PairedReadSupplierGenerator *createPairedReadSupplierGenerator(const char *fileName, int numThreads, bool quicklyDropUnmatchedReads, 
             const ReaderContext& context, int matchBufferSize = 5000);
 
+        // where in the file the BGZF block holding the first record after a header of headerBytes starts
+        static _int64 getFirstRecordBlockOffset(const char* fileName, size_t headerBytes);
+
         static const int MAX_SEQ_LENGTH;
         static const int MAX_RECORD_LENGTH;
 
@@ -429,10 +438,20 @@ protected:
 private:
         void readHeader(const char* fileName);
 
+        DataReader* createDataReader();
+
+        // for a range that starts in the middle of the file, skip the end of a record that started before it
+        void skipToFirstRecord();
+
+        static bool looksLikeRecords(char* buffer, char* end);
+
 
         char* getExtra(_int64 bytes);
 
         DataReader*         data;
+        char*               fileName;
+        int                 bufferCount;
+        bool                started; // data has been reinit()ed
         //unsigned            n_ref; // number of reference sequences
         //unsigned*           refOffset; // array mapping ref sequence ID to contig location
         _int64              extraOffset; // offset into extra data
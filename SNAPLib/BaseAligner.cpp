@@ -35,6 +35,7 @@ Revision History:
 #include "exit.h"
 #include "AlignerOptions.h"
 #include "Error.h"
+#include "ReadPreprocessing.h"
 
 using std::min;
 
@@ -97,12 +98,25 @@ Arguments:
  --*/
 {
     hadBigAllocator = allocator != NULL;
+    tracebacks = NULL;
 
     nHashTableLookups = 0;
     nLocationsScored = 0;
     nHitsIgnoredBecauseOfTooHighPopularity = 0;
     nReadsIgnoredBecauseOfTooManyNs = 0;
     nIndelsMerged = 0;
+    nSeedsLookedUp = 0;
+    nSeedLookupBatches = 0;
+    nSeedsLookedUpPastExactMatch = 0;
+    nSeedsInTimedBatches = 0;
+    nanosInTimedBatches = 0;
+    nReadsFinishedByExactMatchTier = 0;
+    nReadsFinishedByFullSearch = 0;
+
+    seedLookupBatchSize = 8;
+    nSeedLookupsInBatch = 0;
+    nextSeedLookupInBatch = 0;
+    useExactMatchTier = false;
 
     genome = genomeIndex->getGenome();
     seedLen = genomeIndex->getSeedLength();
@@ -130,6 +144,15 @@ Arguments:
         ownLandauVishkin = false;
     }
 
+#ifdef LONG_READS
+    bitParallelEditDistance = new BitParallelEditDistance<>;
+    reverseBitParallelEditDistance = new BitParallelEditDistance<-1>;
+#else   // LONG_READS
+    bitParallelEditDistance = NULL;
+    reverseBitParallelEditDistance = NULL;
+#endif  // LONG_READS
+    useBitParallelEditDistance = false;
+
     unsigned maxSeedsToUse;
     if (0 != maxSeedsToUseFromCommandLine) {
         maxSeedsToUse = maxSeedsToUseFromCommandLine;
@@ -158,9 +181,20 @@ Arguments:
 
     rcReadData = (char *)BigAlloc(sizeof(char) * maxReadSize);
 
+    if (allocator) {
+        genomeUnpackBuffer = (char *)allocator->allocate(Genome::getUnpackBufferSize(maxReadSize + MAX_K, MAX_K));
+    } else {
+        genomeUnpackBuffer = (char *)BigAlloc(Genome::getUnpackBufferSize(maxReadSize + MAX_K, MAX_K));
+    }
+
+    if (allocator) {
+        readSeeds = (Seed *)allocator->allocate(sizeof(Seed) * maxReadSize);
+    } else {
+        readSeeds = (Seed *)BigAlloc(sizeof(Seed) * maxReadSize);
+    }
+
     // treat everything but ACTG like N
     for (unsigned i = 0; i < 256; i++) {
-        nTable[i] = 1;
         rcTranslationTable[i] = 'N';
     }
     reversedRead[RC] = reversedRead[FORWARD] + maxReadSize;
@@ -171,10 +205,6 @@ Arguments:
     rcTranslationTable['T'] = 'A';
     rcTranslationTable['N'] = 'N';
 
-    memset(nTable, 0, sizeof(nTable));
-
-    nTable['N'] = 1;
-
     if (allocator) {
         seedUsed = (BYTE *)allocator->allocate((sizeof(BYTE) * (maxReadSize + 7 + 128) / 8));    // +128 to make sure it extends at both
     } else {
@@ -184,6 +214,16 @@ Arguments:
     seedUsedAsAllocated = seedUsed; // Save the pointer for the delete.
     seedUsed += 8;  // This moves the pointer up an _int64, so we now have the appropriate before buffer.
 
+    maxSeedsPerPass = maxReadSize / seedLen + 2;
+    if (allocator) {
+        passSeedOffsets = (unsigned *)allocator->allocate(maxSeedsPerPass * (2 * sizeof(unsigned) + sizeof(BYTE)));
+    } else {
+        passSeedOffsets = (unsigned *)BigAlloc(maxSeedsPerPass * (2 * sizeof(unsigned) + sizeof(BYTE)));
+    }
+    passSeedScratch = passSeedOffsets + maxSeedsPerPass;
+    passSeedClasses = (BYTE *)(passSeedScratch + maxSeedsPerPass);
+    seedPopularity = NULL;  // Read order unless setRankSeedsByPopularity turns ranking on
+
     nUsedHashTableElements = 0;
 
     if (allocator) {
@@ -288,8 +328,7 @@ Return Value:
     primaryResult->direction = FORWARD;              // So we deterministically print the read forward in this case.
     primaryResult->score = UnusedScoreValue;
     primaryResult->status = NotFound;
-
-    unsigned lookupsThisRun = 0;
+    primaryResult->traceback.clear();
 
     popularSeedsSkipped = 0;
 
@@ -322,23 +361,26 @@ Return Value:
 #endif  // _DEBUG
 
     //
-    // Clear out the seed used array.
+    // Clear out the seed used array, and any seeds left over in the lookup batch from the last read.
     //
     memset(seedUsed, 0, (inputRead->getDataLength() + 7) / 8);
+    nSeedLookupsInBatch = 0;
+    nextSeedLookupInBatch = 0;
 
     unsigned readLen = inputRead->getDataLength();
     const char *readData = inputRead->getData();
     const char *readQuality = inputRead->getQuality();
-    unsigned countOfNs = 0;
-    for (unsigned i = 0; i < readLen; i++) {
-        char baseByte = readData[i];
-        char complement = rcTranslationTable[baseByte];
-        rcReadData[readLen - i - 1] = complement;
-        rcReadQuality[readLen - i - 1] = readQuality[i];
-        reversedRead[FORWARD][readLen - i - 1] = baseByte;
-        reversedRead[RC][i] = complement;
-        countOfNs += nTable[baseByte];
-    }
+    PreprocessedRead preprocessed;
+    preprocessed.rcData = rcReadData;
+    preprocessed.rcQuality = rcReadQuality;
+    preprocessed.reversedData = reversedRead[FORWARD];
+    preprocessed.reversedRCData = reversedRead[RC];
+    preprocessed.seeds = readLen >= seedLen ? readSeeds : NULL;
+    preprocessed.seedLen = seedLen;
+    PreprocessRead(readData, readQuality, readLen, &preprocessed);
+
+    unsigned countOfNs = preprocessed.nNs;
+    allBasesAreACGT = 0 == preprocessed.nNonACGTBases;
 
     if (countOfNs > maxK) {
         nReadsIgnoredBecauseOfTooManyNs++;
@@ -368,7 +410,7 @@ Return Value:
     Read *read[NUM_DIRECTIONS];
     read[FORWARD] = inputRead;
     read[RC] = &reverseComplimentRead;
-    read[RC]->init(NULL, 0, rcReadData, rcReadQuality, readLen);
+    read[RC]->init(NULL, 0, rcReadData, rcReadQuality, readLen, true);
 
     clearCandidates();
 
@@ -379,11 +421,13 @@ Return Value:
     unsigned nPossibleSeeds = readLen - seedLen + 1;
     TRACE("nPossibleSeeds: %d\n", nPossibleSeeds);
 
-    unsigned nextSeedToTest = 0;
     unsigned wrapCount = 0;
+    nPassSeeds = nextPassSeed = 0;
+    startedFirstPass = false;
     lowestPossibleScoreOfAnyUnseenLocation[FORWARD] = lowestPossibleScoreOfAnyUnseenLocation[RC] = 0;
     mostSeedsContainingAnyParticularBase[FORWARD] = mostSeedsContainingAnyParticularBase[RC] = 1;  // Instead of tracking this for real, we're just conservative and use wrapCount+1.  It's faster.
     bestScore = UnusedScoreValue;
+    bestScoreTraceback.clear();
     secondBestScore = UnusedScoreValue;
     nSeedsApplied[FORWARD] = nSeedsApplied[RC] = 0;
     lvScores = 0;
@@ -392,85 +436,61 @@ Return Value:
     probabilityOfBestCandidate = 0.0;
 
     scoreLimit = maxK + extraSearchDepth; // For MAPQ computation
+    useBitParallelEditDistance = NULL != bitParallelEditDistance && UseBitParallelEditDistance(readLen, scoreLimit);
 
-    while (nSeedsApplied[FORWARD] + nSeedsApplied[RC] < maxSeedsToUse) {
+    if (useExactMatchTier && 0 == countOfNs && !stopOnFirstHit && !noTruncation && minWeightToCheck <= 1 &&
+        readLen / seedLen <= maxSeedLookupBatchSize && 0 != maxSeedsToUse) {
         //
-        // Choose the next seed to use.  Choose the first one that isn't used
+        // alignByExactMatch looks up the start of the first pass.  If it doesn't finish the read, the seed loop below
+        // starts with those lookups just as if it had made them itself.
         //
-        if (nextSeedToTest >= nPossibleSeeds) {
-            //
-            // We're wrapping.  We want to space the seeds out as much as possible, so if we had
-            // a seed length of 20 we'd want to take 0, 10, 5, 15, 2, 7, 12, 17.  To make the computation
-            // fast, we use use a table lookup.
-            //
-            wrapCount++;
-            if (wrapCount >= seedLen) {
-                //
-                // We tried all possible seeds without matching or even getting enough seeds to
-                // exceed our seed count.  Do the best we can with what we have.
-                //
-#ifdef TRACE_ALIGNER
-                printf(stderr, "Calling score with force=true because we wrapped around enough\n");
-#endif
-                score(
-                    true,
-                    read,
-                    primaryResult,
-                    maxEditDistanceForSecondaryResults,
-                    secondaryResultBufferSize,
-                    nSecondaryResults,
-                    secondaryResults);
+        startSeedPass(readData, nPossibleSeeds, &wrapCount);
 
-#ifdef  _DEBUG
-                if (_DumpAlignments) printf("\tFinal result score %d MAPQ %d (%e probability of best candidate, %e probability of all candidates)  at %u\n", 
-                                            primaryResult->score, primaryResult->mapq, probabilityOfBestCandidate, probabilityOfAllCandidates, primaryResult->location);
-#endif  // _DEBUG
-                finalizeSecondaryResults(*primaryResult, nSecondaryResults, secondaryResults, maxSecondaryResults, maxEditDistanceForSecondaryResults, bestScore);
-                return;
-            }
-            nextSeedToTest = GetWrappedNextSeedToTest(seedLen, wrapCount);
+        if (alignByExactMatch(read, maxSeedsToUse, primaryResult)) {
+            nReadsFinishedByExactMatchTier++;
+            finalizeSecondaryResults(*primaryResult, nSecondaryResults, secondaryResults, maxSecondaryResults, maxEditDistanceForSecondaryResults, bestScore);
+            return;
+        }
+    }
 
-            mostSeedsContainingAnyParticularBase[FORWARD] = mostSeedsContainingAnyParticularBase[RC] = wrapCount + 1;
+    while (nSeedsApplied[FORWARD] + nSeedsApplied[RC] < maxSeedsToUse) {
+        //
+        // Choose the next seed to use.  The passes over the read are laid out by startSeedPass.
+        //
+        bool passesLeft = true;
+        while (nextPassSeed >= nPassSeeds && passesLeft) {
+            passesLeft = startSeedPass(readData, nPossibleSeeds, &wrapCount);
         }
 
-        while (nextSeedToTest < nPossibleSeeds && IsSeedUsed(nextSeedToTest)) {
+        if (!passesLeft) {
             //
-            // This seed is already used.  Try the next one.
+            // We tried all possible seeds without matching or even getting enough seeds to
+            // exceed our seed count.  Do the best we can with what we have.
             //
-            TRACE("Skipping due to IsSeedUsed\n");
-            nextSeedToTest++;
+            break;
         }
 
-        if (nextSeedToTest >= nPossibleSeeds) {
+        if (nextSeedLookupInBatch >= nSeedLookupsInBatch || seedLookupOffsets[nextSeedLookupInBatch] != passSeedOffsets[nextPassSeed]) {
             //
-            // Unusable seeds have pushed us past the end of the read.  Go back around the outer loop so we wrap properly.
+            // Look up this seed along with the next few that we'll use if this one doesn't finish the read.  There's no
+            // point in looking up more than enough to use up the rest of our seed budget, since each seed can apply twice.
             //
-            TRACE("Eek, we're past the end of the read\n");
-            continue;
-        }
-
-        SetSeedUsed(nextSeedToTest);
-
-        if (!Seed::DoesTextRepresentASeed(read[FORWARD]->getData() + nextSeedToTest, seedLen)) {
-            continue;
+            unsigned seedsLeft = maxSeedsToUse - (nSeedsApplied[FORWARD] + nSeedsApplied[RC]);
+            lookupSeedBatch(__min(seedLookupBatchSize, (seedsLeft + 1) / 2));
         }
 
-        Seed seed(read[FORWARD]->getData() + nextSeedToTest, seedLen);
+        bool seedPredictedPopular = nextPassSeed >= firstPredictedPopularPassSeed;
+        unsigned nextSeedToTest = passSeedOffsets[nextPassSeed];
+        nextPassSeed++;
 
-        _int64        nHits[NUM_DIRECTIONS];                // Number of times this seed hits in the genome
-        const GenomeLocation  *hits[NUM_DIRECTIONS];        // The actual hits (of size nHits)
-        GenomeLocation singletonHits[NUM_DIRECTIONS];       // Storage for single hits (this is required for 64 bit genome indices, since they might use fewer than 8 bytes internally)
+        GenomeIndex::SeedLookup *lookup = &seedLookups[nextSeedLookupInBatch];
+        nextSeedLookupInBatch++;
 
-        const unsigned *hits32[NUM_DIRECTIONS];
-
-        if (doesGenomeIndexHave64BitLocations) {
-            genomeIndex->lookupSeed(seed, &nHits[FORWARD], &hits[FORWARD], &nHits[RC], &hits[RC], &singletonHits[FORWARD], &singletonHits[RC]);
-        } else {
-            genomeIndex->lookupSeed32(seed, &nHits[FORWARD], &hits32[FORWARD], &nHits[RC], &hits32[RC]);
-        }
+        _int64 *nHits = lookup->nHits;                      // Number of times this seed hits in the genome
+        const GenomeLocation **hits = lookup->hits;         // The actual hits (of size nHits)
+        const unsigned **hits32 = lookup->hits32;
 
         nHashTableLookups++;
-        lookupsThisRun++;
 
 
 #ifdef  _DEBUG
@@ -500,6 +520,10 @@ Return Value:
 
         bool appliedEitherSeed = false;
 
+        if (seedPredictedPopular && !explorePopularSeeds) {
+            popularSeedsSkipped--;  // It was counted when the pass was ranked; now it counts for what it really is
+        }
+
         for (Direction direction = 0; direction < NUM_DIRECTIONS; direction++) {
             if (nHits[direction] > maxHitsToConsider && !explorePopularSeeds) {
                 //
@@ -589,23 +613,6 @@ Return Value:
             } // not too popular
         }   // directions
 
-#if 1
-        nextSeedToTest += seedLen;
-#else   // 0
-
-        //
-        // If we don't have enough seeds left to reach the end of the read, space out the seeds more-or-less evenly.
-        //
-        if ((maxSeedsToUse - (nSeedsApplied[FORWARD] + nSeedsApplied[RC]) + 1) * seedLen + nextSeedToTest < nPossibleSeeds) {
-            _ASSERT((nPossibleSeeds + nextSeedToTest) / (maxSeedsToUse - (nSeedsApplied[FORWARD] + nSeedsApplied[RC]) + 1) > seedLen);
-            nextSeedToTest += (nPossibleSeeds + nextSeedToTest) / (maxSeedsToUse - (nSeedsApplied[FORWARD] + nSeedsApplied[RC]) + 1);
-        } else {
-            nextSeedToTest += seedLen;
-        }
-
-#endif // 0
-
-
         if (appliedEitherSeed) {
             //
             // And finally, try scoring.
@@ -623,6 +630,7 @@ Return Value:
                 if (_DumpAlignments) printf("\tFinal result score %d MAPQ %d at %u\n", primaryResult->score, primaryResult->mapq, primaryResult->location);
 #endif  // _DEBUG
 
+                nReadsFinishedByFullSearch++;
                 finalizeSecondaryResults(*primaryResult, nSecondaryResults, secondaryResults, maxSecondaryResults, maxEditDistanceForSecondaryResults, bestScore);
                 return;
             }
@@ -648,8 +656,366 @@ Return Value:
     if (_DumpAlignments) printf("\tFinal result score %d MAPQ %d (%e probability of best candidate, %e probability of all candidates) at %u\n", primaryResult->score, primaryResult->mapq, probabilityOfBestCandidate, probabilityOfAllCandidates, primaryResult->location);
 #endif  // _DEBUG
 
+    nReadsFinishedByFullSearch++;
     finalizeSecondaryResults(*primaryResult, nSecondaryResults, secondaryResults, maxSecondaryResults, maxEditDistanceForSecondaryResults, bestScore);
-    return;
+}
+
+    bool
+BaseAligner::alignByExactMatch(
+    Read                    *read[NUM_DIRECTIONS],
+    unsigned                 maxSeedsToUse,
+    SingleAlignmentResult   *primaryResult)
+/*++
+
+Routine Description:
+
+    The first tier of the search.  Most reads match one place in the genome exactly or nearly so, and the full search
+    finishes them in its first pass over the seeds, once it's applied enough seeds past the first one that hit
+    that place that no place it hasn't seen could be within extraSearchDepth of it.  This looks up the start of the
+    first pass and sees whether the full search would go that way: the seeds it would apply all hit nowhere but that
+    one place and direction, and the place scores well enough.  If so, it finishes the read with the same result that
+    the full search would have, without ever building candidates.
+
+    It looks up only as many seeds as the best case needs (an exact match found by the first seed), and more only
+    when what it's seen so far says it needs them, so that it doesn't look up seeds that the read finishes without.
+    If it can't finish the read, it leaves everything the way the full search expects to find it, and the full search
+    starts with the same lookups.
+
+Return Value:
+
+    true if the read is done.
+
+--*/
+{
+    _ASSERT(startedFirstPass && 0 == nextPassSeed);
+
+    unsigned readLen = read[FORWARD]->getDataLength();
+
+    //
+    // With a perfect match, the full search applies the seed that finds it and extraSearchDepth more (see below).
+    //
+    unsigned nSeedsForBestCase = __max(2, (noUkkonen ? maxK : 0) + extraSearchDepth + 1);
+    lookupSeedBatch(__min(nSeedsForBestCase, maxSeedLookupBatchSize));
+
+    //
+    // Find the first seed with any hits.  That's where the full search would find and score the location.  If the full
+    // search had applied more than scoreLimit seeds by then, it would have stopped as soon as it scored the location
+    // rather than after the next seed.  That takes a read too far off to be worth handling here.
+    //
+    unsigned firstHit = 0;
+    for (;;) {
+        if (firstHit + 1 > scoreLimit) {
+            return false;
+        }
+
+        if (firstHit == nSeedLookupsInBatch) {
+            extendSeedBatch(firstHit + nSeedsForBestCase);
+            if (firstHit == nSeedLookupsInBatch) {
+                return false;   // No more seeds in the pass
+            }
+        }
+
+        if (0 != seedLookups[firstHit].nHits[FORWARD] || 0 != seedLookups[firstHit].nHits[RC]) {
+            break;
+        }
+        firstHit++;
+    }
+
+    Direction direction = 0 == seedLookups[firstHit].nHits[FORWARD] ? RC : FORWARD;
+    int seedOffset = FORWARD == direction ? seedLookupOffsets[firstHit] : readLen - seedLen - seedLookupOffsets[firstHit];
+    GenomeLocation candidateLocation;
+    if (doesGenomeIndexHave64BitLocations) {
+        candidateLocation = seedLookups[firstHit].hits[direction][0] - seedOffset;
+    } else {
+        candidateLocation = seedLookups[firstHit].hits32[direction][0] - seedOffset;
+    }
+
+    GenomeLocation genomeLocation = candidateLocation;
+    unsigned score;
+    double matchProbability;
+    scoreLocation(read, direction, seedOffset, &genomeLocation, &score, &matchProbability);
+    nLocationsScored++;
+    lvScores++;
+
+    if (-1 == score || score > maxK) {
+        return false;
+    }
+
+    //
+    // The full search checks whether it's done each time it applies a seed, before it scores anything that seed found,
+    // so it applies at least one more seed after it scores the location, and enough to rule out any place that it
+    // hasn't seen.  They all have to be seeds we have, and can't hit anywhere else.
+    //
+    unsigned limitAfterScoring = noUkkonen ? maxK + extraSearchDepth : __min(score, maxK) + extraSearchDepth;
+    unsigned nSeedsToApply = __max(firstHit + 2, limitAfterScoring + 1);
+    if (2 * (nSeedsToApply - 1) >= maxSeedsToUse) {
+        return false;
+    }
+
+    extendSeedBatch(nSeedsToApply);
+    if (nSeedsToApply > nSeedLookupsInBatch) {
+        return false;
+    }
+
+    for (unsigned i = firstHit; i < nSeedsToApply; i++) {
+        for (Direction hitDirection = 0; hitDirection < NUM_DIRECTIONS; hitDirection++) {
+            _int64 nHits = seedLookups[i].nHits[hitDirection];
+            if (0 == nHits) {
+                continue;
+            }
+
+            if (hitDirection != direction || nHits > 1 || nHits > maxHitsToConsider) {
+                return false;
+            }
+
+            unsigned offset = FORWARD == direction ? seedLookupOffsets[i] : readLen - seedLen - seedLookupOffsets[i];
+            GenomeLocation hitLocation;
+            if (doesGenomeIndexHave64BitLocations) {
+                hitLocation = seedLookups[i].hits[direction][0] - offset;
+            } else {
+                hitLocation = seedLookups[i].hits32[direction][0] - offset;
+            }
+
+            if (hitLocation != candidateLocation) {
+                return false;
+            }
+        }
+    }
+
+    //
+    // Account for the seeds the way the full search would have.  The ones that the popularity ranking predicted to be
+    // popular were counted in popularSeedsSkipped as the pass was laid out, and each one applied takes itself back out.
+    //
+    nHashTableLookups += nSeedsToApply;
+    nSeedsLookedUpPastExactMatch += nSeedLookupsInBatch - nSeedsToApply;
+    if (!explorePopularSeeds && nSeedsToApply > firstPredictedPopularPassSeed) {
+        popularSeedsSkipped -= nSeedsToApply - firstPredictedPopularPassSeed;
+    }
+
+    if (NULL != tracebacks && !useBitParallelEditDistance) {
+        bestScoreTraceback = recordTraceback();
+    }
+
+    probabilityOfAllCandidates = probabilityOfBestCandidate = matchProbability;
+    bestScore = score;
+    bestScoreGenomeLocation = genomeLocation;
+
+    primaryResult->location = genomeLocation;
+    primaryResult->direction = direction;
+    primaryResult->score = score;
+    primaryResult->mapq = computeMAPQ(probabilityOfAllCandidates, probabilityOfBestCandidate, score, popularSeedsSkipped);
+    primaryResult->status = primaryResult->mapq >= MAPQ_LIMIT_FOR_SINGLE_HIT ? SingleHit : MultipleHits;
+    primaryResult->traceback = bestScoreTraceback;
+
+    return true;
+}
+
+    bool
+BaseAligner::startSeedPass(
+    const char  *readData,
+    unsigned     nPossibleSeeds,
+    unsigned    *wrapCount)
+/*++
+
+Routine Description:
+
+    Lay out the next pass over the read's seeds in passSeedOffsets.  We want to space the seeds out as much as possible,
+    so each pass steps through the read by seedLen.  The first pass starts at 0, and later ones start at the offsets
+    from the seed sequencer, so if we had a seed length of 20 we'd start at 0, 10, 5, 15, 2, 7, 12, 17.  Seeds that
+    were used in an earlier pass or contain an N are skipped one base at a time.  All of the pass's seeds are marked
+    used here, which is the same as marking them as they're used since they don't overlap each other.
+
+Return Value:
+
+    false if we've run out of passes.
+
+--*/
+{
+    unsigned nextSeedToTest;
+    if (!startedFirstPass) {
+        startedFirstPass = true;
+        nextSeedToTest = 0;
+    } else {
+        (*wrapCount)++;
+        if (*wrapCount >= seedLen) {
+            //
+            // We tried all possible seeds without matching or even getting enough seeds to
+            // exceed our seed count.  Do the best we can with what we have.
+            //
+#ifdef TRACE_ALIGNER
+            printf("Calling score with force=true because we wrapped around enough\n");
+#endif
+            return false;
+        }
+        nextSeedToTest = GetWrappedNextSeedToTest(seedLen, *wrapCount);
+
+        mostSeedsContainingAnyParticularBase[FORWARD] = mostSeedsContainingAnyParticularBase[RC] = *wrapCount + 1;
+    }
+
+    nPassSeeds = 0;
+    nextPassSeed = 0;
+
+    unsigned offset = nextSeedToTest;
+    while (offset < nPossibleSeeds) {
+        if (IsSeedUsed(offset)) {
+            TRACE("Skipping due to IsSeedUsed\n");
+            offset++;
+            continue;
+        }
+
+        SetSeedUsed(offset);
+
+        if (!allBasesAreACGT && !Seed::DoesTextRepresentASeed(readData + offset, seedLen)) {
+            offset++;
+            continue;
+        }
+
+        _ASSERT(nPassSeeds < maxSeedsPerPass);
+        passSeedOffsets[nPassSeeds] = offset;
+        nPassSeeds++;
+        offset += seedLen;
+    }
+
+    firstPredictedPopularPassSeed = nPassSeeds;
+    if (NULL != seedPopularity && nPassSeeds > 1) {
+        rankPassSeedsByPopularity();
+    }
+
+    return true;
+}
+
+    void
+BaseAligner::rankPassSeedsByPopularity()
+/*++
+
+Routine Description:
+
+    Order the seeds in the pass from the fewest expected hits to the most, so that the read gets its most selective
+    seeds (which bring in the fewest candidates to score) before any repetitive ones, and may finish without ever
+    looking up the seeds that would have matched too many places to use.  The sort is a stable counting sort on the
+    popularity class, so ties stay in read order.
+
+--*/
+{
+    for (unsigned i = 0; i < nPassSeeds; i++) {
+        seedPopularity->prefetch(readSeeds[passSeedOffsets[i]]);
+    }
+
+    unsigned nWithClass[SeedPopularity::MaxClass + 1];
+    memset(nWithClass, 0, sizeof(nWithClass));
+    for (unsigned i = 0; i < nPassSeeds; i++) {
+        passSeedClasses[i] = (BYTE)seedPopularity->getClass(readSeeds[passSeedOffsets[i]]);
+        nWithClass[passSeedClasses[i]]++;
+    }
+
+    //
+    // A seed in class c has more than 2^(c-1) hits (in at least one direction), unless it's only collided with a
+    // more popular seed in the sketch.
+    //
+    unsigned firstPopularClass = 1;
+    while (firstPopularClass <= SeedPopularity::MaxClass && ((_int64)1 << (firstPopularClass - 1)) < maxHitsToConsider) {
+        firstPopularClass++;
+    }
+
+    unsigned startOfClass[SeedPopularity::MaxClass + 1];
+    unsigned nextStart = 0;
+    for (unsigned popularityClass = 0; popularityClass <= SeedPopularity::MaxClass; popularityClass++) {
+        if (popularityClass == firstPopularClass) {
+            firstPredictedPopularPassSeed = nextStart;
+        }
+        startOfClass[popularityClass] = nextStart;
+        nextStart += nWithClass[popularityClass];
+    }
+
+    for (unsigned i = 0; i < nPassSeeds; i++) {
+        passSeedScratch[startOfClass[passSeedClasses[i]]++] = passSeedOffsets[i];
+    }
+
+    unsigned *sortedOffsets = passSeedScratch;
+    passSeedScratch = passSeedOffsets;
+    passSeedOffsets = sortedOffsets;
+
+    if (!explorePopularSeeds) {
+        popularSeedsSkipped += nPassSeeds - firstPredictedPopularPassSeed;
+    }
+}
+
+    void
+BaseAligner::lookupSeedBatch(
+    unsigned     maxSeedsInBatch)
+/*++
+
+Routine Description:
+
+    Look up the next seed in the pass along with the ones that the read will use after it in the same pass, as one
+    batch so that their cache misses in the index overlap.  AlignRead consumes the batch in order.  It stops at the
+    end of the pass, since the next one doesn't exist yet.
+
+Arguments:
+
+    maxSeedsInBatch     - how many seeds to look up, at most
+
+--*/
+{
+    _ASSERT(nextPassSeed < nPassSeeds);
+
+    nextSeedLookupInBatch = 0;
+    nSeedLookupsInBatch = __min(maxSeedsInBatch, nPassSeeds - nextPassSeed);
+    for (unsigned i = 0; i < nSeedLookupsInBatch; i++) {
+        seedLookupOffsets[i] = passSeedOffsets[nextPassSeed + i];
+        seedBatch[i] = readSeeds[seedLookupOffsets[i]];
+    }
+
+    if (0 == nSeedLookupBatches % seedLookupTimingInterval) {
+        _int64 start = timeInNanos();
+        genomeIndex->lookupSeeds(seedBatch, nSeedLookupsInBatch, seedLookups);
+        _int64 elapsed = timeInNanos() - start;
+        if (elapsed < maxPlausibleSeedLookupNanos) {
+            nSeedsInTimedBatches += nSeedLookupsInBatch;
+            nanosInTimedBatches += elapsed;
+        }
+    } else {
+        genomeIndex->lookupSeeds(seedBatch, nSeedLookupsInBatch, seedLookups);
+    }
+
+    nSeedLookupBatches++;
+    nSeedsLookedUp += nSeedLookupsInBatch;
+}
+
+    void
+BaseAligner::extendSeedBatch(
+    unsigned     nSeeds)
+/*++
+
+Routine Description:
+
+    Add lookups for the seeds that follow the current batch in the pass, so that the batch holds nSeeds of them, or as
+    many as the pass and the batch have room for.  Used by alignByExactMatch, which only looks at the batch and needs
+    it to start at the beginning of the pass.
+
+Arguments:
+
+    nSeeds      - how many seeds the batch should have
+
+--*/
+{
+    _ASSERT(0 == nextSeedLookupInBatch && nSeedLookupsInBatch > 0 && seedLookupOffsets[0] == passSeedOffsets[0]);
+
+    nSeeds = __min(nSeeds, __min(nPassSeeds, maxSeedLookupBatchSize));
+    if (nSeeds <= nSeedLookupsInBatch) {
+        return;
+    }
+
+    for (unsigned i = nSeedLookupsInBatch; i < nSeeds; i++) {
+        seedLookupOffsets[i] = passSeedOffsets[i];
+        seedBatch[i] = readSeeds[seedLookupOffsets[i]];
+    }
+
+    genomeIndex->lookupSeeds(seedBatch + nSeedLookupsInBatch, nSeeds - nSeedLookupsInBatch, seedLookups + nSeedLookupsInBatch);
+
+    nSeedLookupBatches++;
+    nSeedsLookedUp += nSeeds - nSeedLookupsInBatch;
+    nSeedLookupsInBatch = nSeeds;
 }
 
     bool
@@ -830,94 +1196,9 @@ Return Value:
                     genomeIndex->prefetchGenomeData(genomeLocation);
                 }
 
-                unsigned score = -1;
-                double matchProbability = 0;
-                unsigned readDataLength = read[elementToScore->direction]->getDataLength();
-                GenomeDistance genomeDataLength = readDataLength + MAX_K; // Leave extra space in case the read has deletions
-                const char *data = genome->getSubstring(genomeLocation, genomeDataLength);
-
-#if 0 // This only happens when we're in the padding region, and genomeLocations there just lead to problems.  Just say no.
-                if (NULL == data) {
-                    //
-                    // We're up against the end of a chromosome.  Reduce the extra space enough that it isn't too
-                    // long.  We're willing to reduce it to less than the length of a read, because the read could
-                    // butt up against the end of the chromosome and have insertions in it.
-                    //
-                    const Genome::Contig *contig = genome->getContigAtLocation(genomeLocation);
-
-                    if (contig != NULL) {
-                        GenomeLocation endLocation;
-                        if (genomeLocation + readDataLength + MAX_K >= GenomeLocation(0) + genome->getCountOfBases()) {
-                            endLocation = GenomeLocation(0) + genome->getCountOfBases();
-                        } else {
-                            const Genome::Contig *nextContig = genome->getNextContigAfterLocation(genomeLocation);
-                            _ASSERT(contig->beginningLocation <= genomeLocation && contig != nextContig);
-
-                            endLocation = nextContig->beginningLocation;
-                        }
-                        genomeDataLength = endLocation - genomeLocation - 1;
-                        if (genomeDataLength >= readDataLength - MAX_K) {
-                            data = genome->getSubstring(genomeLocation, genomeDataLength);
-                            _ASSERT(NULL != data);
-                        }
-                    }
-                }
-
-#endif // 0
-                if (data != NULL) {
-                    Read *readToScore = read[elementToScore->direction];
-
-                    _ASSERT(candidateToScore->seedOffset + seedLen <= readToScore->getDataLength());
-
-                    //
-                    // Compute the distance separately in the forward and backward directions from the seed, to allow
-                    // arbitrary offsets at both the start and end.
-                    //
-                    double matchProb1, matchProb2;
-                    int score1, score2;
-                    // First, do the forward direction from where the seed aligns to past of it
-                    int readLen = readToScore->getDataLength();
-                    int seedLen = genomeIndex->getSeedLength();
-                    int seedOffset = candidateToScore->seedOffset; // Since the data is reversed
-                    int tailStart = seedOffset + seedLen;
-
-                    _ASSERT(!memcmp(data+seedOffset, readToScore->getData() + seedOffset, seedLen));
-
-                    int textLen = (int)__min(genomeDataLength - tailStart, 0x7ffffff0);
-                    score1 = landauVishkin->computeEditDistance(data + tailStart, textLen, readToScore->getData() + tailStart, readToScore->getQuality() + tailStart, readLen - tailStart,
-                        scoreLimit, &matchProb1);
-
-                    if (score1 == -1) {
-                        score = -1;
-                    } else {
-                        // The tail of the read matched; now let's reverse match the reference genome and the head
-                        int limitLeft = scoreLimit - score1;
-                        int genomeLocationOffset;
-                        score2 = reverseLandauVishkin->computeEditDistance(data + seedOffset, seedOffset + MAX_K, reversedRead[elementToScore->direction] + readLen - seedOffset,
-                                                                                    read[OppositeDirection(elementToScore->direction)]->getQuality() + readLen - seedOffset, seedOffset, limitLeft, &matchProb2,
-                                                                                    &genomeLocationOffset);
-
-                        if (score2 == -1) {
-                            score = -1;
-                        } else {
-                            score = score1 + score2;
-                            // Map probabilities for substrings can be multiplied, but make sure to count seed too
-                            matchProbability = matchProb1 * matchProb2 * pow(1 - SNP_PROB, seedLen);
-
-                            //
-                            // Adjust the genome location based on any indels that we found.
-                            //
-                            genomeLocation += genomeLocationOffset;
-
-                            //
-                            // We could mark as scored anything in between the old and new genome offsets, but it's probably not worth the effort since this is
-                            // so rare and all it would do is same time.
-                            //
-                        }
-                    }
-                } else { // if we had genome data to compare against
-                    matchProbability = 0;
-                }
+                unsigned score;
+                double matchProbability;
+                scoreLocation(read, elementToScore->direction, candidateToScore->seedOffset, &genomeLocation, &score, &matchProbability);
 #ifdef TRACE_ALIGNER
                 printf("Computing distance at %u (RC) with limit %d: %d (prob %g)\n",
                         genomeLocation, scoreLimit, score, matchProbability);
@@ -1004,6 +1285,13 @@ Return Value:
                 elementToScore->matchProbabilityForBestScore = matchProbability;
                 elementToScore->bestScore = score;
 
+                AlignmentTraceback traceback;
+                if (NULL != tracebacks && !useBitParallelEditDistance && -1 != score) {
+                    traceback = recordTraceback();
+                } else {
+                    traceback.clear();
+                }
+
                 if (bestScore > score ||
                     (bestScore == score && matchProbability > probabilityOfBestCandidate)) {
 
@@ -1035,6 +1323,7 @@ Return Value:
                         result->mapq = 0;
                         result->score = bestScore;
                         result->status = MultipleHits;
+                        result->traceback = bestScoreTraceback;
 
                         _ASSERT(result->score != -1);
 
@@ -1048,6 +1337,8 @@ Return Value:
                     primaryResult->location = bestScoreGenomeLocation;
                     primaryResult->score = bestScore;
                     primaryResult->direction = elementToScore->direction;
+                    bestScoreTraceback = traceback;
+                    primaryResult->traceback = bestScoreTraceback;
 
                     lvScoresAfterBestFound = 0;
                 } else {
@@ -1075,6 +1366,7 @@ Return Value:
                         result->mapq = 0;
                         result->score = score;
                         result->status = MultipleHits;
+                        result->traceback = traceback;
 
                         _ASSERT(result->score != -1);
 
@@ -1114,6 +1406,152 @@ Return Value:
     return false;
 }
 
+    void
+BaseAligner::scoreLocation(
+    Read            *read[NUM_DIRECTIONS],
+    Direction        direction,
+    int              seedOffset,
+    GenomeLocation  *genomeLocation,
+    unsigned        *score,
+    double          *matchProbability)
+/*++
+
+Routine Description:
+
+    Score the read in one direction against one location in the genome, given a seed that matched there, with an
+    edit distance limit of scoreLimit.
+
+Arguments:
+
+    read                - the read in each direction
+    direction           - which direction of the read to score
+    seedOffset          - the offset in the read (in that direction) of a seed that matches exactly at the location
+    genomeLocation      - in/out the location, which is moved to account for any indels at the start of the read
+    score               - returns the edit distance, or -1 if it's more than scoreLimit
+    matchProbability    - returns the probability that the read came from the location
+
+--*/
+{
+    *score = -1;
+    *matchProbability = 0;
+    unsigned readDataLength = read[direction]->getDataLength();
+    GenomeDistance genomeDataLength = readDataLength + MAX_K; // Leave extra space in case the read has deletions
+    const char *data = genome->getSubstring(*genomeLocation, genomeDataLength, genomeUnpackBuffer, MAX_K);
+
+#if 0 // This only happens when we're in the padding region, and genomeLocations there just lead to problems.  Just say no.
+    if (NULL == data) {
+        //
+        // We're up against the end of a chromosome.  Reduce the extra space enough that it isn't too
+        // long.  We're willing to reduce it to less than the length of a read, because the read could
+        // butt up against the end of the chromosome and have insertions in it.
+        //
+        const Genome::Contig *contig = genome->getContigAtLocation(*genomeLocation);
+
+        if (contig != NULL) {
+            GenomeLocation endLocation;
+            if (*genomeLocation + readDataLength + MAX_K >= GenomeLocation(0) + genome->getCountOfBases()) {
+                endLocation = GenomeLocation(0) + genome->getCountOfBases();
+            } else {
+                const Genome::Contig *nextContig = genome->getNextContigAfterLocation(*genomeLocation);
+                _ASSERT(contig->beginningLocation <= *genomeLocation && contig != nextContig);
+
+                endLocation = nextContig->beginningLocation;
+            }
+            genomeDataLength = endLocation - *genomeLocation - 1;
+            if (genomeDataLength >= readDataLength - MAX_K) {
+                data = genome->getSubstring(*genomeLocation, genomeDataLength);
+                _ASSERT(NULL != data);
+            }
+        }
+    }
+
+#endif // 0
+    if (data != NULL) {
+        Read *readToScore = read[direction];
+
+        _ASSERT(seedOffset + seedLen <= readToScore->getDataLength());
+
+        //
+        // Compute the distance separately in the forward and backward directions from the seed, to allow
+        // arbitrary offsets at both the start and end.
+        //
+        double matchProb1, matchProb2;
+        int score1, score2;
+        // First, do the forward direction from where the seed aligns to past of it
+        int readLen = readToScore->getDataLength();
+        int seedLen = genomeIndex->getSeedLength();
+        int tailStart = seedOffset + seedLen;
+
+        _ASSERT(!memcmp(data+seedOffset, readToScore->getData() + seedOffset, seedLen));
+
+        int textLen = (int)__min(genomeDataLength - tailStart, 0x7ffffff0);
+        if (useBitParallelEditDistance) {
+            score1 = bitParallelEditDistance->computeEditDistance(data + tailStart, textLen, readToScore->getData() + tailStart, readToScore->getQuality() + tailStart, readLen - tailStart,
+                scoreLimit, &matchProb1);
+        } else {
+            score1 = landauVishkin->computeEditDistance(data + tailStart, textLen, readToScore->getData() + tailStart, readToScore->getQuality() + tailStart, readLen - tailStart,
+                scoreLimit, &matchProb1);
+        }
+
+        if (score1 == -1) {
+            *score = -1;
+        } else {
+            // The tail of the read matched; now let's reverse match the reference genome and the head
+            int limitLeft = scoreLimit - score1;
+            int genomeLocationOffset;
+            if (useBitParallelEditDistance) {
+                score2 = reverseBitParallelEditDistance->computeEditDistance(data + seedOffset, seedOffset + MAX_K, reversedRead[direction] + readLen - seedOffset,
+                                                                            read[OppositeDirection(direction)]->getQuality() + readLen - seedOffset, seedOffset, limitLeft, &matchProb2,
+                                                                            &genomeLocationOffset);
+            } else {
+                score2 = reverseLandauVishkin->computeEditDistance(data + seedOffset, seedOffset + MAX_K, reversedRead[direction] + readLen - seedOffset,
+                                                                            read[OppositeDirection(direction)]->getQuality() + readLen - seedOffset, seedOffset, limitLeft, &matchProb2,
+                                                                            &genomeLocationOffset);
+            }
+
+            if (score2 == -1) {
+                *score = -1;
+            } else {
+                *score = score1 + score2;
+                // Map probabilities for substrings can be multiplied, but make sure to count seed too
+                *matchProbability = matchProb1 * matchProb2 * pow(1 - SNP_PROB, seedLen);
+
+                //
+                // Adjust the genome location based on any indels that we found.
+                //
+                *genomeLocation += genomeLocationOffset;
+
+                //
+                // We could mark as scored anything in between the old and new genome offsets, but it's probably not worth the effort since this is
+                // so rare and all it would do is same time.
+                //
+            }
+        }
+    } else { // if we had genome data to compare against
+        *matchProbability = 0;
+    }
+}
+
+    AlignmentTraceback
+BaseAligner::recordTraceback()
+/*++
+
+Routine Description:
+
+    Keep the edits of the location that score() just scored.  It scores the part of the read before the seed backward and the
+    part after it forward, so the traceback is the backward part (which LandauVishkin<-1> appends in genome order), the seed
+    and then the forward part.
+
+--*/
+{
+    tracebacks->start();
+    reverseLandauVishkin->appendTraceback(tracebacks);
+    tracebacks->append('=', seedLen);
+    landauVishkin->appendTraceback(tracebacks);
+
+    return tracebacks->finish();
+}
+
 
     void
 BaseAligner::prefetchHashTableBucket(GenomeLocation genomeLocation, Direction direction)
@@ -1302,6 +1740,8 @@ Return Value:
 --*/
 {
     delete probDistance;
+    delete bitParallelEditDistance;
+    delete reverseBitParallelEditDistance;
 
     if (hadBigAllocator) {
         //
@@ -1336,9 +1776,18 @@ Return Value:
         reversedRead[FORWARD] = NULL;
         reversedRead[RC] = NULL;
 
+        BigDealloc(genomeUnpackBuffer);
+        genomeUnpackBuffer = NULL;
+
+        BigDealloc(readSeeds);
+        readSeeds = NULL;
+
         BigDealloc(seedUsedAsAllocated);
         seedUsed = NULL;
 
+        BigDealloc(__min(passSeedOffsets, passSeedScratch));   // Ranking swaps the two halves
+        passSeedOffsets = passSeedScratch = NULL;
+
         BigDealloc(candidateHashTable[FORWARD]);
         candidateHashTable[FORWARD] = NULL;
 
@@ -1456,14 +1905,17 @@ BaseAligner::getBigAllocatorReservation(GenomeIndex *index, bool ownLandauVishki
 
     return
         contigCounters                                                  +
-        sizeof(_uint64) * 14                                            + // allow for alignment
+        sizeof(_uint64) * 15                                            + // allow for alignment
         sizeof(BaseAligner)                                             + // our own member variables
         (ownLandauVishkin ?
             LandauVishkin<>::getBigAllocatorReservation() +
             LandauVishkin<-1>::getBigAllocatorReservation() : 0)        + // our LandauVishkin objects
         sizeof(char) * maxReadSize * 2                                  + // rcReadData
         sizeof(char) * maxReadSize * 4 + 2 * MAX_K                      + // reversed read (both)
+        Genome::getUnpackBufferSize(maxReadSize + MAX_K, MAX_K)         + // genome unpack buffer
+        sizeof(Seed) * maxReadSize                                      + // read seeds
         sizeof(BYTE) * (maxReadSize + 7 + 128) / 8                      + // seed used
+        (maxReadSize / seedLen + 2) * (2 * sizeof(unsigned) + sizeof(BYTE)) + // seed pass
         sizeof(HashTableElement) * hashTableElementPoolSize             + // hash table element pool
         sizeof(HashTableAnchor) * candidateHashTablesSize * 2           + // candidate hash table (both)
         sizeof(HashTableElement) * (maxSeedsToUse + 1);                   // weight lists
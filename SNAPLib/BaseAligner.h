@@ -29,6 +29,7 @@ Revision History:
 
 #include "AlignmentResult.h"
 #include "LandauVishkin.h"
+#include "BitParallelEditDistance.h"
 #include "BigAlloc.h"
 #include "ProbabilityDistance.h"
 #include "AlignerStats.h"
@@ -83,6 +84,13 @@ public:
     _int64 getNHitsIgnoredBecauseOfTooHighPopularity() const {return nHitsIgnoredBecauseOfTooHighPopularity;}
     _int64 getNReadsIgnoredBecauseOfTooManyNs() const {return nReadsIgnoredBecauseOfTooManyNs;}
     _int64 getNIndelsMerged() const {return nIndelsMerged;}
+    _int64 getNSeedsLookedUp() const {return nSeedsLookedUp;}                  // Including ones looked up in a batch that the read never got to
+    _int64 getNSeedLookupBatches() const {return nSeedLookupBatches;}
+    _int64 getNSeedsLookedUpPastExactMatch() const {return nSeedsLookedUpPastExactMatch;}  // Past what the exact match tier needed, for reads it finished
+    _int64 getNSeedsInTimedBatches() const {return nSeedsInTimedBatches;}
+    _int64 getNanosInTimedBatches() const {return nanosInTimedBatches;}
+    _int64 getNReadsFinishedByExactMatchTier() const {return nReadsFinishedByExactMatchTier;}
+    _int64 getNReadsFinishedByFullSearch() const {return nReadsFinishedByFullSearch;}
     void addIgnoredReads(_int64 newlyIgnoredReads) {nReadsIgnoredBecauseOfTooManyNs += newlyIgnoredReads;}
 
     const char *getRCTranslationTable() const {return rcTranslationTable;}
@@ -109,6 +117,35 @@ public:
     inline bool getStopOnFirstHit() {return stopOnFirstHit;}
     inline void setStopOnFirstHit(bool newValue) {stopOnFirstHit = newValue;}
 
+    //
+    // How many seeds to look up at once (see GenomeIndex::lookupSeeds).  1 means one at a time.
+    //
+    static const unsigned maxSeedLookupBatchSize = 32;
+    inline unsigned getSeedLookupBatchSize() {return seedLookupBatchSize;}
+    inline void setSeedLookupBatchSize(unsigned newValue) {seedLookupBatchSize = __max(1, __min(newValue, maxSeedLookupBatchSize));}
+
+    //
+    // Whether to use the index's seed popularity sketch (if it has one) to look up the likely selective seeds in each
+    // pass over the read first.  Off by default, because a read can then finish before it looks up the seeds that
+    // would find its second best candidate, and get a higher MAPQ than it would with the seeds in read order.
+    //
+    inline bool getRankSeedsByPopularity() {return NULL != seedPopularity;}
+    inline void setRankSeedsByPopularity(bool newValue) {seedPopularity = newValue ? genomeIndex->getSeedPopularity() : NULL;}
+
+    //
+    // Whether to look up the start of a read's first pass of seeds and finish the read right there if they all point
+    // to one location that scores well enough that the full search would stop without looking further (see
+    // alignByExactMatch).  The results are the same either way.
+    //
+    inline bool getUseExactMatchTier() {return useExactMatchTier;}
+    inline void setUseExactMatchTier(bool newValue) {useExactMatchTier = newValue;}
+
+    //
+    // Where to keep the tracebacks of the results (see AlignmentTraceback.h), or NULL not to keep them.  The caller owns
+    // the buffer and clears it between reads.
+    //
+    inline void setTracebackBuffer(TracebackBuffer *newValue) {tracebacks = newValue;}
+
     static size_t getBigAllocatorReservation(GenomeIndex *index, bool ownLandauVishkin, unsigned maxHitsToConsider, unsigned maxReadSize, unsigned seedLen, 
         unsigned numSeedsFromCommandLine, double seedCoverage, int maxSecondaryAlignmentsPerContig);
 
@@ -120,6 +157,17 @@ private:
     LandauVishkin<-1> *reverseLandauVishkin;
     bool ownLandauVishkin;
 
+    //
+    // Reads that are too long or too divergent for LandauVishkin (see UseBitParallelEditDistance) are scored with these
+    // instead.  They only exist in LONG_READS builds, since no other reads qualify.
+    //
+    BitParallelEditDistance<> *bitParallelEditDistance;
+    BitParallelEditDistance<-1> *reverseBitParallelEditDistance;
+    bool useBitParallelEditDistance;    // For the current read
+
+    TracebackBuffer *tracebacks;        // NULL unless we're keeping tracebacks
+    AlignmentTraceback recordTraceback();  // For the location that was just scored
+
     ProbabilityDistance *probDistance;
 
     // Maximum distance to merge candidates that differ in indels over.
@@ -135,6 +183,59 @@ private:
     _int64 nHitsIgnoredBecauseOfTooHighPopularity;
     _int64 nReadsIgnoredBecauseOfTooManyNs;
     _int64 nIndelsMerged;
+    _int64 nSeedsLookedUp;
+    _int64 nSeedLookupBatches;
+    _int64 nSeedsLookedUpPastExactMatch;
+
+    //
+    // Every seedLookupTimingInterval'th batch is timed, which is enough to see how long lookups stall on the index
+    // without paying for the clock on every one.  A batch that takes longer than maxPlausibleSeedLookupNanos was
+    // preempted or page faulted, and isn't counted.
+    //
+    static const unsigned seedLookupTimingInterval = 64;
+    static const _int64 maxPlausibleSeedLookupNanos = 50000;
+    _int64 nSeedsInTimedBatches;
+    _int64 nanosInTimedBatches;
+    _int64 nReadsFinishedByExactMatchTier;
+    _int64 nReadsFinishedByFullSearch;
+
+    //
+    // The current batch of seed lookups.  AlignRead consumes them in order, and starts a new batch whenever the
+    // next seed it wants isn't the next one in the batch.
+    //
+    unsigned seedLookupBatchSize;
+    unsigned nSeedLookupsInBatch;
+    unsigned nextSeedLookupInBatch;
+    unsigned seedLookupOffsets[maxSeedLookupBatchSize];
+    Seed seedBatch[maxSeedLookupBatchSize];
+    GenomeIndex::SeedLookup seedLookups[maxSeedLookupBatchSize];
+
+    void lookupSeedBatch(unsigned maxSeedsInBatch);
+    void extendSeedBatch(unsigned nSeeds);
+
+    bool useExactMatchTier;
+    bool alignByExactMatch(Read *read[NUM_DIRECTIONS], unsigned maxSeedsToUse, SingleAlignmentResult *primaryResult);
+
+    //
+    // The seeds for the current pass over the read, in the order to use them.  The first pass takes every seedLen'th
+    // offset starting at 0, and each later pass starts at the next offset from the seed sequencer, skipping seeds used
+    // in earlier passes and ones with Ns.  With a popularity sketch, each pass is ordered from least to most popular
+    // (ties in read order), and the seeds from firstPredictedPopularPassSeed on are expected to have more than
+    // maxHitsToConsider hits.  Those are counted in popularSeedsSkipped from the start, as if they'd been looked up,
+    // so that reads that finish without reaching them don't get a higher MAPQ for it.
+    //
+    const SeedPopularity    *seedPopularity;
+    unsigned                 maxSeedsPerPass;
+    unsigned                *passSeedOffsets;
+    unsigned                *passSeedScratch;
+    BYTE                    *passSeedClasses;
+    unsigned                 nPassSeeds;
+    unsigned                 nextPassSeed;
+    unsigned                 firstPredictedPopularPassSeed;
+    bool                     startedFirstPass;
+
+    bool startSeedPass(const char *readData, unsigned nPossibleSeeds, unsigned *wrapCount);
+    void rankPassSeedsByPopularity();
 
     //
     // A bitvector indexed by offset in the read indicating whether this seed is used.
@@ -249,6 +350,7 @@ private:
     unsigned nSeedsApplied[NUM_DIRECTIONS];
     unsigned bestScore;
     GenomeLocation bestScoreGenomeLocation;
+    AlignmentTraceback bestScoreTraceback;
     unsigned secondBestScore;
     GenomeLocation secondBestScoreGenomeLocation;
     int      secondBestScoreDirection;
@@ -274,6 +376,8 @@ private:
         int                     *nSecondaryResults,
         SingleAlignmentResult   *secondaryResults);
 
+    void scoreLocation(Read *read[NUM_DIRECTIONS], Direction direction, int seedOffset, GenomeLocation *genomeLocation, unsigned *score, double *matchProbability);
+
     void clearCandidates();
 
     bool findElement(GenomeLocation genomeLocation, Direction direction, HashTableElement **hashTableElement);
@@ -309,8 +413,9 @@ private:
     char *rcReadData;
     char *rcReadQuality;
     char *reversedRead[NUM_DIRECTIONS];
-
-    unsigned nTable[256];
+    char *genomeUnpackBuffer;   // Where candidate genome data goes when the genome is packed
+    Seed *readSeeds;            // The seed at each offset of the read, built along with the RC read
+    bool allBasesAreACGT;       // So every offset in readSeeds is a seed
 
     int readId;
     
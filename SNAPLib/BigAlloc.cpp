@@ -388,7 +388,29 @@ void *BigAlloc(
 #ifdef USE_HUGETLB
     flags |= MAP_HUGETLB;
 #endif
-    char *mem = (char *) mmap(NULL, sizeToAllocate, PROT_READ|PROT_WRITE, flags, -1, 0);
+    char *mem = (char *)MAP_FAILED;
+    bool gotGigabytePages = false;
+
+#if (defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT) && !defined(USE_HUGETLB))
+    //
+    // Big allocations (the index, mostly) try 1GB pages first.  These only exist if the administrator has reserved
+    // them (hugepagesz=1G on the kernel command line), so quietly fall back to normal and transparent huge pages.
+    // munmap of a hugetlb mapping needs a multiple of the page size, so round up the size we remember.
+    //
+    const size_t gigabyte = (size_t)1 << 30;
+    if (BigAllocUseHugePages && sizeToAllocate >= gigabyte) {
+        size_t gigabyteRoundedSize = ((sizeToAllocate + gigabyte - 1) / gigabyte) * gigabyte;
+        mem = (char *) mmap(NULL, gigabyteRoundedSize, PROT_READ|PROT_WRITE, flags | MAP_HUGETLB | (30 << MAP_HUGE_SHIFT), -1, 0);
+        if (mem != MAP_FAILED) {
+            sizeToAllocate = gigabyteRoundedSize;
+            gotGigabytePages = true;
+        }
+    }
+#endif
+
+    if (mem == MAP_FAILED) {
+        mem = (char *) mmap(NULL, sizeToAllocate, PROT_READ|PROT_WRITE, flags, -1, 0);
+    }
     if (mem == MAP_FAILED) {
         perror("mmap");
         soft_exit(1);
@@ -396,7 +418,7 @@ void *BigAlloc(
 
 #if (defined(MADV_HUGEPAGE) && !defined(USE_HUGETLB))
     // Tell Linux to use huge pages for this range
-    if (BigAllocUseHugePages) {
+    if (BigAllocUseHugePages && !gotGigabytePages) {
         if (madvise(mem, sizeToAllocate, MADV_HUGEPAGE) == -1) {
             WriteErrorMessage("WARNING: failed to enable huge pages -- your kernel may not support it\n"); 
         }
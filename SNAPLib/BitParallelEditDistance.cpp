@@ -0,0 +1,513 @@
+/*++
+
+Module Name:
+
+    BitParallelEditDistance.cpp
+
+Abstract:
+
+    Banded bit-vector (Myers/Hyyro) edit distance, for reads that are too long or too divergent for LandauVishkin.
+
+Environment:
+
+    User mode service.
+
+--*/
+
+#include "stdafx.h"
+#include "BitParallelEditDistance.h"
+#include "exit.h"
+#include "Error.h"
+#include <algorithm>
+
+//
+// lv_indelProbabilities has this many entries (see initializeLVProbabilitiesToPhredPlus33).  Longer indels are
+// improbable enough to call it zero.
+//
+static const int MaxIndelLengthWithProbability = 10000;
+
+static const int Unreachable = 0x3fffffff;
+
+template<int TEXT_DIRECTION> BitParallelEditDistance<TEXT_DIRECTION>::BitParallelEditDistance() :
+    pattern(NULL), patternLen(0), textLen(0), nBlocks(0), nPatternCodes(0), firstBlock(0), lastBlock(-1), endColumn(0),
+    checkpointInterval(1)
+{
+    if (TEXT_DIRECTION != 1 && TEXT_DIRECTION != -1) {
+        WriteErrorMessage("BitParallelEditDistance: TEXT_DIRECTION must be 1 or -1\n");
+        soft_exit(1);
+    }
+}
+
+    template<int TEXT_DIRECTION> int
+BitParallelEditDistance<TEXT_DIRECTION>::computeEditDistance(
+    const char* text,
+    int textLen,
+    const char* pattern,
+    const char *qualityString,
+    int patternLen,
+    int k,
+    double *matchProbability,
+    int *o_netIndel)
+{
+    if (NULL == text) {
+        // This happens when we're trying to read past the end of the genome.
+        if (NULL != matchProbability) {
+            *matchProbability = 0.0;
+        }
+        return -1;
+    }
+
+    int score = align(text, textLen, pattern, patternLen, k, NULL != matchProbability);
+    if (score < 0) {
+        if (NULL != matchProbability) {
+            *matchProbability = 0.0;
+        }
+        return -1;
+    }
+
+    if (NULL != o_netIndel) {
+        *o_netIndel = patternLen - endColumn;
+    }
+
+    if (NULL != matchProbability) {
+        //
+        // Same model as LandauVishkin: each substitution costs the probability that its base was miscalled (or
+        // mutated), each run of insertions or deletions costs the probability of an indel that long, and the bases
+        // that match cost the chance of there being no SNP.
+        //
+        *matchProbability = 1.0;
+        int nEdits = 0;
+        int row = 0;
+        size_t nTotalEdits = edits.size();
+        for (size_t i = 0; i < nTotalEdits; ) {
+            char edit = edits[i];
+            int runLength = 1;
+            if ('I' == edit || 'D' == edit) {
+                while (i + runLength < nTotalEdits && edits[i + runLength] == edit) {
+                    runLength++;
+                }
+                *matchProbability *= runLength <= MaxIndelLengthWithProbability ? lv_indelProbabilities[runLength] : 0.0;
+                nEdits += runLength;
+                if ('I' == edit) {
+                    row += runLength;
+                }
+            } else {
+                if ('X' == edit) {
+                    *matchProbability *= lv_phredToProbability[(unsigned char)qualityString[row]];
+                    nEdits++;
+                }
+                row++;
+            }
+            i += runLength;
+        }
+        _ASSERT(row == patternLen && nEdits == score);
+
+        *matchProbability *= lv_perfectMatchProbability[__max(0, patternLen - nEdits)];
+    }
+
+    return score;
+}
+
+    template<int TEXT_DIRECTION> int
+BitParallelEditDistance<TEXT_DIRECTION>::computeEditDistance(
+    const char* text,
+    int textLen,
+    const char* pattern,
+    int patternLen,
+    int k,
+    char* cigarBuf,
+    int cigarBufLen,
+    bool useM,
+    CigarFormat format,
+    int* o_cigarBufUsed,
+    int* o_textUsed,
+    int *o_netIndel)
+{
+    char *cigarBufStart = cigarBuf;
+
+    if (NULL == text) {
+        return -1;  // This happens when we're trying to read past the end of the genome.
+    }
+
+    int score = align(text, textLen, pattern, patternLen, k, true);
+    if (score < 0) {
+        if (cigarBufLen > 0) {
+            *cigarBuf = '\0';
+        }
+        return -1;
+    }
+
+    size_t nTotalEdits = edits.size();
+    for (size_t i = 0; i < nTotalEdits; ) {
+        char code = (useM && ('=' == edits[i] || 'X' == edits[i])) ? 'M' : edits[i];
+        int runLength = 1;
+        while (i + runLength < nTotalEdits &&
+               ((useM && 'M' == code) ? ('=' == edits[i + runLength] || 'X' == edits[i + runLength]) : edits[i + runLength] == code)) {
+            runLength++;
+        }
+        if (!writeCigar(&cigarBuf, &cigarBufLen, runLength, code, format)) {
+            return -2;
+        }
+        i += runLength;
+    }
+
+    if (format != BAM_CIGAR_OPS) {
+        *(cigarBuf - (cigarBufLen == 0 ? 1 : 0)) = '\0'; // terminate string
+    }
+    if (NULL != o_cigarBufUsed) {
+        *o_cigarBufUsed = (int)(cigarBuf - cigarBufStart);
+    }
+    if (NULL != o_textUsed) {
+        *o_textUsed = endColumn;
+    }
+    if (NULL != o_netIndel) {
+        *o_netIndel = endColumn - patternLen;
+    }
+
+    return score;
+}
+
+    template<int TEXT_DIRECTION> int
+BitParallelEditDistance<TEXT_DIRECTION>::align(const char *i_text, int i_textLen, const char *i_pattern, int i_patternLen, int k, bool traceback)
+{
+    pattern = i_pattern;
+    patternLen = i_patternLen;
+    textLen = __max(0, i_textLen);
+    edits.clear();
+    endColumn = 0;
+
+    if (k < 0) {
+        return -1;
+    }
+
+    if (0 == patternLen) {
+        return 0;
+    }
+
+    k = __min(k, patternLen);   // Never worse than inserting the whole pattern at the start of the text.
+    nBlocks = (patternLen + BlockSize - 1) / BlockSize;
+
+    //
+    // Give each character in the pattern a code (there are usually five), and make the match bits for each code in
+    // each block.  Text characters that aren't in the pattern get code nPatternCodes, which never matches.
+    //
+    memset(codeForChar, NoMatch, sizeof(codeForChar));
+    nPatternCodes = 0;
+    for (int i = 0; i < patternLen; i++) {
+        BYTE c = (BYTE)pattern[i];
+        if (NoMatch == codeForChar[c] && nPatternCodes < NoMatch - 1) {
+            codeForChar[c] = (BYTE)nPatternCodes++;
+        }
+    }
+
+    peq.assign((size_t)nBlocks * (nPatternCodes + 1), 0);
+    for (int i = 0; i < patternLen; i++) {
+        BYTE code = codeForChar[(BYTE)pattern[i]];
+        if (NoMatch != code) {
+            peq[(size_t)(i / BlockSize) * (nPatternCodes + 1) + code] |= (_uint64)1 << (i % BlockSize);
+        }
+    }
+
+    int nColumns = __min(textLen, patternLen + k);
+    textCodes.resize(__max(1, nColumns));
+    for (int i = 0; i < nColumns; i++) {
+        BYTE code = codeForChar[(BYTE)(TEXT_DIRECTION == 1 ? i_text[i] : i_text[-1 - i])];
+        textCodes[i] = NoMatch == code ? (BYTE)nPatternCodes : code;
+    }
+
+    pv.resize(nBlocks);
+    mv.resize(nBlocks);
+    score.resize(nBlocks);
+
+    int band = __max(1, __min(k, BlockSize));
+    int result;
+    for (;;) {
+        result = alignWithinBand(band, traceback);
+        if (result <= band) {
+            break;
+        }
+        if (band >= k) {
+            return -1;
+        }
+        band = __min(k, band * 2);
+    }
+
+    if (result > k) {
+        return -1;      // Only possible when k is 0 and the band is 1
+    }
+
+    if (traceback) {
+        int row = patternLen - 1;
+        int column = endColumn;
+        if (1 == checkpointInterval) {
+            traceBack(checkpoints, 0, &row, &column);
+        } else {
+            for (int which = (column - 1) / checkpointInterval; column > 0; which--) {
+                int baseColumn = which * checkpointInterval;
+                restoreColumn(checkpoints, which);
+                segment.clear();
+                segment.append(firstBlock, lastBlock, &pv[0], &mv[0], &score[0]);
+                for (int c = baseColumn + 1; c <= column; c++) {
+                    advanceColumn(c, band);
+                    segment.append(firstBlock, lastBlock, &pv[0], &mv[0], &score[0]);
+                }
+                traceBack(segment, baseColumn, &row, &column);
+            }
+        }
+
+        for (; row >= 0; row--) {
+            edits.push_back('I');   // Pattern bases before the start of the text
+        }
+        std::reverse(edits.begin(), edits.end());
+    }
+
+    return result;
+}
+
+//
+// Runs the whole alignment within a band and returns the best score in the last row, or something bigger than
+// band if there isn't one that's <= band.  Leaves the column it ended in in endColumn.
+//
+    template<int TEXT_DIRECTION> int
+BitParallelEditDistance<TEXT_DIRECTION>::alignWithinBand(int band, bool traceback)
+{
+    int nColumns = __min(textLen, patternLen + band);
+    int bestScore = Unreachable;
+    int bestColumn = 0;
+
+    startColumns(band);
+    if (lastBlock == nBlocks - 1) {
+        bestScore = score[nBlocks - 1];
+    }
+
+    if (traceback) {
+        checkpoints.clear();
+        size_t blocksPerColumn = 2 * band / BlockSize + 2;
+        if ((size_t)(nColumns + 1) * blocksPerColumn <= DenseTracebackBlocks) {
+            checkpointInterval = 1;
+        } else {
+            checkpointInterval = __max(1, (int)sqrt((double)nColumns));
+        }
+        checkpoints.append(firstBlock, lastBlock, &pv[0], &mv[0], &score[0]);
+    }
+
+    for (int column = 1; column <= nColumns; column++) {
+        advanceColumn(column, band);
+
+        if (traceback && 0 == column % checkpointInterval) {
+            checkpoints.append(firstBlock, lastBlock, &pv[0], &mv[0], &score[0]);
+        }
+
+        if (lastBlock == nBlocks - 1) {
+            //
+            // Ties go to the column closest to the diagonal (the fewest net indels), and then to the later one, which
+            // is the order LandauVishkin tries them in.
+            //
+            int columnScore = score[nBlocks - 1];
+            if (columnScore < bestScore || (columnScore == bestScore && abs(column - patternLen) <= abs(bestColumn - patternLen))) {
+                bestScore = columnScore;
+                bestColumn = column;
+            }
+        }
+
+        if (0 == column % 16 && column > band) {
+            //
+            // If nothing in this column is within the band then nothing after it can be, so we're done.  The smallest
+            // value in a block is at least its bottom score less the number of +1 deltas above it.
+            //
+            bool anyWithinBand = false;
+            for (int block = firstBlock; block <= lastBlock; block++) {
+                int lastBit = lastRowOfBlock(block) % BlockSize;
+                _uint64 rows = lastBit == BlockSize - 1 ? ~(_uint64)0 : ((_uint64)1 << (lastBit + 1)) - 1;
+                if (score[block] - (int)CountOneBits(pv[block] & rows) <= band) {
+                    anyWithinBand = true;
+                    break;
+                }
+            }
+            if (!anyWithinBand) {
+                break;
+            }
+        }
+    }
+
+    endColumn = bestColumn;
+    return bestScore;
+}
+
+//
+// Column 0 (no text): row i has score i + 1.
+//
+    template<int TEXT_DIRECTION> void
+BitParallelEditDistance<TEXT_DIRECTION>::startColumns(int band)
+{
+    firstBlock = 0;
+    lastBlock = __min(nBlocks - 1, (band - 1) / BlockSize);
+    for (int block = 0; block <= lastBlock; block++) {
+        pv[block] = ~(_uint64)0;
+        mv[block] = 0;
+        score[block] = lastRowOfBlock(block) + 1;
+    }
+}
+
+    template<int TEXT_DIRECTION> void
+BitParallelEditDistance<TEXT_DIRECTION>::advanceColumn(int column, int band)
+{
+    //
+    // The band for this column is rows column - band - 1 through column + band - 1.  Blocks that are entering it
+    // start out as if the previous column kept going down by one per row, which is never better than the truth.
+    // Blocks that have left it are dropped, and the row above the first block is taken to go up by one per column,
+    // which is also never better than the truth.  Neither matters for anything within the band.
+    //
+    int newLastBlock = __min(nBlocks - 1, (column + band - 1) / BlockSize);
+    while (lastBlock < newLastBlock) {
+        lastBlock++;
+        pv[lastBlock] = ~(_uint64)0;
+        mv[lastBlock] = 0;
+        score[lastBlock] = score[lastBlock - 1] + lastRowOfBlock(lastBlock) - lastRowOfBlock(lastBlock - 1);
+    }
+    firstBlock = __max(0, column - band - 1) / BlockSize;
+    _ASSERT(firstBlock <= lastBlock);
+
+    const _uint64 *columnPeq = &peq[textCodes[column - 1]];
+    int stride = nPatternCodes + 1;
+    int hin = 1;    // The top row of the matrix (empty pattern) goes up by one per column
+    for (int block = firstBlock; block <= lastBlock; block++) {
+        _uint64 Pv = pv[block];
+        _uint64 Mv = mv[block];
+        _uint64 Eq = columnPeq[(size_t)block * stride];
+        _uint64 highBit = (_uint64)1 << (lastRowOfBlock(block) % BlockSize);
+
+        _uint64 Xv = Eq | Mv;
+        if (hin < 0) {
+            Eq |= 1;
+        }
+        _uint64 Xh = (((Eq & Pv) + Pv) ^ Pv) | Eq;
+        _uint64 Ph = Mv | ~(Xh | Pv);
+        _uint64 Mh = Pv & Xh;
+
+        int hout = 0;
+        if (Ph & highBit) {
+            hout = 1;
+        } else if (Mh & highBit) {
+            hout = -1;
+        }
+
+        Ph <<= 1;
+        Mh <<= 1;
+        if (hin < 0) {
+            Mh |= 1;
+        } else if (hin > 0) {
+            Ph |= 1;
+        }
+
+        pv[block] = Mh | ~(Xv | Ph);
+        mv[block] = Ph & Xv;
+        score[block] += hout;
+        hin = hout;
+    }
+}
+
+    template<int TEXT_DIRECTION> void
+BitParallelEditDistance<TEXT_DIRECTION>::restoreColumn(const StoredColumns &columns, int which)
+{
+    firstBlock = columns.firstBlock[which];
+    lastBlock = columns.lastBlock[which];
+    size_t offset = columns.offset[which];
+    for (int block = firstBlock; block <= lastBlock; block++) {
+        pv[block] = columns.pv[offset + block - firstBlock];
+        mv[block] = columns.mv[offset + block - firstBlock];
+        score[block] = columns.score[offset + block - firstBlock];
+    }
+}
+
+//
+// The score of a cell of a stored column: the score at the bottom of its block less the deltas below it.
+//
+    template<int TEXT_DIRECTION> int
+BitParallelEditDistance<TEXT_DIRECTION>::getScore(const StoredColumns &columns, int which, int column, int row)
+{
+    if (row < 0) {
+        return column;  // Skipping the start of the text
+    }
+
+    int block = row / BlockSize;
+    if (block < columns.firstBlock[which] || block > columns.lastBlock[which]) {
+        return Unreachable;
+    }
+
+    size_t index = columns.offset[which] + block - columns.firstBlock[which];
+    int lastBit = lastRowOfBlock(block) % BlockSize;
+    _uint64 throughLastRow = lastBit == BlockSize - 1 ? ~(_uint64)0 : ((_uint64)1 << (lastBit + 1)) - 1;
+    _uint64 throughRow = (((_uint64)1 << (row % BlockSize)) << 1) - 1;
+    _uint64 below = throughLastRow & ~throughRow;
+
+    return columns.score[index] - (int)CountOneBits(columns.pv[index] & below) + (int)CountOneBits(columns.mv[index] & below);
+}
+
+//
+// Walks back from (row, column) to baseColumn, appending the edits (last first).  Every cell it steps to has a
+// score that's consistent with the one it came from, which is only true of cells on an optimal path, so it never
+// strays outside of the band where the scores are exact.  It takes a match if it can, and otherwise prefers a
+// substitution to an indel.
+//
+    template<int TEXT_DIRECTION> void
+BitParallelEditDistance<TEXT_DIRECTION>::traceBack(const StoredColumns &columns, int baseColumn, int *row, int *column)
+{
+    int r = *row;
+    int c = *column;
+
+    while (c > baseColumn) {
+        if (r < 0) {
+            edits.push_back('D');
+            c--;
+            continue;
+        }
+
+        int current = getScore(columns, c - baseColumn, c, r);
+        int diagonal = getScore(columns, c - 1 - baseColumn, c - 1, r - 1);
+        if (diagonal == current && textCodes[c - 1] == codeForChar[(BYTE)pattern[r]]) {
+            edits.push_back('=');
+            r--;
+            c--;
+        } else if (diagonal + 1 == current) {
+            edits.push_back('X');
+            r--;
+            c--;
+        } else if (getScore(columns, c - baseColumn, c, r - 1) + 1 == current) {
+            edits.push_back('I');
+            r--;
+        } else {
+            _ASSERT(getScore(columns, c - 1 - baseColumn, c - 1, r) + 1 == current);
+            edits.push_back('D');
+            c--;
+        }
+    }
+
+    *row = r;
+    *column = c;
+}
+
+    template<int TEXT_DIRECTION> void
+BitParallelEditDistance<TEXT_DIRECTION>::StoredColumns::clear()
+{
+    firstBlock.clear();
+    lastBlock.clear();
+    offset.clear();
+    pv.clear();
+    mv.clear();
+    score.clear();
+}
+
+    template<int TEXT_DIRECTION> void
+BitParallelEditDistance<TEXT_DIRECTION>::StoredColumns::append(int first, int last, const _uint64 *i_pv, const _uint64 *i_mv, const int *i_score)
+{
+    firstBlock.push_back(first);
+    lastBlock.push_back(last);
+    offset.push_back(pv.size());
+    pv.insert(pv.end(), i_pv + first, i_pv + last + 1);
+    mv.insert(mv.end(), i_mv + first, i_mv + last + 1);
+    score.insert(score.end(), i_score + first, i_score + last + 1);
+}
+
+template class BitParallelEditDistance<1>;
+template class BitParallelEditDistance<-1>;
@@ -0,0 +1,154 @@
+/*++
+
+Module Name:
+
+    BitParallelEditDistance.h
+
+Abstract:
+
+    Banded bit-vector (Myers/Hyyro) edit distance, for reads that are too long or too divergent for LandauVishkin.
+
+Environment:
+
+    User mode service.
+
+--*/
+
+#pragma once
+
+#include "Compat.h"
+#include "LandauVishkin.h"
+#include <vector>
+
+//
+// Reads at least this long are scored with BitParallelEditDistance rather than LandauVishkin (in LONG_READS builds,
+// where such reads exist).  LandauVishkin is O(k^2) plus a scan of the read no matter how long the read is, which is
+// great for short reads with a few differences, but long reads have error rates that make k large, and it can't go
+// past MAX_K at all.
+//
+const int BitParallelMinPatternLength = 2048;
+
+inline bool UseBitParallelEditDistance(int patternLen, int k)
+{
+    return k >= MAX_K || patternLen >= BitParallelMinPatternLength;
+}
+
+//
+// Computes the same thing as LandauVishkin: the edit distance between all of the pattern and some prefix of the
+// text, or -1 if it's more than k.  It has the same computeEditDistance interfaces as LandauVishkin (for the match
+// probability) and LandauVishkinWithCigar (for the CIGAR string), so callers can pick either engine, but no limit
+// on k.
+//
+// The dynamic programming matrix has a row for each pattern base and a column for each text base.  Each column is
+// kept as blocks of 64 vertical deltas (Myers' bit vectors, with Hyyro's formulation of the horizontal carry between
+// blocks), and only the blocks that intersect the diagonal band |row - column| <= band are computed, so a column
+// costs about band/32 word operations no matter how long the read is.  Any alignment with at most band edits stays
+// within the band, so if the best score in the band is <= band it's exact.  The band starts small and doubles until
+// that's true or it reaches k, so good alignments cost about as much as their edit distance requires and only the
+// ones that will be thrown out pay for all of k.
+//
+// Computing the edits themselves (for the match probability or the CIGAR string) needs the columns again.  When
+// they're small enough they're all kept; otherwise every sqrt(n)th one is, and the traceback recomputes each
+// stretch of columns from its checkpoint as it walks back through it.
+//
+// Bases match if they're the same character, just as with LandauVishkin.  Set TEXT_DIRECTION to -1 to run
+// backwards through the text, in which case text points just after the first base.
+//
+template<int TEXT_DIRECTION = 1> class BitParallelEditDistance {
+public:
+    BitParallelEditDistance();
+
+    int computeEditDistance(
+            const char* text,
+            int textLen,
+            const char* pattern,
+            const char *qualityString,
+            int patternLen,
+            int k,
+            double *matchProbability,
+            int *o_netIndel = NULL);    // patternLen - text used, as with LandauVishkin
+
+    inline int computeEditDistance(
+            const char* text,
+            int textLen,
+            const char* pattern,
+            int patternLen,
+            int k)
+    {
+        return computeEditDistance(text, textLen, pattern, NULL, patternLen, k, NULL);
+    }
+
+    //
+    // Returns -1 if the edit distance exceeds k or -2 if we run out of space in cigarBuf, as with
+    // LandauVishkinWithCigar.
+    //
+    int computeEditDistance(
+            const char* text,
+            int textLen,
+            const char* pattern,
+            int patternLen,
+            int k,
+            char* cigarBuf,
+            int cigarBufLen,
+            bool useM,
+            CigarFormat format = COMPACT_CIGAR_STRING,
+            int* o_cigarBufUsed = NULL,
+            int* o_textUsed = NULL,
+            int *o_netIndel = NULL);    // text used - patternLen, as with LandauVishkinWithCigar
+
+private:
+    static const int BlockSize = 64;
+    static const int NoMatch = 0xff;                        // Code for text bases that aren't in the pattern
+    static const size_t DenseTracebackBlocks = 1 << 18;     // Keep all of the columns if they have at most this many blocks
+
+    //
+    // The vertical deltas of some consecutive blocks of a column, and the score at the bottom row of each block.
+    //
+    struct StoredColumns {
+        std::vector<int> firstBlock, lastBlock;
+        std::vector<size_t> offset;
+        std::vector<_uint64> pv, mv;
+        std::vector<int> score;
+
+        void clear();
+        void append(int first, int last, const _uint64 *pv, const _uint64 *mv, const int *score);
+    };
+
+    int align(const char *text, int textLen, const char *pattern, int patternLen, int k, bool traceback);
+    int alignWithinBand(int band, bool traceback);
+    void startColumns(int band);
+    void advanceColumn(int column, int band);
+    void restoreColumn(const StoredColumns &columns, int which);
+    void traceBack(const StoredColumns &columns, int baseColumn, int *row, int *column);
+    int getScore(const StoredColumns &columns, int which, int column, int row);
+
+    inline int lastRowOfBlock(int block) {return __min(block * BlockSize + BlockSize - 1, patternLen - 1);}
+
+    //
+    // The inputs of the current computation.
+    //
+    const char *pattern;
+    int patternLen;
+    int textLen;
+    int nBlocks;
+    int nPatternCodes;
+    BYTE codeForChar[256];
+    std::vector<BYTE> textCodes;
+    std::vector<_uint64> peq;                              // Match bits for each block and pattern code
+
+    //
+    // The current column.
+    //
+    std::vector<_uint64> pv, mv;
+    std::vector<int> score;
+    int firstBlock, lastBlock;
+
+    //
+    // What the last alignment found.
+    //
+    int endColumn;
+    int checkpointInterval;
+    StoredColumns checkpoints;
+    StoredColumns segment;
+    std::vector<char> edits;    // '=', 'X', 'I' (pattern base) or 'D' (text base), from the start of the alignment
+};
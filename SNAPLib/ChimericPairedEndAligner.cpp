@@ -109,6 +109,8 @@ void ChimericPairedEndAligner::align(
         )
 {
 	result->status[0] = result->status[1] = NotFound;
+    result->traceback[0].clear();
+    result->traceback[1].clear();
     *nSecondaryResults = 0;
     *nSingleEndSecondaryResultsForFirstRead = 0;
     *nSingleEndSecondaryResultsForSecondRead = 0;
@@ -179,6 +181,7 @@ void ChimericPairedEndAligner::align(
 			result->direction[r] = FORWARD;
 			result->location[r] = 0;
 			result->score[r] = 0;
+			result->traceback[r].clear();
 		} else {
 			// We're using *nSingleEndSecondaryResultsForFirstRead because it's either 0 or what all we've seen (i.e., we know NUM_READS_PER_PAIR is 2)
 			singleAligner->AlignRead(read[r], &singleResult, maxEditDistanceForSecondaryResults,
@@ -192,6 +195,7 @@ void ChimericPairedEndAligner::align(
 			result->direction[r] = singleResult.direction;
 			result->location[r] = singleResult.location;
 			result->score[r] = singleResult.score;
+			result->traceback[r] = singleResult.traceback;
 		}
     }
 
@@ -84,6 +84,13 @@ public:
         return underlyingPairedEndAligner->getLocationsScored() + singleAligner->getLocationsScored();
     }
 
+    void setRankSeedsByPopularity(bool newValue) {singleAligner->setRankSeedsByPopularity(newValue);}
+
+    virtual void setTracebackBuffer(TracebackBuffer *tracebacks) {
+        singleAligner->setTracebackBuffer(tracebacks);
+        underlyingPairedEndAligner->setTracebackBuffer(tracebacks);
+    }
+
 private:
    
     bool        forceSpacing;
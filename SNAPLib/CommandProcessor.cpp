@@ -19,6 +19,7 @@ User mode service.
 Revision History:
 
 Pulled from the main program and expanded to handle daemon mode
+Daemon mode runs alignments as concurrent jobs that share the index
 
 --*/
 
@@ -34,6 +35,8 @@ Pulled from the main program and expanded to handle daemon mode
 #include "CommandProcessor.h"
 #include "Error.h"
 #include "Compat.h"
+#include "AlignerContext.h"
+#include "LandauVishkin.h"
 
 const char *SNAP_VERSION = "1.0beta.23";
 
@@ -45,10 +48,92 @@ static void usage()
 		"   index    build a genome index\n"
 		"   single   align single-end reads\n"
 		"   paired   align paired-end reads\n"
-		"   daemon   run in daemon mode--accept commands remotely\n"
+		"   daemon   run in daemon mode--accept commands remotely and run alignments as jobs\n"
 		"Type a command without arguments to see its help.\n");
 }
 
+//
+// Daemon mode runs each alignment command as a job.  Jobs wait in a FIFO queue, and up to maxRunningJobs of them
+// run at once, each on its own thread.  The cores given to the daemon with -t are split evenly among the jobs that
+// are running or waiting when a job starts, and a job's -t is capped at its share.  Jobs that run together must
+// use the same index, which is loaded once and shared read-only; a job that needs a different index waits until
+// the running ones finish.  A finished job is freed once it has been reported to a client, either by waiting for
+// it or by listing it with jobs.
+//
+struct AlignmentJob {
+    enum State {Queued, Running, Finished};
+
+    int             id;
+    int             argc;
+    char          **argv;           // Owned, freed when the job finishes
+    char           *commandLine;    // Owned, for listing
+    char           *indexDir;       // Owned
+    bool            exclusive;      // Names more than one index, so it runs alone
+    bool            echoToPipe;     // Its client is waiting for its messages
+    State           state;
+    int             threadLimit;
+    _int64          submitTime;
+    _int64          startTime;
+    _int64          finishTime;
+
+    // Summed over the job's alignment commands
+    _int64          totalReads;
+    _int64          alignedReads;
+    _int64          alignTime;      // ms
+
+    EventObject     finished;
+    AlignmentJob   *next;
+};
+
+static ExclusiveLock     jobLock;
+static AlignmentJob     *jobs = NULL;           // In submission order
+static AlignmentJob    **lastJobNext = &jobs;
+static int               nextJobId = 1;
+static int               nRunningJobs = 0;
+static int               maxRunningJobs = 4;
+static int               daemonCores = 1;
+static bool              runningJobsAreExclusive = false;
+static const char       *runningIndexDir = NULL;
+
+extern ExclusiveLock *g_indexLock;
+extern char *FormatUIntWithCommas(_uint64 val, char *outputBuffer, size_t outputBufferSize);
+extern char *numPctAndPad(char *buffer, _uint64 num, double pct, size_t desiredWidth, size_t bufferLen);
+
+static void RunAlignmentCommands(int argc, const char **argv, AlignmentJob *job)
+{
+	for (int i = 1; i < argc; /* i is increased below */) {
+		unsigned nArgsConsumed;
+		AlignerContext *context;
+		if (strcmp(argv[i], "single") == 0) {
+			context = new SingleAlignerContext();
+		} else if (strcmp(argv[i], "paired") == 0) {
+			context = new PairedAlignerContext();
+		} else {
+			fprintf(stderr, "Invalid command: %s\n\n", argv[i]);
+			usage();
+			return;
+		}
+
+		if (NULL != job) {
+			context->threadLimit = job->threadLimit;
+			context->allowBinding = maxRunningJobs == 1;
+			context->echoToCommandPipe = job->echoToPipe;
+		}
+
+		context->runAlignment(argc - i, argv + i, SNAP_VERSION, &nArgsConsumed);
+
+		if (NULL != job && NULL != context->stats) {
+			job->totalReads += context->stats->totalReads;
+			job->alignedReads += context->stats->singleHits + context->stats->multiHits;
+			job->alignTime += context->alignTime;
+		}
+		delete context;
+
+		_ASSERT(nArgsConsumed > 0);
+		i += nArgsConsumed;
+	}
+}
+
 void ProcessNonDaemonCommands(int argc, const char **argv) {
 	if (strcmp(argv[1], "index") == 0) {
 		if (CommandPipe == NULL) {
@@ -60,22 +145,7 @@ void ProcessNonDaemonCommands(int argc, const char **argv) {
 			WriteErrorMessage("The index command is not available in daemon mode.  Please run 'snap-aligner index' directly.\n");
 		}
 	} else if (strcmp(argv[1], "single") == 0 || strcmp(argv[1], "paired") == 0) {
-		for (int i = 1; i < argc; /* i is increased below */) {
-			unsigned nArgsConsumed;
-			if (strcmp(argv[i], "single") == 0) {
-				SingleAlignerContext single;
-				single.runAlignment(argc - i, argv + i, SNAP_VERSION, &nArgsConsumed);
-			} else if (strcmp(argv[i], "paired") == 0) {
-				PairedAlignerContext paired;
-				paired.runAlignment(argc - i, argv + i, SNAP_VERSION, &nArgsConsumed);
-			} else {
-				fprintf(stderr, "Invalid command: %s\n\n", argv[i]);
-				usage();
-				return;
-			}
-			_ASSERT(nArgsConsumed > 0);
-			i += nArgsConsumed;
-		}
+		RunAlignmentCommands(argc, argv, NULL);
 	} else {
 		WriteErrorMessage("Invalid command: %s\n\n", argv[1]);
 		usage();
@@ -84,19 +154,274 @@ void ProcessNonDaemonCommands(int argc, const char **argv) {
 
 static void daemonUsage()
 {
-	fprintf(stderr, "Usage: snap-aligner daemon [Named pipe name]\n");
+	fprintf(stderr,
+		"Usage: snap-aligner daemon [<named pipe name>] [-t <cores>] [-mj <max concurrent jobs>]\n"
+		"  -t   cores to share among running jobs (default: all of them)\n"
+		"  -mj  alignment jobs that may run at once (default: %d)\n"
+		"Client commands (through SNAPCommand):\n"
+		"   single|paired ...         align and wait, printing the output\n"
+		"   submit single|paired ...  queue the alignment and return its job number\n"
+		"   jobs                      list jobs with their state and stats\n"
+		"   wait <job number>         wait for a submitted job to finish\n"
+		"A finished job is dropped from the list once it has been waited for or listed.\n"
+		"   exit                      stop the daemon\n"
+		"-xf and other process-wide settings are shared by jobs that run at the same time.\n",
+		maxRunningJobs);
 	soft_exit_no_print(1);    // Don't use soft_exit, it's confusing people to get an "error" message after the usage
 }
 
-void RunDaemonMode(int argc, const char **argv)
+//
+// Must be called with jobLock held.
+//
+static bool CanStartJob(AlignmentJob *job)
+{
+	if (nRunningJobs == 0) {
+		return true;
+	}
+
+	return nRunningJobs < maxRunningJobs && !job->exclusive && !runningJobsAreExclusive && strcmp(job->indexDir, runningIndexDir) == 0;
+}
+
+static void JobThreadMain(void *param);
+
+//
+// Start queued jobs in order until one can't start.  Must be called with jobLock held.
+//
+static void StartRunnableJobs()
+{
+	for (AlignmentJob *job = jobs; NULL != job; job = job->next) {
+		if (job->state != AlignmentJob::Queued) {
+			continue;
+		}
+
+		if (!CanStartJob(job)) {
+			return;	// Strictly FIFO, so a big job isn't starved by a stream of small ones
+		}
+
+		int nWaiting = 0;
+		for (AlignmentJob *other = job; NULL != other; other = other->next) {
+			nWaiting += other->state == AlignmentJob::Queued;
+		}
+
+		job->threadLimit = __max(1, daemonCores / __min(maxRunningJobs, nRunningJobs + nWaiting));
+		job->state = AlignmentJob::Running;
+		job->startTime = timeInMillis();
+		runningIndexDir = job->indexDir;
+		runningJobsAreExclusive = job->exclusive;
+		nRunningJobs++;
+
+		if (!StartNewThread(JobThreadMain, job)) {
+			WriteErrorMessage("Unable to start thread for job %d\n", job->id);
+			soft_exit(1);
+		}
+	}
+}
+
+static void JobThreadMain(void *param)
+{
+	AlignmentJob *job = (AlignmentJob *)param;
+
+	RunAlignmentCommands(job->argc, (const char **)job->argv, job);
+
+	AcquireExclusiveLock(&jobLock);
+	for (int i = 0; i < job->argc; i++) {
+		delete[] job->argv[i];
+	}
+	delete[] job->argv;
+	job->argv = NULL;
+	job->state = AlignmentJob::Finished;
+	job->finishTime = timeInMillis();
+	nRunningJobs--;
+	StartRunnableJobs();
+
+	//
+	// Signal with the lock held, so that whoever frees the job after seeing it finished (which takes the lock)
+	// knows this thread is done with it.
+	//
+	AllowEventWaitersToProceed(&job->finished);
+	ReleaseExclusiveLock(&jobLock);
+}
+
+//
+// Unlink a finished job and free it.  Must be called with jobLock held.
+//
+static void FreeJob(AlignmentJob *job)
+{
+	_ASSERT(job->state == AlignmentJob::Finished);
+
+	AlignmentJob **link;
+	for (link = &jobs; *link != job; link = &(*link)->next) {
+		_ASSERT(NULL != *link);
+	}
+	*link = job->next;
+	if (lastJobNext == &job->next) {
+		lastJobNext = link;
+	}
+
+	if (runningIndexDir == job->indexDir) {
+		//
+		// It was the last job to start, but others with the same index may still be running.
+		//
+		runningIndexDir = NULL;
+		for (AlignmentJob *other = jobs; NULL != other; other = other->next) {
+			if (other->state == AlignmentJob::Running) {
+				runningIndexDir = other->indexDir;
+				break;
+			}
+		}
+	}
+
+	delete[] job->commandLine;
+	delete[] job->indexDir;
+	DestroyEventObject(&job->finished);
+	delete job;
+}
+
+static void FreeJobAfterWait(AlignmentJob *job)
 {
-	if (argc < 2 || argc > 3) {
+	AcquireExclusiveLock(&jobLock);
+	FreeJob(job);
+	ReleaseExclusiveLock(&jobLock);
+}
+
+//
+// Takes ownership of argv, which starts with the program name followed by single or paired.
+//
+static AlignmentJob *SubmitJob(int argc, char **argv, bool echoToPipe)
+{
+	AlignmentJob *job = new AlignmentJob;
+	memset(job, 0, sizeof(*job));
+	job->argc = argc;
+	job->argv = argv;
+	job->echoToPipe = echoToPipe;
+	job->state = AlignmentJob::Queued;
+	job->submitTime = timeInMillis();
+	CreateEventObject(&job->finished);
+	PreventEventWaitersFromProceeding(&job->finished);
+
+	//
+	// The index follows single/paired, both at the start and after each ',' that chains another alignment.
+	//
+	job->indexDir = argc > 2 ? argv[2] : argv[argc - 1];
+	for (int i = 1; i + 2 < argc; i++) {
+		if (strcmp(argv[i], ",") == 0 && (strcmp(argv[i + 1], "single") == 0 || strcmp(argv[i + 1], "paired") == 0) &&
+			strcmp(argv[i + 2], job->indexDir) != 0) {
+			job->exclusive = true;
+		}
+	}
+
+	size_t commandLength = 1;
+	for (int i = 1; i < argc; i++) {
+		commandLength += strlen(argv[i]) + 1;
+	}
+	job->commandLine = new char[commandLength];
+	job->commandLine[0] = '\0';
+	for (int i = 1; i < argc; i++) {
+		strcat(job->commandLine, argv[i]);
+		if (i != argc - 1) {
+			strcat(job->commandLine, " ");
+		}
+	}
+	job->indexDir = new char[strlen(job->indexDir) + 1];
+	strcpy(job->indexDir, argc > 2 ? argv[2] : argv[argc - 1]);
+
+	AcquireExclusiveLock(&jobLock);
+	job->id = nextJobId++;
+	*lastJobNext = job;
+	lastJobNext = &job->next;
+	StartRunnableJobs();
+	ReleaseExclusiveLock(&jobLock);
+
+	return job;
+}
+
+static void PrintJobs()
+{
+	WriteStatusMessage("Job    State     Threads  Total Reads    Aligned                Reads/s    Waited (s)  Ran (s)   Command\n");
+
+	const size_t strBufLen = 50;
+	char totalReads[strBufLen];
+	char aligned[strBufLen];
+	char readsPerSecond[strBufLen];
+
+	AcquireExclusiveLock(&jobLock);
+	_int64 now = timeInMillis();
+	AlignmentJob *nextJob;
+	for (AlignmentJob *job = jobs; NULL != job; job = nextJob) {
+		nextJob = job->next;
+		static const char *stateNames[] = {"queued", "running", "finished"};
+		_int64 started = job->state == AlignmentJob::Queued ? now : job->startTime;
+		_int64 finished = job->state == AlignmentJob::Finished ? job->finishTime : now;
+		bool haveStats = job->state == AlignmentJob::Finished;
+
+		WriteStatusMessage("%-6d %-9s %-8d %-14s %-22s %-10s %-11lld %-9lld %s\n",
+			job->id, stateNames[job->state], job->state == AlignmentJob::Queued ? 0 : job->threadLimit,
+			haveStats ? FormatUIntWithCommas(job->totalReads, totalReads, strBufLen) : "-",
+			haveStats ? numPctAndPad(aligned, job->alignedReads, 100.0 * job->alignedReads / __max(job->totalReads, (_int64)1), 22, strBufLen) : "-",
+			haveStats ? FormatUIntWithCommas(1000 * job->totalReads / __max(job->alignTime, (_int64)1), readsPerSecond, strBufLen) : "-",
+			(started - job->submitTime) / 1000,
+			job->state == AlignmentJob::Queued ? 0 : (finished - job->startTime) / 1000,
+			job->commandLine);
+
+		if (job->state == AlignmentJob::Finished) {
+			FreeJob(job);	// It's been reported
+		}
+	}
+	ReleaseExclusiveLock(&jobLock);
+}
+
+static AlignmentJob *FindJob(int id)
+{
+	AcquireExclusiveLock(&jobLock);
+	AlignmentJob *job;
+	for (job = jobs; NULL != job && job->id != id; job = job->next) {
+		// Just looking
+	}
+	ReleaseExclusiveLock(&jobLock);
+	return job;
+}
+
+static void ParseDaemonArgs(int argc, const char **argv, const char **pipeName)
+{
+	*pipeName = DEFAULT_NAMED_PIPE_NAME;
+	daemonCores = GetNumberOfProcessors();
+
+	for (int i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			daemonCores = atoi(argv[i + 1]);
+			i++;
+		} else if (strcmp(argv[i], "-mj") == 0 && i + 1 < argc) {
+			maxRunningJobs = atoi(argv[i + 1]);
+			i++;
+		} else if (i == 2 && argv[i][0] != '-') {
+			*pipeName = argv[i];
+		} else {
+			daemonUsage();
+		}
+	}
+
+	if (daemonCores < 1 || maxRunningJobs < 1) {
 		daemonUsage();
 	}
+}
+
+void RunDaemonMode(int argc, const char **argv)
+{
+	const char *pipeName;
+	ParseDaemonArgs(argc, argv, &pipeName);
+
+	printf("SNAP in daemon mode, waiting for commands to execute.  %d cores, up to %d concurrent jobs\n", daemonCores, maxRunningJobs);
+
+	//
+	// Each job's AlignerOptions would otherwise fill in the LV probability tables on first use, racing with the
+	// jobs that start alongside it.
+	//
+	initializeLVProbabilitiesToPhredPlus33();
 
-	printf("SNAP in daemon mode, waiting for commands to execute\n");
+	InitializeExclusiveLock(&jobLock);
+	g_indexLock = new ExclusiveLock;
+	InitializeExclusiveLock(g_indexLock);
 
-	const char *pipeName = argc == 3 ? argv[2] : DEFAULT_NAMED_PIPE_NAME;
 	CommandPipe = OpenNamedPipe(pipeName, true);
 
 	if (NULL == CommandPipe) {
@@ -145,16 +470,50 @@ void RunDaemonMode(int argc, const char **argv)
 			}
 			printf("\n");
 
-			ProcessNonDaemonCommands(argc, (const char **) argv);
+			bool argvOwnedByJob = false;
+			if (argc > 1 && (strcmp(argv[1], "single") == 0 || strcmp(argv[1], "paired") == 0)) {
+				//
+				// Run it as a job so that it shares the index and cores with the background ones, and wait for it.
+				//
+				AlignmentJob *job = SubmitJob(argc, argv, true);
+				argvOwnedByJob = true;
+				WaitForEvent(&job->finished);
+				FreeJobAfterWait(job);
+			} else if (argc > 2 && strcmp(argv[1], "submit") == 0) {
+				delete[] argv[1];
+				for (int i = 2; i < argc; i++) {
+					argv[i - 1] = argv[i];
+				}
+				AlignmentJob *job = SubmitJob(argc - 1, argv, false);
+				argvOwnedByJob = true;
+				WriteStatusMessage("Submitted job %d\n", job->id);
+			} else if (argc == 2 && strcmp(argv[1], "jobs") == 0) {
+				PrintJobs();
+			} else if (argc == 3 && strcmp(argv[1], "wait") == 0) {
+				AlignmentJob *job = FindJob(atoi(argv[2]));
+				if (NULL == job) {
+					WriteErrorMessage("No job %s (finished jobs are dropped once they've been reported)\n", argv[2]);
+				} else {
+					WaitForEvent(&job->finished);
+					char totalReads[50];
+					WriteStatusMessage("Job %d finished: %s reads in %llds\n", job->id, FormatUIntWithCommas(job->totalReads, totalReads, sizeof(totalReads)),
+						(job->finishTime - job->startTime + 500) / 1000);
+					FreeJobAfterWait(job);
+				}
+			} else {
+				ProcessNonDaemonCommands(argc, (const char **) argv);
+			}
 
 			printf("\n");
 
-			for (int i = 0; i < argc; i++) {
-				delete[] argv[i];
-				argv[i] = NULL;
+			if (!argvOwnedByJob) {
+				for (int i = 0; i < argc; i++) {
+					delete[] argv[i];
+					argv[i] = NULL;
+				}
+				delete[] argv;
+				argv = NULL;
 			}
-			delete[] argv;
-			argv = NULL;
 		}
 		WriteToNamedPipe(CommandPipe, CommandExecutedString);
 	}
@@ -25,12 +25,18 @@ Revision History:
 #include "stdafx.h"
 #include "Compat.h"
 #include "BigAlloc.h"
+#include "Error.h"
 #ifndef _MSC_VER
 #include <fcntl.h>
 #include <aio.h>
 #include <err.h>
 #include <unistd.h>
 #include <signal.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#else
+#include <intrin.h>     // For __cpuid
 #endif
 #include "exit.h"
 #ifdef PROFILE_WAIT
@@ -252,6 +258,7 @@ void* InterlockedCompareExchangePointerAndReturnOldValue(void * volatile *valueT
 struct WrapperThreadContext {
     ThreadMainFunction      mainFunction;
     void                    *mainFunctionParameter;
+    bool                    commandPipeEcho;
 };
 
     DWORD WINAPI
@@ -259,6 +266,7 @@ WrapperThreadMain(PVOID Context)
 {
     WrapperThreadContext *context = (WrapperThreadContext *)Context;
 
+    SetCommandPipeEchoForThisThread(context->commandPipeEcho);
     (*context->mainFunction)(context->mainFunctionParameter);
     delete context;
     context = NULL;
@@ -274,6 +282,7 @@ bool StartNewThread(ThreadMainFunction threadMainFunction, void *threadMainFunct
     }
     context->mainFunction = threadMainFunction;
     context->mainFunctionParameter = threadMainFunctionParameter;
+    context->commandPipeEcho = GetCommandPipeEchoForThisThread();
 
     HANDLE hThread;
     DWORD threadId;
@@ -303,6 +312,51 @@ unsigned GetNumberOfProcessors()
     return systemInfo->dwNumberOfProcessors;
 }
 
+int GetNumberOfNumaNodes()
+{
+    ULONG highestNode;
+    if (!GetNumaHighestNodeNumber(&highestNode)) {
+        return 1;
+    }
+    return __min((int)highestNode + 1, MaxNumaNodes);
+}
+
+int GetNumaNodeOfProcessor(unsigned processorNumber)
+{
+    UCHAR node;
+    if (processorNumber > 255 || !GetNumaProcessorNode((UCHAR)processorNumber, &node) || node == 0xff) {
+        return 0;
+    }
+    return __min((int)node, MaxNumaNodes - 1);
+}
+
+_int64 GetNumaNodeFreeMemory(int node)
+{
+    ULONGLONG availableBytes;
+    if (!GetNumaAvailableMemoryNode((UCHAR)node, &availableBytes)) {
+        return -1;
+    }
+    return (_int64)availableBytes;
+}
+
+//
+// Windows places memory by the node of the thread that first touches it, but has no per-thread policy to change that,
+// so these aren't implemented.
+//
+bool InterleaveThreadMemoryAcrossNumaNodes()
+{
+    return false;
+}
+
+bool BindThreadMemoryToNumaNode(int node)
+{
+    return false;
+}
+
+void ResetThreadMemoryPlacement()
+{
+}
+
 _int64 QueryFileSize(const char *fileName) {
     HANDLE hFile = CreateFile(fileName,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
     if (INVALID_HANDLE_VALUE == hFile) {
@@ -677,6 +731,11 @@ int _fseek64bit(FILE *stream, _int64 offset, int origin)
     return _fseeki64(stream,offset,origin);
 }
 
+_int64 _ftell64bit(FILE *stream)
+{
+    return _ftelli64(stream);
+}
+
 int getpagesize()
 {
     SYSTEM_INFO systemInfo;
@@ -1252,12 +1311,14 @@ namespace {
 struct ThreadInfo {
     ThreadMainFunction function;
     void *parameter;
+    bool commandPipeEcho;
 
-    ThreadInfo(ThreadMainFunction f, void *p): function(f), parameter(p) {}
+    ThreadInfo(ThreadMainFunction f, void *p): function(f), parameter(p), commandPipeEcho(GetCommandPipeEchoForThisThread()) {}
 };
 
 void* runThread(void* infoVoidPtr) {
     ThreadInfo *info = (ThreadInfo*) infoVoidPtr;
+    SetCommandPipeEchoForThisThread(info->commandPipeEcho);
     info->function(info->parameter);
     delete info;
     return NULL;
@@ -1289,6 +1350,119 @@ unsigned GetNumberOfProcessors()
     return (unsigned) sysconf(_SC_NPROCESSORS_ONLN);
 }
 
+#ifdef __linux__
+//
+// Call the memory policy system calls directly rather than linking libnuma.  These are the values from linux/mempolicy.h.
+//
+static const int SNAP_MPOL_DEFAULT = 0;
+static const int SNAP_MPOL_BIND = 2;
+static const int SNAP_MPOL_INTERLEAVE = 3;
+
+static bool NumaNodeExists(int node)
+{
+    char path[100];
+    sprintf(path, "/sys/devices/system/node/node%d", node);
+    struct stat sb;
+    return stat(path, &sb) == 0;
+}
+
+int GetNumberOfNumaNodes()
+{
+    int nNodes = 0;
+    while (nNodes < MaxNumaNodes && NumaNodeExists(nNodes)) {
+        nNodes++;
+    }
+    return __max(nNodes, 1);
+}
+
+int GetNumaNodeOfProcessor(unsigned processorNumber)
+{
+    for (int node = 0; node < GetNumberOfNumaNodes(); node++) {
+        char path[100];
+        sprintf(path, "/sys/devices/system/cpu/cpu%u/node%d", processorNumber, node);
+        struct stat sb;
+        if (stat(path, &sb) == 0) {
+            return node;
+        }
+    }
+    return 0;
+}
+
+_int64 GetNumaNodeFreeMemory(int node)
+{
+    char path[100];
+    sprintf(path, "/sys/devices/system/node/node%d/meminfo", node);
+    FILE *meminfo = fopen(path, "r");
+    if (NULL == meminfo) {
+        return -1;
+    }
+
+    _int64 freeKB = -1;
+    char line[200];
+    while (NULL != fgets(line, sizeof(line), meminfo)) {
+        const char *memFree = strstr(line, "MemFree:");
+        if (NULL != memFree) {
+            freeKB = atoll(memFree + strlen("MemFree:"));
+            break;
+        }
+    }
+    fclose(meminfo);
+
+    return freeKB < 0 ? -1 : freeKB * 1024;
+}
+
+static bool SetThreadMemoryPolicy(int mode, _uint64 nodeMask)
+{
+    unsigned long mask = (unsigned long)nodeMask;
+    return syscall(SYS_set_mempolicy, mode, mode == SNAP_MPOL_DEFAULT ? NULL : &mask, mode == SNAP_MPOL_DEFAULT ? 0 : MaxNumaNodes + 1) == 0;
+}
+
+bool InterleaveThreadMemoryAcrossNumaNodes()
+{
+    int nNodes = GetNumberOfNumaNodes();
+    return SetThreadMemoryPolicy(SNAP_MPOL_INTERLEAVE, nNodes >= 64 ? ~(_uint64)0 : ((_uint64)1 << nNodes) - 1);
+}
+
+bool BindThreadMemoryToNumaNode(int node)
+{
+    return SetThreadMemoryPolicy(SNAP_MPOL_BIND, (_uint64)1 << node);
+}
+
+void ResetThreadMemoryPlacement()
+{
+    SetThreadMemoryPolicy(SNAP_MPOL_DEFAULT, 0);
+}
+#else   // __linux__
+int GetNumberOfNumaNodes()
+{
+    return 1;
+}
+
+int GetNumaNodeOfProcessor(unsigned processorNumber)
+{
+    return 0;
+}
+
+_int64 GetNumaNodeFreeMemory(int node)
+{
+    return -1;
+}
+
+bool InterleaveThreadMemoryAcrossNumaNodes()
+{
+    return false;
+}
+
+bool BindThreadMemoryToNumaNode(int node)
+{
+    return false;
+}
+
+void ResetThreadMemoryPlacement()
+{
+}
+#endif  // __linux__
+
 void SleepForMillis(unsigned millis)
 {
   usleep(millis*1000);
@@ -1848,6 +2022,15 @@ int _fseek64bit(FILE *stream, _int64 offset, int origin)
 #endif
 }
 
+_int64 _ftell64bit(FILE *stream)
+{
+#ifdef __APPLE__
+    return ftello(stream);
+#else
+    return ftello64(stream);
+#endif
+}
+
 FileMapper::FileMapper()
 {
     fd = -1;
@@ -1908,7 +2091,7 @@ FileMapper::createMapping(size_t offset, size_t amountToMap, void** o_token)
     lastPosMadvised = 0;
 
     InterlockedIncrementAndReturnNewValue(&mapCount);
-    *o_token = new UnmapToken(mappedBase, amountToMap);
+    *o_token = new UnmapToken(mappedBase, amountToMap + beginRounding);
     return mappedBase + beginRounding;
 }
 
@@ -2201,6 +2384,47 @@ const char *DEFAULT_NAMED_PIPE_NAME = "SNAP";
 
 #endif  // _MSC_VER
 
+    static SIMDLevel
+ComputeProcessorSIMDLevel()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    bool sse41 = (info[2] & (1 << 19)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    bool avx2 = false;
+    if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 0x6) == 0x6) {  // The OS saves the YMM registers
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+    if (avx2) {
+        return SIMDLevelAVX2;
+    }
+    if (sse41) {
+        return SIMDLevelSSE41;
+    }
+#elif defined(SIMD_KERNELS_AVAILABLE)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SIMDLevelAVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return SIMDLevelSSE41;
+    }
+#endif
+    return SIMDLevelScalar;
+}
+
+SIMDLevel GetProcessorSIMDLevel()
+{
+    static SIMDLevel level = ComputeProcessorSIMDLevel();
+    return level;
+}
+
 AsyncFile* AsyncFile::open(const char* filename, bool write)
 {
     if (!strcmp("-", filename) && write) {
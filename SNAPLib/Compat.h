@@ -343,6 +343,19 @@ void* InterlockedCompareExchangePointerAndReturnOldValue(void * volatile *valueT
 typedef void (*ThreadMainFunction) (void *threadMainFunctionParameter);
 bool StartNewThread(ThreadMainFunction threadMainFunction, void *threadMainFunctionParameter);
 void BindThreadToProcessor(unsigned processorNumber); // This hard binds a thread to a processor.  You can no-op it at some perf hit.
+
+//
+// NUMA placement.  Placement applies to memory that the calling thread touches first, so set it before allocating and
+// filling the memory, then reset it.  Systems (or builds) without NUMA support report a single node, and the placement
+// functions return false.
+//
+const int MaxNumaNodes = 64;
+int GetNumberOfNumaNodes();
+int GetNumaNodeOfProcessor(unsigned processorNumber);
+_int64 GetNumaNodeFreeMemory(int node);     // In bytes, or -1 if unknown
+bool InterleaveThreadMemoryAcrossNumaNodes();
+bool BindThreadMemoryToNumaNode(int node);
+void ResetThreadMemoryPlacement();
 #ifdef  _MSC_VER
 #define GetThreadId() GetCurrentThreadId()
 #else   // _MSC_VER
@@ -353,6 +366,30 @@ void SleepForMillis(unsigned millis);
 
 unsigned GetNumberOfProcessors();
 
+//
+// Vector instruction set support, used to choose SIMD kernels at startup.  The levels are cumulative: a processor
+// that reports SIMDLevelAVX2 also supports SSE4.1.
+//
+enum SIMDLevel {SIMDLevelScalar = 0, SIMDLevelSSE41 = 1, SIMDLevelAVX2 = 2};
+SIMDLevel GetProcessorSIMDLevel();
+
+//
+// Marks a function that uses intrinsics beyond what the file is compiled for (-msse).  Callers must check
+// GetProcessorSIMDLevel() before calling it.  MSVC allows the intrinsics anywhere, so it needs no attribute.
+//
+#if defined(_MSC_VER)
+#define SIMD_KERNELS_AVAILABLE 1
+#define SIMD_TARGET(isa) /* nothing */
+#define SIMD_FORCE_INLINE __forceinline
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(__APPLE__)
+#define SIMD_KERNELS_AVAILABLE 1
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#define SIMD_FORCE_INLINE inline __attribute__((always_inline))
+#else
+#define SIMD_TARGET(isa) /* nothing */
+#define SIMD_FORCE_INLINE inline
+#endif
+
 _int64 QueryFileSize(const char *fileName);
 
 // returns true on success
@@ -433,15 +470,17 @@ public:
 
 
 //
-// Macro for counting trailing zeros of a 64-bit value
+// Macros for counting leading/trailing zeros and one bits of a 64-bit value
 //
 #ifdef _MSC_VER
 #define CountLeadingZeroes(x, ans) {_BitScanReverse64(&ans, x);}
 #define CountTrailingZeroes(x, ans) {_BitScanForward64(&ans, x);}
+#define CountOneBits(x) ((unsigned)__popcnt64(x))
 #define ByteSwapUI64(x) (_byteswap_uint64(x))
 #else
 #define CountLeadingZeroes(x, ans) {ans = __builtin_clzll(x);}
 #define CountTrailingZeroes(x, ans) {ans = __builtin_ctzll(x);}
+#define CountOneBits(x) ((unsigned)__builtin_popcountll(x))
 #define ByteSwapUI64(x) (__builtin_bswap64(x))
 #endif
 
@@ -450,6 +489,7 @@ public:
 //
 
 int _fseek64bit(FILE *stream, _int64 offset, int origin);
+_int64 _ftell64bit(FILE *stream);
 
 #ifndef _MSC_VER
 
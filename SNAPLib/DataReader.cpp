@@ -24,9 +24,20 @@ Environment:
 #include "ParallelTask.h"
 #include "DataReader.h"
 #include "Bam.h"
+#include "SpeculativeInflate.h"
 #include "zlib.h"
 #include "exit.h"
 #include "Error.h"
+#ifdef SNAP_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
 
 using std::max;
 using std::min;
@@ -45,7 +56,7 @@ class ReadBasedDataReader : public DataReader
 {
 public:
 
-    ReadBasedDataReader(unsigned i_nBuffers, _int64 i_overflowBytes, double extraFactor, size_t bufferSpace = 0);
+    ReadBasedDataReader(unsigned i_nBuffers, _int64 i_overflowBytes, double extraFactor, size_t bufferSpace = 0, unsigned bufferAlignment = 1);
 
     virtual ~ReadBasedDataReader();
     
@@ -124,6 +135,8 @@ protected:
 
     unsigned            nBuffers;
     const unsigned      maxBuffers;
+    char*               allocatedBuffers;   // What to free; the buffers start at the first aligned address in it
+    size_t              bufferStride;       // Distance between the starts of consecutive buffers, a multiple of the alignment
 	int					headerBuffersOutstanding;
 	bool				startedReadingHeader;
     _int64              extraBytes;
@@ -163,7 +176,8 @@ ReadBasedDataReader::ReadBasedDataReader(
     unsigned i_nBuffers,
     _int64 i_overflowBytes,
     double extraFactor,
-    size_t i_bufferSpace)
+    size_t i_bufferSpace,
+    unsigned bufferAlignment)
     : DataReader(), nBuffers(i_nBuffers), overflowBytes(i_overflowBytes),
     maxBuffers(i_nBuffers * (i_nBuffers == 1 ? 2 : 4)),
     bufferSize(i_bufferSpace > 0 ? i_bufferSpace / (i_nBuffers * 2) : BUFFER_SIZE),
@@ -180,17 +194,17 @@ ReadBasedDataReader::ReadBasedDataReader(
     _ASSERT(extraFactor >= 0 && i_nBuffers > 0);
     bufferInfo = new BufferInfo[maxBuffers];
     extraBytes = max((_int64) 0, (_int64) ((bufferSize + overflowBytes) * extraFactor));
-    char* allocated = (char*) BigReserve(maxBuffers * (bufferSize + extraBytes + overflowBytes));
-    BigCommit(allocated, nBuffers * (bufferSize + extraBytes + overflowBytes));
-    if (NULL == allocated) {
+    bufferStride = ((bufferSize + extraBytes + overflowBytes + bufferAlignment - 1) / bufferAlignment) * bufferAlignment;
+    allocatedBuffers = (char*) BigReserve(maxBuffers * bufferStride + bufferAlignment - 1);
+    if (NULL == allocatedBuffers) {
         WriteErrorMessage("ReadBasedDataReader: unable to allocate IO buffer\n");
         soft_exit(1);
     }
+    char* allocated = allocatedBuffers + (bufferAlignment - (size_t)allocatedBuffers % bufferAlignment) % bufferAlignment;
+    BigCommit(allocated, nBuffers * bufferStride);
     for (unsigned i = 0 ; i < nBuffers; i++) {
-        bufferInfo[i].buffer = allocated;
-        allocated += bufferSize + overflowBytes;
-        bufferInfo[i].extra = extraBytes > 0 ? allocated : NULL;
-        allocated += extraBytes;
+        bufferInfo[i].buffer = allocated + i * bufferStride;
+        bufferInfo[i].extra = extraBytes > 0 ? bufferInfo[i].buffer + bufferSize + overflowBytes : NULL;
 
         bufferInfo[i].state = Empty;
         bufferInfo[i].isEOF = false;
@@ -213,7 +227,7 @@ ReadBasedDataReader::ReadBasedDataReader(
 
 ReadBasedDataReader::~ReadBasedDataReader()
 {
-    BigDealloc(bufferInfo[0].buffer);
+    BigDealloc(allocatedBuffers);
     for (unsigned i = 0; i < nBuffers; i++) {
         bufferInfo[i].buffer = bufferInfo[i].extra = NULL;
     }
@@ -525,6 +539,7 @@ ReadBasedDataReader::nextBatch()
     _ASSERT(nextBufferForConsumer >= 0);
     BufferInfo* info = &bufferInfo[nextBufferForConsumer];
     if (info->isEOF) {
+        info->state = InUse;    // The consumer's done with it, so releasing the last hold frees it
         ReleaseExclusiveLock(&lock);
         if (info->holds == 0) {
             releaseBatch(DataBatch(info->batchID));
@@ -635,7 +650,12 @@ ReadBasedDataReader::releaseBatch(
                 if (info->holds > 0) {
                     info->holds--;
                 }
-                if (info->holds == 0) {
+                if (info->holds == 0 && info->state == Full && i == nextBufferForConsumer) {
+                    //
+                    // The consumer is still reading this one, and may hand out more of it.  nextBatch() releases it when it moves on.
+                    //
+                    result = false;
+                } else if (info->holds == 0) {
                     //fprintf(stderr,"%x releaseBatch batch %d, releasing %s buffer %d\n", (unsigned) this, batch.batchID, info->state == InUse ? "InUse" : "Full", i);
                     info->state = Empty;
                     // remove from ready list
@@ -728,13 +748,12 @@ ReadBasedDataReader::addBuffer()
     }
     _ASSERT(nBuffers < maxBuffers);
     //fprintf(stderr, "ReadBasedDataReader: addBuffer %d of %d\n", nBuffers, maxBuffers);
-    size_t bytes = bufferSize + extraBytes + overflowBytes;
-    bufferInfo[nBuffers].buffer = bufferInfo[nBuffers-1].buffer + bytes;
-    if (! BigCommit(bufferInfo[nBuffers].buffer, bytes)) {
+    bufferInfo[nBuffers].buffer = bufferInfo[nBuffers-1].buffer + bufferStride;
+    if (! BigCommit(bufferInfo[nBuffers].buffer, bufferStride)) {
         WriteErrorMessage("ReadBasedDataReader: unable to commit IO buffer\n");
         soft_exit(1);
     }
-    bufferInfo[nBuffers].extra = extraBytes > 0 ? bufferInfo[nBuffers].buffer + bytes - extraBytes : NULL;
+    bufferInfo[nBuffers].extra = extraBytes > 0 ? bufferInfo[nBuffers].buffer + bufferSize + overflowBytes : NULL;
 
 
     bufferInfo[nBuffers].state = Empty;
@@ -1279,6 +1298,547 @@ DataSupplier* DataSupplier::WindowsOverlapped = new WindowsOverlappedDataSupplie
 
 #endif // _MSC_VER
 
+#ifdef SNAP_IO_URING
+//
+// Asynchronous reads on Linux using io_uring.  The file is opened with O_DIRECT, so the data goes straight from the
+// device into our buffers without passing through (or polluting) the page cache, and the buffers are registered with
+// the ring so the kernel doesn't have to map them for every read.  All of the free buffers are submitted with one
+// system call and left in flight, and the consumer only waits if it gets to one that isn't done yet.
+//
+// O_DIRECT needs the buffers, file offsets and lengths to be aligned.  The buffers are aligned by ReadBasedDataReader.
+// For the offsets, each buffer stops being the place reads can begin at an aligned offset (rather than exactly
+// overflowBytes before its end), which is where the next one starts.  A range that doesn't start aligned gets the
+// bytes before it read into the first buffer, and the consumer starts past them.  If the file system won't do
+// O_DIRECT, or the buffers are too small for it, this is all the same with an alignment of 1.
+//
+class IoUringDataReader : public ReadBasedDataReader
+{
+public:
+
+    IoUringDataReader(unsigned i_nBuffers, _int64 i_overflowBytes, double extraFactor, size_t bufferSpace);
+
+    virtual ~IoUringDataReader();
+
+    virtual bool init(const char* i_fileName);
+
+    virtual void reinit(_int64 startingOffset, _int64 amountOfFileToProcess);
+
+    virtual const char* getFilename()
+    { return fileName; }
+
+    // Whether the kernel lets this process use io_uring (it may be too old, configured out or blocked by seccomp)
+    static bool IsAvailable();
+
+ protected:
+
+    // must hold the lock to call
+    virtual void startIo();
+
+    // must hold the lock to call
+    virtual void waitForBuffer(unsigned bufferNumber);
+
+private:
+
+    static const unsigned DirectIoAlignment = 4096;
+
+    void setupRing();
+
+    // Puts a read for the buffer into the submission queue.  It's not started until submitReads().
+    void queueRead(unsigned bufferNumber, unsigned bytesToRead);
+
+    void submitReads();
+
+    // Takes one completion off the completion queue and finishes its buffer, waiting for one if wait is set.
+    // Returns false if there wasn't one.
+    bool reapCompletion(bool wait);
+
+    void finishRead(unsigned bufferNumber, int result);
+
+    const char*         fileName;
+    int                 directFile;         // -1 if we're not using O_DIRECT
+    int                 bufferedFile;       // For short reads and when we can't use O_DIRECT
+    _int64              fileSize;
+    _int64              readOffset;
+    _int64              endingOffset;
+    unsigned            alignment;
+    unsigned            readSize;           // Largest read, bufferSize rounded down to the alignment
+
+    unsigned            *bytesRequested;    // For each buffer, how much of the file it should get (before rounding up for O_DIRECT)
+    struct iovec        *bufferIovecs;      // For each buffer, for reads into ones that aren't registered
+    char                *registeredBuffers; // NULL if we couldn't register them
+    size_t              registeredBytes;
+
+    int                 ringFd;
+    unsigned            nQueued;
+    unsigned            nInFlight;
+    void                *sqRing;
+    size_t              sqRingSize;
+    void                *cqRing;
+    size_t              cqRingSize;
+    struct io_uring_sqe *sqes;
+    size_t              sqesSize;
+    unsigned            *sqTail;
+    unsigned            *sqMask;
+    unsigned            *sqArray;
+    unsigned            *cqHead;
+    unsigned            *cqTail;
+    unsigned            *cqMask;
+    struct io_uring_cqe *cqes;
+};
+
+static int IoUringSetup(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int IoUringEnter(int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static int IoUringRegister(int ringFd, unsigned opcode, void *arg, unsigned nArgs)
+{
+    return (int)syscall(__NR_io_uring_register, ringFd, opcode, arg, nArgs);
+}
+
+IoUringDataReader::IoUringDataReader(unsigned i_nBuffers, _int64 i_overflowBytes, double extraFactor, size_t bufferSpace) :
+    ReadBasedDataReader(i_nBuffers, i_overflowBytes, extraFactor, bufferSpace, DirectIoAlignment), fileName(NULL), directFile(-1), bufferedFile(-1),
+    fileSize(0), readOffset(0), endingOffset(0), alignment(1), readSize((unsigned)bufferSize), registeredBuffers(NULL), registeredBytes(0),
+    ringFd(-1), nQueued(0), nInFlight(0), sqRing(MAP_FAILED), sqRingSize(0), cqRing(MAP_FAILED), cqRingSize(0), sqes((struct io_uring_sqe *)MAP_FAILED), sqesSize(0)
+{
+    bytesRequested = new unsigned[maxBuffers];
+    bufferIovecs = new struct iovec[maxBuffers];
+}
+
+IoUringDataReader::~IoUringDataReader()
+{
+    //
+    // The kernel is still writing into any buffers with reads in flight, so they have to finish before the buffers go away.
+    //
+    while (nInFlight > 0) {
+        reapCompletion(true);
+    }
+
+    if (MAP_FAILED != (void *)sqes) {
+        munmap(sqes, sqesSize);
+    }
+    if (MAP_FAILED != cqRing && cqRing != sqRing) {
+        munmap(cqRing, cqRingSize);
+    }
+    if (MAP_FAILED != sqRing) {
+        munmap(sqRing, sqRingSize);
+    }
+    if (-1 != ringFd) {
+        close(ringFd);
+    }
+    if (-1 != directFile) {
+        close(directFile);
+    }
+    if (-1 != bufferedFile) {
+        close(bufferedFile);
+    }
+
+    delete[] bytesRequested;
+    delete[] bufferIovecs;
+}
+
+    bool
+IoUringDataReader::IsAvailable()
+{
+    static int available = -1;
+    if (-1 == available) {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        int fd = IoUringSetup(1, &params);
+        available = fd >= 0;
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    return 0 != available;
+}
+
+    bool
+IoUringDataReader::init(const char* i_fileName)
+{
+    fileName = i_fileName;
+    bufferedFile = open(fileName, O_RDONLY);
+    if (-1 == bufferedFile) {
+        return false;
+    }
+
+    struct stat fileStat;
+    if (0 != fstat(bufferedFile, &fileStat)) {
+        WriteErrorMessage("IoUringDataReader: unable to get file size of '%s', %d\n", fileName, errno);
+        return false;
+    }
+    fileSize = fileStat.st_size;
+
+    //
+    // Each buffer has to let reads begin in at least one aligned block, or we'd never get anywhere.
+    //
+    unsigned alignedReadSize = (unsigned)(bufferSize / DirectIoAlignment * DirectIoAlignment);
+    if (alignedReadSize >= overflowBytes + DirectIoAlignment) {
+        directFile = open(fileName, O_RDONLY | O_DIRECT);
+    }
+    if (-1 != directFile) {
+        alignment = DirectIoAlignment;
+        readSize = alignedReadSize;
+    }
+
+    setupRing();
+
+    return true;
+}
+
+    void
+IoUringDataReader::setupRing()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ringFd = IoUringSetup(maxBuffers, &params);
+    if (ringFd < 0) {
+        WriteErrorMessage("IoUringDataReader: unable to set up io_uring for '%s', %d\n", fileName, errno);
+        soft_exit(1);
+    }
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sqRingSize = cqRingSize = __max(sqRingSize, cqRingSize);
+    }
+
+    sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cqRing = sqRing;
+    } else {
+        cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+    }
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe *)mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (MAP_FAILED == sqRing || MAP_FAILED == cqRing || MAP_FAILED == (void *)sqes) {
+        WriteErrorMessage("IoUringDataReader: unable to map io_uring for '%s', %d\n", fileName, errno);
+        soft_exit(1);
+    }
+
+    sqTail = (unsigned *)((char *)sqRing + params.sq_off.tail);
+    sqMask = (unsigned *)((char *)sqRing + params.sq_off.ring_mask);
+    sqArray = (unsigned *)((char *)sqRing + params.sq_off.array);
+    cqHead = (unsigned *)((char *)cqRing + params.cq_off.head);
+    cqTail = (unsigned *)((char *)cqRing + params.cq_off.tail);
+    cqMask = (unsigned *)((char *)cqRing + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *)((char *)cqRing + params.cq_off.cqes);
+
+    //
+    // Register the buffers we have now.  Ones added later just use ordinary reads.  Older kernels count registered
+    // buffers against the locked memory limit, so this may well fail, which is fine.
+    //
+    struct iovec registered;
+    registered.iov_base = bufferInfo[0].buffer;
+    registered.iov_len = nBuffers * bufferStride;
+    if (0 == IoUringRegister(ringFd, IORING_REGISTER_BUFFERS, &registered, 1)) {
+        registeredBuffers = bufferInfo[0].buffer;
+        registeredBytes = registered.iov_len;
+    }
+}
+
+    void
+IoUringDataReader::reinit(
+    _int64 i_startingOffset,
+    _int64 amountOfFileToProcess)
+{
+    _ASSERT(-1 != bufferedFile);  // Must call init() before reinit()
+
+    AcquireExclusiveLock(&lock);
+
+    //
+    // First let any pending IO complete.
+    //
+    for (unsigned i = 0; i < nBuffers; i++) {
+        if (bufferInfo[i].state == Reading) {
+            waitForBuffer(i);
+        }
+        bufferInfo[i].state = Empty;
+        bufferInfo[i].isEOF= false;
+        bufferInfo[i].offset = 0;
+        bufferInfo[i].next = i < nBuffers - 1 ? i + 1 : -1;
+        bufferInfo[i].previous = i > 0 ? i - 1 : -1;
+    }
+
+    nextBufferForConsumer = -1;
+    lastBufferForConsumer = -1;
+    nextBufferForReader = 0;
+
+    readOffset = i_startingOffset / alignment * alignment;
+    if (amountOfFileToProcess == 0) {
+        //
+        // This means just read the whole file.
+        //
+        endingOffset = fileSize;
+    } else {
+        endingOffset = min(fileSize, i_startingOffset + amountOfFileToProcess);
+    }
+
+    //
+    // Kick off IO, wait for the first buffer to be read, and skip what we read from before the start of the range.
+    //
+    startIo();
+    waitForBuffer(nextBufferForConsumer);
+
+    BufferInfo *first = &bufferInfo[nextBufferForConsumer];
+    first->offset = (unsigned)min((_int64)first->validBytes, i_startingOffset - first->fileOffset);
+
+    ReleaseExclusiveLock(&lock);
+}
+
+    void
+IoUringDataReader::startIo()
+{
+    //
+    // Launch reads on whatever buffers are ready.
+    //
+    AssertExclusiveLockHeld(&lock);
+
+    while (nextBufferForReader != -1) {
+        // remove from free list
+        BufferInfo* info = &bufferInfo[nextBufferForReader];
+        _ASSERT(info->state == Empty);
+        int index = nextBufferForReader;
+        nextBufferForReader = info->next;
+        info->batchID = nextBatchID++;
+        // add to end of consumer list
+        if (lastBufferForConsumer != -1) {
+            _ASSERT(bufferInfo[lastBufferForConsumer].next == -1);
+            bufferInfo[lastBufferForConsumer].next = index;
+        }
+        info->next = -1;
+        info->previous = lastBufferForConsumer;
+        lastBufferForConsumer = index;
+
+        if (nextBufferForConsumer == -1) {
+            nextBufferForConsumer = index;
+        }
+
+        if (readOffset >= fileSize || readOffset >= endingOffset) {
+            info->validBytes = 0;
+            info->nBytesThatMayBeginARead = 0;
+            info->isEOF = true;
+            info->state = Full;
+            break;
+        }
+
+        _int64 finalOffset = min(fileSize, endingOffset + overflowBytes);
+        _int64 finalStartOffset = min(fileSize, endingOffset);
+        _int64 nextAlignedStart = (readOffset + readSize - overflowBytes) / alignment * alignment;
+        unsigned amountToRead = (unsigned)min(finalOffset - readOffset, (_int64)readSize);   // Cast OK because can't be longer than unsigned readSize
+        info->isEOF = readOffset + amountToRead == finalOffset;
+        if (info->isEOF) {
+            //
+            // There's no next buffer, so everything up to the end of the range has to be able to begin a read here.
+            //
+            info->nBytesThatMayBeginARead = (unsigned)(finalStartOffset - readOffset);
+        } else {
+            info->nBytesThatMayBeginARead = (unsigned)(min(nextAlignedStart, finalStartOffset) - readOffset);
+        }
+
+        _ASSERT(amountToRead >= info->nBytesThatMayBeginARead && info->nBytesThatMayBeginARead > 0);
+        info->fileOffset = readOffset;
+        readOffset += info->nBytesThatMayBeginARead;
+        info->state = Reading;
+        info->offset = 0;
+
+        bytesRequested[index] = amountToRead;
+        queueRead(index, (amountToRead + alignment - 1) / alignment * alignment);
+    }
+
+    submitReads();
+
+    if (nextBufferForConsumer == -1) {
+        PreventEventWaitersFromProceeding(&releaseEvent);
+    }
+}
+
+    void
+IoUringDataReader::queueRead(
+    unsigned bufferNumber,
+    unsigned bytesToRead)
+{
+    BufferInfo *info = &bufferInfo[bufferNumber];
+
+    unsigned tail = *sqTail;
+    unsigned slot = tail & *sqMask;
+    struct io_uring_sqe *sqe = &sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+
+    sqe->fd = -1 != directFile ? directFile : bufferedFile;
+    sqe->off = info->fileOffset;
+    sqe->user_data = bufferNumber;
+    if (NULL != registeredBuffers && info->buffer >= registeredBuffers && info->buffer + bytesToRead <= registeredBuffers + registeredBytes) {
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->addr = (_uint64)info->buffer;
+        sqe->len = bytesToRead;
+        sqe->buf_index = 0;
+    } else {
+        bufferIovecs[bufferNumber].iov_base = info->buffer;
+        bufferIovecs[bufferNumber].iov_len = bytesToRead;
+        sqe->opcode = IORING_OP_READV;
+        sqe->addr = (_uint64)&bufferIovecs[bufferNumber];
+        sqe->len = 1;
+    }
+
+    sqArray[slot] = slot;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    nQueued++;
+}
+
+    void
+IoUringDataReader::submitReads()
+{
+    while (nQueued > 0) {
+        int submitted = IoUringEnter(ringFd, nQueued, 0, 0);
+        if (submitted < 0) {
+            if (EINTR == errno || EAGAIN == errno || EBUSY == errno) {
+                //
+                // Out of resources for the moment; let some reads finish and try again.
+                //
+                if (nInFlight > 0) {
+                    reapCompletion(true);
+                }
+                continue;
+            }
+            WriteErrorMessage("IoUringDataReader: io_uring_enter failed reading '%s', %d\n", fileName, errno);
+            soft_exit(1);
+        }
+        nQueued -= submitted;
+        nInFlight += submitted;
+    }
+}
+
+    bool
+IoUringDataReader::reapCompletion(bool wait)
+{
+    unsigned head = *cqHead;
+    while (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+        if (!wait) {
+            return false;
+        }
+        if (IoUringEnter(ringFd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && EINTR != errno) {
+            WriteErrorMessage("IoUringDataReader: io_uring_enter failed waiting for '%s', %d\n", fileName, errno);
+            soft_exit(1);
+        }
+    }
+
+    struct io_uring_cqe *cqe = &cqes[head & *cqMask];
+    unsigned bufferNumber = (unsigned)cqe->user_data;
+    int result = cqe->res;
+    __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+
+    nInFlight--;
+    finishRead(bufferNumber, result);
+    return true;
+}
+
+    void
+IoUringDataReader::finishRead(
+    unsigned bufferNumber,
+    int result)
+{
+    BufferInfo *info = &bufferInfo[bufferNumber];
+    _ASSERT(info->state == Reading);
+
+    if (-EINVAL == result && DirectIoAlignment == alignment) {
+        //
+        // The file system took O_DIRECT at open time but won't do it for this read.  Give up on it; the offsets stay aligned,
+        // which doesn't matter for ordinary reads.  Any other reads already in flight on it will fail the same way.
+        //
+        if (-1 != directFile) {
+            close(directFile);
+            directFile = -1;
+        }
+        result = 0;
+    } else if (result < 0) {
+        WriteErrorMessage("IoUringDataReader: error reading '%s' at offset %lld, %d\n", fileName, info->fileOffset, -result);
+        soft_exit(1);
+    }
+
+    //
+    // Finish short reads (and ones we gave up on) synchronously.  They're rare, since we never ask for more than the file has.
+    //
+    unsigned validBytes = __min((unsigned)result, bytesRequested[bufferNumber]);
+    while (validBytes < bytesRequested[bufferNumber]) {
+        ssize_t bytesRead = pread(bufferedFile, info->buffer + validBytes, bytesRequested[bufferNumber] - validBytes, info->fileOffset + validBytes);
+        if (bytesRead <= 0) {
+            WriteErrorMessage("IoUringDataReader: unable to read '%s' at offset %lld (was it truncated?), %d\n", fileName, info->fileOffset + validBytes, errno);
+            soft_exit(1);
+        }
+        validBytes += (unsigned)bytesRead;
+    }
+
+    info->validBytes = validBytes;
+    info->buffer[info->validBytes] = 0;
+    info->state = Full;
+}
+
+    void
+IoUringDataReader::waitForBuffer(
+    unsigned bufferNumber)
+{
+    _ASSERT(bufferNumber >= 0 && bufferNumber < nBuffers);
+    BufferInfo *info = &bufferInfo[bufferNumber];
+
+    while (info->state == InUse) {
+        // must already have lock to call, release & wait & reacquire
+        ReleaseExclusiveLock(&lock);
+        _int64 start = timeInNanos();
+        bool waitSucceeded = WaitForEventWithTimeout(&releaseEvent, releaseWaitInMillis);
+        InterlockedAdd64AndReturnNewValue(&ReleaseWaitTime, timeInNanos() - start);
+        AcquireExclusiveLock(&lock);
+        if (!waitSucceeded) {
+            // this isn't going to directly make this buffer available, but will reduce pressure
+            addBuffer();
+        }
+    }
+
+    if (info->state == Full) {
+        return;
+    }
+
+    if (info->state != Reading) {
+        startIo();
+    }
+
+    _int64 start = timeInNanos();
+    while (info->state == Reading) {
+        reapCompletion(true);
+    }
+    InterlockedAdd64AndReturnNewValue(&ReadWaitTime, timeInNanos() - start);
+}
+
+class IoUringDataSupplier : public DataSupplier
+{
+public:
+    IoUringDataSupplier() : DataSupplier() {}
+    virtual DataReader* getDataReader(int bufferCount, _int64 overflowBytes, double extraFactor, size_t bufferSpace)
+    {
+        //
+        // Decompressors ask for room for the expanded data with every buffer.  ReadBasedDataReader reserves four times as many
+        // buffers as it starts with so it can add more, and on Linux reserving is committing, so that would take several times
+        // the memory the memmap reader does.  Give them the memmap reader.
+        //
+        if (!IoUringDataReader::IsAvailable() || extraFactor > 0) {
+            return DataSupplier::MemMap->getDataReader(bufferCount, overflowBytes, extraFactor, bufferSpace);
+        }
+
+        // add some buffers for read-ahead
+        return new IoUringDataReader(bufferCount + (bufferCount > 1 ? 4 : 0), overflowBytes, extraFactor, bufferSpace);
+    }
+};
+
+DataSupplier* DataSupplier::IoUring = new IoUringDataSupplier();
+
+#endif // SNAP_IO_URING
+
 //
 // Decompress
 //
@@ -1293,7 +1853,8 @@ class DecompressDataReader : public DataReader
 {
 public:
 
-    DecompressDataReader(DataReader* i_inner, int i_count, _int64 totalExtra, _int64 i_extraBytes, _int64 i_overflowBytes, int i_chunkSize = BAM_BLOCK);
+    DecompressDataReader(DataReader* i_inner, int i_count, _int64 totalExtra, _int64 i_extraBytes, _int64 i_overflowBytes, int i_chunkSize = BAM_BLOCK,
+        bool i_speculative = false);
 
     virtual ~DecompressDataReader();
 
@@ -1339,8 +1900,12 @@ private:
 
     static void decompressThreadContinuous(void *context);
 
+    static void decompressThreadSpeculative(void *context);
+
     friend class DecompressManager;
     friend class DecompressWorker;
+    friend class SpeculativeDecompressManager;
+    friend class SpeculativeDecompressWorker;
 
     enum EntryState
     {
@@ -1362,6 +1927,7 @@ private:
         _int64 decompressedStart;
         _int64 decompressedValid;
         bool allocated; // if decompressed has been allocated specially, not from inner extra data
+        bool lastInRange; // has blocks past the end of the range after decompressedStart, not to go on to the next batch
     };
 
     // use only these routines to manipulate the linked  lists
@@ -1376,6 +1942,9 @@ private:
     const _int64 overflowBytes; // overflow between batches
     const _int64 totalExtra; // total extra data
     const int chunkSize; // max size of decompressed data
+    const bool speculative; // decompress non-BGZF data on several threads with SpeculativeInflater
+    bool seekBlock; // the range starts in the middle of the file, so look for the first BGZF block in it
+    int decompressThreads;
     _int64 offset; // into current entry
     bool threadStarted; // whether thread has been started
     bool eof; // true when we've read to eof of previous
@@ -1400,10 +1969,11 @@ DecompressDataReader::DecompressDataReader(
     _int64 i_totalExtra,
     _int64 i_extraBytes,
     _int64 i_overflowBytes,
-    int i_chunkSize)
+    int i_chunkSize,
+    bool i_speculative)
     : DataReader(), inner(i_inner), count(i_count), offset(i_overflowBytes),
     totalExtra(i_totalExtra), extraBytes(i_extraBytes), overflowBytes(i_overflowBytes),
-    chunkSize(i_chunkSize), threadStarted(false), eof(false), stopping(false)
+    chunkSize(i_chunkSize), speculative(i_speculative), threadStarted(false), eof(false), stopping(false)
 {
     entries = new Entry[count];
     for (int i = 0; i < count; i++) {
@@ -1412,6 +1982,7 @@ DecompressDataReader::DecompressDataReader(
         entry->next = i < count - 1 ? &entries[i + 1] : NULL;
         entry->decompressed = NULL;
         entry->allocated = false;
+        entry->lastInRange = false;
         entry->batch = DataBatch(0, 0);
     }
     available = entries;
@@ -1488,8 +2059,11 @@ DecompressDataReader::reinit(
     }
     // todo: transform start/amount to add for compression? I don't think so...
     inner->reinit(startingOffset, amountOfFileToProcess);
+    seekBlock = startingOffset > 0;
+    // a range is one of many being read at once, each by its own reader
+    decompressThreads = amountOfFileToProcess == 0 ? min(8, DataSupplier::ThreadCount) : 1;
     threadStarted = true;
-    if (! StartNewThread(chunkSize > 0 ? decompressThread : decompressThreadContinuous, this)) {
+    if (! StartNewThread(chunkSize > 0 ? decompressThread : speculative ? decompressThreadSpeculative : decompressThreadContinuous, this)) {
         WriteErrorMessage("failed to start decompressThread\n");
         soft_exit(1);
     }
@@ -1538,7 +2112,7 @@ DecompressDataReader::nextBatch()
     }
     Entry* next = peekReady();
     _ASSERT(next->state == EntryReady && next->decompressed != NULL);
-    _int64 copy = old->decompressedValid - max(offset, old->decompressedStart);
+    _int64 copy = old->lastInRange ? 0 : old->decompressedValid - max(offset, old->decompressedStart);
     memcpy(next->decompressed + overflowBytes - copy, old->decompressed + old->decompressedValid - copy, copy);
     offset = overflowBytes - copy;
     //fprintf(stderr,"DecompressDataReader nextBatch %d:%d #%d -> %d:%d #%d copy %lld + %lld/%lld\n", old->batch.fileID, old->batch.batchID, old-entries, next->batch.fileID, next->batch.batchID, next-entries, copy, next->decompressedStart, next->decompressedValid);
@@ -1630,7 +2204,10 @@ DecompressDataReader::decompress(
         zstream->zalloc = zalloc;
         zstream->zfree = zfree;
         zstream->opaque = heap;
-    } else {
+    } else if (mode != ContinueMultiBlock) {
+        //
+        // inflateInit2() fills in zlib's own allocators, and inflate() refuses to continue a stream if they've been cleared.
+        //
         zstream->zalloc = NULL;
         zstream->zfree = NULL;
     }
@@ -1763,7 +2340,7 @@ DecompressDataReader::decompressThread(
     DecompressDataReader* reader = (DecompressDataReader*) context;
     OffsetVector inputs, outputs;
     DecompressManager manager(&inputs, &outputs);
-    ParallelCoworker coworker(min(8, DataSupplier::ThreadCount), false, &manager);
+    ParallelCoworker coworker(reader->decompressThreads, false, &manager);
     coworker.start();
     // keep reading & decompressing entries until stopped
     bool stop = false;
@@ -1775,9 +2352,17 @@ DecompressDataReader::decompressThread(
         // always starts with a fresh batch - advances after reading it all
         bool ok = reader->inner->getData(&entry->compressed, &entry->compressedValid, &entry->compressedStart);
         int index = (int) (entry - reader->entries);
+        _int64 input = 0;
+        bool noBlocks = false;
+        if (ok && reader->seekBlock) {
+            reader->seekBlock = false;
+            input = BgzfHeader::findBlock(entry->compressed, entry->compressedValid, entry->compressedStart);
+            ok = input >= 0;
+            noBlocks = ! ok;
+        }
         if (! ok) {
             //fprintf(stderr, "decompressThread #%d %d:%d eof\n", index, reader->inner->getBatch().fileID, reader->inner->getBatch().batchID);
-            if (! reader->inner->isEOF()) {
+            if (! noBlocks && ! reader->inner->isEOF()) {
                 WriteErrorMessage("error reading file at offset %lld\n", reader->getFileOffset());
                 soft_exit(1);
             }
@@ -1788,6 +2373,7 @@ DecompressDataReader::decompressThread(
             // decompressed buffer is same as next-to-last batch, need to allocate own buffer
             entry->decompressed = (char*) BigAlloc(reader->totalExtra);
             entry->allocated = true;
+            entry->lastInRange = false;
             stop = true;
         } else {
             _int64 extraSize;
@@ -1796,7 +2382,6 @@ DecompressDataReader::decompressThread(
             // figure out offsets and advance inner data
             inputs.clear();
             outputs.clear();
-            _int64 input = 0;
             _int64 output = reader->overflowBytes;
             do {
                 inputs.push_back(input);
@@ -1814,16 +2399,32 @@ DecompressDataReader::decompressThread(
                     soft_exit(1);
                 }
             } while (input < entry->compressedStart);
+            reader->inner->advance(input);
+            entry->batch = reader->inner->getBatch();
+			reader->holdBatch(entry->batch); // hold batch while decompressing
+            reader->inner->nextBatch(); // start reading next batch
+            // the last record of a range can run on into the blocks after it, so decompress enough of them to finish it
+            char* nextData;
+            _int64 nextBytes;
+            entry->lastInRange = ! reader->inner->getData(&nextData, &nextBytes);
+            _int64 rangeOutput = output;
+            while (entry->lastInRange && output - rangeOutput < reader->overflowBytes &&
+                    BgzfHeader::isWholeBlock(entry->compressed + input, entry->compressedValid - input)) {
+                BgzfHeader* zip = (BgzfHeader*) (entry->compressed + input);
+                if (output + zip->ISIZE() > reader->extraBytes) {
+                    break;
+                }
+                inputs.push_back(input);
+                outputs.push_back(output);
+                input += zip->BSIZE() + 1;
+                output += zip->ISIZE();
+            }
             // append final offsets
             inputs.push_back(input);
             outputs.push_back(output);
             //fprintf(stderr, "decompressThread read #%d %lld->%lld\n", index, input, output);
-            reader->inner->advance(input);
             entry->decompressedValid = output;
-            entry->decompressedStart = output - reader->overflowBytes;
-            entry->batch = reader->inner->getBatch();
-			reader->holdBatch(entry->batch); // hold batch while decompressing
-            reader->inner->nextBatch(); // start reading next batch
+            entry->decompressedStart = entry->lastInRange ? rangeOutput : output - reader->overflowBytes;
             // decompress all chunks synchronously on multiple threads
             manager.entry = entry;
             coworker.step();
@@ -1891,6 +2492,252 @@ DecompressDataReader::decompressThreadContinuous(
     AllowEventWaitersToProceed(&reader->decompressThreadDone);
 }
 
+//
+// Speculative decompression for gzip that isn't BGZF, so can't be split at member boundaries.  Each batch of
+// compressed data is cut into one chunk per thread.  In parallel, every chunk but the first looks for a deflate block
+// that starts in it, and then each one decodes from there to where the next chunk's block starts, leaving references
+// into the 32KB window before it as markers.  Serially, any chunk that didn't start where the one before it stopped is
+// decoded again from the right place, and the last 32KB of each is resolved to give the window for the next.  Then in
+// parallel the rest of each chunk is resolved, copied into the batch and CRCed, so the member trailers can be checked.
+//
+
+static const _int64 SpeculativeOverflowBytes = 1024 * 1024; // so a block that starts before the end of a batch can finish
+static const _int64 MinSpeculativeChunkBytes = 256 * 1024;
+
+struct SpeculativeChunk
+{
+    SpeculativeInflater inflater;
+    _int64 searchBegin, searchEnd; // bits in which to look for a block start
+    _int64 start; // bit where decoding starts, -1 if no block was found
+    _int64 stopBit;
+    bool ok; // decoded from start to stopBit
+    bool used; // output is part of the batch
+    _int64 outputOffset;
+    BYTE window[SpeculativeInflater::WindowSize]; // output before the chunk
+    VariableSizeVector<_uint32> crcs; // of the output up to each member end, and after the last one
+};
+
+class SpeculativeDecompressWorker : public ParallelWorker
+{
+public:
+    virtual void step();
+};
+
+class SpeculativeDecompressManager : public ParallelWorkerManager
+{
+public:
+    SpeculativeDecompressManager(SpeculativeChunk* i_chunks)
+        : chunks(i_chunks)
+    {}
+
+    virtual ParallelWorker* createWorker()
+    { return new SpeculativeDecompressWorker(); }
+
+    enum Phase { Search, Decode, Finish };
+
+    SpeculativeChunk* chunks;
+    int nChunks; // used for this batch, one per thread
+    Phase phase;
+    const BYTE* input;
+    _int64 inputBytes;
+    bool inputIsComplete;
+    InflateBoundary firstStart;
+    char* output;
+
+    friend class SpeculativeDecompressWorker;
+};
+
+    void
+SpeculativeDecompressWorker::step()
+{
+    SpeculativeDecompressManager* manager = (SpeculativeDecompressManager*) getManager();
+    int i = getThreadNum();
+    if (i >= manager->nChunks) {
+        return;
+    }
+    SpeculativeChunk* chunk = &manager->chunks[i];
+    SpeculativeInflater* inflater = &chunk->inflater;
+    switch (manager->phase) {
+    case SpeculativeDecompressManager::Search:
+        if (i > 0) {
+            chunk->start = inflater->findBlockStart(manager->input, manager->inputBytes, chunk->searchBegin, chunk->searchEnd);
+        }
+        break;
+
+    case SpeculativeDecompressManager::Decode:
+        chunk->ok = chunk->start >= 0 && inflater->inflate(manager->input, manager->inputBytes,
+            0 == i ? manager->firstStart : InflateBoundary(chunk->start, false), chunk->stopBit, manager->inputIsComplete);
+        break;
+
+    case SpeculativeDecompressManager::Finish:
+        if (chunk->used) {
+            _int64 bytes = inflater->getOutputBytes();
+            inflater->resolve(chunk->window, 0, bytes - min(bytes, (_int64) SpeculativeInflater::WindowSize));
+            memcpy(manager->output + chunk->outputOffset, inflater->getOutput(), bytes);
+            VariableSizeVector<InflateMemberEnd>* memberEnds = inflater->getMemberEnds();
+            chunk->crcs.clear();
+            _int64 segmentStart = 0;
+            for (_int64 j = 0; j <= memberEnds->size(); j++) {
+                _int64 segmentEnd = j < memberEnds->size() ? (*memberEnds)[j].outputOffset : bytes;
+                chunk->crcs.push_back((_uint32) crc32(0, inflater->getOutput() + segmentStart, (uInt)(segmentEnd - segmentStart)));
+                segmentStart = segmentEnd;
+            }
+        }
+        break;
+    }
+}
+
+    void
+DecompressDataReader::decompressThreadSpeculative(
+    void* context)
+{
+    DecompressDataReader* reader = (DecompressDataReader*) context;
+    const int WindowSize = SpeculativeInflater::WindowSize;
+    int nThreads = min(8, DataSupplier::ThreadCount);
+    SpeculativeChunk* chunks = new SpeculativeChunk[nThreads];
+    SpeculativeDecompressManager manager(chunks);
+    ParallelCoworker coworker(nThreads, false, &manager);
+    coworker.start();
+    InflateBoundary next(0, true); // where the next batch starts, relative to its first byte
+    BYTE* window = (BYTE*) BigAlloc(WindowSize); // the last output of the previous batch
+    memset(window, 0, WindowSize);
+    _uint32 memberCrc = 0; // of the member in progress
+    _int64 memberBytes = 0;
+    bool streamEnded = false;
+    bool stop = false;
+    while (! stop) {
+        Entry* entry = reader->dequeueAvailable();
+        if (reader->stopping) {
+            break;
+        }
+        // always starts with a fresh batch - advances after reading it all
+        bool ok = ! streamEnded && reader->inner->getData(&entry->compressed, &entry->compressedValid, &entry->compressedStart);
+        if (! ok) {
+            if (! streamEnded && ! reader->inner->isEOF()) {
+                WriteErrorMessage("error reading file at offset %lld\n", reader->getFileOffset());
+                soft_exit(1);
+            }
+            // mark as eof - no data
+            entry->decompressedValid = entry->decompressedStart = reader->overflowBytes;
+            DataBatch b = reader->inner->getBatch();
+            entry->batch = DataBatch(b.batchID + 1, b.fileID);
+            entry->decompressed = (char*) BigAlloc(reader->totalExtra);
+            entry->allocated = true;
+            stop = true;
+        } else {
+            _int64 ignore;
+            reader->inner->getExtra(&entry->decompressed, &ignore);
+            _ASSERT(ignore >= reader->extraBytes && ignore >= reader->overflowBytes);
+            entry->batch = reader->inner->getBatch();
+            reader->holdBatch(entry->batch); // hold batch while decompressing
+            bool inputIsComplete = reader->inner->isEOF();
+            _int64 limit = inputIsComplete ? entry->compressedValid : entry->compressedStart;
+
+            manager.input = (const BYTE*) entry->compressed;
+            manager.inputBytes = entry->compressedValid;
+            manager.inputIsComplete = inputIsComplete;
+            manager.firstStart = next;
+            manager.nChunks = (int) max((_int64) 1, min((_int64) nThreads, limit / MinSpeculativeChunkBytes));
+            for (int i = 0; i < manager.nChunks; i++) {
+                chunks[i].searchBegin = limit * 8 * i / manager.nChunks;
+                chunks[i].searchEnd = limit * 8 * (i + 1) / manager.nChunks;
+            }
+            chunks[0].start = next.bit;
+            manager.phase = SpeculativeDecompressManager::Search;
+            coworker.step();
+
+            // each chunk stops where the next one that found a block starts
+            _int64 stopBit = limit * 8;
+            for (int i = manager.nChunks - 1; i >= 0; i--) {
+                chunks[i].stopBit = stopBit;
+                if (chunks[i].start >= 0) {
+                    stopBit = chunks[i].start;
+                }
+            }
+            manager.phase = SpeculativeDecompressManager::Decode;
+            coworker.step();
+
+            // a chunk that started somewhere other than where the one before it stopped has to be done again
+            InflateBoundary end = next;
+            for (int i = 0; i < manager.nChunks; i++) {
+                SpeculativeChunk* chunk = &chunks[i];
+                chunk->used = false;
+                if (chunk->start < 0 || streamEnded || end.bit >= chunk->stopBit) {
+                    continue;
+                }
+                if (! chunk->ok || (i > 0 && InflateBoundary(chunk->start, false) != end)) {
+                    if (! chunk->inflater.inflate(manager.input, manager.inputBytes, end, chunk->stopBit, inputIsComplete)) {
+                        WriteErrorMessage("corrupt gzip data, or a deflate block over %lld bytes, in %s\n", SpeculativeOverflowBytes, reader->getFilename());
+                        soft_exit(1);
+                    }
+                }
+                chunk->used = true;
+                end = chunk->inflater.getEnd();
+                streamEnded = chunk->inflater.streamEnded();
+            }
+            reader->inner->advance(streamEnded ? entry->compressedValid : end.bit / 8);
+            reader->inner->nextBatch(); // start reading next batch
+            next = InflateBoundary(end.bit % 8, end.memberStart);
+
+            // resolve the end of each chunk to get the window for the next
+            _int64 total = 0;
+            for (int i = 0; i < manager.nChunks; i++) {
+                SpeculativeChunk* chunk = &chunks[i];
+                if (! chunk->used) {
+                    continue;
+                }
+                _int64 bytes = chunk->inflater.getOutputBytes();
+                _int64 tail = min(bytes, (_int64) WindowSize);
+                memcpy(chunk->window, window, WindowSize);
+                chunk->inflater.resolve(chunk->window, bytes - tail, bytes);
+                memmove(window, window + tail, WindowSize - tail);
+                memcpy(window + WindowSize - tail, chunk->inflater.getOutput() + bytes - tail, tail);
+                chunk->outputOffset = total;
+                total += bytes;
+            }
+            if (total > reader->extraBytes - reader->overflowBytes) {
+                WriteErrorMessage("insufficient decompression buffer space - increase expansion factor, currently -xf %.1f\n", DataSupplier::ExpansionFactor);
+                soft_exit(1);
+            }
+            manager.output = entry->decompressed + reader->overflowBytes;
+            manager.phase = SpeculativeDecompressManager::Finish;
+            coworker.step();
+
+            // check each member's CRC and length against its trailer
+            for (int i = 0; i < manager.nChunks; i++) {
+                SpeculativeChunk* chunk = &chunks[i];
+                if (! chunk->used) {
+                    continue;
+                }
+                VariableSizeVector<InflateMemberEnd>* memberEnds = chunk->inflater.getMemberEnds();
+                _int64 segmentStart = 0;
+                for (_int64 j = 0; j <= memberEnds->size(); j++) {
+                    _int64 segmentEnd = j < memberEnds->size() ? (*memberEnds)[j].outputOffset : chunk->inflater.getOutputBytes();
+                    memberCrc = (_uint32) crc32_combine(memberCrc, chunk->crcs[j], (z_off_t)(segmentEnd - segmentStart));
+                    memberBytes += segmentEnd - segmentStart;
+                    segmentStart = segmentEnd;
+                    if (j < memberEnds->size()) {
+                        if (memberCrc != (*memberEnds)[j].crc || (_uint32) memberBytes != (*memberEnds)[j].size) {
+                            WriteErrorMessage("gzip data in %s fails its CRC or length check\n", reader->getFilename());
+                            soft_exit(1);
+                        }
+                        memberCrc = 0;
+                        memberBytes = 0;
+                    }
+                }
+            }
+            entry->decompressedValid = reader->overflowBytes + total;
+            entry->decompressedStart = total;
+        }
+        // make buffer available for clients & go on to next
+        reader->enqueueReady(entry);
+    }
+    coworker.stop();
+    delete [] chunks;
+    BigDealloc(window);
+    AllowEventWaitersToProceed(&reader->decompressThreadDone);
+}
+
     DecompressDataReader::Entry*
 DecompressDataReader::peekReady()
 {
@@ -1984,8 +2831,8 @@ DecompressDataReader::enqueueAvailable(Entry* entry)
 class DecompressDataReaderSupplier : public DataSupplier
 {
 public:
-    DecompressDataReaderSupplier(DataSupplier* i_inner, int i_blockSize = BAM_BLOCK)
-        : DataSupplier(), inner(i_inner), blockSize(i_blockSize)
+    DecompressDataReaderSupplier(DataSupplier* i_inner, int i_blockSize = BAM_BLOCK, bool i_speculative = false)
+        : DataSupplier(), inner(i_inner), blockSize(i_blockSize), speculative(i_speculative)
     {}
 
     virtual DataReader* getDataReader(int bufferCount, _int64 overflowBytes, double extraFactor, size_t bufferSpace);
@@ -1993,6 +2840,7 @@ public:
 private:
     DataSupplier* inner;
     const int blockSize;
+    const bool speculative;
 };
 
     DataReader*
@@ -2005,9 +2853,13 @@ DecompressDataReaderSupplier::getDataReader(
     // adjust extra factor for compression ratio
     double expand = MAX_FACTOR * DataSupplier::ExpansionFactor;
     double totalFactor = expand * (1.0 + extraFactor);
-    // get inner reader with no overflow since zlib can't deal with it
+    // get inner reader with no overflow since zlib can't deal with it, except that the speculative decompressor
+    // finishes the block that's in progress at the end of each batch, and BGZF ranges go on past their end for as many
+    // blocks as it takes to hold the last record
     // add 2 buffers for compression thread
-    DataReader* data = inner->getDataReader(bufferCount + 2, blockSize, totalFactor, bufferSpace);
+    bool parallel = speculative && DataSupplier::ThreadCount > 1;
+    _int64 innerOverflow = parallel ? SpeculativeOverflowBytes : blockSize > 0 ? 2 * blockSize + overflowBytes : 0;
+    DataReader* data = inner->getDataReader(bufferCount + 2, innerOverflow, totalFactor, bufferSpace);
     // compute how many extra bytes are owned by this layer
     char* p;
     _int64 totalExtra;
@@ -2015,7 +2867,7 @@ DecompressDataReaderSupplier::getDataReader(
     _int64 mine = (_int64)(totalExtra * expand / totalFactor);
     // create new reader, telling it how many bytes it owns
     // it will subtract overflow off the end of each batch
-    return new DecompressDataReader(data, bufferCount, totalExtra, mine, overflowBytes, blockSize);
+    return new DecompressDataReader(data, bufferCount, totalExtra, mine, overflowBytes, blockSize, parallel);
 }
     
     DataSupplier*
@@ -2031,6 +2883,13 @@ DataSupplier::Gzip(
 {
     return new DecompressDataReaderSupplier(inner, 0);
 }
+
+    DataSupplier*
+DataSupplier::ParallelGzip(
+    DataSupplier* inner)
+{
+    return new DecompressDataReaderSupplier(inner, 0, true);
+}
     DataSupplier* 
 DataSupplier::StdioSupplier()
 {
@@ -2516,13 +3375,13 @@ DataSupplier* DataSupplier::Default = DataSupplier::WindowsOverlapped;
 DataSupplier* DataSupplier::Default = DataSupplier::MemMap;
 #endif
 
-DataSupplier* DataSupplier::GzipDefault = DataSupplier::Gzip(DataSupplier::Default);
+DataSupplier* DataSupplier::GzipDefault = DataSupplier::ParallelGzip(DataSupplier::Default);
 
 DataSupplier* DataSupplier::GzipBamDefault = DataSupplier::GzipBam(DataSupplier::Default);
 
 DataSupplier* DataSupplier::Stdio = DataSupplier::StdioSupplier();
 
-DataSupplier* DataSupplier::GzipStdio = DataSupplier::Gzip(DataSupplier::Stdio);
+DataSupplier* DataSupplier::GzipStdio = DataSupplier::ParallelGzip(DataSupplier::Stdio);
 
 DataSupplier* DataSupplier::GzipBamStdio = DataSupplier::GzipBam(DataSupplier::Stdio);
 
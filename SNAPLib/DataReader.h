@@ -24,6 +24,12 @@ Revision History:
 
 #include "Compat.h"
 #include "VariableSizeMap.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define SNAP_IO_URING
+#endif
+#endif
 //
 // This defines a family of composable classes for efficiently reading data with flow control.
 //
@@ -163,6 +169,8 @@ public:
     // 
     static DataSupplier* GzipBam(DataSupplier* inner);
     static DataSupplier* Gzip(DataSupplier* inner);
+    // gzip that isn't BGZF, decompressed on several threads when ThreadCount allows
+    static DataSupplier* ParallelGzip(DataSupplier* inner);
     static DataSupplier* StdioSupplier();
 
     // memmap works on both platforms (but better on Linux)
@@ -173,6 +181,11 @@ public:
     static DataSupplier* WindowsOverlapped;
 #endif
 
+#ifdef SNAP_IO_URING
+    // io_uring is only on Linux, and falls back to memmap if the kernel won't let us use it
+    static DataSupplier* IoUring;
+#endif
+
     // default raw data supplier for platform
     static DataSupplier* Default;
     static DataSupplier* GzipDefault;
@@ -150,6 +150,7 @@ public:
         const char* sortedFileName,
         DataWriter::FilterSupplier* sortedFilterSupplier,
         size_t maxBufferSize,
+        unsigned backgroundMergeFanIn = 0, // merge spilled blocks this many at a time in the background, 0 = only merge at the end
         FileEncoder* encoder = NULL);
 
     // defaults follow BAM output spec
@@ -27,6 +27,24 @@ Revision History:
 #include "AlignerOptions.h"
 #include "CommandProcessor.h"
 
+#ifdef _MSC_VER
+static __declspec(thread) bool noCommandPipeEcho = false;
+#else
+static __thread bool noCommandPipeEcho = false;
+#endif
+
+    void
+SetCommandPipeEchoForThisThread(bool echo)
+{
+    noCommandPipeEcho = !echo;
+}
+
+    bool
+GetCommandPipeEchoForThisThread()
+{
+    return !noCommandPipeEcho;
+}
+
 	void
 WriteMessageToFile(FILE *file, const char *message)
 {
@@ -56,7 +74,7 @@ WriteErrorMessage(const char *message, ...)
     vsnprintf(buffer, bufferSize - 1, message, args);
     buffer[bufferSize - 1] = '\0';  // vsnprintf spec is vague on whether it null terminates a full buffer, so better safe than sorry
     WriteMessageToFile(stderr, buffer);
-	if (NULL != CommandPipe) {
+	if (NULL != CommandPipe && !noCommandPipeEcho) {
 	  WriteToNamedPipe(CommandPipe, buffer);
 	}
 }
@@ -71,7 +89,7 @@ WriteStatusMessage(const char *message, ...)
     vsnprintf(buffer, bufferSize - 1, message, args);
     buffer[bufferSize - 1] = '\0';  // vsnprintf spec is vague on whether it null terminates a full buffer, so better safe than sorry
     WriteMessageToFile(stdout, buffer);
-	if (NULL != CommandPipe) {
+	if (NULL != CommandPipe && !noCommandPipeEcho) {
 	  WriteToNamedPipe(CommandPipe, buffer);
 	}
 }
@@ -31,4 +31,15 @@ WriteErrorMessage(const char *message, ...);
 WriteStatusMessage(const char *message, ...);
 
     void
-WriteProgressCounter(const char *counterName, _int64 increment);
\ No newline at end of file
+WriteProgressCounter(const char *counterName, _int64 increment);
+
+//
+// In daemon mode, messages are also sent to the client on the command pipe.  Jobs that run in the background
+// after their client has gone turn this off for the threads they run on; a new thread starts with the setting
+// of the thread that started it.
+//
+    void
+SetCommandPipeEchoForThisThread(bool echo);
+
+    bool
+GetCommandPipeEchoForThisThread();
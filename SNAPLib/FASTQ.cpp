@@ -33,6 +33,7 @@ Revision History:
 #include "Util.h"
 #include "exit.h"
 #include "Error.h"
+#include "TextScanner.h"
 
 using std::min;
 using util::strnchr;
@@ -119,6 +120,22 @@ FASTQReader::reinit(
 
     bool
 FASTQReader::skipPartialRecord(DataReader *data)
+{
+    char* buffer;
+    _int64 validBytes;
+    data->getData(&buffer, &validBytes);
+
+    _int64 recordStart = findRecordStart(buffer, validBytes);
+    if (recordStart < 0) {
+        return false;
+    }
+
+    data->advance(recordStart);
+    return true;
+}
+
+    _int64
+FASTQReader::findRecordStart(char *buffer, _int64 validBytes)
 {
     //
     // Just assume that a single FASTQ read is smaller than our buffer, so we won't exceed the buffer here.
@@ -126,26 +143,27 @@ FASTQReader::skipPartialRecord(DataReader *data)
     // newline, followed by an '@' and some text, another newline followed by a list of bases and a newline, 
     // and then a plus.
     //
-    char* buffer;
-    _int64 validBytes;
-    data->getData(&buffer, &validBytes);
-
+    char *bufferEnd = buffer + validBytes;
     char *firstLineCandidate = buffer;
-    if (*firstLineCandidate != '@') {
-        firstLineCandidate = strnchr(buffer, '\n', validBytes) + 1;
+    if (validBytes > 0 && *firstLineCandidate != '@') {
+        firstLineCandidate = strnchr(buffer, '\n', validBytes);
+        if (NULL == firstLineCandidate) {
+            return -1;
+        }
+        firstLineCandidate++;
     }
 
     for (;;) {
-        if (firstLineCandidate - buffer >= validBytes) {
+        if (firstLineCandidate >= bufferEnd) {
             // This happens for very small files.  
-            return false;
+            return -1;
         }
 
-        char *secondLineCandidate = strnchr(firstLineCandidate, '\n', validBytes - (firstLineCandidate - buffer)) + 1;
-        if (NULL == (secondLineCandidate-1)) {
-			WriteErrorMessage("Unable to find a read in FASTQ buffer (2) at %d\n", data->getFileOffset());
-            return false;
+        char *secondLineCandidate = strnchr(firstLineCandidate, '\n', bufferEnd - firstLineCandidate);
+        if (NULL == secondLineCandidate) {
+            return -1;
         }
+        secondLineCandidate++;
 
         if (*firstLineCandidate != '@') {
             firstLineCandidate = secondLineCandidate;
@@ -153,23 +171,29 @@ FASTQReader::skipPartialRecord(DataReader *data)
         }
 
         //
-        // Scan through the second line making sure it's all bases (or 'N').  We don't have to
-        // check for end-of-buffer because we know there's a null there.
+        // Scan through the second line making sure it's all bases (or 'N').
         //
         char *thirdLineCandidate = secondLineCandidate;
-        while (*thirdLineCandidate == 'A' || *thirdLineCandidate == 'C' || *thirdLineCandidate == 'T' || *thirdLineCandidate == 'G' ||
+        while (thirdLineCandidate < bufferEnd && (*thirdLineCandidate == 'A' || *thirdLineCandidate == 'C' || *thirdLineCandidate == 'T' || *thirdLineCandidate == 'G' ||
                 *thirdLineCandidate == 'N' || *thirdLineCandidate == 'a' || *thirdLineCandidate == 'c' || *thirdLineCandidate == 't' || 
-                *thirdLineCandidate == 'g' || *thirdLineCandidate == 'n') {
+                *thirdLineCandidate == 'g' || *thirdLineCandidate == 'n')) {
             thirdLineCandidate++;
         }
 
-        if (*thirdLineCandidate == '\r') {
+        if (thirdLineCandidate < bufferEnd && *thirdLineCandidate == '\r') {
             //
             // CRLF text; skip the CR.
             //
             thirdLineCandidate++;
         }
 
+        if (thirdLineCandidate + 1 >= bufferEnd) {
+            //
+            // We ran out of data before we could tell.
+            //
+            return -1;
+        }
+
         if (*thirdLineCandidate != '\n') {
             //
             // We found something that's not a base and not a newline.  It wasn't a read data (second) line.  Move up a line
@@ -185,10 +209,81 @@ FASTQReader::skipPartialRecord(DataReader *data)
             continue;
         }
 
-        break;
+        return firstLineCandidate - buffer;
+    }
+}
+
+    bool
+FASTQReader::getNextChunk(_int64 targetBytes, ReadChunk *chunk)
+{
+    char* buffer;
+    _int64 validBytes;
+    _int64 startBytes;
+    if (! data->getData(&buffer, &validBytes, &startBytes)) {
+        data->nextBatch();
+        if (! data->getData(&buffer, &validBytes, &startBytes)) {
+            return false;
+        }
+    }
+
+    //
+    // The buffer starts at a record, because that's where the last chunk ended (or it's the start of the file).  End this
+    // chunk at the first record that starts at or after targetBytes, or after the last byte of the batch that may begin a
+    // read, whichever comes first.  When the batch ends, that's somewhere in the overflow, and advancing to it lets the next
+    // batch start on a record boundary, too.
+    //
+    _int64 target = __min(targetBytes, startBytes);
+    _int64 chunkBytes = -1;
+    if (target < validBytes) {
+        _int64 recordStart = findRecordStart(buffer + target, validBytes - target);
+        if (recordStart >= 0) {
+            chunkBytes = target + recordStart;
+        }
+    }
+
+    if (chunkBytes < 0) {
+        //
+        // There wasn't enough data after the target to recognize a record (which happens with very long reads at the end of a
+        // batch, or at EOF).  Walk forward from the start of the chunk a record at a time, which is slower but always right.
+        //
+        chunkBytes = 0;
+        while (chunkBytes < target) {
+            for (unsigned i = 0; i < nLinesPerFastqQuery && chunkBytes < validBytes; i++) {
+                char *newLine = strnchr(buffer + chunkBytes, '\n', validBytes - chunkBytes);
+                chunkBytes = NULL == newLine ? validBytes : newLine + 1 - buffer;
+            }
+            if (chunkBytes >= validBytes) {
+                break;
+            }
+        }
+    }
+
+    chunk->buffer = buffer;
+    chunk->bytes = chunkBytes;
+    chunk->validBytes = validBytes;
+    chunk->offset = 0;
+    chunk->batch = data->getBatch();
+    data->holdBatch(chunk->batch);
+
+    data->advance(chunkBytes);
+    return true;
+}
+
+    bool
+FASTQReader::getReadFromChunk(ReadChunk *chunk, Read *readToUpdate)
+{
+    if (chunk->offset >= chunk->bytes) {
+        return false;
+    }
+
+    _int64 bytesConsumed = getReadFromBuffer(chunk->buffer + chunk->offset, chunk->validBytes - chunk->offset, readToUpdate, fileName, data, context);
+    if (bytesConsumed == 0) {
+        chunk->offset = chunk->bytes;
+        return false;
     }
 
-    data->advance(firstLineCandidate - buffer);
+    readToUpdate->setBatch(chunk->batch);
+    chunk->offset += bytesConsumed;
     return true;
 }
 
@@ -219,6 +314,7 @@ FASTQReader::getNextRead(Read *readToUpdate)
         return false;
     }
 
+    readToUpdate->setBatch(data->getBatch());
     data->advance(bytesConsumed);
     return true;
 }
@@ -234,11 +330,16 @@ FASTQReader::getReadFromBuffer(char *buffer, _int64 validBytes, Read *readToUpda
     char* lines[nLinesPerFastqQuery];
     unsigned lineLengths[nLinesPerFastqQuery];
     char* scan = buffer;
+    TextScanner scanner(buffer, validBytes, false);
 
     for (unsigned i = 0; i < nLinesPerFastqQuery; i++) {
 
-        char *newLine = strnchr(scan, '\n', validBytes - (scan - buffer));
-        if (NULL == newLine) {
+        //
+        // The scanner also stops at NULs, which like strnchr() we treat as there being no newline.  The CR that some
+        // files have after the newline isn't one of the characters it looks for, so it can't be out of step with scan.
+        //
+        char *newLine = buffer + scanner.next();
+        if (newLine >= buffer + validBytes || '\0' == *newLine) {
             if (validBytes - (scan - buffer) == 1 && *scan == 0x1a && data->isEOF()) {
                 // sometimes DOS files will have extra ^Z at end
                 return false;
@@ -275,7 +376,6 @@ FASTQReader::getReadFromBuffer(char *buffer, _int64 validBytes, Read *readToUpda
     const char* space = strnchr(id, ' ', lineLengths[0] - 1);
     readToUpdate->init(id, space != NULL ? (unsigned) (space - id) : (unsigned) lineLengths[0] - 1, lines[1], lines[3], lineLengths[1]);
     readToUpdate->clip(context.clipping);
-    readToUpdate->setBatch(data->getBatch());
     readToUpdate->setReadGroup(context.defaultReadGroup);
 
     // memcpy(LAST, buffer, scan - buffer); LASTLEN = scan - buffer;
@@ -387,6 +487,8 @@ PairedInterleavedFASTQReader::getNextReadPair(Read *read0, Read *read1)
         return false;
     }
     bytesConsumed += FASTQReader::getReadFromBuffer(buffer + bytesConsumed, validBytes - bytesConsumed, read1, fileName, data, context);
+    read0->setBatch(data->getBatch());
+    read1->setBatch(data->getBatch());
 
     //
     // Validate the Read IDs.
@@ -605,7 +707,7 @@ FASTQReader::createReadSupplierGenerator(
         //
         // Single ended uncompressed FASTQ files can be handled by a range splitter.
         //
-        return new RangeSplittingReadSupplierGenerator(fileName, false, numThreads, context);
+        return new RangeSplittingReadSupplierGenerator(fileName, FASTQFile, numThreads, context);
     } else {
         ReadReader* fastq;
         //
@@ -624,7 +726,10 @@ FASTQReader::createReadSupplierGenerator(
             delete fastq;
             return NULL;
         }
-        ReadSupplierQueue *queue = new ReadSupplierQueue(fastq);
+        //
+        // Decompression happens on its own threads, so with enough aligners parsing becomes the bottleneck.  Split it up.
+        //
+        ReadSupplierQueue *queue = new ReadSupplierQueue(fastq, gzip ? ReadSupplierQueue::ParserThreadCount(numThreads) : 1);
         queue->startReaders();
         return queue;
     }
@@ -63,11 +63,20 @@ public:
 
         virtual bool releaseBatch(DataBatch batch)
         { return data->releaseBatch(batch); }
+
+        virtual bool supportsParallelParsing()
+        { return true; }
+
+        virtual bool getNextChunk(_int64 targetBytes, ReadChunk *chunk);
+
+        virtual bool getReadFromChunk(ReadChunk *chunk, Read *readToUpdate);
         
-        static _int64 getReadFromBuffer(char *buffer, _int64 bufferSize, Read *readToUpdate, const char *fileName, DataReader *data, const ReaderContext &context);    // Returns the number of bytes consumed.
+        static _int64 getReadFromBuffer(char *buffer, _int64 bufferSize, Read *readToUpdate, const char *fileName, DataReader *data, const ReaderContext &context);    // Returns the number of bytes consumed.  Doesn't set the read's batch.
 
         static bool skipPartialRecord(DataReader *data);
 
+        static _int64 findRecordStart(char *buffer, _int64 validBytes);    // Offset of the first record that starts in the buffer, or -1 if there isn't enough data to find one
+
 private:
 
         static const int maxReadSizeInBytes = MAX_READ_LENGTH * 2 + 1000;    // Read as in sequencer read, not read-from-the-filesystem.  +1000 is for ID string, + line, newlines, etc.
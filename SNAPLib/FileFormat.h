@@ -89,13 +89,18 @@ public:
         const ReaderContext& context, char *header, size_t headerBufferSize, size_t *headerActualSize,
         bool sorted, int argc, const char **argv, const char *version, const char *rgLine, bool omitSQLines) const = 0;
 
+    //
+    // traceback, if it's not NULL, is the aligner's traceback for this result (see AlignmentTraceback.h).  It's only good
+    // for the location that the aligner returned and the read's own clipping, so retries after adding front clipping
+    // don't pass it.
+    //
     virtual bool writeRead(
         const ReaderContext& context, LandauVishkinWithCigar * lv, char * buffer, size_t bufferSpace,
         size_t * spaceUsed, size_t qnameLen, Read * read, AlignmentResult result,
         int mapQuality, GenomeLocation genomeLocation, Direction direction, bool secondaryAlignment, int* o_addFrontClipping,
         bool hasMate = false, bool firstInPair = false, Read * mate = NULL, 
         AlignmentResult mateResult = NotFound, GenomeLocation mateLocation = 0, Direction mateDirection = FORWARD,
-        bool alignedAsPair = false) const = 0; 
+        bool alignedAsPair = false, const AlignmentTraceback *traceback = NULL) const = 0;
 
     //
     // formats
@@ -33,7 +33,8 @@ Revision History:
 #include "Util.h"
 
 Genome::Genome(GenomeDistance i_maxBases, GenomeDistance nBasesStored, unsigned i_chromosomePadding, unsigned i_maxContigs)
-: maxBases(i_maxBases), minLocation(0), maxLocation(i_maxBases), chromosomePadding(i_chromosomePadding), maxContigs(i_maxContigs),
+: packedBases(NULL), nonACGTBlocks(NULL), nonACGTRuns(NULL), nNonACGTRuns(0), nPackedBases(0),
+  maxBases(i_maxBases), minLocation(0), maxLocation(i_maxBases), chromosomePadding(i_chromosomePadding), maxContigs(i_maxContigs),
   mappedFile(NULL)
 {
     bases = ((char *) BigAlloc(nBasesStored + 2 * N_PADDING)) + N_PADDING;
@@ -124,6 +125,15 @@ Genome::~Genome()
 		mappedFile->close();
 		delete mappedFile;
 	}
+
+    if (NULL != packedBases) {
+        BigDealloc(packedBases);
+        packedBases = NULL;
+        BigDealloc(nonACGTBlocks);
+        nonACGTBlocks = NULL;
+        delete [] nonACGTRuns;
+        nonACGTRuns = NULL;
+    }
 }
 
 
@@ -160,11 +170,23 @@ Genome::saveToFile(const char *fileName) const
 
 	size_t bases_to_write = nBases;
 	size_t bases_written = 0;
+    char *unpackBuffer = NULL;
+    if (NULL != packedBases) {
+        unpackBuffer = (char *)BigAlloc(max_chunk_size);
+    }
 	while (bases_to_write > 0) {
 		size_t bases_this_write = __min(bases_to_write, max_chunk_size);
-		if (bases_this_write != fwrite(bases + bases_written, 1, bases_this_write, saveFile)) {
+        const char *basesToWrite = bases + bases_written;
+        if (NULL != packedBases) {
+            unpackBases(bases_written, bases_this_write, unpackBuffer);
+            basesToWrite = unpackBuffer;
+        }
+		if (bases_this_write != fwrite(basesToWrite, 1, bases_this_write, saveFile)) {
 			WriteErrorMessage("Genome::saveToFile: fwrite failed\n");
 			fclose(saveFile);
+            if (NULL != unpackBuffer) {
+                BigDealloc(unpackBuffer);
+            }
 			return false;
 		}
 		bases_to_write -= bases_this_write;
@@ -172,18 +194,25 @@ Genome::saveToFile(const char *fileName) const
 	}
 
 	_ASSERT(bases_written == nBases);
+    if (NULL != unpackBuffer) {
+        BigDealloc(unpackBuffer);
+    }
 
     fclose(saveFile);
     return true;
 }
 
     const Genome *
-Genome::loadFromFile(const char *fileName, unsigned chromosomePadding, GenomeLocation minLocation, GenomeDistance length, bool map)
+Genome::loadFromFile(const char *fileName, unsigned chromosomePadding, GenomeLocation minLocation, GenomeDistance length, bool map, bool packed)
 {    
     GenericFile *loadFile;
     GenomeDistance nBases;
     unsigned nContigs;
 
+    if (packed) {
+        map = false;    // We have to read all of the bases to pack them anyway
+    }
+
     if (!openFileAndGetSizes(fileName, &loadFile, &nBases, &nContigs, map)) {
         //
         // It already printed an error.  Just fail.
@@ -203,7 +232,7 @@ Genome::loadFromFile(const char *fileName, unsigned chromosomePadding, GenomeLoc
         maxLocation = minLocation + length;
     }
 
-    Genome *genome = new Genome(nBases, length, chromosomePadding);
+    Genome *genome = new Genome(nBases, packed ? 0 : length, chromosomePadding);    // Packed genomes only use bases for the padding
    
     genome->nBases = nBases;
     genome->nContigs = genome->maxContigs = nContigs;
@@ -265,6 +294,12 @@ Genome::loadFromFile(const char *fileName, unsigned chromosomePadding, GenomeLoc
 		genome->bases = (char *)mappedFile->mapAndAdvance(length, &readSize);
 		genome->mappedFile = mappedFile;
 		mappedFile->prefetch();
+	} else if (packed) {
+        readSize = genome->packFromFile(loadFile, length) ? length : 0;
+
+		loadFile->close();
+		delete loadFile;
+		loadFile = NULL;
 	} else {
 		readSize = loadFile->read(genome->bases, length);
 
@@ -491,4 +526,179 @@ const Genome::Contig *Genome::getContigForRead(GenomeLocation location, unsigned
     return contig;
 }
 
-GenomeLocation InvalidGenomeLocation;   // Gets set on genome build/load
\ No newline at end of file
+GenomeLocation InvalidGenomeLocation;   // Gets set on genome build/load
+//
+// Maps each byte of packed bases to the four characters it holds, first base in the low order bits.
+//
+static _uint32 UnpackTable[256];
+
+    static bool
+InitializeUnpackTable()
+{
+    for (unsigned byte = 0; byte < 256; byte++) {
+        char chars[4];
+        for (unsigned i = 0; i < 4; i++) {
+            chars[i] = "ACGT"[(byte >> (2 * i)) & 3];
+        }
+        memcpy(&UnpackTable[byte], chars, 4);
+    }
+    return true;
+}
+
+static bool UnpackTableInitialized = InitializeUnpackTable();
+
+    bool
+Genome::packFromFile(GenericFile *file, GenomeDistance length)
+{
+    nPackedBases = length;
+    size_t packedSize = sizeof(_uint64) * ((length + 31) / 32 + 1);
+    size_t blocksSize = sizeof(_uint64) * ((length + 63) / 64 / 64 + 1);
+    packedBases = (_uint64 *)BigAlloc(packedSize);
+    nonACGTBlocks = (_uint64 *)BigAlloc(blocksSize);
+    memset(packedBases, 0, packedSize);
+    memset(nonACGTBlocks, 0, blocksSize);
+
+    std::vector<NonACGTRun> runs;
+
+    const size_t chunkSize = 16 * 1024 * 1024;
+    char *chunk = (char *)BigAlloc(chunkSize);
+    _int64 offset = 0;
+    while (offset < length) {
+        size_t bytesToRead = (size_t)__min((_int64)chunkSize, length - offset);
+        if (bytesToRead != file->read(chunk, bytesToRead)) {
+            WriteErrorMessage("Genome::packFromFile: read of bases failed at offset %lld\n", offset);
+            BigDealloc(chunk);
+            return false;
+        }
+
+        for (size_t i = 0; i < bytesToRead; i++, offset++) {
+            _uint64 code;
+            switch (chunk[i]) {
+            case 'A': code = 0; break;
+            case 'C': code = 1; break;
+            case 'G': code = 2; break;
+            case 'T': code = 3; break;
+            default:
+                code = 0;
+                nonACGTBlocks[offset / 64 / 64] |= (_uint64)1 << ((offset / 64) % 64);
+                if (runs.size() > 0 && runs.back().start + runs.back().length == offset && runs.back().base == chunk[i]) {
+                    runs.back().length++;
+                } else {
+                    NonACGTRun run;
+                    run.start = offset;
+                    run.length = 1;
+                    run.base = chunk[i];
+                    runs.push_back(run);
+                }
+            }
+            packedBases[offset / 32] |= code << (2 * (offset % 32));
+        }
+    }
+    BigDealloc(chunk);
+
+    nNonACGTRuns = runs.size();
+    nonACGTRuns = new NonACGTRun[nNonACGTRuns + 1];
+    for (_int64 i = 0; i < nNonACGTRuns; i++) {
+        nonACGTRuns[i] = runs[i];
+    }
+
+    return true;
+}
+
+    const Genome::NonACGTRun *
+Genome::findNonACGTRun(_int64 offset) const
+{
+    _int64 low = 0;
+    _int64 high = nNonACGTRuns;
+    while (low < high) {
+        _int64 mid = (low + high) / 2;
+        if (nonACGTRuns[mid].start + nonACGTRuns[mid].length <= offset) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low < nNonACGTRuns ? &nonACGTRuns[low] : NULL;
+}
+
+    char
+Genome::getPackedBase(_int64 offset) const
+{
+    if (offset < 0 || offset >= nPackedBases) {
+        return 'n';
+    }
+
+    if (nonACGTBlocks[offset / 64 / 64] & ((_uint64)1 << ((offset / 64) % 64))) {
+        const NonACGTRun *run = findNonACGTRun(offset);
+        if (NULL != run && run->start <= offset) {
+            return run->base;
+        }
+    }
+
+    return "ACGT"[(packedBases[offset / 32] >> (2 * (offset % 32))) & 3];
+}
+
+    void
+Genome::unpackBases(_int64 offset, _int64 length, char *buffer) const
+{
+    _int64 end = offset + length;
+    char *dest = buffer;
+
+    //
+    // Anything before or after the stored bases is padding.
+    //
+    _int64 storedStart = __max(offset, (_int64)0);
+    _int64 storedEnd = __min(end, nPackedBases);
+    if (storedStart >= storedEnd) {
+        memset(buffer, 'n', length);
+        return;
+    }
+
+    if (offset < storedStart) {
+        memset(dest, 'n', storedStart - offset);
+        dest += storedStart - offset;
+    }
+
+    _int64 pos = storedStart;
+    while (pos < storedEnd && (pos % 4) != 0) {
+        *dest++ = "ACGT"[(packedBases[pos / 32] >> (2 * (pos % 32))) & 3];
+        pos++;
+    }
+
+    while (pos + 4 <= storedEnd) {
+        unsigned byte = (unsigned)(packedBases[pos / 32] >> (2 * (pos % 32))) & 0xff;
+        memcpy(dest, &UnpackTable[byte], 4);
+        dest += 4;
+        pos += 4;
+    }
+
+    while (pos < storedEnd) {
+        *dest++ = "ACGT"[(packedBases[pos / 32] >> (2 * (pos % 32))) & 3];
+        pos++;
+    }
+
+    if (end > storedEnd) {
+        memset(dest, 'n', end - storedEnd);
+    }
+
+    //
+    // Now patch in anything that's not ACGT.  Most of the time the block bits say there's nothing to do.
+    //
+    bool anyNonACGT = false;
+    for (_int64 block = storedStart / 64; block <= (storedEnd - 1) / 64; block++) {
+        if (nonACGTBlocks[block / 64] & ((_uint64)1 << (block % 64))) {
+            anyNonACGT = true;
+            break;
+        }
+    }
+
+    if (!anyNonACGT) {
+        return;
+    }
+
+    for (const NonACGTRun *run = findNonACGTRun(storedStart); NULL != run && run < nonACGTRuns + nNonACGTRuns && run->start < storedEnd; run++) {
+        _int64 runStart = __max(run->start, storedStart);
+        _int64 runEnd = __min(run->start + run->length, storedEnd);
+        memset(buffer + (runStart - offset), run->base, runEnd - runStart);
+    }
+}
@@ -24,6 +24,8 @@ Revision History:
 
 #pragma once
 #include "Compat.h"
+#include "Error.h"
+#include "exit.h"
 #include "GenericFile.h"
 #include "GenericFile_map.h"
 
@@ -193,7 +195,11 @@ public:
         //
         // minOffset and length are used to read in only a part of a whole genome.
         //
-        static const Genome *loadFromFile(const char *fileName, unsigned chromosomePadding, GenomeLocation i_minLocation = 0, GenomeDistance length = 0, bool map = false);
+        // If packed is set, the genome is held in memory at two bits per base (see packedBases below).
+        // The file format is the same either way.  map is ignored for packed genomes.
+        //
+        static const Genome *loadFromFile(const char *fileName, unsigned chromosomePadding, GenomeLocation i_minLocation = 0, GenomeDistance length = 0, bool map = false,
+                                          bool packed = false);
                                                                   // This loads from a genome save
                                                                   // file, not a FASTA file.  Use
                                                                   // FASTA.h for FASTA loads.
@@ -206,40 +212,59 @@ public:
         // Methods to read the genome.
         //
 		inline const char *getSubstring(GenomeLocation location, GenomeDistance lengthNeeded) const {
-			if (location > nBases || location + lengthNeeded > nBases + N_PADDING) {
-				// The first part of the test is for the unsigned version of a negative offset.
-				return NULL;
+			if (NULL != packedBases) {
+				// There's no unpacked copy to point into.  Use the version below that takes an unpack buffer.
+				WriteErrorMessage("Genome::getSubstring needs an unpack buffer for a packed genome; this command doesn't support -pg\n");
+				soft_exit(1);
 			}
 
-			// If we're in the padding, then the base will be an n, and we can't short circuit.  Recall that we use lower case n in the reference so it won't match with N in the read.
-			if (lengthNeeded <= chromosomePadding && bases[GenomeLocationAsInt64(location)] != 'n') {
-				return bases + (location - minLocation);
-			}
-
-			_ASSERT(location >= minLocation && location + lengthNeeded <= maxLocation + N_PADDING); // If the caller asks for a genome slice, it's only legal to look within it.
-
-			if (lengthNeeded == 0) {
-				return bases + (location - minLocation);
-			}
-
-			const Contig *contig = getContigAtLocation(location);
-			if (NULL == contig) {
-				return NULL;
-			}
-
-			_ASSERT(contig->beginningLocation <= location && contig->beginningLocation + contig->length >= location);
-			if (contig->beginningLocation + contig->length <= location + lengthNeeded) {
+			if (!isSubstringAvailable(location, lengthNeeded)) {
 				return NULL;
 			}
 
 			return bases + (location - minLocation);
 		}
 
+        //
+        // Version of getSubstring that also works on packed genomes.  For a packed genome, the bases are unpacked into
+        // unpackBuffer along with basesBefore bases ahead of them (LandauVishkin<-1> reads backward from its text pointer)
+        // and basesAfter beyond them (for callers that read past what they checked), and the return value points into
+        // unpackBuffer.  unpackBuffer must be at least getUnpackBufferSize(lengthNeeded, basesBefore, basesAfter) bytes.
+        // For unpacked genomes this is just getSubstring.
+        //
+        inline const char *getSubstring(GenomeLocation location, GenomeDistance lengthNeeded, char *unpackBuffer, GenomeDistance basesBefore,
+                                        GenomeDistance basesAfter = 0) const {
+            if (NULL == packedBases) {
+                return getSubstring(location, lengthNeeded);
+            }
+
+            if (!isSubstringAvailable(location, lengthNeeded)) {
+                return NULL;
+            }
+
+            unpackBases((location - minLocation) - basesBefore - UnpackSlack, getUnpackBufferSize(lengthNeeded, basesBefore, basesAfter), unpackBuffer);
+            return unpackBuffer + basesBefore + UnpackSlack;
+        }
+
+        static inline size_t getUnpackBufferSize(GenomeDistance lengthNeeded, GenomeDistance basesBefore, GenomeDistance basesAfter = 0) {
+            return (size_t)(lengthNeeded + basesBefore + basesAfter + 2 * UnpackSlack);
+        }
+
+        inline bool isPacked() const {return NULL != packedBases;}
+
         inline GenomeDistance getCountOfBases() const {return nBases;}
 
         bool getLocationOfContig(const char *contigName, GenomeLocation *location, int* index = NULL) const;
 
         inline void prefetchData(GenomeLocation genomeLocation) const {
+            if (NULL != packedBases) {
+                //
+                // A cache line holds 256 packed bases, so a read's worth of genome is in at most two of them.
+                //
+                _mm_prefetch((const char *)(packedBases + GenomeLocationAsInt64(genomeLocation) / 32), _MM_HINT_T2);
+                _mm_prefetch((const char *)(packedBases + (GenomeLocationAsInt64(genomeLocation) + 192) / 32), _MM_HINT_T2);
+                return;
+            }
             _mm_prefetch(bases + GenomeLocationAsInt64(genomeLocation), _MM_HINT_T2);
             _mm_prefetch(bases + GenomeLocationAsInt64(genomeLocation) + 64, _MM_HINT_T2);
         }
@@ -273,6 +298,67 @@ public:
 private:
 
         static const int N_PADDING = 100; // Padding to add on either end of the genome to allow substring reads past it
+        static const int UnpackSlack = 32; // Extra bases unpacked on each side for match kernels that load a whole vector past the end of the text
+
+        //
+        // The checks that getSubstring does before returning a pointer; shared between the packed and unpacked versions.
+        //
+		inline bool isSubstringAvailable(GenomeLocation location, GenomeDistance lengthNeeded) const {
+			if (location > nBases || location + lengthNeeded > nBases + N_PADDING) {
+				// The first part of the test is for the unsigned version of a negative offset.
+				return false;
+			}
+
+			// If we're in the padding, then the base will be an n, and we can't short circuit.  Recall that we use lower case n in the reference so it won't match with N in the read.
+			if (lengthNeeded <= chromosomePadding &&
+                (NULL == packedBases ? bases[GenomeLocationAsInt64(location)] : getPackedBase(location - minLocation)) != 'n') {
+				return true;
+			}
+
+			_ASSERT(location >= minLocation && location + lengthNeeded <= maxLocation + N_PADDING); // If the caller asks for a genome slice, it's only legal to look within it.
+
+			if (lengthNeeded == 0) {
+				return true;
+			}
+
+			const Contig *contig = getContigAtLocation(location);
+			if (NULL == contig) {
+				return false;
+			}
+
+			_ASSERT(contig->beginningLocation <= location && contig->beginningLocation + contig->length >= location);
+			if (contig->beginningLocation + contig->length <= location + lengthNeeded) {
+				return false;
+			}
+
+			return true;
+		}
+
+        //
+        // Packed genomes hold the bases at two bits each (A=0, C=1, G=2, T=3, 32 bases per word, low order bits first) in
+        // packedBases rather than a byte each in bases.  Anything that isn't ACGT (the 'n' padding between contigs, runs of N
+        // and the occasional IUPAC code) is recorded in nonACGTRuns, and nonACGTBlocks has a bit set for each 64 base block that
+        // overlaps one of them, so unpacking a clean stretch of the genome never has to look at the runs.
+        //
+        // All offsets here are relative to minLocation.  Offsets outside of the stored bases unpack as 'n', like the padding
+        // around an unpacked genome.
+        //
+        struct NonACGTRun {
+            _int64          start;
+            _int64          length;
+            char            base;
+        };
+
+        _uint64             *packedBases;
+        _uint64             *nonACGTBlocks;
+        NonACGTRun          *nonACGTRuns;
+        _int64               nNonACGTRuns;
+        _int64               nPackedBases;
+
+        void unpackBases(_int64 offset, _int64 length, char *buffer) const;
+        char getPackedBase(_int64 offset) const;
+        const NonACGTRun *findNonACGTRun(_int64 offset) const;   // First run that ends after offset, or NULL
+        bool packFromFile(GenericFile *file, GenomeDistance length);
 
         //
         // The actual genome.
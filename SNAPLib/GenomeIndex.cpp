@@ -50,6 +50,7 @@ static const unsigned DEFAULT_LOCATION_SIZE = 4;
 const char *GenomeIndexFileName = "GenomeIndex";
 const char *OverflowTableFileName = "OverflowTable";
 const char *GenomeIndexHashFileName = "GenomeIndexHash";
+const char *SeedPopularityFileName = "SeedPopularity";
 const char *GenomeFileName = "Genome";
 
 static void usage()
@@ -85,6 +86,8 @@ static void usage()
 		"                   In particular, this will generally use less memory than the index will use once it's built, so if this doesn't work you\n"
 		"                   won't be able to use the index anyway. However, if you've got sufficient memory to begin with, this option will just\n"
 		"                   slow down the index build by doing extra, useless IO.\n"
+		" -lockedBuild      Build the hash tables with all threads inserting into them under per-table locks, rather than the default\n"
+		"                   partitioned build where each thread owns a range of hash tables.  -sm always uses the locked build.\n"
 			,
             DEFAULT_SEED_SIZE,
             DEFAULT_SLACK,
@@ -121,6 +124,7 @@ GenomeIndex::runIndexer(
 	bool large = false;
     unsigned locationSize = DEFAULT_LOCATION_SIZE;
 	bool smallMemory = false;
+    bool partitionedBuild = true;
 
     for (int n = 2; n < argc; n++) {
         if (strcmp(argv[n], "-s") == 0) {
@@ -172,7 +176,9 @@ GenomeIndex::runIndexer(
 			}
 		} else if (argv[n][0] == '-' && argv[n][1] == 's' && argv[n][2] == 'm') {
 			smallMemory = true;
-		}
+		} else if (strcmp(argv[n], "-lockedBuild") == 0) {
+            partitionedBuild = false;
+        }
 		else if (strcmp(argv[n], "-keysize") == 0) {
             if (n + 1 < argc) {
                 keySizeInBytes = atoi(argv[n+1]);
@@ -233,7 +239,7 @@ GenomeIndex::runIndexer(
     GenomeDistance nBases = genome->getCountOfBases();
 
     if (!GenomeIndex::BuildIndexToDirectory(genome, seedLen, slack, computeBias, outputDir, maxThreads, chromosomePadding, forceExact, keySizeInBytes, 
-		large, histogramFileName, locationSize, smallMemory)) {
+		large, histogramFileName, locationSize, smallMemory, partitionedBuild)) {
         WriteErrorMessage("Genome index build failed\n");
         soft_exit(1);
     }
@@ -258,10 +264,18 @@ SetInvalidGenomeLocation(unsigned locationSize)
     }
 }
 
+//
+// A seed for the popularity sketch, as its bases in the direction the hash table has it.
+//
+struct PopularSeed {
+    _uint64 bases;
+    _uint64 nHits;
+};
+
     bool
 GenomeIndex::BuildIndexToDirectory(const Genome *genome, int seedLen, double slack, bool computeBias, const char *directoryName,
                                     unsigned maxThreads, unsigned chromosomePaddingSize, bool forceExact, unsigned hashTableKeySize, 
-									bool large, const char *histogramFileName, unsigned locationSize, bool smallMemory)
+									bool large, const char *histogramFileName, unsigned locationSize, bool smallMemory, bool partitionedBuild)
 {
 	PreventMachineHibernationWhileThisThreadIsAlive();
 
@@ -369,6 +383,11 @@ GenomeIndex::BuildIndexToDirectory(const Genome *genome, int seedLen, double sla
 
     runningThreadCount = nThreads;
 
+    //
+    // The partitioned build doesn't keep the per-thread backpointer progress that -sm needs to spill the backpointer table.
+    //
+    bool partitioned = partitionedBuild && !smallMemory;
+
     GenomeDistance nextChunkToProcess = 0;
 	_int64 * lastBackpointerIndexUsedByThread = NULL;
 	ExclusiveLock backpointerSpillLock;
@@ -421,11 +440,21 @@ GenomeIndex::BuildIndexToDirectory(const Genome *genome, int seedLen, double sla
 		threadContexts[i].backpointerSpillLock = &backpointerSpillLock;
 		threadContexts[i].lastBackpointerIndexUsedByThread = lastBackpointerIndexUsedByThread;
 		threadContexts[i].backpointerSpillFile = backpointerSpillFile;
+        threadContexts[i].partitioned = partitioned;
+        threadContexts[i].allContexts = threadContexts;
+        threadContexts[i].nextReservedBackpointer = 0;
+        threadContexts[i].reservedBackpointerLimit = 0;
 
-        StartNewThread(BuildHashTablesWorkerThreadMain, &threadContexts[i]);
+        if (!partitioned) {
+            StartNewThread(BuildHashTablesWorkerThreadMain, &threadContexts[i]);
+        }
     }
 
-    WaitForSingleWaiterObject(&doneObject);
+    if (partitioned) {
+        index->BuildHashTablesPartitioned(threadContexts, nThreads);
+    } else {
+        WaitForSingleWaiterObject(&doneObject);
+    }
     DestroySingleWaiterObject(&doneObject);
 	DestroyExclusiveLock(&backpointerSpillLock);
 	delete[] lastBackpointerIndexUsedByThread;
@@ -550,6 +579,12 @@ GenomeIndex::BuildIndexToDirectory(const Genome *genome, int seedLen, double sla
     _uint64 overflowTableIndex = 0;
 	_uint64 duplicateSeedsProcessed = 0;
 
+    //
+    // The seeds popular enough to go in the popularity sketch.  We don't know how big to make the sketch until we've
+    // seen them all.
+    //
+    vector<PopularSeed> popularSeeds;
+
 	for (unsigned whichHashTable = 0; whichHashTable < nHashTables; whichHashTable++) {
 		if (NULL == hashTables[whichHashTable]) {
 			_ASSERT(smallMemory);
@@ -629,6 +664,16 @@ GenomeIndex::BuildIndexToDirectory(const Genome *genome, int seedLen, double sla
 					    qsort(&index->overflowTable32[overflowTableIndex -nOccurrences], nOccurrences, sizeof(index->overflowTable32[0]), BackwardsUnsignedCompare);
                     }
 
+                    if (nOccurrences >= SeedPopularity::MinHitsToRecord) {
+                        PopularSeed popularSeed;
+                        popularSeed.bases = hashTables[whichHashTable]->getEntryKey(whichEntry);
+                        if (hashTableKeySize < 8) {
+                            popularSeed.bases |= (_uint64)whichHashTable << (hashTableKeySize * 8);
+                        }
+                        popularSeed.nHits = nOccurrences;
+                        popularSeeds.push_back(popularSeed);
+                    }
+
 					if (timeInMillis() - lastPrintTime > 60 * 1000) {
 						WriteStatusMessage("%lld/%lld duplicate seeds, %lld/%lld backpointers, %d/%d hash tables processed\n", 
 							duplicateSeedsProcessed, seedsWithMultipleOccurrences, nBackpointersProcessed, genomeLocationsInOverflowTable,
@@ -687,6 +732,20 @@ GenomeIndex::BuildIndexToDirectory(const Genome *genome, int seedLen, double sla
         delete [] histogram;
     }
 
+    {
+        SeedPopularity seedPopularity(popularSeeds.size(), seedLen);
+        for (size_t i = 0; i < popularSeeds.size(); i++) {
+            seedPopularity.record(popularSeeds[i].bases, popularSeeds[i].nHits);
+        }
+        vector<PopularSeed>().swap(popularSeeds);
+
+        snprintf(filenameBuffer, filenameBufferSize, "%s%c%s", directoryName, PATH_SEP, SeedPopularityFileName);
+        if (!seedPopularity.saveToFile(filenameBuffer)) {
+            delete[] filenameBuffer;
+            return false;
+        }
+    }
+
     //
     // Now save out the part of the index that's independent of the genome itself.
     //
@@ -845,7 +904,7 @@ SNAPHashTable** GenomeIndex::allocateHashTables(
 
 
 
-GenomeIndex::GenomeIndex() : nHashTables(0), hashTables(NULL), overflowTable32(NULL), overflowTable64(NULL), genome(NULL), tablesBlob(NULL), mappedOverflowTable(NULL), mappedTables(NULL)
+GenomeIndex::GenomeIndex() : nHashTables(0), hashTables(NULL), overflowTable32(NULL), overflowTable64(NULL), genome(NULL), tablesBlob(NULL), mappedOverflowTable(NULL), seedPopularity(NULL), mappedTables(NULL)
 {
 }
 
@@ -862,6 +921,9 @@ GenomeIndex::~GenomeIndex()
     delete [] hashTables;
     hashTables = NULL;
 
+    delete seedPopularity;
+    seedPopularity = NULL;
+
 	if (NULL != mappedTables) {
 		mappedTables->close();
 		mappedOverflowTable->close();
@@ -1226,6 +1288,207 @@ GenomeIndex::BuildHashTablesWorkerThread(BuildHashTablesThreadContext *context)
 }
     
 const _int64 GenomeIndex::printPeriod = 100000000;
+const _int64 GenomeIndex::partitionedBuildSeedsPerRound = 1024 * 1024;
+const _int64 GenomeIndex::backpointerReservationSize = 4096;
+
+    void
+GenomeIndex::BuildHashTablesPartitioned(BuildHashTablesThreadContext *threadContexts, unsigned nThreads)
+{
+    //
+    // Give each thread a contiguous range of hash tables with about the same total size, so that the apply passes
+    // take about the same time.
+    //
+    unsigned *hashTableOwner = new unsigned[nHashTables];
+    _uint64 totalTableSize = 0;
+    for (unsigned whichHashTable = 0; whichHashTable < nHashTables; whichHashTable++) {
+        totalTableSize += hashTables[whichHashTable]->GetTableSize();
+    }
+
+    _uint64 tableSizeSoFar = 0;
+    for (unsigned whichHashTable = 0; whichHashTable < nHashTables; whichHashTable++) {
+        hashTableOwner[whichHashTable] = (unsigned)__min((_uint64)nThreads - 1, tableSizeSoFar * nThreads / __max(totalTableSize, (_uint64)1));
+        tableSizeSoFar += hashTables[whichHashTable]->GetTableSize();
+    }
+
+    for (unsigned i = 0; i < nThreads; i++) {
+        threadContexts[i].hashTableOwner = hashTableOwner;
+        threadContexts[i].scatteredSeeds = (ScatteredSeed *)BigAlloc(partitionedBuildSeedsPerRound * sizeof(ScatteredSeed));
+        threadContexts[i].scatterScratch = (ScatteredSeed *)BigAlloc(partitionedBuildSeedsPerRound * sizeof(ScatteredSeed));
+        threadContexts[i].scatterOffsets = new _int64[nThreads + 1];
+        threadContexts[i].partitionedStats = new IndexBuildStats;
+    }
+
+    //
+    // Each round scatters at most partitionedBuildSeedsPerRound genome locations per thread, which bounds the
+    // size of the scatter buffers.
+    //
+    _int64 scatterTime = 0;
+    _int64 applyTime = 0;
+    unsigned nRounds = 0;
+    for (;;) {
+        bool anyLeft = false;
+        for (unsigned i = 0; i < nThreads; i++) {
+            BuildHashTablesThreadContext *context = &threadContexts[i];
+            context->roundEnd = __min(context->genomeChunkStart + partitionedBuildSeedsPerRound, context->genomeChunkEnd);
+            anyLeft |= context->genomeChunkStart < context->roundEnd;
+        }
+
+        if (!anyLeft) {
+            break;
+        }
+
+        _int64 phaseStart = timeInMillis();
+        RunPartitionedBuildPhase(threadContexts, nThreads, ScatterSeedsWorkerThreadMain);
+        _int64 scatterDone = timeInMillis();
+        RunPartitionedBuildPhase(threadContexts, nThreads, ApplyScatteredSeedsWorkerThreadMain);
+        scatterTime += scatterDone - phaseStart;
+        applyTime += timeInMillis() - scatterDone;
+        nRounds++;
+    }
+
+    for (unsigned i = 0; i < nThreads; i++) {
+        BuildHashTablesThreadContext *context = &threadContexts[i];
+        IndexBuildStats *stats = context->partitionedStats;
+
+        *context->noBaseAvailable += stats->noBaseAvailable;
+        *context->nonSeeds += stats->nonSeeds;
+        *context->bothComplementsUsed += stats->bothComplementsUsed;
+        *context->genomeLocationsInOverflowTable += stats->genomeLocationsInOverflowTable;
+        *context->seedsWithMultipleOccurrences += stats->seedsWithMultipleOccurrences;
+
+        BigDealloc(context->scatteredSeeds);
+        context->scatteredSeeds = NULL;
+        BigDealloc(context->scatterScratch);
+        context->scatterScratch = NULL;
+        delete[] context->scatterOffsets;
+        context->scatterOffsets = NULL;
+        delete stats;
+        context->partitionedStats = NULL;
+        context->hashTableOwner = NULL;
+    }
+
+    delete[] hashTableOwner;
+
+    WriteStatusMessage("Partitioned hash table build: %d rounds, scatter %llds, apply %llds\n", nRounds, (scatterTime + 500) / 1000, (applyTime + 500) / 1000);
+}
+
+    void
+GenomeIndex::RunPartitionedBuildPhase(BuildHashTablesThreadContext *threadContexts, unsigned nThreads, ThreadMainFunction phaseMain)
+{
+    SingleWaiterObject doneObject;
+    CreateSingleWaiterObject(&doneObject);
+    volatile int runningThreadCount = nThreads;
+
+    for (unsigned i = 0; i < nThreads; i++) {
+        threadContexts[i].doneObject = &doneObject;
+        threadContexts[i].runningThreadCount = &runningThreadCount;
+        StartNewThread(phaseMain, &threadContexts[i]);
+    }
+
+    WaitForSingleWaiterObject(&doneObject);
+    DestroySingleWaiterObject(&doneObject);
+}
+
+    void
+GenomeIndex::ScatterSeedsWorkerThreadMain(void *param)
+{
+    BuildHashTablesThreadContext *context = (BuildHashTablesThreadContext *)param;
+    const Genome *genome = context->genome;
+    unsigned seedLen = context->seedLen;
+    unsigned nThreads = context->nThreads;
+    IndexBuildStats *stats = context->partitionedStats;
+    _int64 nScattered = 0;
+
+    for (GenomeLocation genomeLocation = context->genomeChunkStart; genomeLocation < context->roundEnd; genomeLocation++) {
+        const char *bases = genome->getSubstring(genomeLocation, seedLen);
+        if (NULL == bases) {
+            stats->noBaseAvailable++;
+            continue;
+        }
+
+        if (!Seed::DoesTextRepresentASeed(bases, seedLen)) {
+            stats->nonSeeds++;
+            continue;
+        }
+
+        Seed seed(bases, seedLen);
+        bool usingComplement = context->large && seed.isBiggerThanItsReverseComplement();
+        if (usingComplement) {
+            seed = ~seed;
+        }
+
+        ScatteredSeed *scattered = &context->scatterScratch[nScattered++];
+        scattered->whichHashTable = (unsigned)seed.getHighBases(context->hashTableKeySize);
+        scattered->lowBases = seed.getLowBases(context->hashTableKeySize);
+        scattered->genomeLocation = genomeLocation;
+        scattered->usingComplement = usingComplement;
+    }
+
+    //
+    // Counting sort the seeds by owner, so that each apply thread reads one contiguous range of our buffer.
+    //
+    _int64 *offsets = context->scatterOffsets;
+    for (unsigned i = 0; i <= nThreads; i++) {
+        offsets[i] = 0;
+    }
+
+    for (_int64 i = 0; i < nScattered; i++) {
+        offsets[context->hashTableOwner[context->scatterScratch[i].whichHashTable] + 1]++;
+    }
+
+    for (unsigned i = 1; i <= nThreads; i++) {
+        offsets[i] += offsets[i - 1];
+    }
+
+    for (_int64 i = 0; i < nScattered; i++) {
+        unsigned owner = context->hashTableOwner[context->scatterScratch[i].whichHashTable];
+        context->scatteredSeeds[offsets[owner]++] = context->scatterScratch[i];
+    }
+
+    //
+    // The placement loop advanced each offset to the start of the next owner's range; shift them back.
+    //
+    for (unsigned i = nThreads; i > 0; i--) {
+        offsets[i] = offsets[i - 1];
+    }
+    offsets[0] = 0;
+
+    GenomeDistance basesThisRound = context->roundEnd - context->genomeChunkStart;
+    context->genomeChunkStart = context->roundEnd;
+
+    _int64 newNBasesProcessed = InterlockedAdd64AndReturnNewValue(context->nBasesProcessed, basesThisRound);
+    if (newNBasesProcessed / printPeriod > (newNBasesProcessed - basesThisRound) / printPeriod) {
+        WriteStatusMessage("Indexing %lld / %lld\n", (newNBasesProcessed / printPeriod) * printPeriod, genome->getCountOfBases());
+    }
+
+    if (0 == InterlockedDecrementAndReturnNewValue(context->runningThreadCount)) {
+        SignalSingleWaiterObject(context->doneObject);
+    }
+}
+
+    void
+GenomeIndex::ApplyScatteredSeedsWorkerThreadMain(void *param)
+{
+    BuildHashTablesThreadContext *context = (BuildHashTablesThreadContext *)param;
+    IndexBuildStats *stats = context->partitionedStats;
+
+    //
+    // No locks: this thread is the only one that touches the hash tables that it owns.
+    //
+    for (unsigned producer = 0; producer < context->nThreads; producer++) {
+        BuildHashTablesThreadContext *producerContext = &context->allContexts[producer];
+        for (_int64 i = producerContext->scatterOffsets[context->whichThread]; i < producerContext->scatterOffsets[context->whichThread + 1]; i++) {
+            ScatteredSeed *scattered = &producerContext->scatteredSeeds[i];
+            _ASSERT(context->hashTableOwner[scattered->whichHashTable] == context->whichThread);
+            ApplyHashTableUpdate(context, scattered->whichHashTable, scattered->genomeLocation, scattered->lowBases, scattered->usingComplement,
+                &stats->bothComplementsUsed, &stats->genomeLocationsInOverflowTable, &stats->seedsWithMultipleOccurrences, context->large);
+        }
+    }
+
+    if (0 == InterlockedDecrementAndReturnNewValue(context->runningThreadCount)) {
+        SignalSingleWaiterObject(context->doneObject);
+    }
+}
 
 
 
@@ -1370,7 +1633,16 @@ GenomeIndex::AddOverflowBackpointer(
 	BuildHashTablesThreadContext*context,
 	GenomeLocation               genomeLocation)
 {
-    _int64 overflowBackpointerIndex = InterlockedAdd64AndReturnNewValue(context->nextOverflowBackpointer, 1) - 1;
+    _int64 overflowBackpointerIndex;
+    if (context->partitioned) {
+        if (context->nextReservedBackpointer >= context->reservedBackpointerLimit) {
+            context->reservedBackpointerLimit = InterlockedAdd64AndReturnNewValue(context->nextOverflowBackpointer, backpointerReservationSize);
+            context->nextReservedBackpointer = context->reservedBackpointerLimit - backpointerReservationSize;
+        }
+        overflowBackpointerIndex = context->nextReservedBackpointer++;
+    } else {
+        overflowBackpointerIndex = InterlockedAdd64AndReturnNewValue(context->nextOverflowBackpointer, 1) - 1;
+    }
     OverflowBackpointer *newBackpointer = context->overflowAnchor->getBackpointer(overflowBackpointerIndex);
  
     newBackpointer->nextIndex = previousOverflowBackpointer;
@@ -1542,8 +1814,8 @@ GenomeIndex::OverflowBackpointer GenomeIndex::OverflowBackpointerAnchor::spilled
     void
 GenomeIndex::printBiasTables()
 {
-    for (int keySize = 0; keySize <= largestKeySize; keySize++) {
-        for (int seedSize = 0; seedSize <= largestBiasTable; seedSize++) {
+    for (unsigned keySize = 0; keySize <= largestKeySize; keySize++) {
+        for (unsigned seedSize = 0; seedSize <= largestBiasTable; seedSize++) {
             if (NULL != hg19_biasTables_large[keySize][seedSize]) {
                 printf("static double hg19_biasTable%d_%d_large[] = {\n", seedSize, keySize);
                 unsigned bitsOfSeed = seedSize * 2;
@@ -1573,8 +1845,8 @@ GenomeIndex::printBiasTables()
         } // for each seed size
     } // for each key size
 
-    for (int keySize = 0; keySize <= largestKeySize; keySize++) {
-        for (int seedSize = 0; seedSize <= largestBiasTable; seedSize++) {
+    for (unsigned keySize = 0; keySize <= largestKeySize; keySize++) {
+        for (unsigned seedSize = 0; seedSize <= largestBiasTable; seedSize++) {
             if (NULL != hg19_biasTables[keySize][seedSize]) {
                 printf("static double hg19_biasTable%d_%d[] = {\n", seedSize, keySize);
                 unsigned bitsOfSeed = seedSize * 2;
@@ -1605,8 +1877,37 @@ GenomeIndex::printBiasTables()
     } // for each key size
 }
 
-        GenomeIndex *
-GenomeIndex::loadFromDirectory(char *directoryName, bool map, bool prefetch)
+        _int64
+GenomeIndex::getLoadedSize(const char *directoryName)
+{
+    const char *fileNames[] = {GenomeIndexHashFileName, OverflowTableFileName, GenomeFileName, SeedPopularityFileName};
+    const size_t nRequiredFiles = 3;  // The seed popularity sketch is optional
+    _int64 totalSize = 0;
+
+    for (size_t i = 0; i < sizeof(fileNames) / sizeof(fileNames[0]); i++) {
+        size_t filenameBufferSize = strlen(directoryName) + 1 + strlen(fileNames[i]) + 1;
+        char *filenameBuffer = new char[filenameBufferSize];
+        snprintf(filenameBuffer, filenameBufferSize, "%s%c%s", directoryName, PATH_SEP, fileNames[i]);
+
+        FILE *file = fopen(filenameBuffer, "rb");
+        if (NULL == file) {
+            delete[] filenameBuffer;
+            if (i >= nRequiredFiles) {
+                continue;
+            }
+            return -1;
+        }
+        fclose(file);
+
+        totalSize += QueryFileSize(filenameBuffer);
+        delete[] filenameBuffer;
+    }
+
+    return totalSize;
+}
+
+    GenomeIndex *
+GenomeIndex::loadFromDirectory(char *directoryName, bool map, bool prefetch, bool packGenome)
 {
     int filenameBufferSize = (int)(strlen(directoryName) + 1 + __max(strlen(GenomeIndexFileName), __max(strlen(OverflowTableFileName), __max(strlen(GenomeIndexHashFileName), strlen(GenomeFileName)))) + 1);
     char *filenameBuffer = new char[filenameBufferSize];
@@ -1649,9 +1950,9 @@ GenomeIndex::loadFromDirectory(char *directoryName, bool map, bool prefetch)
     indexFile->close();
     delete indexFile;
 
-    if (majorVersion != GenomeIndexFormatMajorVersion) {
-        WriteErrorMessage("This genome index appears to be from a different version of SNAP than this, and so we can't read it.  Index version %d, SNAP index format version %d\n",
-            majorVersion, GenomeIndexFormatMajorVersion);
+    if (majorVersion < OldestLoadableGenomeIndexFormatMajorVersion || majorVersion > GenomeIndexFormatMajorVersion) {
+        WriteErrorMessage("This genome index appears to be from a different version of SNAP than this, and so we can't read it.  Index version %d, SNAP index format versions %d-%d\n",
+            majorVersion, OldestLoadableGenomeIndexFormatMajorVersion, GenomeIndexFormatMajorVersion);
         soft_exit(1);
     }
 
@@ -1766,7 +2067,7 @@ GenomeIndex::loadFromDirectory(char *directoryName, bool map, bool prefetch)
 			delete hashTableFile;
 		}
 
-		if (QueryFileSize(filenameBuffer) != hashTablesFileSize) {
+		if (QueryFileSize(filenameBuffer) != (_int64)hashTablesFileSize) {
 			WriteErrorMessage("File '%s' had unexpected size, %lld != %lld\n", filenameBuffer, QueryFileSize(filenameBuffer), hashTablesFileSize);
             delete[]filenameBuffer;
 			delete index;
@@ -1830,7 +2131,7 @@ GenomeIndex::loadFromDirectory(char *directoryName, bool map, bool prefetch)
 	}
 
     snprintf(filenameBuffer, filenameBufferSize, "%s%c%s", directoryName, PATH_SEP, GenomeFileName);
-    if (NULL == (index->genome = Genome::loadFromFile(filenameBuffer, chromosomePadding, 0, 0, map))) {
+    if (NULL == (index->genome = Genome::loadFromFile(filenameBuffer, chromosomePadding, 0, 0, map, packGenome))) {
         WriteErrorMessage("GenomeIndex::loadFromDirectory: Failed to load the genome itself\n");
         delete[] filenameBuffer;
         delete index;
@@ -1847,6 +2148,12 @@ GenomeIndex::loadFromDirectory(char *directoryName, bool map, bool prefetch)
         soft_exit(1);
     }
 
+    //
+    // The filename buffer is sized for the longest of the other names, which is longer than this one.
+    //
+    snprintf(filenameBuffer, filenameBufferSize, "%s%c%s", directoryName, PATH_SEP, SeedPopularityFileName);
+    index->seedPopularity = SeedPopularity::loadFromFile(filenameBuffer, index->seedLen);
+
     delete[] filenameBuffer;
     return index;
 }
@@ -2085,3 +2392,165 @@ GenomeIndex::fillInLookedUpResults(GenomeLocation lookedUpLocation, _int64 *nHit
         *hits = (const GenomeLocation *)&overflowTable64[overflowTableOffset + 1];
     }
 }
+
+    void
+GenomeIndex::lookupSeeds(
+    const Seed         *seeds,
+    unsigned            nSeeds,
+    SeedLookup         *lookups)
+{
+    //
+    // Each pass touches memory that the previous pass prefetched, so as long as the batch is big enough
+    // to cover the memory latency, only the first pass of the first few seeds stalls.
+    //
+    for (unsigned i = 0; i < nSeeds; i++) {
+        prefetchSeed(seeds[i]);
+    }
+
+    for (unsigned i = 0; i < nSeeds; i++) {
+        probeSeed(seeds[i], &lookups[i]);
+    }
+
+    for (unsigned i = 0; i < nSeeds; i++) {
+        fillInSeedLookup(seeds[i], &lookups[i]);
+    }
+}
+
+    void
+GenomeIndex::prefetchSeed(
+    Seed                seed) const
+{
+    if (largeHashTable) {
+        if (seed.isBiggerThanItsReverseComplement()) {
+            seed = ~seed;
+        }
+        hashTables[seed.getHighBases(hashTableKeySize)]->PrefetchKey(seed.getLowBases(hashTableKeySize));
+    } else {
+        for (int dir = 0; dir < NUM_DIRECTIONS; dir++) {
+            hashTables[seed.getHighBases(hashTableKeySize)]->PrefetchKey(seed.getLowBases(hashTableKeySize));
+            seed = ~seed;
+        }
+    }
+}
+
+    void
+GenomeIndex::probeSeed(
+    Seed                seed,
+    SeedLookup         *lookup) const
+/*++
+
+Routine Description:
+
+    Find the hash table entries for a seed (just one for large hash tables, which hold both complements in one entry)
+    and start the prefetch of any overflow table entries they point to.
+
+--*/
+{
+    if (largeHashTable) {
+        lookup->lookedUpComplement = seed.isBiggerThanItsReverseComplement();
+        if (lookup->lookedUpComplement) {
+            seed = ~seed;
+        }
+
+        _ASSERT(seed.getHighBases(hashTableKeySize) < nHashTables);
+        const char *entry = (const char *)hashTables[seed.getHighBases(hashTableKeySize)]->GetFirstValueForKey(seed.getLowBases(hashTableKeySize));
+        lookup->entries[FORWARD] = lookup->entries[RC] = entry;
+        if (NULL != entry) {
+            prefetchOverflowEntry(entry);
+            prefetchOverflowEntry(entry + locationSize);
+        }
+    } else {
+        lookup->lookedUpComplement = false;
+        for (int dir = 0; dir < NUM_DIRECTIONS; dir++) {
+            _ASSERT(seed.getHighBases(hashTableKeySize) < nHashTables);
+            const char *entry = (const char *)hashTables[seed.getHighBases(hashTableKeySize)]->GetFirstValueForKey(seed.getLowBases(hashTableKeySize));
+            lookup->entries[dir] = entry;
+            if (NULL != entry) {
+                prefetchOverflowEntry(entry);
+            }
+            seed = ~seed;
+        }
+    }
+}
+
+    void
+GenomeIndex::prefetchOverflowEntry(
+    const char         *valueInEntry) const
+{
+    //
+    // Values at or beyond the end of the genome are offsets into the overflow table, where the first thing
+    // the fill in pass will read is the hit count.  The range check also weeds out the unused value marker.
+    //
+    _uint64 value = 0;
+    memcpy(&value, valueInEntry, locationSize); // Assumes little endian
+    _uint64 overflowTableOffset = value - genome->getCountOfBases();
+    if (value < (_uint64)genome->getCountOfBases() || overflowTableOffset >= overflowTableSize) {
+        return;
+    }
+
+    if (locationSize == 4) {
+        _mm_prefetch((const char *)&overflowTable32[overflowTableOffset], _MM_HINT_T2);
+    } else {
+        _mm_prefetch((const char *)&overflowTable64[overflowTableOffset], _MM_HINT_T2);
+    }
+}
+
+    void
+GenomeIndex::fillInSeedLookup(
+    Seed                seed,
+    SeedLookup         *lookup)
+/*++
+
+Routine Description:
+
+    Turn the entries found by probeSeed into hit lists, the same way that lookupSeed and lookupSeed32 do.
+
+--*/
+{
+    if (largeHashTable) {
+        const char *entry = lookup->entries[FORWARD];
+        if (NULL == entry) {
+            lookup->nHits[FORWARD] = lookup->nHits[RC] = 0;
+            return;
+        }
+
+        int forwardValue = lookup->lookedUpComplement ? 1 : 0;
+        if (locationSize == 4) {
+            fillInLookedUpResults32((const unsigned *)entry + forwardValue, &lookup->nHits[FORWARD], &lookup->hits32[FORWARD]);
+            if (seed.isOwnReverseComplement()) {
+                lookup->nHits[RC] = lookup->nHits[FORWARD];
+                lookup->hits32[RC] = lookup->hits32[FORWARD];
+            } else {
+                fillInLookedUpResults32((const unsigned *)entry + 1 - forwardValue, &lookup->nHits[RC], &lookup->hits32[RC]);
+            }
+        } else {
+            GenomeLocation entryByValue[NUM_DIRECTIONS];
+            entryByValue[0] = 0;
+            entryByValue[1] = 0;
+
+            memcpy(&entryByValue[0], entry, locationSize);  // Works because we're litte-endian
+            memcpy(&entryByValue[1], entry + locationSize, locationSize);
+
+            fillInLookedUpResults(entryByValue[forwardValue], &lookup->nHits[FORWARD], &lookup->hits[FORWARD], &lookup->singletonHits[FORWARD]);
+            if (seed.isOwnReverseComplement()) {
+                lookup->nHits[RC] = lookup->nHits[FORWARD];
+                lookup->hits[RC] = lookup->hits[FORWARD];
+            } else {
+                fillInLookedUpResults(entryByValue[1 - forwardValue], &lookup->nHits[RC], &lookup->hits[RC], &lookup->singletonHits[RC]);
+            }
+        }
+    } else {
+        for (int dir = 0; dir < NUM_DIRECTIONS; dir++) {
+            const char *entry = lookup->entries[dir];
+            if (NULL == entry) {
+                lookup->nHits[dir] = 0;
+            } else if (locationSize == 4) {
+                fillInLookedUpResults32((const unsigned *)entry, &lookup->nHits[dir], &lookup->hits32[dir]);
+            } else {
+                GenomeLocation entryByValue = 0;
+                memcpy(&entryByValue, entry, locationSize);  // Assumes little endian
+                fillInLookedUpResults(entryByValue, &lookup->nHits[dir], &lookup->hits[dir], &lookup->singletonHits[dir]);
+            }
+        }
+    }
+}
@@ -26,9 +26,11 @@ Revision History:
 
 #include "HashTable.h"
 #include "Seed.h"
+#include "directions.h"
 #include "Genome.h"
 #include "ApproximateCounter.h"
 #include "GenericFile_map.h"
+#include "SeedPopularity.h"
 
 class GenomeIndex {
 public:
@@ -52,6 +54,29 @@ public:
 
     bool doesGenomeIndexHave64BitLocations() const {return locationSize > 4;}
 
+    //
+    // Batched version of lookupSeed/lookupSeed32.  Looking up one seed at a time means taking the cache miss on
+    // its hash table bucket (and then on its overflow table entry) before starting the next.  This instead works
+    // in passes over the whole batch: prefetch every bucket, then probe them all and prefetch the overflow entries
+    // they point to, then fill in the results.  The answers are exactly what lookupSeed would give, including
+    // the guarantee about hits[-1].  Fill in hits for indices with 64 bit locations and hits32 for the others.
+    // The hits may point at singletonHits within the same SeedLookup, so don't copy them.
+    //
+    struct SeedLookup {
+        _int64                  nHits[NUM_DIRECTIONS];
+        const GenomeLocation   *hits[NUM_DIRECTIONS];
+        const unsigned         *hits32[NUM_DIRECTIONS];
+        GenomeLocation          singletonHits[NUM_DIRECTIONS];
+
+        //
+        // Private to lookupSeeds: the hash table entries found by the probe pass.
+        //
+        const char             *entries[NUM_DIRECTIONS];
+        bool                    lookedUpComplement;
+    };
+
+    void lookupSeeds(const Seed *seeds, unsigned nSeeds, SeedLookup *lookups);
+
     //
     // Looks up a seed and its reverse complement, restricting the search to a given range of locations,
     // and returns the number and list of hits for each.
@@ -68,6 +93,11 @@ public:
 
     inline int getSeedLength() const { return seedLen; }
 
+    //
+    // How popular each seed is, roughly, or NULL if the index was built without the sketch.
+    //
+    inline const SeedPopularity *getSeedPopularity() const { return seedPopularity; }
+
     virtual ~GenomeIndex();
 
     //
@@ -75,7 +105,10 @@ public:
     //
     static void runIndexer(int argc, const char **argv);
 
-    static GenomeIndex *loadFromDirectory(char *directoryName, bool map, bool prefetch);
+    static GenomeIndex *loadFromDirectory(char *directoryName, bool map, bool prefetch, bool packGenome = false);
+
+    // Memory that loading (rather than mapping) the index in this directory takes, or -1 if its files aren't there
+    static _int64 getLoadedSize(const char *directoryName);
 
     static void printBiasTables();
 
@@ -101,6 +134,8 @@ protected:
 	GenericFile_map *mappedOverflowTable;
 
     void *tablesBlob;   // All of the hash tables in one giant blob
+
+    SeedPopularity *seedPopularity;
 	GenericFile_map *mappedTables;
 
     //
@@ -152,7 +187,7 @@ protected:
                                       bool computeBias, const char *directory,
                                       unsigned maxThreads, unsigned chromosomePaddingSize, bool forceExact, 
                                       unsigned hashTableKeySize, bool large, const char *histogramFileName,
-                                      unsigned locationSize, bool smallMemory);
+                                      unsigned locationSize, bool smallMemory, bool partitionedBuild);
 
  
     //
@@ -161,8 +196,13 @@ protected:
     static SNAPHashTable** allocateHashTables(unsigned* o_nTables, GenomeDistance countOfBases, double slack,
         int seedLen, unsigned hashTableKeySize, bool large, unsigned locationSize, double* biasTable = NULL);
     
-    static const unsigned GenomeIndexFormatMajorVersion = 5;
+    //
+    // Version 6 stores the hash tables in the bucketed layout (see HashTable.h).  Version 5 indices, whose hash tables
+    // use the linear probing layout, can still be loaded; the tables describe their own layout.
+    //
+    static const unsigned GenomeIndexFormatMajorVersion = 6;
     static const unsigned GenomeIndexFormatMinorVersion = 0;
+    static const unsigned OldestLoadableGenomeIndexFormatMajorVersion = 5;
     
     static const unsigned largestBiasTable = 32;    // Can't be bigger than the biggest seed size, which is set in Seed.h.  Bigger than 32 means a new Seed structure.
     static const unsigned largestKeySize = 8;
@@ -191,6 +231,17 @@ protected:
     static void ComputeBiasTableWorkerThreadMain(void *param);
 
     struct OverflowBackpointer;
+    struct IndexBuildStats;
+
+    //
+    // A seed that the scatter pass of the partitioned build has routed to the thread that owns its hash table.
+    //
+    struct ScatteredSeed {
+        _uint64         lowBases;
+        GenomeLocation  genomeLocation;
+        unsigned        whichHashTable;
+        bool            usingComplement;
+    };
 
     struct BuildHashTablesThreadContext {
 		unsigned						 nThreads;
@@ -228,6 +279,24 @@ protected:
 
         ExclusiveLock                   *hashTableLocks;
         ExclusiveLock                   *overflowTableLock;
+
+        //
+        // The partitioned build runs in rounds.  In the scatter pass each thread reads the next part of its genome chunk
+        // and sorts the resulting seeds by the thread that owns their hash table.  In the apply pass each thread
+        // inserts the seeds for the hash tables it owns, from all of the threads' scatter buffers, without taking
+        // any locks.  Overflow backpointer indices are reserved in blocks so that threads don't contend on
+        // nextOverflowBackpointer for each one.
+        //
+        bool                             partitioned;
+        BuildHashTablesThreadContext    *allContexts;
+        const unsigned                  *hashTableOwner;        // Which thread applies the updates for each hash table
+        GenomeLocation                   roundEnd;              // End of this thread's scatter for the current round
+        ScatteredSeed                   *scatteredSeeds;        // This round's seeds, sorted by owner
+        ScatteredSeed                   *scatterScratch;
+        _int64                          *scatterOffsets;        // nThreads + 1 offsets into scatteredSeeds, one range per owner
+        IndexBuildStats                 *partitionedStats;
+        _int64                           nextReservedBackpointer;
+        _int64                           reservedBackpointerLimit;
     };
 
     struct PerHashTableBatch {
@@ -278,6 +347,14 @@ protected:
 
     static void BuildHashTablesWorkerThreadMain(void *param);
     void BuildHashTablesWorkerThread(BuildHashTablesThreadContext *context);
+
+    static const _int64 partitionedBuildSeedsPerRound;
+    static const _int64 backpointerReservationSize;
+
+    void BuildHashTablesPartitioned(BuildHashTablesThreadContext *threadContexts, unsigned nThreads);
+    static void RunPartitionedBuildPhase(BuildHashTablesThreadContext *threadContexts, unsigned nThreads, ThreadMainFunction phaseMain);
+    static void ScatterSeedsWorkerThreadMain(void *param);
+    static void ApplyScatteredSeedsWorkerThreadMain(void *param);
     static void ApplyHashTableUpdate(BuildHashTablesThreadContext *context, _uint64 whichHashTable, GenomeLocation genomeLocation, _uint64 lowBases, bool usingComplement,
                     _int64 *bothComplementsUsed, _int64 *genomeLocationsInOverflowTable, _int64 *seedsWithMultipleOccurrences, bool large);
 
@@ -296,4 +373,12 @@ protected:
 
     void fillInLookedUpResults32(const unsigned *subEntry, _int64 *nHits, const unsigned **hits);
     void fillInLookedUpResults(GenomeLocation lookedUpLocation, _int64 *nHits, const GenomeLocation **hits, GenomeLocation *singleHitLocation);
+
+    //
+    // The passes of lookupSeeds.
+    //
+    void prefetchSeed(Seed seed) const;
+    void probeSeed(Seed seed, SeedLookup *lookup) const;
+    void prefetchOverflowEntry(const char *valueInEntry) const;
+    void fillInSeedLookup(Seed seed, SeedLookup *lookup);
 };
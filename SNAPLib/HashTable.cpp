@@ -29,7 +29,8 @@ SNAPHashTable::SNAPHashTable(
     unsigned    i_keySizeInBytes,
     unsigned    i_valueSizeInBytes,
     unsigned    i_valueCount,
-    _uint64     i_invalidValueValue)
+    _uint64     i_invalidValueValue,
+    Layout      i_layout)
 /*++
 
 Routine Description:
@@ -37,7 +38,8 @@ Routine Description:
     Constructor for a new, empty closed hash table.
 
 Arguments:
-    tableSize           - How many slots should the table have.
+    tableSize           - How many slots should the table have.  The bucketed layout rounds this up to a whole number of buckets.
+    layout              - Whether to use the bucketed or the (old) linear probing layout
 --*/
 {
     keySizeInBytes = i_keySizeInBytes;
@@ -48,15 +50,27 @@ Arguments:
     tableSize = i_tableSize;
     usedElementCount = 0;
     Table = NULL;
+    ownsMemoryForTable = false;
+    setLayout(i_layout);
 
     if (tableSize <= 0) {
         tableSize = 0;
+        nBuckets = 0;
         return;
     }
 
-	Table = BigAlloc(tableSize * elementSize);
+    if (BucketedLayout == layout) {
+        nBuckets = (tableSize + entriesPerBucket - 1) / entriesPerBucket;
+        tableSize = nBuckets * entriesPerBucket;
+    }
+
+	Table = BigAlloc(getTableSizeInBytes());
     ownsMemoryForTable = true;
 
+    if (BucketedLayout == layout) {
+        memset(Table, 0, getTableSizeInBytes());   // All tags 0 (unused), and the padding is deterministic in the saved file
+    }
+
     //
     // Run through the table and set all of the first values to invalidValueValue, which means
     // unused.
@@ -64,19 +78,51 @@ Arguments:
 
     for (size_t i = 0; i < tableSize; i++) {
         void *entry = getEntry(i);
-		_ASSERT(entry >= Table && entry <= (char *)Table + tableSize * elementSize);
+		_ASSERT(entry >= Table && entry <= (char *)Table + getTableSizeInBytes());
         clearKey(entry);
         memcpy(getEntry(i), &invalidValueValue, valueSizeInBytes);
     }
 }
 
+    void
+SNAPHashTable::setLayout(Layout i_layout)
+{
+    layout = i_layout;
+    nBuckets = 0;
+    entriesPerBucket = 1;
+    bucketEntryOffset = 0;
+    tagMask = 0;
+
+    if (BucketedLayout != layout) {
+        return;
+    }
+
+    //
+    // Fit as many entries as we can in a bucket along with their tags, keeping the entries 4 byte aligned.  Never more
+    // than 16, because that's what a lookup can match in one SSE2 compare.
+    //
+    entriesPerBucket = 0;
+    while (entriesPerBucket < 16 &&
+            ((entriesPerBucket + 1 + 3) & ~3) + (entriesPerBucket + 1) * elementSize <= BucketSize) {
+        entriesPerBucket++;
+    }
+
+    if (0 == entriesPerBucket) {
+        WriteErrorMessage("SNAPHashTable: element size %d is too big for a %d byte bucket\n", elementSize, BucketSize);
+        soft_exit(1);
+    }
+
+    bucketEntryOffset = (entriesPerBucket + 3) & ~3;
+    tagMask = (1 << entriesPerBucket) - 1;
+}
+
 SNAPHashTable *SNAPHashTable::loadFromBlob(GenericFile_Blob *loadFile)
 {
 	SNAPHashTable *table = loadCommon(loadFile);
 
 	size_t bytesMapped;
-	table->Table = loadFile->mapAndAdvance(table->tableSize * table->elementSize, &bytesMapped);
-	if (bytesMapped != table->tableSize * table->elementSize) {
+	table->Table = loadFile->mapAndAdvance(table->getTableSizeInBytes(), &bytesMapped);
+	if (bytesMapped != table->getTableSizeInBytes()) {
 		WriteErrorMessage("SNAPHashTable: unable to map table\n");
 		soft_exit(1);
 	}
@@ -88,8 +134,8 @@ SNAPHashTable *SNAPHashTable::loadFromBlob(GenericFile_Blob *loadFile)
 SNAPHashTable *SNAPHashTable::loadFromGenericFile(GenericFile *loadFile)
 {
 	SNAPHashTable *table = loadCommon(loadFile);
-	table->Table = BigAlloc(table->tableSize * table->elementSize);
-	loadFile->read(table->Table, table->tableSize * table->elementSize);
+	table->Table = BigAlloc(table->getTableSizeInBytes());
+	loadFile->read(table->Table, table->getTableSizeInBytes());
 	table->ownsMemoryForTable = true;
 
 	return table;
@@ -105,7 +151,7 @@ SNAPHashTable *SNAPHashTable::loadCommon(GenericFile *loadFile)
         soft_exit(1);
     }
 
-    if (fileMagic != magic) {
+    if (fileMagic != magic && fileMagic != bucketedMagic) {
         WriteErrorMessage("SNAPHashTable: magic number mismatch.  Perhaps you have a corruped index.  %d != %d\n", fileMagic, magic);
         soft_exit(1);
     }
@@ -168,8 +214,26 @@ SNAPHashTable *SNAPHashTable::loadCommon(GenericFile *loadFile)
     }
 
     table->elementSize = table->keySizeInBytes + table->valueSizeInBytes * table->valueCount;
+    table->setLayout(fileMagic == bucketedMagic ? BucketedLayout : LinearProbingLayout);
 
+    if (BucketedLayout == table->layout) {
+        if (0 != table->tableSize % table->entriesPerBucket) {
+            WriteErrorMessage("SNAPHashTable: table size %lld isn't a whole number of buckets of %d entries.  Perhaps your index is corrupt.\n", (_int64)table->tableSize, table->entriesPerBucket);
+            soft_exit(1);
+        }
+        table->nBuckets = table->tableSize / table->entriesPerBucket;
 
+        //
+        // Skip the padding that puts the table itself on a bucket boundary in the file.
+        //
+        unsigned paddingSize;
+        char padding[BucketSize];
+        if (sizeof(paddingSize) != loadFile->read(&paddingSize, sizeof(paddingSize)) || paddingSize >= BucketSize || 
+                paddingSize != loadFile->read(padding, paddingSize)) {
+            WriteErrorMessage("SNAPHashTable: unable to read bucket alignment padding\n");
+            soft_exit(1);
+        }
+    }
 
     return table;
 }
@@ -200,7 +264,8 @@ bool
 SNAPHashTable::saveToFile(FILE *saveFile, size_t *bytesWritten) 
 {
     *bytesWritten = 0;
-    if (1 != fwrite(&magic,sizeof(magic), 1, saveFile)) {
+    const unsigned *magicToWrite = BucketedLayout == layout ? &bucketedMagic : &magic;
+    if (1 != fwrite(magicToWrite, sizeof(*magicToWrite), 1, saveFile)) {
         WriteErrorMessage("SNAPHashTable::SNAPHashTable fwrite magic number failed\n");
         return false;
     }    
@@ -242,10 +307,30 @@ SNAPHashTable::saveToFile(FILE *saveFile, size_t *bytesWritten)
     }
     (*bytesWritten) += valueSizeInBytes;
 
+    if (BucketedLayout == layout) {
+        //
+        // Pad so that the table starts on a bucket boundary in the file, so that when the file is mapped (or read into
+        // page aligned memory) buckets are cache lines.
+        //
+        _int64 offset = _ftell64bit(saveFile);
+        if (offset < 0) {
+            WriteErrorMessage("SNAPHashTable: ftell failed, %d\n", errno);
+            return false;
+        }
+        unsigned paddingSize = (unsigned)((BucketSize - (offset + sizeof(paddingSize)) % BucketSize) % BucketSize);
+        char padding[BucketSize];
+        memset(padding, 0, sizeof(padding));
+        if (1 != fwrite(&paddingSize, sizeof(paddingSize), 1, saveFile) || (paddingSize > 0 && 1 != fwrite(padding, paddingSize, 1, saveFile))) {
+            WriteErrorMessage("SNAPHashTable: fwrite bucket alignment padding failed\n");
+            return false;
+        }
+        (*bytesWritten) += sizeof(paddingSize) + paddingSize;
+    }
+
     size_t maxWriteSize = 100 * 1024 * 1024;
     size_t writeOffset = 0;
-    while (writeOffset < tableSize * elementSize) {
-        size_t amountToWrite = __min(maxWriteSize,tableSize * elementSize - writeOffset);
+    while (writeOffset < getTableSizeInBytes()) {
+        size_t amountToWrite = __min(maxWriteSize,getTableSizeInBytes() - writeOffset);
         size_t thisWrite = fwrite((char*)Table + writeOffset, 1, amountToWrite, saveFile);
         if (thisWrite < amountToWrite) {
             WriteErrorMessage("SNAPHashTable::saveToFile: fwrite failed, %d\n"
@@ -267,6 +352,10 @@ SNAPHashTable::getEntryForKey(KeyType key) const
 {
     nCallsToGetEntryForKey++;
 
+    if (BucketedLayout == layout) {
+        return getBucketedEntryForKey(key, true);
+    }
+
     _uint64 tableIndex = hash(key) % tableSize;
 
     bool wrapped = false;
@@ -326,7 +415,14 @@ SNAPHashTable::Insert(KeyType key, ValueType *data)
         return false;
     }
 
-	if (!isKeyEqual(entry, key)) {
+    if (BucketedLayout == layout) {
+        char *tag = getTagForEntry(entry);
+        if (0 == *tag) {
+            *tag = tagForHash(hash(key));
+            setKey(entry, key);
+            usedElementCount++;
+        }
+    } else if (!isKeyEqual(entry, key)) {
 		setKey(entry, key);
 		usedElementCount++;
 	}
@@ -341,3 +437,4 @@ SNAPHashTable::Insert(KeyType key, ValueType *data)
 
 
 const unsigned SNAPHashTable::magic = 0xb111b010;
+const unsigned SNAPHashTable::bucketedMagic = 0xb111b011;
@@ -23,6 +23,7 @@ Environment:
 #include "Compat.h"
 #include "GenericFile_Blob.h"
 #include "Genome.h"
+#include <emmintrin.h>
 
 
 class SNAPHashTable {
@@ -31,12 +32,23 @@ class SNAPHashTable {
         typedef _uint64 ValueType;  // Values can be smaller than this, but they're expanded in the interface
         typedef _uint64 KeyType;    // Likewise for keys.
 
+        //
+        // The table can be laid out in one of two ways.  The linear probing layout is the original one (index format
+        // version 5 and before): entries packed end to end, probing quadratically and then linearly on collision.  The
+        // bucketed layout groups entries into cache-line-sized buckets, each headed by a one byte tag per entry taken
+        // from the key's hash.  A lookup reads one bucket, matches its tags all at once with SSE2 and only compares
+        // the keys of entries whose tags match, and so usually costs exactly one cache miss.  Buckets that are full
+        // overflow into the next bucket.
+        //
+        enum Layout {LinearProbingLayout, BucketedLayout};
+
         SNAPHashTable(
             _int64		i_tableSize,
             unsigned    i_keySizeInBytes,
             unsigned    i_valueSizeInBytes,
             unsigned    i_valueCount,
-            _uint64		i_invalidValueValue);
+            _uint64		i_invalidValueValue,
+            Layout      i_layout = BucketedLayout);
 
         //
         // Load from file.
@@ -62,6 +74,7 @@ class SNAPHashTable {
         unsigned GetKeySizeInBytes() const {return keySizeInBytes;}
         unsigned GetValueSizeInBytes() const {return valueSizeInBytes;}
         unsigned GetValueCount() const {return valueCount;}
+        Layout GetLayout() const {return layout;}
 
 		void *getEntryValues(_uint64 whichEntry) 
 		{
@@ -69,6 +82,14 @@ class SNAPHashTable {
 			return getEntry(whichEntry);
 		}
 
+        KeyType getEntryKey(_uint64 whichEntry) const
+        {
+            _ASSERT(whichEntry < GetTableSize());
+            KeyType key = 0;
+            memcpy(&key, (char *)getEntry(whichEntry) + valueSizeInBytes * valueCount, keySizeInBytes);  // Assumes little-endian
+            return key;
+        }
+
         static inline _uint64 hash(_uint64 key) {
             //
             // Hash the key.  Use the hash finalizer from the 64 bit MurmurHash3, http://code.google.com/p/smhasher/wiki/MurmurHash3,
@@ -86,6 +107,10 @@ class SNAPHashTable {
 
         inline ValueType *GetFirstValueForKey(KeyType key) const {
             _ASSERT(keySizeInBytes == 8 || (key & ~((((_uint64)1) << (keySizeInBytes * 8)) - 1)) == 0);    // High bits of the key aren't set.
+            if (BucketedLayout == layout) {
+                return (ValueType *)getBucketedEntryForKey(key, false);
+            }
+
             _uint64 tableIndex = hash(key) % tableSize;
             void *entry = getEntry(tableIndex);
             if (isKeyEqual(entry, key) && !doesEntryHaveInvalidValue(entry)) {
@@ -118,6 +143,21 @@ class SNAPHashTable {
         }
 
 
+        //
+        // Prefetch the bucket that a lookup of key would look at first.  Issue these for a batch of keys before looking
+        // any of them up, and the cache misses overlap rather than happening one after another.  Keys that have to probe
+        // past their first bucket still stall on the later probes, but they're the minority.
+        //
+        inline void PrefetchKey(KeyType key) const {
+            if (BucketedLayout == layout) {
+                _mm_prefetch(getBucket(hash(key) % nBuckets), _MM_HINT_T2); // Buckets are cache line aligned, so this is all of it
+                return;
+            }
+            const char *entry = (const char *)getEntry(hash(key) % tableSize);
+            _mm_prefetch(entry, _MM_HINT_T2);
+            _mm_prefetch(entry + elementSize - 1, _MM_HINT_T2);     // Entries aren't cache line aligned, so one may straddle two lines
+        }
+
         inline bool Lookup(KeyType key, unsigned nValuesToFill, ValueType *values) const {
             _ASSERT(nValuesToFill <= valueCount);
             char *entry = (char *)GetFirstValueForKey(key);
@@ -145,6 +185,9 @@ private:
         static const unsigned QUADRATIC_CHAINING_DEPTH = 5; // Chain quadratically for this long, then linerarly  Set to 0 for linear chaining
 		static SNAPHashTable *loadCommon(GenericFile *loadFile);
 
+        void setLayout(Layout i_layout);
+        size_t getTableSizeInBytes() const {return BucketedLayout == layout ? nBuckets * BucketSize : tableSize * elementSize;}
+
         //
         // A hash table entry consists of a set of valueCount values, each of valueSizeInBytes bytes, followed by
         // a key of keySizeInBytes bytes.  The key size must be between 4 and 8 bytes, inclusive.
@@ -166,9 +209,71 @@ private:
         // understand the format and try to make it less opaque to use them.
         
         inline void *getEntry(_uint64 whichEntry) const {
+            if (BucketedLayout == layout) {
+                return getBucket(whichEntry / entriesPerBucket) + bucketEntryOffset + elementSize * (whichEntry % entriesPerBucket);
+            }
             return ((char *)Table + elementSize * whichEntry);
         }
 
+        //
+        // A bucket is entriesPerBucket one byte tags, padded out to bucketEntryOffset, followed by entriesPerBucket
+        // entries in the same format as in the linear probing layout.  A tag of 0 means the entry is unused; used
+        // entries have the high byte of the key's hash, with 0 mapped to 1.  Entries are filled in from the front of
+        // the bucket and never removed, so the first unused entry in a bucket means the key can't be any further on.
+        //
+        static const unsigned BucketSize = 64;
+
+        inline char *getBucket(_uint64 whichBucket) const {
+            return (char *)Table + BucketSize * whichBucket;
+        }
+
+        static inline char tagForHash(_uint64 hashValue) {
+            char tag = (char)(hashValue >> 56);
+            return 0 == tag ? 1 : tag;
+        }
+
+        inline void *getBucketedEntryForKey(KeyType key, bool returnUnusedEntry) const {
+            _uint64 hashValue = hash(key);
+            _uint64 whichBucket = hashValue % nBuckets;
+            __m128i tagToMatch = _mm_set1_epi8(tagForHash(hashValue));
+
+            for (_uint64 nBucketsProbed = 0; nBucketsProbed < nBuckets; nBucketsProbed++) {
+                char *bucket = getBucket(whichBucket);
+                __m128i tags = _mm_loadu_si128((const __m128i *)bucket);   // entriesPerBucket <= 16, so this covers all of the tags
+
+                unsigned matches = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(tags, tagToMatch)) & tagMask;
+                while (0 != matches) {
+                    unsigned long whichEntry;
+                    CountTrailingZeroes(matches, whichEntry);
+                    char *entry = bucket + bucketEntryOffset + elementSize * whichEntry;
+                    if (isKeyEqual(entry, key)) {
+                        return entry;
+                    }
+                    matches &= matches - 1;
+                }
+
+                unsigned unused = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(tags, _mm_setzero_si128())) & tagMask;
+                if (0 != unused) {
+                    if (!returnUnusedEntry) {
+                        return NULL;
+                    }
+                    unsigned long whichEntry;
+                    CountTrailingZeroes(unused, whichEntry);
+                    return bucket + bucketEntryOffset + elementSize * whichEntry;
+                }
+
+                whichBucket = (whichBucket + 1 == nBuckets) ? 0 : whichBucket + 1;
+            }
+
+            return NULL;    // The table is full and the key isn't in it
+        }
+
+        inline char *getTagForEntry(void *entry) const {
+            _uint64 offset = (char *)entry - (char *)Table;
+            char *bucket = getBucket(offset / BucketSize);
+            return bucket + ((char *)entry - bucket - bucketEntryOffset) / elementSize;
+        }
+
         inline bool doesEntryHaveInvalidValue(void *entry) const
         {
             return !memcmp(entry, &invalidValueValue, valueSizeInBytes);
@@ -206,6 +311,12 @@ private:
         unsigned valueSizeInBytes;
         unsigned valueCount;
         ValueType invalidValueValue;
+
+        Layout layout;
+        _uint64 nBuckets;               // Only used in the bucketed layout, where tableSize == nBuckets * entriesPerBucket
+        unsigned entriesPerBucket;
+        unsigned bucketEntryOffset;
+        unsigned tagMask;               // The low entriesPerBucket bits set
  
         //
         // Returns either the entry for this key, or else the entry where the key would be
@@ -215,5 +326,6 @@ private:
 
         friend class SeedCountIterator;
 
-        static const unsigned magic;
+        static const unsigned magic;            // Linear probing layout
+        static const unsigned bucketedMagic;    // Bucketed layout
 };
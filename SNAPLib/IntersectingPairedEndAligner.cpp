@@ -28,6 +28,7 @@ Revision History:
 #include "Error.h"
 #include "BigAlloc.h"
 #include "AlignerOptions.h"
+#include "ReadPreprocessing.h"
 
 #ifdef  _DEBUG
 extern bool _DumpAlignments;    // From BaseAligner.cpp
@@ -56,6 +57,7 @@ IntersectingPairedEndAligner::IntersectingPairedEndAligner(
     maxSecondaryAlignmentsPerContig(maxSecondaryAlignmentsPerContig_)
 {
     doesGenomeIndexHave64BitLocations = index->doesGenomeIndexHave64BitLocations();
+    tracebacks = NULL;
 
     unsigned maxSeedsToUse;
     if (0 != numSeedsFromCommandLine) {
@@ -65,18 +67,6 @@ IntersectingPairedEndAligner::IntersectingPairedEndAligner(
     }
     allocateDynamicMemory(allocator, maxReadSize, maxBigHits, maxSeedsToUse, maxK, extraSearchDepth, maxCandidatePoolSize, maxSecondaryAlignmentsPerContig);
 
-    rcTranslationTable['A'] = 'T';
-    rcTranslationTable['G'] = 'C';
-    rcTranslationTable['C'] = 'G';
-    rcTranslationTable['T'] = 'A';
-    rcTranslationTable['N'] = 'N';
-
-    for (unsigned i = 0; i < 256; i++) {
-        nTable[i] = 0;
-    }
-
-    nTable['N'] = 1;
-
     seedLen = index->getSeedLength();
 
     genome = index->getGenome();
@@ -120,6 +110,7 @@ IntersectingPairedEndAligner::allocateDynamicMemory(BigAllocator *allocator, uns
     for (unsigned whichRead = 0; whichRead < NUM_READS_PER_PAIR; whichRead++) {
         rcReadData[whichRead] = (char *)allocator->allocate(maxReadSize);
         rcReadQuality[whichRead] = (char *)allocator->allocate(maxReadSize);
+        readSeeds[whichRead] = (Seed *)allocator->allocate(sizeof(Seed) * maxReadSize);
 
         for (Direction dir = 0; dir < NUM_DIRECTIONS; dir++) {
             reversedRead[whichRead][dir] = (char *)allocator->allocate(maxReadSize);
@@ -128,6 +119,8 @@ IntersectingPairedEndAligner::allocateDynamicMemory(BigAllocator *allocator, uns
         }
     }
 
+    genomeUnpackBuffer = (char *)allocator->allocate(Genome::getUnpackBufferSize(maxReadSize + MAX_K, MAX_K));
+
     scoringCandidatePoolSize = min(maxCandidatePoolSize, maxBigHitsToConsider * maxSeedsToUse * NUM_READS_PER_PAIR);
 
     scoringCandidates = (ScoringCandidate **) allocator->allocate(sizeof(ScoringCandidate *) * (maxEditDistanceToConsider + maxExtraSearchDepth + 1));  //+1 is for 0.
@@ -168,6 +161,8 @@ IntersectingPairedEndAligner::align(
 {
     result->nLVCalls = 0;
     result->nSmallHits = 0;
+    result->traceback[0].clear();
+    result->traceback[1].clear();
 
     *nSecondaryResults = 0;
     *nSingleEndSecondaryResultsForFirstRead = 0;
@@ -201,8 +196,12 @@ IntersectingPairedEndAligner::align(
     GenomeLocation bestResultGenomeLocation[NUM_READS_PER_PAIR];
     Direction bestResultDirection[NUM_READS_PER_PAIR];
     unsigned bestResultScore[NUM_READS_PER_PAIR];
+    AlignmentTraceback bestResultTraceback[NUM_READS_PER_PAIR];
     unsigned popularSeedsSkipped[NUM_READS_PER_PAIR];
 
+    bestResultTraceback[0].clear();
+    bestResultTraceback[1].clear();
+
     reads[0][FORWARD] = read0;
     reads[1][FORWARD] = read1;
 
@@ -241,32 +240,29 @@ IntersectingPairedEndAligner::align(
             soft_exit(1);
         }
 
-        for (unsigned i = 0; i < reads[whichRead][FORWARD]->getDataLength(); i++) {
-            rcReadData[whichRead][i] = rcTranslationTable[read->getData()[readLen[whichRead] - i - 1]];
-            rcReadQuality[whichRead][i] = read->getQuality()[readLen[whichRead] - i - 1];
-            countOfNs += nTable[read->getData()[i]];
-        }
+        //
+        // Along with the RC read, this builds the reverse data in both directions for the backwards LV and the seeds.
+        //
+        PreprocessedRead preprocessed;
+        preprocessed.rcData = rcReadData[whichRead];
+        preprocessed.rcQuality = rcReadQuality[whichRead];
+        preprocessed.reversedData = reversedRead[whichRead][FORWARD];
+        preprocessed.reversedRCData = reversedRead[whichRead][RC];
+        preprocessed.seeds = readSeeds[whichRead];
+        preprocessed.seedLen = seedLen;
+        PreprocessRead(read->getData(), read->getQuality(), readLen[whichRead], &preprocessed);
+
+        countOfNs += preprocessed.nNs;
+        allBasesAreACGT[whichRead] = 0 == preprocessed.nNonACGTBases;
+
         reads[whichRead][RC] = &rcReads[whichRead];
-        reads[whichRead][RC]->init(read->getId(), read->getIdLength(), rcReadData[whichRead], rcReadQuality[whichRead], read->getDataLength());
+        reads[whichRead][RC]->init(read->getId(), read->getIdLength(), rcReadData[whichRead], rcReadQuality[whichRead], read->getDataLength(), true);
     }
 
     if (countOfNs > maxK) {
         return;
     }
 
-    //
-    // Build the reverse data for both reads in both directions for the backwards LV to use.
-    //
-    for (unsigned whichRead = 0; whichRead < NUM_READS_PER_PAIR; whichRead++) {
-        for (Direction dir = 0; dir < NUM_DIRECTIONS; dir++) {
-            Read *read = reads[whichRead][dir];
-
-            for (unsigned i = 0; i < read->getDataLength(); i++) {
-                reversedRead[whichRead][dir][i] = read->getData()[read->getDataLength() - i - 1];
-            }
-        }
-    }
-
     unsigned thisPassSeedsNotSkipped[NUM_READS_PER_PAIR][NUM_DIRECTIONS] = {{0,0}, {0,0}};
 
     //
@@ -320,7 +316,7 @@ IntersectingPairedEndAligner::align(
 
             SetSeedUsed(nextSeedToTest);
 
-            if (!Seed::DoesTextRepresentASeed(reads[whichRead][FORWARD]->getData() + nextSeedToTest, seedLen)) {
+            if (!allBasesAreACGT[whichRead] && !Seed::DoesTextRepresentASeed(reads[whichRead][FORWARD]->getData() + nextSeedToTest, seedLen)) {
                 //
                 // It's got Ns in it, so just skip it.
                 //
@@ -328,7 +324,7 @@ IntersectingPairedEndAligner::align(
                 continue;
             }
 
-            Seed seed(reads[whichRead][FORWARD]->getData() + nextSeedToTest, seedLen);
+            Seed seed = readSeeds[whichRead][nextSeedToTest];
             //
             // Find all instances of this seed in the genome.
             //
@@ -601,9 +597,10 @@ IntersectingPairedEndAligner::align(
         unsigned fewerEndScore;
         double fewerEndMatchProbability;
         int fewerEndGenomeLocationOffset;
+        AlignmentTraceback fewerEndTraceback;
 
         scoreLocation(readWithFewerHits, setPairDirection[candidate->whichSetPair][readWithFewerHits], candidate->readWithFewerHitsGenomeLocation,
-            candidate->seedOffset, scoreLimit, &fewerEndScore, &fewerEndMatchProbability, &fewerEndGenomeLocationOffset);
+            candidate->seedOffset, scoreLimit, &fewerEndScore, &fewerEndMatchProbability, &fewerEndGenomeLocationOffset, &fewerEndTraceback);
 
         _ASSERT(-1 == fewerEndScore || fewerEndScore >= candidate->bestPossibleScore);
 
@@ -637,7 +634,7 @@ IntersectingPairedEndAligner::align(
                     if (mate->score == -2 || mate->score == -1 && mate->scoreLimit < scoreLimit - fewerEndScore) {
                         scoreLocation(readWithMoreHits, setPairDirection[candidate->whichSetPair][readWithMoreHits], mate->readWithMoreHitsGenomeLocation,
                             mate->seedOffset, scoreLimit - fewerEndScore, &mate->score, &mate->matchProbability,
-                            &mate->genomeOffset);
+                            &mate->genomeOffset, &mate->traceback);
 #ifdef _DEBUG
                         if (_DumpAlignments) {
                             printf("Scored mate candidate %d, set pair %d, read %d, location %u, seed offset %d, score limit %d, score %d, offset %d\n",
@@ -752,6 +749,7 @@ IntersectingPairedEndAligner::align(
                                         result->mapq[r] = 0;
                                         result->score[r] = bestResultScore[r];
                                         result->status[r] = MultipleHits;
+                                        result->traceback[r] = bestResultTraceback[r];
                                     }
  
                                     (*nSecondaryResults)++;
@@ -765,6 +763,8 @@ IntersectingPairedEndAligner::align(
                                 bestResultScore[readWithMoreHits] = mate->score;
                                 bestResultDirection[readWithFewerHits] = setPairDirection[candidate->whichSetPair][readWithFewerHits];
                                 bestResultDirection[readWithMoreHits] = setPairDirection[candidate->whichSetPair][readWithMoreHits];
+                                bestResultTraceback[readWithFewerHits] = fewerEndTraceback;
+                                bestResultTraceback[readWithMoreHits] = mate->traceback;
 
                                 if (!noUkkonen) {
                                     scoreLimit = bestPairScore + extraSearchDepth;
@@ -792,6 +792,8 @@ IntersectingPairedEndAligner::align(
                                     result->score[readWithMoreHits] = mate->score;
                                     result->score[readWithFewerHits] = fewerEndScore;
                                     result->status[readWithFewerHits] = result->status[readWithMoreHits] = MultipleHits;
+                                    result->traceback[readWithMoreHits] = mate->traceback;
+                                    result->traceback[readWithFewerHits] = fewerEndTraceback;
 
                                     (*nSecondaryResults)++;
                                 }
@@ -859,6 +861,7 @@ doneScoring:
             result->mapq[whichRead] = computeMAPQ(probabilityOfAllPairs, probabilityOfBestPair, bestResultScore[whichRead], popularSeedsSkipped[0] + popularSeedsSkipped[1]);
             result->status[whichRead] = result->mapq[whichRead] > MAPQ_LIMIT_FOR_SINGLE_HIT ? SingleHit : MultipleHits;
             result->score[whichRead] = bestResultScore[whichRead];
+            result->traceback[whichRead] = bestResultTraceback[whichRead];
         }
 #ifdef  _DEBUG
             if (_DumpAlignments) {
@@ -966,14 +969,16 @@ IntersectingPairedEndAligner::scoreLocation(
     unsigned             scoreLimit,
     unsigned            *score,
     double              *matchProbability,
-    int                 *genomeLocationOffset)
+    int                 *genomeLocationOffset,
+    AlignmentTraceback  *traceback)
 {
     nLocationsScored++;
+    traceback->clear();
 
     Read *readToScore = reads[whichRead][direction];
     unsigned readDataLength = readToScore->getDataLength();
     GenomeDistance genomeDataLength = readDataLength + MAX_K; // Leave extra space in case the read has deletions
-    const char *data = genome->getSubstring(genomeLocation, genomeDataLength);
+    const char *data = genome->getSubstring(genomeLocation, genomeDataLength, genomeUnpackBuffer, MAX_K);
 
 #if		0 // This only happens when genomeLocation is in the padding, which can lead to no good.  Just say no.
     if (NULL == data) {
@@ -1044,6 +1049,17 @@ IntersectingPairedEndAligner::scoreLocation(
             _ASSERT(*score <= scoreLimit);
             // Map probabilities for substrings can be multiplied, but make sure to count seed too
             *matchProbability = matchProb1 * matchProb2 * pow(1 - SNP_PROB, seedLen);
+
+            if (NULL != tracebacks) {
+                //
+                // The part before the seed was scored backward, and LandauVishkin<-1> appends it in genome order.
+                //
+                tracebacks->start();
+                reverseLandauVishkin->appendTraceback(tracebacks);
+                tracebacks->append('=', seedLen);
+                landauVishkin->appendTraceback(tracebacks);
+                *traceback = tracebacks->finish();
+            }
         }
     }
 
@@ -1058,6 +1074,7 @@ IntersectingPairedEndAligner::scoreLocation(
     maxSeeds = maxSeeds_;
     maxMergeDistance = maxMergeDistance_;
     doesGenomeIndexHave64BitLocations = doesGenomeIndexHave64BitLocations_;
+    kernel = GetProcessorSIMDLevel();
     nLookupsUsed = 0;
     if (doesGenomeIndexHave64BitLocations) {
         lookups64 = (HashTableLookup<GenomeLocation> *)allocator->allocate(sizeof(HashTableLookup<GenomeLocation>) * maxSeeds);
@@ -1180,6 +1197,177 @@ IntersectingPairedEndAligner::HashTableHitSet::computeBestPossibleScoreForCurren
 	return bestPossibleScoreSoFar;
 }
 
+//
+// Matchers for findFirstHitAtOrBelow.  Each looks at four consecutive hits and returns the index of the first one that's <= maxToFind,
+// or 4 if there isn't one.  Because hit lists are sorted from largest to smallest, the lanes that are above the limit are always
+// a prefix, so the answer is just the number of them.
+//
+struct HitListScalarMatcher {
+    static inline int firstAtOrBelow(const unsigned *hits, unsigned maxToFind)
+    {
+        for (int i = 0; i < 4; i++) {
+            if (hits[i] <= maxToFind) {
+                return i;
+            }
+        }
+        return 4;
+    }
+
+    static inline int firstAtOrBelow(const GenomeLocation *hits, GenomeLocation maxToFind)
+    {
+        for (int i = 0; i < 4; i++) {
+            if (hits[i] <= maxToFind) {
+                return i;
+            }
+        }
+        return 4;
+    }
+};
+
+#ifdef SIMD_KERNELS_AVAILABLE
+//
+// SSE has only a signed 32 bit compare, so flip the sign bits to compare unsigned.  The 64 bit compare needs SSE4.2, so
+// 64 bit hits stay scalar at this level.
+//
+struct HitListSSE41Matcher {
+    SIMD_TARGET("sse4.1") static inline int firstAtOrBelow(const unsigned *hits, unsigned maxToFind)
+    {
+        const __m128i signFlip = _mm_set1_epi32(0x80000000);
+        __m128i hitChunk = _mm_xor_si128(_mm_loadu_si128((const __m128i *)hits), signFlip);
+        __m128i limit = _mm_xor_si128(_mm_set1_epi32((int)maxToFind), signFlip);
+        unsigned above = (unsigned)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(hitChunk, limit)));
+        unsigned long nAbove;
+        CountTrailingZeroes((_uint64)(~above & 0x1f), nAbove);
+        return (int)nAbove;
+    }
+
+    static inline int firstAtOrBelow(const GenomeLocation *hits, GenomeLocation maxToFind)
+    {
+        return HitListScalarMatcher::firstAtOrBelow(hits, maxToFind);
+    }
+};
+
+//
+// Genome locations are never negative, so the signed 64 bit compare is fine.
+//
+struct HitListAVX2Matcher {
+    SIMD_TARGET("avx2") static inline int firstAtOrBelow(const unsigned *hits, unsigned maxToFind)
+    {
+        return HitListSSE41Matcher::firstAtOrBelow(hits, maxToFind);
+    }
+
+    SIMD_TARGET("avx2") static inline int firstAtOrBelow(const GenomeLocation *hits, GenomeLocation maxToFind)
+    {
+        __m256i hitChunk = _mm256_loadu_si256((const __m256i *)hits);
+        __m256i limit = _mm256_set1_epi64x(GenomeLocationAsInt64(maxToFind));
+        unsigned above = (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(hitChunk, limit)));
+        unsigned long nAbove;
+        CountTrailingZeroes((_uint64)(~above & 0x1f), nAbove);
+        return (int)nAbove;
+    }
+};
+#endif // SIMD_KERNELS_AVAILABLE
+
+template<class MATCHER, class GL> SIMD_FORCE_INLINE _int64 gallopToFirstHitAtOrBelow(const GL *hits, _int64 start, _int64 nHits, GL maxToFind)
+{
+    //
+    // Everything in [start, lo) is above maxToFind.  Most of the time the answer is close, so look at the first four directly.
+    //
+    _int64 lo = start;
+    int lane;
+    if (lo + 4 <= nHits) {
+        lane = MATCHER::firstAtOrBelow(hits + lo, maxToFind);
+        if (lane < 4) {
+            return lo + lane;
+        }
+        lo += 4;
+    }
+
+    //
+    // Gallop until we step onto a hit that's <= maxToFind (or off the end), which becomes hi.
+    //
+    _int64 hi;
+    for (_int64 step = 4; ; step *= 2) {
+        _int64 probe = lo + step;
+        if (probe >= nHits) {
+            hi = nHits;
+            break;
+        }
+        if (hits[probe] <= maxToFind) {
+            hi = probe;
+            break;
+        }
+        lo = probe + 1;
+    }
+
+    while (hi - lo > 8) {
+        _int64 probe = lo + (hi - lo) / 2;
+        if (hits[probe] <= maxToFind) {
+            hi = probe;
+        } else {
+            lo = probe + 1;
+        }
+    }
+
+    while (lo + 4 <= hi) {
+        lane = MATCHER::firstAtOrBelow(hits + lo, maxToFind);
+        if (lane < 4) {
+            return lo + lane;
+        }
+        lo += 4;
+    }
+
+    while (lo < hi && hits[lo] > maxToFind) {
+        lo++;
+    }
+
+    return lo;
+}
+
+#ifdef SIMD_KERNELS_AVAILABLE
+//
+// These exist only to give the inlined search the target attribute, so the compiler can inline the vector matchers into it.
+//
+SIMD_TARGET("sse4.1") static _int64 gallopSSE41(const unsigned *hits, _int64 start, _int64 nHits, unsigned maxToFind)
+{
+    return gallopToFirstHitAtOrBelow<HitListSSE41Matcher>(hits, start, nHits, maxToFind);
+}
+
+SIMD_TARGET("avx2") static _int64 gallopAVX2(const unsigned *hits, _int64 start, _int64 nHits, unsigned maxToFind)
+{
+    return gallopToFirstHitAtOrBelow<HitListAVX2Matcher>(hits, start, nHits, maxToFind);
+}
+
+SIMD_TARGET("avx2") static _int64 gallopAVX2(const GenomeLocation *hits, _int64 start, _int64 nHits, GenomeLocation maxToFind)
+{
+    return gallopToFirstHitAtOrBelow<HitListAVX2Matcher>(hits, start, nHits, maxToFind);
+}
+#endif // SIMD_KERNELS_AVAILABLE
+
+    _int64
+IntersectingPairedEndAligner::findFirstHitAtOrBelow(SIMDLevel kernel, const unsigned *hits, _int64 start, _int64 nHits, unsigned maxToFind)
+{
+#ifdef SIMD_KERNELS_AVAILABLE
+    if (SIMDLevelAVX2 == kernel) {
+        return gallopAVX2(hits, start, nHits, maxToFind);
+    } else if (SIMDLevelSSE41 == kernel) {
+        return gallopSSE41(hits, start, nHits, maxToFind);
+    }
+#endif // SIMD_KERNELS_AVAILABLE
+    return gallopToFirstHitAtOrBelow<HitListScalarMatcher>(hits, start, nHits, maxToFind);
+}
+
+    _int64
+IntersectingPairedEndAligner::findFirstHitAtOrBelow(SIMDLevel kernel, const GenomeLocation *hits, _int64 start, _int64 nHits, GenomeLocation maxToFind)
+{
+#ifdef SIMD_KERNELS_AVAILABLE
+    if (SIMDLevelAVX2 == kernel) {
+        return gallopAVX2(hits, start, nHits, maxToFind);
+    }
+#endif // SIMD_KERNELS_AVAILABLE
+    return gallopToFirstHitAtOrBelow<HitListScalarMatcher>(hits, start, nHits, maxToFind);
+}
+
 	bool
 IntersectingPairedEndAligner::HashTableHitSet::getNextHitLessThanOrEqualTo(GenomeLocation maxGenomeLocationToFind, GenomeLocation *actualGenomeLocationFound, unsigned *seedOffsetFound)
 {
@@ -1187,82 +1375,52 @@ IntersectingPairedEndAligner::HashTableHitSet::getNextHitLessThanOrEqualTo(Genom
     bool anyFound = false;
     GenomeLocation bestLocationFound = 0;
     for (unsigned i = 0; i < nLookupsUsed; i++) {
-        //
-        // Binary search from the current starting offset to either the right place or the end.
-        //
-        _int64 limit[2];
+        _int64 *currentHitForIntersection;
+        _int64 nHits;
+        unsigned seedOffset;
         GenomeLocation maxGenomeLocationToFindThisSeed;
+        GenomeLocation foundHit;
+        _int64 found;
 
+        //
+        // Search down from where the last call left off.  The binary search that this replaced would only accept the first
+        // hit in the whole list that's <= the target, so if the hit just above our position already qualifies, this lookup is done.
+        //
         if (doesGenomeIndexHave64BitLocations) {
-            limit[0] = (_int64)lookups64[i].currentHitForIntersection;
-            limit[1] = (_int64)lookups64[i].nHits - 1;
-            maxGenomeLocationToFindThisSeed = maxGenomeLocationToFind + lookups64[i].seedOffset;
-        } else {
-            limit[0] = (_int64)lookups32[i].currentHitForIntersection;
-            limit[1] = (_int64)lookups32[i].nHits - 1;
-            maxGenomeLocationToFindThisSeed = maxGenomeLocationToFind + lookups32[i].seedOffset;
-        }
- 
-        while (limit[0] <= limit[1]) {
-            _int64 probe = (limit[0] + limit[1]) / 2;
-            if (doAlignerPrefetch) { // not clear this helps.  We're probably not far enough ahead.
-                if (doesGenomeIndexHave64BitLocations) {
-                    _mm_prefetch((const char *)&lookups64[i].hits[(limit[0] + probe) / 2 - 1], _MM_HINT_T2);
-                    _mm_prefetch((const char *)&lookups64[i].hits[(limit[1] + probe) / 2 + 1], _MM_HINT_T2);
-                } else {
-                    _mm_prefetch((const char *)&lookups32[i].hits[(limit[0] + probe) / 2 - 1], _MM_HINT_T2);
-                    _mm_prefetch((const char *)&lookups32[i].hits[(limit[1] + probe) / 2 + 1], _MM_HINT_T2);
+            currentHitForIntersection = &lookups64[i].currentHitForIntersection;
+            nHits = lookups64[i].nHits;
+            seedOffset = lookups64[i].seedOffset;
+            maxGenomeLocationToFindThisSeed = maxGenomeLocationToFind + seedOffset;
+            if (*currentHitForIntersection == nHits || (*currentHitForIntersection > 0 && lookups64[i].hits[*currentHitForIntersection - 1] <= maxGenomeLocationToFindThisSeed)) {
+                found = nHits;
+            } else {
+                found = findFirstHitAtOrBelow(kernel, lookups64[i].hits, *currentHitForIntersection, nHits, maxGenomeLocationToFindThisSeed);
+                if (found != nHits) {
+                    foundHit = lookups64[i].hits[found];
                 }
             }
-            //
-            // Recall that the hit sets are sorted from largest to smallest, so the strange looking logic is actually right.
-            // We're evaluating the expression "lookups[i].hits[probe] <= maxGenomeOffsetToFindThisSeed && (probe == 0 || lookups[i].hits[probe-1] > maxGenomeOffsetToFindThisSeed)"
-            // It's written in this strange way just so the profile tool will show us where the time's going.
-            //
-            GenomeLocation probeHit;
-            GenomeLocation probeMinusOneHit;
-            unsigned seedOffset;
-            if (doesGenomeIndexHave64BitLocations) {
-                probeHit = lookups64[i].hits[probe];
-                probeMinusOneHit = lookups64[i].hits[probe-1];
-                seedOffset = lookups64[i].seedOffset;
+        } else {
+            currentHitForIntersection = &lookups32[i].currentHitForIntersection;
+            nHits = lookups32[i].nHits;
+            seedOffset = lookups32[i].seedOffset;
+            maxGenomeLocationToFindThisSeed = maxGenomeLocationToFind + seedOffset;
+            if (*currentHitForIntersection == nHits || (*currentHitForIntersection > 0 && lookups32[i].hits[*currentHitForIntersection - 1] <= maxGenomeLocationToFindThisSeed)) {
+                found = nHits;
             } else {
-                probeHit = lookups32[i].hits[probe];
-                probeMinusOneHit = lookups32[i].hits[probe-1];
-                seedOffset = lookups32[i].seedOffset;
-            }
-            unsigned clause1 =  probeHit <= maxGenomeLocationToFindThisSeed;
-            unsigned clause2 = probe == 0;
-
-            if (clause1 && (clause2 || probeMinusOneHit > maxGenomeLocationToFindThisSeed)) {
-                if (probeHit - seedOffset > bestLocationFound) {
-					anyFound = true;
-                    mostRecentLocationReturned = *actualGenomeLocationFound = bestLocationFound = probeHit - seedOffset;
-                    *seedOffsetFound = seedOffset;
-                }
-
-                if (doesGenomeIndexHave64BitLocations) {
-                    lookups64[i].currentHitForIntersection = probe;
-                } else {
-                    lookups32[i].currentHitForIntersection = probe;
+                unsigned maxHitToFind = (unsigned)__min(GenomeLocationAsInt64(maxGenomeLocationToFindThisSeed), (_int64)0xffffffff);
+                found = findFirstHitAtOrBelow(kernel, lookups32[i].hits, *currentHitForIntersection, nHits, maxHitToFind);
+                if (found != nHits) {
+                    foundHit = lookups32[i].hits[found];
                 }
-                break;
             }
+        }
 
-            if (probeHit > maxGenomeLocationToFindThisSeed) {   // Recode this without the if to avoid the hard-to-predict branch.
-                limit[0] = probe + 1;
-            } else {
-                limit[1] = probe - 1;
-            }
-        } // While we're looking
+        *currentHitForIntersection = found;
 
-        if (limit[0] > limit[1]) {
-            // We're done with this lookup.
-            if (doesGenomeIndexHave64BitLocations) {
-                lookups64[i].currentHitForIntersection = lookups64[i].nHits;    
-            } else {
-                lookups32[i].currentHitForIntersection = lookups32[i].nHits;
-            }
+        if (found != nHits && foundHit - seedOffset > bestLocationFound) {
+            anyFound = true;
+            mostRecentLocationReturned = *actualGenomeLocationFound = bestLocationFound = foundHit - seedOffset;
+            *seedOffsetFound = seedOffset;
         }
     } // For each lookup
 
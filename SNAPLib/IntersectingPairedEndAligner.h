@@ -76,6 +76,8 @@ public:
         landauVishkin = landauVishkin_;
         reverseLandauVishkin = reverseLandauVishkin_;
     }
+
+    virtual void setTracebackBuffer(TracebackBuffer *tracebacks_) {tracebacks = tracebacks_;}
     
     virtual ~IntersectingPairedEndAligner();
     
@@ -108,6 +110,15 @@ public:
          return nLocationsScored;
      }
 
+    //
+    // Find the first hit at or after start that's <= maxToFind in a seed's hit list, which is sorted from largest to smallest.
+    // Returns nHits if there isn't one.  This gallops from start (steps of 4, 8, 16...), binary searches the last step and
+    // then finishes with vector compares, because successive searches in the intersection usually move only a little.
+    // kernel selects the vector instructions; it's here so that tests can compare them.
+    //
+    static _int64 findFirstHitAtOrBelow(SIMDLevel kernel, const unsigned *hits, _int64 start, _int64 nHits, unsigned maxToFind);
+    static _int64 findFirstHitAtOrBelow(SIMDLevel kernel, const GenomeLocation *hits, _int64 start, _int64 nHits, GenomeLocation maxToFind);
+
 
 private:
 
@@ -261,6 +272,7 @@ private:
         GenomeLocation                      mostRecentLocationReturned;
 		unsigned		                    maxMergeDistance;
         bool                                doesGenomeIndexHave64BitLocations;
+        SIMDLevel                           kernel;
     };
 
     HashTableHitSet *                       hashTableHitSets[NUM_READS_PER_PAIR][NUM_DIRECTIONS];
@@ -303,18 +315,21 @@ private:
 
     char *rcReadData[NUM_READS_PER_PAIR];                   // the reverse complement of the data for each read
     char *rcReadQuality[NUM_READS_PER_PAIR];                // the reversed quality strings for each read
+    Seed *readSeeds[NUM_READS_PER_PAIR];                    // the seed at each offset of each read, built along with the RC read
+    bool allBasesAreACGT[NUM_READS_PER_PAIR];               // so every offset in readSeeds is a seed
     unsigned readLen[NUM_READS_PER_PAIR];
 
     Read *reads[NUM_READS_PER_PAIR][NUM_DIRECTIONS];        // These are the reads that are provided in the align call, together with their reverse complements, which are computed.
     Read rcReads[NUM_READS_PER_PAIR][NUM_DIRECTIONS];
 
     char *reversedRead[NUM_READS_PER_PAIR][NUM_DIRECTIONS]; // The reversed data for each read for forward and RC.  This is used in the backwards LV
+    char *genomeUnpackBuffer;   // Where candidate genome data goes when the genome is packed
 
     LandauVishkin<> *landauVishkin;
     LandauVishkin<-1> *reverseLandauVishkin;
 
-    char rcTranslationTable[256];
-    unsigned nTable[256];
+    TracebackBuffer *tracebacks;    // NULL unless we're keeping tracebacks
+
 
     BYTE *seedUsed;
 
@@ -343,7 +358,8 @@ private:
             unsigned             scoreLimit,
             unsigned            *score,
             double              *matchProbability,
-            int                 *genomeLocationOffset   // The computed offset for genomeLocation (which is needed because we scan several different possible starting locations)
+            int                 *genomeLocationOffset,  // The computed offset for genomeLocation (which is needed because we scan several different possible starting locations)
+            AlignmentTraceback  *traceback              // The edits, if we're keeping tracebacks and the score isn't -1; cleared otherwise
     );
 
     //
@@ -399,6 +415,7 @@ private:
         unsigned                scoreLimit;             // The scoreLimit with which score was computed
         unsigned                seedOffset;
         int                     genomeOffset;
+        AlignmentTraceback      traceback;
 
         void init(GenomeLocation readWithMoreHitsGenomeLocation_, unsigned bestPossibleScore_, unsigned seedOffset_) {
             readWithMoreHitsGenomeLocation = readWithMoreHitsGenomeLocation_;
@@ -408,6 +425,7 @@ private:
             scoreLimit = -1;
             matchProbability = 0;
             genomeOffset = 0;
+            traceback.clear();
         }
     };
 
@@ -1,6 +1,7 @@
 #include "stdafx.h"
 #include "Compat.h"
 #include "LandauVishkin.h"
+#include "BitParallelEditDistance.h"
 #include "mapq.h"
 #include "Read.h"
 #include "BaseAligner.h"
@@ -12,7 +13,7 @@ using std::make_pair;
 using std::min;
 
  
-LandauVishkinWithCigar::LandauVishkinWithCigar()
+LandauVishkinWithCigar::LandauVishkinWithCigar() : bitParallel(NULL), scratch(NULL), scratchBytes(0)
 {
     for (int i = 0; i < MAX_K+1; i++) {
         for (int j = 0; j < 2*MAX_K+1; j++) {
@@ -22,6 +23,24 @@ LandauVishkinWithCigar::LandauVishkinWithCigar()
     totalIndels[0][MAX_K] = 0;
 }
 
+LandauVishkinWithCigar::~LandauVishkinWithCigar()
+{
+    delete bitParallel;
+    delete [] scratch;
+}
+
+    char*
+LandauVishkinWithCigar::getScratch(
+    size_t bytes)
+{
+    if (bytes > scratchBytes) {
+        delete [] scratch;
+        scratchBytes = __max(bytes, 2 * scratchBytes);
+        scratch = new char[scratchBytes];
+    }
+    return scratch;
+}
+
 /*++
     Write cigar to buffer, return true if it fits
     null-terminates buffer if it returns false (i.e. fills up buffer)
@@ -145,6 +164,14 @@ int LandauVishkinWithCigar::computeEditDistance(
     CigarFormat format, int* o_cigarBufUsed, int* o_textUsed,
     int *o_netIndel)
 {
+    if (UseBitParallelEditDistance(patternLen, k)) {
+        if (NULL == bitParallel) {
+            bitParallel = new BitParallelEditDistance<1>;
+        }
+        return bitParallel->computeEditDistance(text, textLen, pattern, patternLen, k, cigarBuf, cigarBufLen, useM, format,
+                                                o_cigarBufUsed, o_textUsed, o_netIndel);
+    }
+
     int localNetIndel;
     if (NULL == o_netIndel) {
         //
@@ -604,6 +631,91 @@ int LandauVishkinWithCigar::computeEditDistanceNormalized(
 #endif // 0 // This shouldn't happen anymore, the basic computeEditDistance doesn't allow it.  Just assert it
 	_ASSERT('I' != BAMAlignment::CodeToCigar[BAMAlignment::GetCigarOpCode(bamOps[bamOpCount - 1])]);
 
+    return finishNormalizedCigar(bamOps, bamOpCount, score, cigarBuf, cigarBufLen, format, o_cigarBufUsed, o_addFrontClipping);
+}
+
+    int
+LandauVishkinWithCigar::computeCigarFromTraceback(
+    const AlignmentTraceback *traceback,
+    int patternLen,
+    char *cigarBuf, int cigarBufLen, bool useM,
+    CigarFormat format, int* o_cigarBufUsed,
+    int* o_addFrontClipping,
+    int *o_netIndel)
+{
+    if (format != BAM_CIGAR_OPS && format != COMPACT_CIGAR_STRING) {
+        WriteErrorMessage("LandauVishkinWithCigar::computeCigarFromTraceback invalid parameter\n");
+        soft_exit(1);
+    }
+
+    //
+    // computeEditDistanceNormalized finds the fewest edits that align the pattern starting at the beginning of the text,
+    // and writes them without indels whenever that takes no more edits.  The traceback has the fewest edits on each
+    // side of the seed, which can place an indel differently, or have more edits than the best alignment that doesn't
+    // go through the seed.  So only use it when the two are sure to agree: no indels, and at most one substitution.
+    // The only alignment with fewer edits than that is the exact match, which goes through the seed and so would have
+    // been the traceback, so computeEditDistanceNormalized finds one edit and writes it as this same substitution.
+    // Otherwise return -1 and let the caller compute the CIGAR string.
+    //
+    const unsigned char *ops = (const unsigned char *)traceback->ops;
+    _uint32 bamOps[3];      // At most =, X, =
+    int bamOpCount = 0;
+    int score = 0;
+    int patternUsed = 0;
+
+    for (int i = 0; i < traceback->opsLength; i += 2) {
+        int count = ops[i];
+        char code = ops[i + 1];
+
+        if ('I' == code || 'D' == code) {
+            return -1;
+        }
+
+        if ('X' == code) {
+            score += count;
+            if (score > 1) {
+                return -1;
+            }
+        }
+        patternUsed += count;
+
+        if (useM) {
+            code = 'M';
+        }
+
+        if (bamOpCount > 0 && BAMAlignment::CodeToCigar[BAMAlignment::GetCigarOpCode(bamOps[bamOpCount - 1])] == code) {
+            bamOps[bamOpCount - 1] += count << 4;
+        } else {
+            _ASSERT(bamOpCount < 3);
+            bamOps[bamOpCount++] = (count << 4) | BAMAlignment::CigarToCode[code];
+        }
+    }
+
+    if (patternUsed != patternLen || 0 == bamOpCount) {
+        return -1;
+    }
+
+    if (format == BAM_CIGAR_OPS && bamOpCount * (int)sizeof(_uint32) > cigarBufLen) {
+        return -2;
+    }
+
+    if (NULL != o_netIndel) {
+        *o_netIndel = 0;
+    }
+
+    return finishNormalizedCigar(bamOps, bamOpCount, score, cigarBuf, cigarBufLen, format, o_cigarBufUsed, o_addFrontClipping);
+}
+
+    int
+LandauVishkinWithCigar::finishNormalizedCigar(
+    _uint32 *bamOps,
+    int bamOpCount,
+    int score,
+    char *cigarBuf, int cigarBufLen,
+    CigarFormat format, int* o_cigarBufUsed,
+    int* o_addFrontClipping)
+{
+    int bamBufUsed = bamOpCount * sizeof(_uint32);
     //
     // Turn leading 'D' into soft clipping, and 'I' into an alignment change followed by an X.
     //
@@ -764,3 +876,11 @@ initializeLVProbabilitiesToPhredPlus33()
 double *lv_phredToProbability = NULL;
 double *lv_indelProbabilities = NULL;
 double *lv_perfectMatchProbability = NULL;
+
+SIMDLevel lv_kernel = GetProcessorSIMDLevel();
+
+    void
+setLVKernel(SIMDLevel kernel)
+{
+    lv_kernel = __min(kernel, GetProcessorSIMDLevel());
+}
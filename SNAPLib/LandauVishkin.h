@@ -4,6 +4,10 @@
 #include "BigAlloc.h"
 #include "exit.h"
 #include "Genome.h"
+#include "AlignmentTraceback.h"
+#ifdef SIMD_KERNELS_AVAILABLE
+#include <immintrin.h>
+#endif
 
 const int MAX_K = 63;
 
@@ -35,6 +39,126 @@ struct LVResult {
 
 
 
+//
+// Kernels for counting the characters of an exact match starting at p and t.  All of them return the same value as
+// the original 8-bytes-at-a-time loop for every input (including availBytes <= 0), so they can be swapped without
+// changing any alignment.  The vector versions only load full vectors that lie within availBytes and finish with the
+// scalar loop, so they never read further past the end of the strings than the scalar version does.
+//
+struct LVScalarMatcher {
+    template<int TEXT_DIRECTION> static inline int countPerfectMatch(const char *p, const char *t, int availBytes)
+    {
+	    const char *pBase = p;
+	    const char *pend = p + availBytes;
+	    while (true) {
+		    _uint64 x;
+		    if (TEXT_DIRECTION == 1) {
+			    x = *((_uint64*)p) ^ *((_uint64*)t);
+		    } else {
+			    _uint64 T = *(_uint64 *)(t - 7);
+			    _uint64 tSwap = ByteSwapUI64(T);
+			    x = *((_uint64*)p) ^ tSwap;
+		    }
+
+		    if (x) {
+			    unsigned long zeroes;
+			    CountTrailingZeroes(x, zeroes);
+			    zeroes >>= 3;
+			    return __min((int)(p - pBase) + (int)zeroes, availBytes);
+		    } // if (x)
+
+		    p += 8;
+		    if (p >= pend) {
+			    return availBytes;
+		    }
+
+		    t += 8 * TEXT_DIRECTION;
+	    } // while true
+
+	    return 0;
+    }
+};
+
+#ifdef SIMD_KERNELS_AVAILABLE
+//
+// 16 bases per compare.  Running backward through the text needs pshufb (SSSE3) to reverse the text vector.
+//
+struct LVSSE41Matcher {
+    template<int TEXT_DIRECTION> SIMD_TARGET("sse4.1") static inline int countPerfectMatch(const char *p, const char *t, int availBytes)
+    {
+        const char *pBase = p;
+        const __m128i reverse = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        while (availBytes - (int)(p - pBase) >= 16) {
+            __m128i patternChunk = _mm_loadu_si128((const __m128i *)p);
+            __m128i textChunk;
+            if (TEXT_DIRECTION == 1) {
+                textChunk = _mm_loadu_si128((const __m128i *)t);
+            } else {
+                textChunk = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(t - 15)), reverse);
+            }
+            unsigned mismatches = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(patternChunk, textChunk)) & 0xffff;
+            if (mismatches) {
+                unsigned long zeroes;
+                CountTrailingZeroes((_uint64)mismatches, zeroes);
+                return (int)(p - pBase) + (int)zeroes;
+            }
+            p += 16;
+            t += 16 * TEXT_DIRECTION;
+        }
+
+        int used = (int)(p - pBase);
+        if (used > 0 && used == availBytes) {
+            return availBytes;
+        }
+        return used + LVScalarMatcher::countPerfectMatch<TEXT_DIRECTION>(p, t, availBytes - used);
+    }
+};
+
+//
+// 32 bases per compare.  The backward reversal is within each 128 bit lane followed by a lane swap.
+//
+struct LVAVX2Matcher {
+    template<int TEXT_DIRECTION> SIMD_TARGET("avx2") static inline int countPerfectMatch(const char *p, const char *t, int availBytes)
+    {
+        const char *pBase = p;
+        const __m256i reverse = _mm256_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                                                0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        while (availBytes - (int)(p - pBase) >= 32) {
+            __m256i patternChunk = _mm256_loadu_si256((const __m256i *)p);
+            __m256i textChunk;
+            if (TEXT_DIRECTION == 1) {
+                textChunk = _mm256_loadu_si256((const __m256i *)t);
+            } else {
+                textChunk = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(t - 31)), reverse);
+                textChunk = _mm256_permute2x128_si256(textChunk, textChunk, 1);
+            }
+            unsigned mismatches = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(patternChunk, textChunk));
+            if (mismatches) {
+                unsigned long zeroes;
+                CountTrailingZeroes((_uint64)mismatches, zeroes);
+                return (int)(p - pBase) + (int)zeroes;
+            }
+            p += 32;
+            t += 32 * TEXT_DIRECTION;
+        }
+
+        int used = (int)(p - pBase);
+        if (used > 0 && used == availBytes) {
+            return availBytes;
+        }
+        return used + LVScalarMatcher::countPerfectMatch<TEXT_DIRECTION>(p, t, availBytes - used);
+    }
+};
+#endif // SIMD_KERNELS_AVAILABLE
+
+//
+// The kernel that new LandauVishkin objects use.  It's chosen from CPUID at startup, and can be lowered (but not raised
+// beyond what the processor supports) with setLVKernel().
+//
+extern SIMDLevel lv_kernel;
+void setLVKernel(SIMDLevel kernel);
+
+
 static inline void memsetint(int* p, int value, int count)
 {
 // this is required to get around a GCC optimization bug
@@ -47,14 +171,23 @@ static inline void memsetint(int* p, int value, int count)
   }
 }
 
+//
+// A cell of LandauVishkin's rows of L, which count how far through the pattern the alignment has gotten.  Reads that
+// fit in 16 bits are all that there are unless this is a LONG_READS build.
+//
+#ifdef LONG_READS
+typedef int LVRowCell;
+#else   // LONG_READS
+typedef short LVRowCell;
+#endif  // LONG_READS
+
 // Computes the edit distance between two strings without returning the edits themselves.
 // Set TEXT_DIRECTION to -1 to run backwards through the text.
 template<int TEXT_DIRECTION = 1> class LandauVishkin {
 
 //
-// Macros to make arrays with negative indices seem "natural" in the code.
+// Macro to make arrays with negative indices seem "natural" in the code.
 //
-#define L(e,d)			L_zero			[(e) * (2 * MAX_K + 1) + (d)]
 #define A(e,d)			A_zero			[(e) * (2 * MAX_K + 1) + (d)]
 
 public:
@@ -65,9 +198,9 @@ public:
         soft_exit(1);
     }
 
-    memsetint(L_space, -2, (MAX_K + 1) * (2 * MAX_K + 1));
+    kernel = lv_kernel;
+    tracebackE = -1;
 
-    L_zero = L_space + MAX_K;   // The address of L(0,0)
     A_zero = A_space + MAX_K;   // The address of A(0,0)
 
     //
@@ -119,6 +252,52 @@ public:
                 int k,
                 double *matchProbability,
                 int *o_netIndel = NULL)   // the net of insertions and deletions in the alignment.  Negative for insertions, positive for deleteions (and 0 if there are non in net).  Filled in only if matchProbability is non-NULL
+{
+#ifdef SIMD_KERNELS_AVAILABLE
+    if (SIMDLevelAVX2 == kernel) {
+        return computeEditDistanceAVX2(text, textLen, pattern, qualityString, patternLen, k, matchProbability, o_netIndel);
+    } else if (SIMDLevelSSE41 == kernel) {
+        return computeEditDistanceSSE41(text, textLen, pattern, qualityString, patternLen, k, matchProbability, o_netIndel);
+    }
+#endif // SIMD_KERNELS_AVAILABLE
+    return computeEditDistanceWithMatcher<LVScalarMatcher>(text, textLen, pattern, qualityString, patternLen, k, matchProbability, o_netIndel);
+}
+
+    //
+    // Which match kernel this object uses.  The default comes from lv_kernel; tests use this to compare kernels.
+    //
+    SIMDLevel getKernel() {return kernel;}
+    void setKernel(SIMDLevel newKernel) {kernel = __min(newKernel, GetProcessorSIMDLevel());}
+
+private:
+
+#ifdef SIMD_KERNELS_AVAILABLE
+    //
+    // These exist only to give the inlined body the target attribute, so the compiler can inline the vector
+    // match kernels into it.
+    //
+    SIMD_TARGET("sse4.1") int computeEditDistanceSSE41(const char* text, int textLen, const char* pattern, const char *qualityString,
+                                                        int patternLen, int k, double *matchProbability, int *o_netIndel)
+    {
+        return computeEditDistanceWithMatcher<LVSSE41Matcher>(text, textLen, pattern, qualityString, patternLen, k, matchProbability, o_netIndel);
+    }
+
+    SIMD_TARGET("avx2") int computeEditDistanceAVX2(const char* text, int textLen, const char* pattern, const char *qualityString,
+                                                     int patternLen, int k, double *matchProbability, int *o_netIndel)
+    {
+        return computeEditDistanceWithMatcher<LVAVX2Matcher>(text, textLen, pattern, qualityString, patternLen, k, matchProbability, o_netIndel);
+    }
+#endif // SIMD_KERNELS_AVAILABLE
+
+    template<class MATCHER> SIMD_FORCE_INLINE int computeEditDistanceWithMatcher(
+                const char* text,
+                int textLen, 
+                const char* pattern,
+                const char *qualityString,
+                int patternLen,
+                int k,
+                double *matchProbability,
+                int *o_netIndel)
 {
     int localNetIndel;
 	int d;
@@ -158,9 +337,9 @@ public:
     int end = __min(patternLen, textLen);
     const char* pend = pattern + end;
 
-    L(0, 0) = countPerfectMatch(p, t, end);
+    matchedBeforeFirstEdit = MATCHER::template countPerfectMatch<TEXT_DIRECTION>(p, t, end);
 
-    if (L(0, 0) == end) {
+    if (matchedBeforeFirstEdit == end) {
         int result = (patternLen > end ? patternLen - end : 0); // Could need some deletions at the end
         if (NULL != matchProbability) {
             *matchProbability = lv_perfectMatchProbability[patternLen];    // Becuase the chance of a perfect match is < 1
@@ -171,18 +350,29 @@ public:
             //
             return -1;
         }
+        tracebackE = 0;
+        tracebackTrailingMismatches = result;
         return result;
     }
 
 	int lastBestD = MAX_K + 1;
 	int e;
 
+    //
+    // L(e-1, *) and L(e, *).  The cells just outside of the ones that get computed for e are read while computing e + 1,
+    // and have to hold -2 so that they're never used.  The rows are reused, so put the -2s in as we go.
+    //
+    LVRowCell *previousRow = rowSpace[0] + RowZero;
+    LVRowCell *currentRow = rowSpace[1] + RowZero;
+    previousRow[0] = (LVRowCell)matchedBeforeFirstEdit;
+    previousRow[-2] = previousRow[-1] = previousRow[1] = previousRow[2] = -2;
+
     for (e = 1; e <= k; e++) {
         // Search d's in the order 0, 1, -1, 2, -2, etc to find an alignment with as few indels as possible.
         // dTable is just precomputed d = (d > 0 ? -d : -d+1) to save the branch misprediction from (d > 0)
         int i =0;
         for (d = 0; d != e+1 ; i++, d = dTable[i]) {
-            int best = L(e-1, d) + 1; // up
+            int best = previousRow[d] + 1; // up
             A(e, d) = 'X';
 
             const char* p = pattern + best;
@@ -191,18 +381,18 @@ public:
                 int end = __min(patternLen, textLen - d);
                 const char* pend = pattern + end;
 
-                best += countPerfectMatch(p, t, (int)(end - (p - pattern)));
+                best += MATCHER::template countPerfectMatch<TEXT_DIRECTION>(p, t, (int)(end - (p - pattern)));
             }
 
 
-            int left = L(e-1, d-1);
+            int left = previousRow[d-1];
             p = pattern + left;
             t = (text + d * TEXT_DIRECTION) + left * TEXT_DIRECTION;
             if (*p == *t && left >= 0) {
                 int end = __min(patternLen, textLen - d);
                 const char* pend = pattern + end;
 
-                left += countPerfectMatch(p, t, (int)(end - (p - pattern)));
+                left += MATCHER::template countPerfectMatch<TEXT_DIRECTION>(p, t, (int)(end - (p - pattern)));
             }
 
             if (left > best) {
@@ -210,14 +400,14 @@ public:
                 A(e, d) = 'D';
             }
 
-            int right = L(e-1, d+1) + 1;
+            int right = previousRow[d+1] + 1;
             p = pattern + right;
             t = (text + d * TEXT_DIRECTION) + right * TEXT_DIRECTION;
             if (*p == *t && right >= 0) {
                 int end = __min(patternLen, textLen - d);
                 const char* pend = pattern + end;
 
-                right += countPerfectMatch(p, t, (int)(end - (p - pattern)));
+                right += MATCHER::template countPerfectMatch<TEXT_DIRECTION>(p, t, (int)(end - (p - pattern)));
             }
 
             if (right > best) {
@@ -246,12 +436,17 @@ public:
 				}
 			} // if best==patternLen
 
-            L(e, d) = best;
+            currentRow[d] = (LVRowCell)best;
         } // for d
 
 		if (MAX_K + 1 != lastBestD) {
 			break;
 		}
+
+        currentRow[-e-2] = currentRow[-e-1] = currentRow[e+1] = currentRow[e+2] = -2;
+        LVRowCell *temp = previousRow;
+        previousRow = currentRow;
+        currentRow = temp;
     } // for e
 
 	if (MAX_K + 1 == lastBestD) {
@@ -278,23 +473,39 @@ got_answer:
 			backtraceAction[curE] = A(curE, curD);
 			if (backtraceAction[curE] == 'I') {
 				backtraceD[curE] = curD + 1;
-				backtraceMatched[curE] = L(curE, curD) - L(curE - 1, curD + 1) - 1;
 			} else if (backtraceAction[curE] == 'D') {
 				backtraceD[curE] = curD - 1;
-				backtraceMatched[curE] = L(curE, curD) - L(curE - 1, curD - 1);
 			} else { // backtraceAction[curE] == 'X'
 				backtraceD[curE] = curD;
-				backtraceMatched[curE] = L(curE, curD) - L(curE - 1, curD) - 1;
 			}
 			curD = backtraceD[curE];
+		}
+
+		//
+		// Only the last two rows of L are kept, so redo the exact matches along the path to see how many bases
+		// matched after each edit.  It's the same extension that the search did for these cells.
+		//
+		int pathL = matchedBeforeFirstEdit;
+		for (int curE = 1; curE <= e; curE++) {
+			int pathD = curE == e ? lastBestD : backtraceD[curE + 1];
+			int start = pathL + (backtraceAction[curE] == 'D' ? 0 : 1);
+			pathL = start;
+
+			const char* p = pattern + start;
+			const char* t = (text + pathD * TEXT_DIRECTION) + start * TEXT_DIRECTION;
+			if (*p == *t && start >= 0) {
+				int end = __min(patternLen, textLen - pathD);
+				pathL += MATCHER::template countPerfectMatch<TEXT_DIRECTION>(p, t, (int)(end - (p - pattern)));
+			}
+			backtraceMatched[curE] = pathL - start;
 #ifdef TRACE_LV
-			printf("%d %d: %d %c %d %d\n", curE, curD, L(curE, curD),
+			printf("%d %d: %d %c %d %d\n", curE, pathD, pathL,
 				backtraceAction[curE], backtraceD[curE], backtraceMatched[curE]);
 #endif
 		}
 
 		int curE = 1;
-		int offset = L(0, 0);
+		int offset = matchedBeforeFirstEdit;
 		_ASSERT(*o_netIndel == 0);
 		while (curE <= e) {
 			// First write the action, possibly with a repeat if it occurred multiple times with no exact matches
@@ -327,16 +538,22 @@ got_answer:
 		}
 
 		*matchProbability *= lv_perfectMatchProbability[patternLen - e]; // Accounting for the < 1.0 chance of no changes for matching bases
+
+		tracebackE = e;
+		tracebackTrailingMismatches = 0;
 	} else {
 		//
-		// Not tracking match probability.
+		// Not tracking match probability, and so not tracing back, either.
 		//
+		tracebackE = -1;
 	}
 
 	_ASSERT(e <= k);
 	return e;
 }
 
+public:
+
 
     // Version that does not requre match probability and quality string
     inline int computeEditDistance(
@@ -349,76 +566,70 @@ got_answer:
         return computeEditDistance(text, textLen, pattern, NULL, patternLen, k, NULL);
     }
 
-    void *operator new(size_t size) {return BigAlloc(size);}
-    void operator delete(void *ptr) {BigDealloc(ptr);}
-
-    void *operator new(size_t size, BigAllocator *allocator) {_ASSERT(size == sizeof(LandauVishkin<TEXT_DIRECTION>)); return allocator->allocate(size);}
-    void operator delete(void *ptr, BigAllocator *allocator) {/*Do nothing.  The memory is freed when the allocator is deleted.*/}
- 
-private:
     //
-    // Count characters of a perfect match until a mismatch or the end of one or the other string, the
-    // minimum length of which is represented by the end parameter.  Advances p & t to the first mismatch
-    // or first character beyond the end.
+    // Append the edits of the last computeEditDistance call (which must have succeeded and been given a matchProbability)
+    // to the traceback being built in tracebacks.  They're appended in text order, so for TEXT_DIRECTION -1 they come
+    // out in the reverse of pattern order.  Returns false if that call didn't trace back.
     //
-    inline int countPerfectMatch(const char *& p, const char *& t, int availBytes)      // This is essentially duplicated in LandauVishkinWithCigar
+    bool appendTraceback(TracebackBuffer *tracebacks)
     {
-	    const char *pBase = p;
-	    const char *pend = p + availBytes;
-	    while (true) {
-		    _uint64 x;
-		    if (TEXT_DIRECTION == 1) {
-			    x = *((_uint64*)p) ^ *((_uint64*)t);
-		    } else {
-			    _uint64 T = *(_uint64 *)(t - 7);
-			    _uint64 tSwap = ByteSwapUI64(T);
-			    x = *((_uint64*)p) ^ tSwap;
-		    }
-
-		    if (x) {
-			    unsigned long zeroes;
-			    CountTrailingZeroes(x, zeroes);
-			    zeroes >>= 3;
-			    return __min((int)(p - pBase) + (int)zeroes, availBytes);
-		    } // if (x)
-
-		    p += 8;
-		    if (p >= pend) {
-			    return availBytes;
-		    }
+        if (tracebackE < 0) {
+            return false;
+        }
 
-		    t += 8 * TEXT_DIRECTION;
-	    } // while true
+        if (TEXT_DIRECTION == 1) {
+            tracebacks->append('=', matchedBeforeFirstEdit);
+            for (int curE = 1; curE <= tracebackE; curE++) {
+                tracebacks->append(backtraceAction[curE], 1);
+                tracebacks->append('=', backtraceMatched[curE]);
+            }
+            tracebacks->append('X', tracebackTrailingMismatches);
+        } else {
+            tracebacks->append('X', tracebackTrailingMismatches);
+            for (int curE = tracebackE; curE >= 1; curE--) {
+                tracebacks->append('=', backtraceMatched[curE]);
+                tracebacks->append(backtraceAction[curE], 1);
+            }
+            tracebacks->append('=', matchedBeforeFirstEdit);
+        }
 
-	    return 0;
+        return true;
     }
 
+    void *operator new(size_t size) {return BigAlloc(size);}
+    void operator delete(void *ptr) {BigDealloc(ptr);}
 
+    void *operator new(size_t size, BigAllocator *allocator) {_ASSERT(size == sizeof(LandauVishkin<TEXT_DIRECTION>)); return allocator->allocate(size);}
+    void operator delete(void *ptr, BigAllocator *allocator) {/*Do nothing.  The memory is freed when the allocator is deleted.*/}
+ 
+private:
     //
     // Table of d values for the inner loop in computeEditDistance.  This allows us to avoid the line d = (d > 0 ? -d : -d+1), which causes
     // a branch misprediction every time.
     //
     int dTable[2 * (MAX_K + 1) + 1];
+
+    SIMDLevel kernel;
     
 	//
 	// Note on state arrays:
 	// 
-	// We have several arrays that need to be indexed on edit distance and net indels.  Because net indels is signed, we want them
-	// to have their second coordinate (d) run from [-MAX_K .. MAX_K].  When computing the opening or closing of an indel, we add more than
-	// one edit distance, which means we compute LInsert[e][x] based on L[e-OpenPenalty][x+1].  When we're at edit distance < the gap open
-	// penalty, of course we can't fill in LInsert; however, rather than just checking it each time (and incurring a branch prediction miss), 
-	// we just let it happily index into negative space, which is initialized with -2 and so will never be used.  So, we want our arrays to
-	// run from [-MAX_GAP..MAX_K][-MAX_K .. MAX_K].  To do this, we just allocate the space and compute a pointer that would be at [0][0].
-	// We use macros to do the indexing, because it's tricky to convince C++ to do this kind of thing statically.
+	// We have arrays that need to be indexed on net indels.  Because net indels is signed, we want them to have d run from
+	// [-MAX_K .. MAX_K] (or a little more).  To do this, we just allocate the space and compute a pointer that would be at d = 0.
+	// We use a macro to do the indexing for A, because it's tricky to convince C++ to do this kind of thing statically.
 	//
 	// Also, conceptually these arrays are local to each computation.  They're here to save memory allocation and initialization overhead.
-	// Note that the important parts for the initialization is never overwritten, though the rest is.
 	//
 
-
-    // TODO: For long reads, we should include a version that only has L be 2 x (2*MAX_K+1) cells
-    int L_space[(MAX_K + 1) * (2 * MAX_K + 1)];
-	int *L_zero;
+    //
+    // The last two rows of L, where L(e, d) is how far through the pattern we can get with e edits and a net indel of d.  Nothing
+    // but the traceback needs the older rows, and it can redo the few cells that it needs, so there's no need to keep all of L.
+    // That way the state touched by each call stays in a few cache lines.  There are two extra cells on each end for the ones
+    // that are read just outside of the ones that get computed.
+    //
+    static const int RowZero = MAX_K + 2;
+    LVRowCell rowSpace[2][2 * RowZero + 1];
+    int matchedBeforeFirstEdit;     // L(0, 0)
 
     // Action we did to get to each position: 'D' = deletion, 'I' = insertion, 'X' = substitution.  This is needed to compute match probability.
 	char A_space[(MAX_K + 1) * (2 * MAX_K + 1)];
@@ -429,7 +640,13 @@ private:
     int  backtraceMatched[MAX_K+1];
     int  backtraceD[MAX_K+1];
 
-#undef  L
+    //
+    // What appendTraceback needs about the last computation besides the backtrace arrays and matchedBeforeFirstEdit.
+    // tracebackE is -1 if it didn't trace back.
+    //
+    int  tracebackE;
+    int  tracebackTrailingMismatches;      // Pattern past the end of the text, when the text ran out during a perfect match
+
 #undef  A
 };
 
@@ -447,6 +664,9 @@ enum CigarFormat
     BAM_CIGAR_OPS = 3,
 };
 
+// Append count of the CIGAR operation code to the buffer in the given format.  Returns false if it doesn't fit.
+bool writeCigar(char** o_buf, int* o_buflen, int count, char code, CigarFormat format);
+
 // express cigar as 2 byte per reference base summarizing the changes
 // at that location; may lose information for longer inserts
 enum LinearCigarFlags
@@ -464,12 +684,16 @@ enum LinearCigarFlags
     CigarDelete      = 0x05,    // delete
 };
 
+template<int TEXT_DIRECTION> class BitParallelEditDistance;
+
 class LandauVishkinWithCigar {
 public:
     LandauVishkinWithCigar();
+    ~LandauVishkinWithCigar();
 
     // Compute the edit distance between two strings and write the CIGAR string in cigarBuf.
     // Returns -1 if the edit distance exceeds k or -2 if we run out of space in cigarBuf.
+    // Long patterns and k >= MAX_K go to BitParallelEditDistance.
     int computeEditDistance(const char* text, int textLen, const char* pattern, int patternLen, int k,
                             char* cigarBuf, int cigarBufLen, bool useM,
                             CigarFormat format = COMPACT_CIGAR_STRING,
@@ -485,6 +709,17 @@ public:
                             int* o_textUsed = NULL,
                             int *o_netIndel = NULL);
 
+    // same output as computeEditDistanceNormalized, but made from the edits that the aligner found when it scored the
+    // alignment (see AlignmentTraceback.h) rather than by computing them again.  Returns -1 if the traceback isn't sure
+    // to be what computeEditDistanceNormalized would find (anything but at most one substitution) or doesn't cover
+    // exactly patternLen bases of the pattern.
+    static int computeCigarFromTraceback(const AlignmentTraceback *traceback, int patternLen,
+                            char* cigarBuf, int cigarBufLen, bool useM,
+                            CigarFormat format = COMPACT_CIGAR_STRING,
+                            int* o_cigarBufUsed = NULL,
+                            int* o_addFrontClipping = NULL,
+                            int *o_netIndel = NULL);
+
     // take a compact cigar binary format and turn it into one byte per reference base
     // describing the difference from the reference at that location
     // might lose information for large inserts
@@ -493,7 +728,20 @@ public:
         char* cigar, int cigarSize, char* sample, int sampleSize);
 
     static void printLinear(char* buffer, int bufferSize, unsigned variant);
+
+    // A buffer of at least bytes that's kept from one call to the next, for callers that need to unpack the reference
+    // from a packed genome.  Its contents don't survive asking for a bigger one.
+    char* getScratch(size_t bytes);
 private:
+    // the common end of computeEditDistanceNormalized and computeCigarFromTraceback: handle a leading indel and
+    // copy the BAM ops out in the requested format.  Returns what they return.
+    static int finishNormalizedCigar(_uint32 *bamOps, int bamOpCount, int score, char* cigarBuf, int cigarBufLen,
+                            CigarFormat format, int* o_cigarBufUsed, int* o_addFrontClipping);
+
+    BitParallelEditDistance<1> *bitParallel;   // Created the first time it's needed
+    char* scratch;
+    size_t scratchBytes;
+
     int L[MAX_K+1][2 * MAX_K + 1];
     
     // Action we did to get to each position: 'D' = deletion, 'I' = insertion, 'X' = substitution.
@@ -301,7 +301,7 @@ bool PairedAlignerOptions::parse(const char** argv, int argc, int& n, bool *done
 }
 
 PairedAlignerContext::PairedAlignerContext(AlignerExtension* i_extension)
-    : AlignerContext( 0,  NULL, NULL, i_extension)
+    : AlignerContext( 0,  NULL, NULL, i_extension), alignmentCache(NULL)
 {
 }
 
@@ -438,6 +438,11 @@ void PairedAlignerContext::runIterationThread()
         maxSecondaryAlignmentsPerContig,
         allocator);
 
+    aligner->setRankSeedsByPopularity(options->seedRanking);
+
+    TracebackBuffer *tracebacks = options->reuseTracebacks ? new TracebackBuffer : NULL;
+    aligner->setTracebackBuffer(tracebacks);
+
     allocator->checkCanaries();
 
     PairedAlignmentResult *results = (PairedAlignmentResult *)allocator->allocate((1 + maxPairedSecondaryHits) * sizeof(*results)); // 1 + is for the primary result
@@ -483,6 +488,8 @@ void PairedAlignerContext::runIterationThread()
             result.status[1] = NotFound;
             result.location[0] = InvalidGenomeLocation;
             result.location[1] = InvalidGenomeLocation;
+            result.traceback[0].clear();
+            result.traceback[1].clear();
             nSingleResults[0] = nSingleResults[1] = 0;
 
             bool pass0 = options->passFilter(reads[0], result.status[0], true, false);
@@ -506,22 +513,54 @@ void PairedAlignerContext::runIterationThread()
 
 
 
+        int nSecondaryResults;
+        int nSingleSecondaryResults[2];
+
+        AlignmentCacheKey cacheKey;
+        _int64 nanosToAlign;
+        bool cacheHit = false;
+        if (NULL != alignmentCache) {
+            cacheKey.computeFor(reads[0], reads[1]);
+            stats->alignmentCacheLookups++;
+            if (alignmentCache->lookup(cacheKey, &results[0], &nanosToAlign)) {
+                stats->alignmentCacheHits++;
+                stats->alignmentCacheNanosSaved += nanosToAlign;
+                nSecondaryResults = nSingleSecondaryResults[0] = nSingleSecondaryResults[1] = 0;
+                results[0].fromAlignTogether = false;   // Keep the align together stats about pairs that actually ran it
+                results[0].traceback[0].clear();        // They were in the traceback buffer for the pair that was cached
+                results[0].traceback[1].clear();
+                cacheHit = true;
+            }
+        }
+
+        if (!cacheHit) {
 #if     TIME_HISTOGRAM
-        _int64 startTime = timeInNanos();
+            _int64 startTime = timeInNanos();
+#else   // TIME_HISTOGRAM
+            _int64 startTime = (NULL != alignmentCache) ? timeInNanos() : 0;
 #endif // TIME_HISTOGRAM
 
-        int nSecondaryResults;
-        int nSingleSecondaryResults[2];
+            if (NULL != tracebacks) {
+                tracebacks->clear();
+            }
 
-        aligner->align(reads[0], reads[1], results, maxSecondaryAlignmentAdditionalEditDistance, maxPairedSecondaryHits, &nSecondaryResults, results + 1,
-            maxSingleSecondaryHits, maxSecondaryAlignments, &nSingleSecondaryResults[0], &nSingleSecondaryResults[1], singleSecondaryResults);
+            aligner->align(reads[0], reads[1], results, maxSecondaryAlignmentAdditionalEditDistance, maxPairedSecondaryHits, &nSecondaryResults, results + 1,
+                maxSingleSecondaryHits, maxSecondaryAlignments, &nSingleSecondaryResults[0], &nSingleSecondaryResults[1], singleSecondaryResults);
+
+            //
+            // Only cache pairs without secondary alignments, and cache them before the spacing and filtering below change the results.
+            //
+            if (NULL != alignmentCache && 0 == nSecondaryResults && 0 == nSingleSecondaryResults[0] && 0 == nSingleSecondaryResults[1]) {
+                alignmentCache->insert(cacheKey, results[0], timeInNanos() - startTime);
+            }
 
 #if     TIME_HISTOGRAM
-        _int64 runTime = timeInNanos() - startTime;
-        int timeBucket = min(30, cheezyLogBase2(runTime));
-        stats->countByTimeBucket[timeBucket]++;
-        stats->nanosByTimeBucket[timeBucket] += runTime;
+            _int64 runTime = timeInNanos() - startTime;
+            int timeBucket = min(30, cheezyLogBase2(runTime));
+            stats->countByTimeBucket[timeBucket]++;
+            stats->nanosByTimeBucket[timeBucket] += runTime;
 #endif // TIME_HISTOGRAM
+        }
 
         if (forceSpacing && isOneLocation(results[0].status[0]) != isOneLocation(results[0].status[1])) {
             // either both align or neither do
@@ -583,6 +622,7 @@ void PairedAlignerContext::runIterationThread()
     delete supplier;
 
     intersectingAligner->~IntersectingPairedEndAligner();
+    delete tracebacks;
     delete allocator;
 }
 
@@ -657,6 +697,13 @@ PairedAlignerContext::typeSpecificBeginIteration()
     readerContext.headerBytes = context->headerBytes;
     readerContext.headerLength = context->headerLength;
     readerContext.headerMatchesIndex = context->headerMatchesIndex;
+
+    //
+    // Per run rather than per process, for the same reason as in SingleAlignerContext.
+    //
+    if (options->alignmentCacheMegabytes > 0) {
+        alignmentCache = new AlignmentCache<PairedAlignmentResult>((size_t)options->alignmentCacheMegabytes * 1024 * 1024);
+    }
 }
     void 
 PairedAlignerContext::typeSpecificNextIteration()
@@ -669,4 +716,7 @@ PairedAlignerContext::typeSpecificNextIteration()
     }
     delete pairedReadSupplierGenerator;
     pairedReadSupplierGenerator = NULL;
+
+    delete alignmentCache;
+    alignmentCache = NULL;
 }
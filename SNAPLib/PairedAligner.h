@@ -26,6 +26,7 @@ Revision History:
 #include "stdafx.h"
 #include "AlignerContext.h"
 #include "ReadSupplierQueue.h"
+#include "AlignmentCache.h"
 
 struct PairedAlignerStats;
 
@@ -59,6 +60,8 @@ protected:
     virtual void typeSpecificNextIteration();
 
     PairedReadSupplierGenerator *pairedReadSupplierGenerator;
+
+    AlignmentCache<PairedAlignmentResult> *alignmentCache;     // NULL unless -ac
  
     int                 minSpacing;
     int                 maxSpacing;
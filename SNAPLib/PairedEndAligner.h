@@ -58,5 +58,14 @@ public:
     {
     }
 
+    //
+    // Where to keep the tracebacks of the results (see AlignmentTraceback.h), or NULL not to keep them.  The caller owns
+    // the buffer and clears it between pairs.  Aligners that don't keep tracebacks leave their results' ops NULL.
+    //
+    virtual void setTracebackBuffer(
+        TracebackBuffer         *tracebacks)
+    {
+    }
+
     virtual _int64 getLocationsScored() const  = 0;
 };
@@ -154,11 +154,12 @@ ParallelTask<TContext>::run()
     DestroyEventObject(&memoryAllocationCompleteBarrier);
 #endif  // _MSC_VER
 
-    for (int i = 0; i < common->totalThreads; i++) {
+    // a coworker can be destroyed as soon as its last thread finishes, so don't touch this task after that
+    common->time = timeInMillis() - start;
+    int totalThreads = common->totalThreads;
+    for (int i = 0; i < totalThreads; i++) {
         contexts[i].finishThread(common);
     }
-
-    common->time = timeInMillis() - start;
 }
 
     template <class TContext>
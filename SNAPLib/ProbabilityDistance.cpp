@@ -1,6 +1,9 @@
 #include "stdafx.h"
 #include "ProbabilityDistance.h"
 #include "Compat.h"
+#ifdef SIMD_KERNELS_AVAILABLE
+#include <immintrin.h>
+#endif
 
 
 #ifdef TRACE_PROBABILITY_DISTANCE
@@ -10,22 +13,12 @@
 #endif
 
 
-namespace {
-    inline double max3(double d1, double d2, double d3) {
-        if (d1 > d2) {
-            return (d1 > d3) ? d1 : d3;
-        } else {
-            return (d2 > d3) ? d2 : d3;
-        }
-    }
-}
-
-
 ProbabilityDistance::ProbabilityDistance(double snpProb, double gapOpenProb, double gapExtensionProb)
 {
     snpLogProb = log(snpProb);
     gapOpenLogProb = log(gapOpenProb);
     gapExtensionLogProb = log(gapExtensionProb);
+    kernel = GetProcessorSIMDLevel();
 
     // Fill in the matchLogProb and mismatchLogProb tables for base quality values; assumes Phred+33 encoding
     for (int q = 0; q < 256; q++) {
@@ -63,73 +56,171 @@ int ProbabilityDistance::compute(
     _ASSERT(maxShift < MAX_SHIFT);
     _ASSERT(maxStartShift <= maxShift);
 
-    // Fill in the readPos = 0 row to allow us to start only at -maxStartShift..+maxStartShift
-    for (int s = -maxShift-1; s <= maxShift+1; s++) {
-        d[0][MAX_SHIFT+s][READ_GAP] = NO_PROB;
-        d[0][MAX_SHIFT+s][REF_GAP] = NO_PROB;
-        if (s < -maxStartShift || s > maxStartShift) {
-            d[0][MAX_SHIFT+s][NO_GAP] = NO_PROB;
-        } else {
-            d[0][MAX_SHIFT+s][NO_GAP] = log(1.0);
-        }
+    for (int i = 0; i < RowLanes; i++) {
+        int s = i - ShiftOfLaneZero;
+        laneLimit[i] = (s < -maxShift || s > maxShift) ? NO_PROB : 0.0f;    // No log probability is more than 0
     }
 
-    // Now go through each readPos from 1 to readLen and compute how to best get there
-    for (int r = 1; r <= readLen; r++) {
-        // Add sentinels at the end of the array
-        d[r][MAX_SHIFT-maxShift-1][READ_GAP] = NO_PROB;
-        d[r][MAX_SHIFT+maxShift+1][READ_GAP] = NO_PROB;
-        d[r][MAX_SHIFT-maxShift-1][REF_GAP] = NO_PROB;
-        d[r][MAX_SHIFT+maxShift+1][REF_GAP] = NO_PROB;
-        d[r][MAX_SHIFT-maxShift-1][NO_GAP] = NO_PROB;
-        d[r][MAX_SHIFT+maxShift+1][NO_GAP] = NO_PROB;
-
-        // Fill in the rest of the values using dynamic program recurrence
-        for (int s = -maxShift; s <= maxShift; s++) {
-            // The NO_GAP case; we get here either from a previous NO_GAP or by closing a gap from the
-            // previous readPos, and in either case, we need to match the current base
-            double thisBaseProb = (read[r-1] == reference[r-1+s]) ? matchLogProb[quality[r-1]] : mismatchLogProb[quality[r-1]];
-            d[r][MAX_SHIFT+s][NO_GAP] = max3(d[r-1][MAX_SHIFT+s][NO_GAP] + thisBaseProb,
-                                             d[r-1][MAX_SHIFT+s][REF_GAP] + thisBaseProb,
-                                             d[r-1][MAX_SHIFT+s][READ_GAP] + thisBaseProb);
-
-            // The READ_GAP case; we can either open a new gap from the previous NO_GAP or REF_GAP cases, or
-            // extend a gap computed in the previous READ_GAP case
-            d[r][MAX_SHIFT+s][READ_GAP] = max3(d[r-1][MAX_SHIFT+s+1][NO_GAP] + gapOpenLogProb,
-                                               d[r-1][MAX_SHIFT+s+1][REF_GAP] + gapOpenLogProb,
-                                               d[r-1][MAX_SHIFT+s+1][READ_GAP] + gapExtensionLogProb);
-
-            // The REF_GAP case; we can either open a new gap from NO_GAP/READ_GAP, or extend one
-            d[r][MAX_SHIFT+s][REF_GAP] = max3(d[r][MAX_SHIFT+s-1][NO_GAP] + gapOpenLogProb,
-                                              d[r][MAX_SHIFT+s-1][REF_GAP] + gapExtensionLogProb,
-                                              d[r][MAX_SHIFT+s-1][READ_GAP] + gapOpenLogProb);
-        }
+    //
+    // Copy the part of the reference that the shifts can reach, so that the kernels can load a whole row's worth
+    // of it without checking where it ends.
+    //
+    paddedReference.assign(readLen + RowLanes, 0);
+    for (int p = -maxShift; p < readLen + maxShift; p++) {
+        paddedReference[p + ShiftOfLaneZero] = reference[p];
     }
 
-#ifdef TRACE_PROBABILITY_DISTANCE
-    printf("Here is the final matrix:\n");
-    for (int r = 0; r <= readLen; r++) {
-        printf("%d: ", r);
+    // Fill in the readPos = 0 row to allow us to start only at -maxStartShift..+maxStartShift
+    for (int which = 0; which < 2; which++) {
         for (int g = 0; g < 3; g++) {
-            for (int s = -maxShift; s <= maxShift; s++) {
-                printf("%7.2g ", d[r][MAX_SHIFT+s][g]);
-            }
-            if (g < 2) {
-                printf("| ");
+            for (int i = 0; i < RowPadding + RowLanes + RowPadding; i++) {
+                rows[which].gap[g][i] = NO_PROB;
             }
         }
-        printf("\n");
     }
-#endif
+    for (int s = -maxStartShift; s <= maxStartShift; s++) {
+        rows[0].gap[NO_GAP][RowPadding + ShiftOfLaneZero + s] = 0.0f;   // log(1.0)
+    }
+
+    // Now go through each readPos from 1 to readLen and compute how to best get there
+    Row *last;
+#ifdef SIMD_KERNELS_AVAILABLE
+    if (kernel >= SIMDLevelSSE41) {
+        last = computeRowsSSE41(read, quality, readLen);
+    } else
+#endif // SIMD_KERNELS_AVAILABLE
+    {
+        last = computeRowsScalar(read, quality, readLen);
+    }
 
     // Return the best probability, and a somewhat arbitrary score for it (TODO: need to actually compute # of edits)
-    double best = NO_PROB;
-    for (int s = -maxShift; s <= maxShift; s++) {
-        for (int g = 0; g < 3; g++) {
-            best = __max(best, d[readLen][MAX_SHIFT+s][g]);
+    float best = NO_PROB;
+    for (int g = 0; g < 3; g++) {
+        for (int i = 0; i < RowLanes; i++) {
+            best = __max(best, last->gap[g][RowPadding + i]);
         }
     }
-    *matchProbability = exp(best);
-    TRACE("Best match probability: %g (log: %.2g)\n", exp(best), best);
+    *matchProbability = exp((double)best);
+    TRACE("Best match probability: %g (log: %.2g)\n", exp((double)best), best);
     return 5;
 }
+
+//
+// Both kernels compute the same recurrences.  For each shift s:
+//
+// The NO_GAP case; we get here either from a previous NO_GAP or by closing a gap from the previous readPos, and in
+// either case, we need to match the current base.
+//
+// The READ_GAP case; we can either open a new gap from the previous NO_GAP or REF_GAP cases at s+1, or extend a gap
+// computed in the previous READ_GAP case.
+//
+// The REF_GAP case; we can either open a new gap from NO_GAP/READ_GAP at s-1 in this row, or extend one.  This
+// depends on the REF_GAP value to its left, so unlike the others it's a running maximum across the row.
+//
+// Lanes outside of the shifts we're considering are clamped to NO_PROB so that they act as the sentinels.
+//
+ProbabilityDistance::Row *
+ProbabilityDistance::computeRowsScalar(const char *read, const char *quality, int readLen)
+{
+    Row *previous = &rows[0];
+    Row *current = &rows[1];
+
+    for (int r = 1; r <= readLen; r++) {
+        const float *prevNoGap = previous->gap[NO_GAP] + RowPadding;
+        const float *prevReadGap = previous->gap[READ_GAP] + RowPadding;
+        const float *prevRefGap = previous->gap[REF_GAP] + RowPadding;
+        float *noGap = current->gap[NO_GAP] + RowPadding;
+        float *readGap = current->gap[READ_GAP] + RowPadding;
+        float *refGap = current->gap[REF_GAP] + RowPadding;
+
+        const char *referenceRow = &paddedReference[r - 1];
+        char readBase = read[r-1];
+        float matchProb = matchLogProb[(unsigned char)quality[r-1]];
+        float mismatchProb = mismatchLogProb[(unsigned char)quality[r-1]];
+
+        for (int i = 0; i < RowLanes; i++) {
+            float thisBaseProb = (readBase == referenceRow[i]) ? matchProb : mismatchProb;
+            noGap[i] = __min(__max(__max(prevNoGap[i], prevRefGap[i]), prevReadGap[i]) + thisBaseProb, laneLimit[i]);
+            readGap[i] = __min(__max(__max(prevNoGap[i+1], prevRefGap[i+1]) + gapOpenLogProb, prevReadGap[i+1] + gapExtensionLogProb), laneLimit[i]);
+        }
+
+        float running = NO_PROB;
+        for (int i = 0; i < RowLanes; i++) {
+            running = __max(__max(noGap[i-1], readGap[i-1]) + gapOpenLogProb, running + gapExtensionLogProb);
+            refGap[i] = __min(running, laneLimit[i]);
+        }
+
+        Row *temp = previous;
+        previous = current;
+        current = temp;
+    }
+
+    return previous;
+}
+
+#ifdef SIMD_KERNELS_AVAILABLE
+//
+// Four shifts at a time.  The REF_GAP running maximum is done within each vector as a two step prefix scan (shift by
+// one lane and add one extension, then by two lanes and add two), and then carried in from the last lane of the
+// previous vector.
+//
+SIMD_TARGET("sse4.1") ProbabilityDistance::Row *
+ProbabilityDistance::computeRowsSSE41(const char *read, const char *quality, int readLen)
+{
+    Row *previous = &rows[0];
+    Row *current = &rows[1];
+
+    const __m128 noProb = _mm_set1_ps(NO_PROB);
+    const __m128 gapOpen = _mm_set1_ps(gapOpenLogProb);
+    const __m128 gapExtension = _mm_set1_ps(gapExtensionLogProb);
+    const __m128 twoGapExtensions = _mm_set1_ps(2 * gapExtensionLogProb);
+    const __m128 carryGapExtensions = _mm_set_ps(4 * gapExtensionLogProb, 3 * gapExtensionLogProb, 2 * gapExtensionLogProb, gapExtensionLogProb);
+
+    for (int r = 1; r <= readLen; r++) {
+        const float *prevNoGap = previous->gap[NO_GAP] + RowPadding;
+        const float *prevReadGap = previous->gap[READ_GAP] + RowPadding;
+        const float *prevRefGap = previous->gap[REF_GAP] + RowPadding;
+        float *noGap = current->gap[NO_GAP] + RowPadding;
+        float *readGap = current->gap[READ_GAP] + RowPadding;
+        float *refGap = current->gap[REF_GAP] + RowPadding;
+
+        const char *referenceRow = &paddedReference[r - 1];
+        const __m128i readBase = _mm_set1_epi8(read[r-1]);
+        const __m128 matchProb = _mm_set1_ps(matchLogProb[(unsigned char)quality[r-1]]);
+        const __m128 mismatchProb = _mm_set1_ps(mismatchLogProb[(unsigned char)quality[r-1]]);
+
+        for (int i = 0; i < RowLanes; i += 4) {
+            int referenceBases;
+            memcpy(&referenceBases, referenceRow + i, sizeof(referenceBases));
+            __m128i matches = _mm_cvtepi8_epi32(_mm_cmpeq_epi8(_mm_cvtsi32_si128(referenceBases), readBase));
+            __m128 thisBaseProb = _mm_blendv_ps(mismatchProb, matchProb, _mm_castsi128_ps(matches));
+            __m128 limit = _mm_loadu_ps(laneLimit + i);
+
+            __m128 prevBest = _mm_max_ps(_mm_max_ps(_mm_loadu_ps(prevNoGap + i), _mm_loadu_ps(prevRefGap + i)), _mm_loadu_ps(prevReadGap + i));
+            _mm_storeu_ps(noGap + i, _mm_min_ps(_mm_add_ps(prevBest, thisBaseProb), limit));
+
+            __m128 open = _mm_add_ps(_mm_max_ps(_mm_loadu_ps(prevNoGap + i + 1), _mm_loadu_ps(prevRefGap + i + 1)), gapOpen);
+            __m128 extend = _mm_add_ps(_mm_loadu_ps(prevReadGap + i + 1), gapExtension);
+            _mm_storeu_ps(readGap + i, _mm_min_ps(_mm_max_ps(open, extend), limit));
+        }
+
+        __m128 carry = noProb;
+        for (int i = 0; i < RowLanes; i += 4) {
+            __m128 running = _mm_add_ps(_mm_max_ps(_mm_loadu_ps(noGap + i - 1), _mm_loadu_ps(readGap + i - 1)), gapOpen);
+            __m128 shifted = _mm_move_ss(_mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(running), 4)), noProb);
+            running = _mm_max_ps(running, _mm_add_ps(shifted, gapExtension));
+            shifted = _mm_blend_ps(_mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(running), 8)), noProb, 0x3);
+            running = _mm_max_ps(running, _mm_add_ps(shifted, twoGapExtensions));
+            running = _mm_max_ps(running, _mm_add_ps(carry, carryGapExtensions));
+            carry = _mm_shuffle_ps(running, running, _MM_SHUFFLE(3, 3, 3, 3));
+            _mm_storeu_ps(refGap + i, _mm_min_ps(running, _mm_loadu_ps(laneLimit + i)));
+        }
+
+        Row *temp = previous;
+        previous = current;
+        current = temp;
+    }
+
+    return previous;
+}
+#endif // SIMD_KERNELS_AVAILABLE
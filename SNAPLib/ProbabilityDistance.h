@@ -1,6 +1,8 @@
 #pragma once
 
+#include "Compat.h"
 #include "Read.h"
+#include <vector>
 
 //
 // Similar to BoundedStringDistance and LandauVishkin, but computes the probability of a read
@@ -10,6 +12,11 @@
 // per base. For substitions, we could have different probabilities for each transition, but
 // we assume that they all have the same probability right now.
 //
+// The dynamic program works in single precision log space, a row (read position) at a time, with
+// all of the shifts of a row in one array per gap status so that the SSE4.1 kernel can do four
+// shifts at a time.  Only the previous row is needed to compute the next one, so only two rows
+// are kept.
+//
 class ProbabilityDistance {
 public:
     static const int MAX_READ = MAX_READ_LENGTH;
@@ -26,31 +33,59 @@ public:
             int maxTotalShift,
             double *matchProbability);
 
+    //
+    // Which kernel this object uses.  It defaults to the best one the processor supports; tests use this to compare them.
+    //
+    SIMDLevel getKernel() {return kernel;}
+    void setKernel(SIMDLevel newKernel) {kernel = __min(newKernel, GetProcessorSIMDLevel());}
+
 private:
-    double snpLogProb;
-    double gapOpenLogProb;
-    double gapExtensionLogProb;
+    float snpLogProb;
+    float gapOpenLogProb;
+    float gapExtensionLogProb;
 
-    double matchLogProb[256];      // [baseQuality]
-    double mismatchLogProb[256];   // [baseQuality]
+    float matchLogProb[256];      // [baseQuality]
+    float mismatchLogProb[256];   // [baseQuality]
 
-#define NO_PROB  -1000000.0;  // A really negative log probability -- basically zero.  VC compiler won't allow static const double in a class.
+#define NO_PROB  -1000000.0f  // A really negative log probability -- basically zero.  VC compiler won't allow static const double in a class.
 
     enum GapStatus { NO_GAP, READ_GAP, REF_GAP };
 
-    // d[readPos][shift][gapStatus] is the best possible log probability for aligning the
+    //
+    // Lane i of a row is shift i - ShiftOfLaneZero, so lanes 1..2*MAX_SHIFT+1 are the shifts that can be used, and the
+    // rest (including lane 0) are always NO_PROB, as are the padding lanes on either side.  That way every lane's
+    // neighbors can be loaded without any bounds checks.
+    //
+    static const int ShiftOfLaneZero = MAX_SHIFT + 1;
+    static const int RowLanes = 48;     // 2*MAX_SHIFT+3 rounded up to a multiple of the vector size
+    static const int RowPadding = 4;
+
+    // row[gapStatus][RowPadding + lane] is the best possible log probability for aligning the
     // substring read[0..readPos] to reference[?..readPos + shift]. The "?" in reference is
     // because we allow starting an alignment from reference[-maxStartShift..maxStartShift]
     // instead of just reference[0], to deal with indels toward the start of the read.
-    double d[MAX_READ][2*MAX_SHIFT+1][3];   // [readPos][shift][gapStatus]
-
-    // A state in the D array, used for backtracking pointers
-    struct State {
-        int readPos;
-        int shift;
-        int gapStatus;
+    struct Row {
+        float gap[3][RowPadding + RowLanes + RowPadding];   // [gapStatus][lane]
     };
 
-    // Previous state in our dynamic program, for backtracking to print CIGAR strings
-    State prev[MAX_READ][2*MAX_SHIFT+1][3];   // [readPos][shift][gapStatus]
+    Row rows[2];
+
+    //
+    // NO_PROB for the lanes outside of +/-maxTotalShift and something bigger than any log probability for the rest,
+    // so that taking the minimum with it clears the lanes that aren't being used.
+    //
+    float laneLimit[RowLanes];
+
+    //
+    // The reference for the current computation, copied so that lane i of row r compares against paddedReference[r - 1 + i],
+    // with zeroes (which never match a read) outside of what the shifts can reach.
+    //
+    std::vector<char> paddedReference;
+
+    SIMDLevel kernel;
+
+    Row *computeRowsScalar(const char *read, const char *quality, int readLen);
+#ifdef SIMD_KERNELS_AVAILABLE
+    SIMD_TARGET("sse4.1") Row *computeRowsSSE41(const char *read, const char *quality, int readLen);
+#endif // SIMD_KERNELS_AVAILABLE
 };
@@ -28,6 +28,7 @@ Revision History:
 #include "RangeSplitter.h"
 #include "SAM.h"
 #include "FASTQ.h"
+#include "Bam.h"
 
 using std::max;
 using std::min;
@@ -102,10 +103,10 @@ bool RangeSplitter::getNextRange(_int64 *rangeStart, _int64 *rangeLength)
 
 RangeSplittingReadSupplierGenerator::RangeSplittingReadSupplierGenerator(
     const char *i_fileName,
-    bool i_isSAM, 
+    FileType i_fileType,
     unsigned i_numThreads,
     const ReaderContext& i_context)
-    : isSAM(i_isSAM), context(i_context), numThreads(i_numThreads)
+    : fileType(i_fileType), context(i_context), numThreads(i_numThreads)
 {
     fileName = new char[strlen(i_fileName) + 1];
     strcpy(fileName, i_fileName);
@@ -116,7 +117,8 @@ RangeSplittingReadSupplierGenerator::RangeSplittingReadSupplierGenerator(
 	// header.
 	//
 	_int64 headerSize;
-	if (isSAM) {
+	unsigned minRangeSize = 10 * MAX_READ_LENGTH;
+	if (SAMFile == fileType) {
 		SAMReader *reader = SAMReader::create(DataSupplier::Default, fileName, ReadSupplierQueue::BufferCount(numThreads), context, 0, 0);
 		if (!reader) {
 			WriteErrorMessage("Unable to create reader for SAM file '%s'\n", fileName);
@@ -125,12 +127,23 @@ RangeSplittingReadSupplierGenerator::RangeSplittingReadSupplierGenerator(
 		headerSize = reader->getContext()->headerBytes;
 		delete reader;
 		reader = NULL;
+	} else if (BAMFile == fileType) {
+		//
+		// The ranges are of the compressed file, and the readers for them need the header that only the first one
+		// sees.  Ranges smaller than a few blocks would mostly be spent starting decompressors.
+		//
+		BAMReader *reader = BAMReader::create(fileName, ReadSupplierQueue::BufferCount(numThreads), 0, 0, context);
+		context = *reader->getContext();
+		headerSize = BAMReader::getFirstRecordBlockOffset(fileName, context.headerBytes);
+		delete reader;
+		reader = NULL;
+		minRangeSize = 16 * BAM_BLOCK;
 	} else {
 		// FASTQ has no header.
 		headerSize = 0;
 	}
 
-	splitter = new RangeSplitter(QueryFileSize(fileName), numThreads, 5, headerSize, 200, 10 * MAX_READ_LENGTH);
+	splitter = new RangeSplitter(QueryFileSize(fileName), numThreads, 5, headerSize, 200, minRangeSize);
 }
 
 ReadSupplier *
@@ -143,8 +156,10 @@ RangeSplittingReadSupplierGenerator::generateNewReadSupplier()
 
     ReadReader *underlyingReader;
     // todo: implement layered factory model
-    if (isSAM) {
+    if (SAMFile == fileType) {
         underlyingReader = SAMReader::create(DataSupplier::Default, fileName, 2, context, rangeStart, rangeLength);
+    } else if (BAMFile == fileType) {
+        underlyingReader = BAMReader::create(fileName, 2, rangeStart, rangeLength, context);
     } else {
         underlyingReader = FASTQReader::create(DataSupplier::Default, fileName, 2, rangeStart, rangeLength, context);
     }
@@ -153,6 +168,7 @@ RangeSplittingReadSupplierGenerator::generateNewReadSupplier()
 
 RangeSplittingReadSupplier::~RangeSplittingReadSupplier()
 {
+    delete underlyingReader;
 }
 
 
@@ -176,6 +192,7 @@ RangeSplittingReadSupplier::getNextRead()
 
 RangeSplittingPairedReadSupplier::~RangeSplittingPairedReadSupplier()
 {
+    delete underlyingReader;
 }
 
     bool 
@@ -77,7 +77,7 @@ private:
 
 class RangeSplittingReadSupplierGenerator: public ReadSupplierGenerator {
 public:
-    RangeSplittingReadSupplierGenerator(const char *i_fileName, bool i_isSAM, unsigned numThreads, const ReaderContext& context);
+    RangeSplittingReadSupplierGenerator(const char *i_fileName, enum FileType i_fileType, unsigned numThreads, const ReaderContext& context);
     ~RangeSplittingReadSupplierGenerator() {delete splitter; delete [] fileName;}
 
     ReadSupplier *generateNewReadSupplier();
@@ -86,7 +86,7 @@ public:
 private:
     RangeSplitter *splitter;
     char *fileName;
-    const bool isSAM;
+    const enum FileType fileType;
     const int numThreads;
     ReaderContext context;
 };
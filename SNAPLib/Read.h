@@ -33,6 +33,7 @@ Revision History:
 #include "Error.h"
 #include "Genome.h"
 #include "AlignmentResult.h"
+#include "ReadPreprocessing.h"
 
 class FileFormat;
 
@@ -60,7 +61,8 @@ struct PairedAlignmentResult;
 //      A ReadReader understands how to generate reads from some input source (i.e., a FASTQ, SAM, BAM or CRAM file, for instance).
 //      It owns the storage for the read's information (i.e., the base string), but does not own the Read object itself.  It is responsible
 //      for assuring that the memory for the read data is valid for the lifetime of the ReadReader (which, in practice, means it needs
-//      to use mapped files).  ReadReaders may assume that they will only be called from one thread.
+//      to use mapped files).  ReadReaders may assume that they will only be called from one thread, except that readers that support
+//      parallel parsing may have getReadFromChunk() called on several threads at once (see below).
 //
 // PairedReadReader:
 //      Similar to a ReadReader, except that it gets mate pairs of Reads.
@@ -103,6 +105,18 @@ struct ReaderContext
     bool                headerMatchesIndex; // header refseq matches current index
 };
 
+//
+// A piece of a ReadReader's input that several threads can parse at once.  It ends at a record boundary, so the reads in
+// it are exactly the ones that begin in [buffer, buffer + bytes).  The last of them may run on into the rest of the valid data.
+//
+struct ReadChunk {
+    char        *buffer;
+    _int64      bytes;
+    _int64      validBytes;
+    _int64      offset;         // How far parsing has gotten
+    DataBatch   batch;          // getNextChunk() holds this once on the caller's behalf
+};
+
 class ReadReader {
 public:
     ReadReader(const ReaderContext& i_context) : context(i_context) {}
@@ -121,6 +135,15 @@ public:
     // decremens hold refcount, when all holds are released the batch is no longer valid
     virtual bool releaseBatch(DataBatch batch) = 0;
 
+    //
+    // Parallel parsing, for formats where a record boundary can be found by looking at the data from an arbitrary point.
+    // getNextChunk() takes about targetBytes of the input and must only be called from one thread at a time (and not mixed
+    // with getNextRead()).  getReadFromChunk() may be called on any thread, and returns false when the chunk is used up.
+    //
+    virtual bool supportsParallelParsing() { return false; }
+    virtual bool getNextChunk(_int64 targetBytes, ReadChunk *chunk) { return false; }
+    virtual bool getReadFromChunk(ReadChunk *chunk, Read *readToUpdate) { return false; }
+
     ReaderContext* getContext() { return &context; }
 
 protected:
@@ -367,9 +390,10 @@ public:
                 unsigned i_idLength,
                 const char *i_data, 
                 const char *i_quality, 
-                unsigned i_dataLength)
+                unsigned i_dataLength,
+                bool allUpper = false)
         {
-            init(i_id, i_idLength, i_data, i_quality, i_dataLength, InvalidGenomeLocation, -1, 0, 0, 0, 0, 0, NULL, 0, 0);
+            init(i_id, i_idLength, i_data, i_quality, i_dataLength, InvalidGenomeLocation, -1, 0, 0, 0, 0, 0, NULL, 0, 0, allUpper);
         }
 
         void init(
@@ -419,19 +443,10 @@ public:
             // '.' to N.
             //
             if (! allUpper) {
-                unsigned anyLowerCase = 0;
-                for (unsigned i = 0; i < dataLength; i++) {
-                    anyLowerCase |= IS_LOWER_CASE_OR_DOT[data[i]];
-                }
-
-                if (anyLowerCase) {
-                    assureLocalBufferLargeEnough();
+                assureLocalBufferLargeEnough();
+                if (UpcaseReadData(data, dataLength, localBuffer)) {
                     upcaseForwardRead = localBuffer;
                     localBufferAllocationOffset += unclippedLength;
-                    for (unsigned i = 0; i < dataLength; i++) {
-                        upcaseForwardRead[i] = TO_UPPER_CASE_DOT_TO_N[data[i]];
-                    }
-
                     unclippedData = data = upcaseForwardRead;
                 }
             }
@@ -0,0 +1,221 @@
+/*++
+
+Module Name:
+
+    ReadPreprocessing.cpp
+
+Abstract:
+
+    The per-read setup that the aligners do before they look up any seeds: the reverse complement, the reversed
+    strings that the backwards LV uses, the count of Ns and the encoding of every seed in the read, all built in one
+    pass over the bases.  Also the upper casing that Read::init() does.
+
+Environment:
+
+    User mode service.
+
+--*/
+
+#include "stdafx.h"
+#include "ReadPreprocessing.h"
+#include "Seed.h"
+#include "Tables.h"
+#ifdef SIMD_KERNELS_AVAILABLE
+#include <immintrin.h>
+#endif
+
+static SIMDLevel preprocessingKernel = GetProcessorSIMDLevel();
+
+    SIMDLevel
+GetReadPreprocessingKernel()
+{
+    return preprocessingKernel;
+}
+
+    void
+SetReadPreprocessingKernel(SIMDLevel kernel)
+{
+    preprocessingKernel = __min(kernel, GetProcessorSIMDLevel());
+}
+
+//
+// Builds the seed starting at each offset from the base values (as in BASE_VALUE) one base at a time, by shifting the
+// new base into the bottom of the forward encoding and the top of the reverse complement one.  This gives the same
+// result as Seed(text, seedLen) at every offset without going back over the bases of each seed.
+//
+class SeedRoller {
+public:
+    SeedRoller(Seed *i_seeds, unsigned i_seedLen) :
+        seeds(i_seeds), seedLen(i_seedLen), basesSeen(0), bases(0), rcBases(0),
+        mask(i_seedLen >= 32 ? ~(_uint64)0 : ((_uint64)1 << (2 * i_seedLen)) - 1), rcShift(2 * (i_seedLen - 1)) {}
+
+    inline void add(unsigned value) {
+        bases = ((bases << 2) | value) & mask;
+        rcBases = (rcBases >> 2) | ((_uint64)(value ^ 0x3) << rcShift);
+        basesSeen++;
+        if (basesSeen >= seedLen) {
+            seeds[basesSeen - seedLen] = Seed((_int64)bases, (_int64)rcBases);
+        }
+    }
+
+private:
+    Seed        *seeds;
+    unsigned    seedLen;
+    unsigned    basesSeen;
+    _uint64     bases;
+    _uint64     rcBases;
+    _uint64     mask;
+    unsigned    rcShift;
+};
+
+static inline void PreprocessBase(const char *data, const char *quality, unsigned readLen, unsigned i, PreprocessedRead *output, SeedRoller *roller)
+{
+    char base = data[i];
+    int value = BASE_VALUE[(unsigned char)base];
+    char complement = value < 4 ? VALUE_BASE[value ^ 0x3] : 'N';
+
+    output->nNs += 'N' == base;
+    output->nNonACGTBases += value >= 4;
+
+    if (NULL != output->rcData) {
+        output->rcData[readLen - i - 1] = complement;
+    }
+    if (NULL != output->rcQuality) {
+        output->rcQuality[readLen - i - 1] = quality[i];
+    }
+    if (NULL != output->reversedData) {
+        output->reversedData[readLen - i - 1] = base;
+    }
+    if (NULL != output->reversedRCData) {
+        output->reversedRCData[i] = complement;
+    }
+    if (NULL != roller) {
+        roller->add(value & 0x3);
+    }
+}
+
+#ifdef SIMD_KERNELS_AVAILABLE
+//
+// Sixteen bases at a time.  A, C, G and T are 0x41, 0x43, 0x47 and 0x54, so their low nibbles are all different, and
+// a pshufb on the low nibble looks up the complement and base value of all sixteen at once.  A base is one of the four
+// only if it's equal to what the same lookup in a table of the bases themselves gives back; everything else becomes
+// N.  The reversed strings are the same vectors stored at the mirror offset with their bytes reversed.
+//
+SIMD_TARGET("sse4.1") static void PreprocessReadSSE41(const char *data, const char *quality, unsigned readLen, PreprocessedRead *output, SeedRoller *roller)
+{
+    //
+    // The unused entries of baseOfNibble are 'A', whose own low nibble is 1, so they never match.
+    //
+    const __m128i lowNibble = _mm_set1_epi8(0x0f);
+    const __m128i baseOfNibble = _mm_setr_epi8('A', 'A', 'A', 'C', 'T', 'A', 'A', 'G', 'A', 'A', 'A', 'A', 'A', 'A', 'A', 'A');
+    const __m128i complementOfNibble = _mm_setr_epi8('N', 'T', 'N', 'G', 'A', 'N', 'N', 'C', 'N', 'N', 'N', 'N', 'N', 'N', 'N', 'N');
+    const __m128i valueOfNibble = _mm_setr_epi8(0, 0, 0, 2, 3, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i reverseBytes = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    const __m128i nBase = _mm_set1_epi8('N');
+
+    unsigned i;
+    for (i = 0; i + 16 <= readLen; i += 16) {
+        __m128i bases = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i nibbles = _mm_and_si128(bases, lowNibble);
+        __m128i isACGT = _mm_cmpeq_epi8(bases, _mm_shuffle_epi8(baseOfNibble, nibbles));
+        __m128i complement = _mm_blendv_epi8(nBase, _mm_shuffle_epi8(complementOfNibble, nibbles), isACGT);
+
+        output->nNs += CountOneBits(_mm_movemask_epi8(_mm_cmpeq_epi8(bases, nBase)));
+        output->nNonACGTBases += 16 - CountOneBits(_mm_movemask_epi8(isACGT));
+
+        unsigned mirrorOffset = readLen - i - 16;
+        if (NULL != output->rcData) {
+            _mm_storeu_si128((__m128i *)(output->rcData + mirrorOffset), _mm_shuffle_epi8(complement, reverseBytes));
+        }
+        if (NULL != output->rcQuality) {
+            _mm_storeu_si128((__m128i *)(output->rcQuality + mirrorOffset), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(quality + i)), reverseBytes));
+        }
+        if (NULL != output->reversedData) {
+            _mm_storeu_si128((__m128i *)(output->reversedData + mirrorOffset), _mm_shuffle_epi8(bases, reverseBytes));
+        }
+        if (NULL != output->reversedRCData) {
+            _mm_storeu_si128((__m128i *)(output->reversedRCData + i), complement);
+        }
+        if (NULL != roller) {
+            BYTE values[16];
+            _mm_storeu_si128((__m128i *)values, _mm_shuffle_epi8(valueOfNibble, nibbles));
+            for (unsigned j = 0; j < 16; j++) {
+                roller->add(values[j]);
+            }
+        }
+    }
+
+    for (; i < readLen; i++) {
+        PreprocessBase(data, quality, readLen, i, output, roller);
+    }
+}
+
+SIMD_TARGET("sse4.1") static bool UpcaseReadDataSSE41(const char *data, unsigned length, char *upcased)
+{
+    const __m128i lowerA = _mm_set1_epi8('a');
+    const __m128i lettersAfterA = _mm_set1_epi8('z' - 'a');
+    const __m128i caseBit = _mm_set1_epi8(0x20);
+    const __m128i dot = _mm_set1_epi8('.');
+    const __m128i nBase = _mm_set1_epi8('N');
+
+    __m128i changed = _mm_setzero_si128();
+    unsigned i;
+    for (i = 0; i + 16 <= length; i += 16) {
+        __m128i bases = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i fromA = _mm_sub_epi8(bases, lowerA);
+        __m128i isLower = _mm_cmpeq_epi8(_mm_min_epu8(fromA, lettersAfterA), fromA);
+        __m128i isDot = _mm_cmpeq_epi8(bases, dot);
+
+        __m128i upper = _mm_blendv_epi8(_mm_sub_epi8(bases, _mm_and_si128(isLower, caseBit)), nBase, isDot);
+        _mm_storeu_si128((__m128i *)(upcased + i), upper);
+        changed = _mm_or_si128(changed, _mm_or_si128(isLower, isDot));
+    }
+
+    unsigned anyChanged = _mm_movemask_epi8(changed);
+    for (; i < length; i++) {
+        upcased[i] = TO_UPPER_CASE_DOT_TO_N[(unsigned char)data[i]];
+        anyChanged |= IS_LOWER_CASE_OR_DOT[(unsigned char)data[i]];
+    }
+
+    return 0 != anyChanged;
+}
+#endif // SIMD_KERNELS_AVAILABLE
+
+    void
+PreprocessRead(const char *data, const char *quality, unsigned readLen, PreprocessedRead *output)
+{
+    output->nNs = 0;
+    output->nNonACGTBases = 0;
+
+    SeedRoller roller(output->seeds, output->seedLen);
+    SeedRoller *rollerToUse = NULL != output->seeds ? &roller : NULL;
+
+#ifdef SIMD_KERNELS_AVAILABLE
+    if (preprocessingKernel >= SIMDLevelSSE41) {
+        PreprocessReadSSE41(data, quality, readLen, output, rollerToUse);
+        return;
+    }
+#endif // SIMD_KERNELS_AVAILABLE
+
+    for (unsigned i = 0; i < readLen; i++) {
+        PreprocessBase(data, quality, readLen, i, output, rollerToUse);
+    }
+}
+
+    bool
+UpcaseReadData(const char *data, unsigned length, char *upcased)
+{
+#ifdef SIMD_KERNELS_AVAILABLE
+    if (preprocessingKernel >= SIMDLevelSSE41) {
+        return UpcaseReadDataSSE41(data, length, upcased);
+    }
+#endif // SIMD_KERNELS_AVAILABLE
+
+    unsigned anyChanged = 0;
+    for (unsigned i = 0; i < length; i++) {
+        upcased[i] = TO_UPPER_CASE_DOT_TO_N[(unsigned char)data[i]];
+        anyChanged |= IS_LOWER_CASE_OR_DOT[(unsigned char)data[i]];
+    }
+
+    return 0 != anyChanged;
+}
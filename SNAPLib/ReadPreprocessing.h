@@ -0,0 +1,58 @@
+/*++
+
+Module Name:
+
+    ReadPreprocessing.h
+
+Abstract:
+
+    The per-read setup that the aligners do before they look up any seeds: the reverse complement, the reversed
+    strings that the backwards LV uses, the count of Ns and the encoding of every seed in the read, all built in one
+    pass over the bases.  Also the upper casing that Read::init() does.
+
+Environment:
+
+    User mode service.
+
+--*/
+
+#pragma once
+
+#include "Compat.h"
+
+struct Seed;
+
+//
+// Where PreprocessRead() puts what it builds.  Any of the pointers may be NULL if the caller doesn't want that one.
+// The strings must each hold readLen bytes, and seeds must hold readLen - seedLen + 1 entries.
+//
+struct PreprocessedRead {
+    char        *rcData;            // The reverse complement.  Anything other than A, C, G or T complements to N.
+    char        *rcQuality;         // The quality string reversed
+    char        *reversedData;      // The read reversed but not complemented
+    char        *reversedRCData;    // The reverse complement reversed, which is just the complement
+    Seed        *seeds;             // seeds[i] is the seed starting at offset i.  Meaningless if it contains a non-ACGT base.
+    unsigned    seedLen;            // Only used if seeds is non-NULL
+
+    unsigned    nNs;                // Filled in: how many of the bases are N
+    unsigned    nNonACGTBases;      // Filled in: how many aren't A, C, G or T (including the Ns).  If it's 0, every seed is good.
+};
+
+//
+// The bases must already be upper case (see Read::init()).  The results are the same as doing it a base at a time
+// through the COMPLEMENT, IS_N and BASE_VALUE tables, except that anything that isn't an upper case base complements
+// to N.
+//
+void PreprocessRead(const char *data, const char *quality, unsigned readLen, PreprocessedRead *output);
+
+//
+// Writes data into upcased with lower case letters converted to upper case and '.' converted to N.  Returns whether
+// anything changed, which is rare, so that the caller can use the original instead.
+//
+bool UpcaseReadData(const char *data, unsigned length, char *upcased);
+
+//
+// Which kernel the functions above use.  It defaults to the best one the processor supports; tests use this to compare them.
+//
+SIMDLevel GetReadPreprocessingKernel();
+void SetReadPreprocessingKernel(SIMDLevel kernel);
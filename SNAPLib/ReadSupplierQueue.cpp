@@ -30,12 +30,23 @@ Revision History:
 
 //#define PAIR_MATCH_DEBUG
 
- ReadSupplierQueue::ReadSupplierQueue(ReadReader *reader)
+ ReadSupplierQueue::ReadSupplierQueue(ReadReader *reader, int i_nParserThreads)
      : tracker(64)
 {
     commonInit();
 
     singleReader[0] = reader;
+
+    if (i_nParserThreads > 1 && reader->supportsParallelParsing()) {
+        nParserThreads = i_nParserThreads;
+        //
+        // Each parser fills its own element.
+        //
+        for (int i = 1; i < nParserThreads; i++) {
+            ReadQueueElement *element = new ReadQueueElement;
+            element->addToTail(emptyQueue);
+        }
+    }
 }
 
 ReadSupplierQueue::ReadSupplierQueue(ReadReader *firstHalfReader, ReadReader *secondHalfReader)
@@ -89,6 +100,9 @@ ReadSupplierQueue::commonInit()
     }
     pairedReader = NULL;
     elementSize = ReadQueueElement::MaxReadsPerElement;
+
+    nParserThreads = 1;
+    InitializeExclusiveLock(&parserReaderLock);
 }
 
 ReadSupplierQueue::~ReadSupplierQueue()
@@ -100,6 +114,7 @@ ReadSupplierQueue::~ReadSupplierQueue()
     DestroyEventObject(&throttle[0]);
     DestroyEventObject(&throttle[1]);
     DestroyExclusiveLock(&lock);
+    DestroyExclusiveLock(&parserReaderLock);
 }
 
 
@@ -108,6 +123,16 @@ ReadSupplierQueue::startReaders()
 {
     bool worked = true;
 
+    if (nParserThreads > 1) {
+        nReadersRunning = nParserThreads;
+        for (int i = 0; i < nParserThreads; i++) {
+            if (!StartNewThread(ParserThreadMain, this)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
     if (singleReader[1] == NULL) {
         nReadersRunning = 1;
     } else {
@@ -608,6 +633,75 @@ ReadSupplierQueue::ReaderThread(ReaderThreadParams *params)
     ReleaseExclusiveLock(&lock);
 }
 
+    void
+ReadSupplierQueue::ParserThreadMain(void *param)
+{
+    ((ReadSupplierQueue *)param)->ParserThread();
+}
+
+    void
+ReadSupplierQueue::ParserThread()
+{
+    ReadReader *reader = singleReader[0];
+    ReadChunk chunk;
+
+    for (;;) {
+        AcquireExclusiveLock(&parserReaderLock);
+        bool gotChunk = reader->getNextChunk(ParserChunkBytes, &chunk);
+        ReleaseExclusiveLock(&parserReaderLock);
+        if (!gotChunk) {
+            break;
+        }
+
+        //
+        // getNextChunk() held the batch once, which covers the first element.  If the chunk has more reads than fit in an
+        // element, each one after that gets its own hold.
+        //
+        bool chunkHoldUsed = false;
+        while (chunk.offset < chunk.bytes) {
+            AcquireExclusiveLock(&lock);
+            ReadQueueElement *element = getEmptyElement();
+            ReleaseExclusiveLock(&lock);
+
+            element->totalReads = 0;
+            while (element->totalReads < (int)elementSize && reader->getReadFromChunk(&chunk, &element->reads[element->totalReads])) {
+                element->totalReads++;
+            }
+
+            AcquireExclusiveLock(&lock);
+            if (element->totalReads == 0) {
+                element->addToTail(emptyQueue);
+                AllowEventWaitersToProceed(&emptyBuffersAvailable);
+            } else {
+                if (chunkHoldUsed) {
+                    holdBatch(chunk.batch);
+                }
+                chunkHoldUsed = true;
+                element->batches.push_back(chunk.batch);
+                element->addToTail(&readyQueue[0]);
+                AllowEventWaitersToProceed(&readsReady);
+            }
+            ReleaseExclusiveLock(&lock);
+        }
+
+        if (!chunkHoldUsed) {
+            releaseBatch(chunk.batch);
+        }
+    }
+
+    AcquireExclusiveLock(&lock);
+    _ASSERT(nReadersRunning > 0);
+    if (1 == nReadersRunning) {
+        //
+        // The other parsers have queued everything they read, so that's all of it.
+        //
+        allReadsQueued = true;
+        AllowEventWaitersToProceed(&readsReady);
+    }
+    nReadersRunning--;
+    ReleaseExclusiveLock(&lock);
+}
+
 ReadSupplierFromQueue::ReadSupplierFromQueue(
     ReadSupplierQueue *i_queue)
     :
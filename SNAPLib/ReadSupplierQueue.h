@@ -88,8 +88,10 @@ public:
     // The version for single ended reads.  This is useful for formats that can't be divided by the
     // RangeSplitter, like BAM (though that's theoretically possible, so maybe..)  It takes a set 
     // of readers (presumably for different files), each of which runs independently and in parallel.
+    // If the reader supports parallel parsing, nParserThreads threads take chunks of its input and
+    // parse them at the same time.
     // 
-    ReadSupplierQueue(ReadReader *i_reader);
+    ReadSupplierQueue(ReadReader *i_reader, int i_nParserThreads = 1);
 
     //
     // The version for paired reads for which each end comes from a different Reader (and presumably
@@ -123,10 +125,21 @@ public:
     static int BufferCount(int numThreads)
     { return (__max(numThreads,2) + 1) * BatchesPerElement; }
 
+    //
+    // How many threads to parse a single file with for a given number of aligner threads.  Parsing is
+    // much cheaper than aligning, so it takes a lot of aligners to keep more than one parser busy.
+    //
+    static int ParserThreadCount(int numThreads)
+    { return __max(1, __min(MaxParserThreads, numThreads / AlignerThreadsPerParser)); }
+
 private:
 
     static const int BatchesPerElement = 4;
 
+    static const int MaxParserThreads = 8;
+    static const int AlignerThreadsPerParser = 16;
+    static const _int64 ParserChunkBytes = 1024 * 1024;   // A chunk of this much FASTQ fits in one element for reads of 100 bases or so
+
     void commonInit();
 
     ReadReader          *singleReader[2];   // Only [0] is filled in for single ended reads
@@ -172,6 +185,15 @@ private:
 
     static void ReaderThreadMain(void *);
     void ReaderThread(ReaderThreadParams *params);
+
+    //
+    // The parallel parsing version of ReaderThread(), for single ended readers that support it.
+    //
+    int                 nParserThreads;
+    ExclusiveLock       parserReaderLock;   // Serializes getNextChunk() calls on the single reader
+
+    static void ParserThreadMain(void *);
+    void ParserThread();
 };
 
 //
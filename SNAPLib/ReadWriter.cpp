@@ -176,7 +176,9 @@ SimpleReadWriter::writeReads(
             unsigned nAdjustments = 0;
 
             while (!format->writeRead(context, &lvc, buffer + used, size - used, &usedBuffer[whichResult], read->getIdLength(), read, results[whichResult].status,
-                results[whichResult].mapq, finalLocations[whichResult], results[whichResult].direction, (whichResult > 0) || !firstIsPrimary, &addFrontClipping)) {
+                results[whichResult].mapq, finalLocations[whichResult], results[whichResult].direction, (whichResult > 0) || !firstIsPrimary, &addFrontClipping,
+                false, false, NULL, NotFound, 0, FORWARD, false,
+                (results[whichResult].status != NotFound && finalLocations[whichResult] == results[whichResult].location) ? &results[whichResult].traceback : NULL)) {
 
                 nAdjustments++;
 
@@ -360,7 +362,8 @@ SimpleReadWriter::writePairs(
                         idLengths[whichRead], reads[whichRead], result[whichAlignmentPair].status[whichRead], result[whichAlignmentPair].mapq[whichRead], locations[whichRead], result[whichAlignmentPair].direction[whichRead],
                         whichAlignmentPair != 0 || !firstIsPrimary, &addFrontClipping, true, writeOrder[firstOrSecond] == 0,
                         reads[1 - whichRead], result[whichAlignmentPair].status[1 - whichRead], locations[1 - whichRead], result[whichAlignmentPair].direction[1 - whichRead],
-                        result[whichAlignmentPair].alignedAsPair)) {
+                        result[whichAlignmentPair].alignedAsPair,
+                        (locations[whichRead] != InvalidGenomeLocation && locations[whichRead] == result[whichAlignmentPair].location[whichRead]) ? &result[whichAlignmentPair].traceback[whichRead] : NULL)) {
 
                         if (0 == addFrontClipping || locations[whichRead] == InvalidGenomeLocation) {
                             //
@@ -419,7 +422,8 @@ SimpleReadWriter::writePairs(
 
                 while (!format->writeRead(context, &lvc, buffer + used, size - used, &usedBuffer[whichRead][nResults + whichAlignment], reads[whichRead]->getIdLength(),
                     reads[whichRead], singleResults[whichRead][whichAlignment].status, singleResults[whichRead][whichAlignment].mapq, location, singleResults[whichRead][whichAlignment].direction,
-                    true, &addFrontClipping)) {
+                    true, &addFrontClipping, false, false, NULL, NotFound, 0, FORWARD, false,
+                    (location != InvalidGenomeLocation && location == singleResults[whichRead][whichAlignment].location) ? &singleResults[whichRead][whichAlignment].traceback : NULL)) {
 
                     if (0 == addFrontClipping) {
                         goto blownBuffer;
@@ -31,6 +31,8 @@ Environment:
 #include "AlignerOptions.h"
 #include "directions.h"
 #include "exit.h"
+#include "BitParallelEditDistance.h"
+#include "TextScanner.h"
 
 using std::max;
 using std::min;
@@ -294,40 +296,65 @@ SAMReader::parseLine(char *line, char *endOfBuffer, char *result[], size_t *line
     *linelength = 0;
 
     char *next = line;
-    char *endOfLine = strnchr(line,'\n',endOfBuffer-line);
-    if (NULL == endOfLine) {
-        return false;
-    }
 
     //
     // Skip over any leading spaces and tabs
     //
-    while (next < endOfLine && (*next == ' ' || *next == '\t')) {
+    while (next < endOfBuffer && (*next == ' ' || *next == '\t')) {
         next++;
     }
 
-    for (unsigned i = 0; i < nSAMFields; i++) {
-        if (NULL == next || next >= endOfLine) {
-            if (i == OPT) {
-                // no optional fields
-                result[OPT] = NULL;
-                break;
-            } else {
-                //
-                // Too few fields.
-                //
-                return false;
-            }
+    //
+    // Go from separator to separator (tabs, CRs for Windows CRLF text, and the newline) rather than looking at every
+    // byte.  This splits the line the same way as skipToBeyondNextFieldSeparator(): a run of tabs and CRs is a single
+    // separator, and a NUL before the newline means there's no line.
+    //
+    char *scanStart = next;
+    TextScanner scanner(scanStart, endOfBuffer - scanStart, true);
+    char *separator = scanStart + scanner.next();
+
+    for (unsigned i = 0; i < OPT; i++) {
+        if (separator >= endOfBuffer || '\0' == *separator || next == separator) {
+            //
+            // No newline, or too few fields (the only empty field is the one past the end of the line).
+            //
+            return false;
         }
 
         result[i] = next;
-        if (i == OPT) {
-            // OPT field is actually all fields until end of line
-            fieldLengths[OPT] = endOfLine - next;
-            break;
+        fieldLengths[i] = separator - next;
+
+        if ('\n' == *separator) {
+            next = separator;
+            continue;
         }
 
-        next = skipToBeyondNextFieldSeparator(next,endOfLine,&fieldLengths[i]);
+        next = separator + 1;
+        separator = scanStart + scanner.next();
+        while (separator == next && separator < endOfBuffer && ('\t' == *separator || '\r' == *separator)) {
+            next++;
+            separator = scanStart + scanner.next();
+        }
+    }
+
+    //
+    // The OPT field is actually all fields until end of line
+    //
+    char *startOfOptionalFields = next;
+    while (separator < endOfBuffer && '\n' != *separator && '\0' != *separator) {
+        separator = scanStart + scanner.next();
+    }
+    if (separator >= endOfBuffer || '\0' == *separator) {
+        return false;
+    }
+
+    char *endOfLine = separator;
+    if (startOfOptionalFields == endOfLine) {
+        // no optional fields
+        result[OPT] = NULL;
+    } else {
+        result[OPT] = startOfOptionalFields;
+        fieldLengths[OPT] = endOfLine - startOfOptionalFields;
     }
 
     *linelength =  endOfLine - line + 1;    // +1 skips over the \n
@@ -611,21 +638,16 @@ SAMReader::getNextRead(
                 return false;
             }
         }
-        char *newLine = strnchr(buffer, '\n', bytes);
-        if (NULL == newLine) {
-            //
-            // There is no newline, so the line crosses the end of the buffer.
-            // This should never happen since underlying reader manages overflow between chunks.
-            //
-            WriteErrorMessage("SAM file has too long a line, or doesn't end with a newline!  Failing.  fileOffset = %lld\n", data->getFileOffset());
-            soft_exit(1);
-        }
 
+        //
+        // getReadFromLine() finds the end of the line while it splits it into fields, and fails if there isn't one.  That
+        // should never happen since the underlying reader manages overflow between chunks.
+        //
         size_t lineLength;
         read->setReadGroup(context.defaultReadGroup);
         getReadFromLine(context.genome, buffer,buffer + bytes, read, alignmentResult, genomeLocation, direction, mapQ, &lineLength, flag, cigar, clipping);
         read->setBatch(data->getBatch());
-        data->advance((newLine + 1) - buffer);
+        data->advance(lineLength);
     } while ((context.ignoreSecondaryAlignments && ((*flag) & SAM_SECONDARY)) ||
              (context.ignoreSupplementaryAlignments && ((*flag) & SAM_SUPPLEMENTARY)));
 
@@ -659,7 +681,7 @@ SAMReader::createReadSupplierGenerator(
         return queue;
     } else {
         RangeSplitter *splitter = new RangeSplitter(QueryFileSize(fileName), numThreads, 100);
-        return new RangeSplittingReadSupplierGenerator(fileName, true, numThreads, context);
+        return new RangeSplittingReadSupplierGenerator(fileName, SAMFile, numThreads, context);
     }
 }
     
@@ -879,7 +901,7 @@ SAMFormat::getWriterSupplier(
         strcpy(tempFileName, options->outputFile.fileName);
         strcpy(tempFileName + len, ".tmp");
         dataSupplier = DataWriterSupplier::sorted(this, genome, tempFileName, options->sortMemory * (1ULL << 30),
-            options->numThreads, options->outputFile.fileName, NULL, options->writeBufferSize);
+            options->numThreads, options->outputFile.fileName, NULL, options->writeBufferSize, options->sortMergeFanIn);
     } else {
         dataSupplier = DataWriterSupplier::create(options->outputFile.fileName, options->writeBufferSize);
     }
@@ -1184,7 +1206,8 @@ SAMFormat::writeRead(
     AlignmentResult mateResult,
     GenomeLocation mateLocation,
     Direction mateDirection,
-    bool alignedAsPair
+    bool alignedAsPair,
+    const AlignmentTraceback *traceback
     ) const
 {
     const int MAX_READ = MAX_READ_LENGTH;
@@ -1231,7 +1254,7 @@ SAMFormat::writeRead(
 		cigar = computeCigarString(context.genome, lv, cigarBuf, cigarBufSize, cigarBufWithClipping, cigarBufWithClippingSize,
 			clippedData, clippedLength, basesClippedBefore, extraBasesClippedBefore, basesClippedAfter, 
 			read->getOriginalFrontHardClipping(), read->getOriginalBackHardClipping(), genomeLocation, direction, useM,
-			&editDistance, o_addFrontClipping);
+			&editDistance, o_addFrontClipping, traceback);
 		if (*o_addFrontClipping != 0) {
 			return false;
 		}
@@ -1332,6 +1355,21 @@ SAMFormat::writeRead(
     return true;
 }
 
+//
+// The edit distance limit for computing the CIGAR string of an alignment that the aligner already found.  Long reads
+// (which only exist in LONG_READS builds) can have more edits than LandauVishkin handles, so they get a limit that
+// BitParallelEditDistance can always satisfy; it only does as much work as the real edit distance needs.
+//
+static inline int CigarEditDistanceLimit(int patternLen)
+{
+#ifdef LONG_READS
+    if (patternLen >= BitParallelMinPatternLength) {
+        return patternLen;
+    }
+#endif // LONG_READS
+    return MAX_K - 1;
+}
+
 //
 // Common cigar string computation between SAM and BAM formats.
 //
@@ -1352,7 +1390,8 @@ SAMFormat::computeCigar(
     bool useM, 
     int * o_editDistance, 
     int *o_cigarBufUsed, 
-    int * o_addFrontClipping)
+    int * o_addFrontClipping,
+    const AlignmentTraceback * traceback)
 {
     if (dataLength > INT32_MAX - MAX_K) {
         dataLength = INT32_MAX - MAX_K;
@@ -1381,7 +1420,28 @@ SAMFormat::computeCigar(
         *o_extraBasesClippedAfter = 0;
     }
 
-    const char *reference = genome->getSubstring(genomeLocation, dataLength);
+    if (NULL != traceback && NULL != traceback->ops && 0 == extraBasesClippedBefore && 0 == *o_extraBasesClippedAfter &&
+        !UseBitParallelEditDistance((int)dataLength, CigarEditDistanceLimit((int)dataLength))) {
+        //
+        // The aligner kept the edits it found for this alignment, so use them rather than finding them again.  That only works if
+        // none of the read has to be clipped to keep it inside the contig, which is almost always, and if the traceback is one that
+        // LandauVishkinWithCigar would find too (see computeCigarFromTraceback).  Otherwise we fall through.
+        //
+        int tracebackEditDistance = LandauVishkinWithCigar::computeCigarFromTraceback(traceback, (int)dataLength, cigarBuf, cigarBufLen,
+            useM, cigarFormat, o_cigarBufUsed, o_addFrontClipping, &netIndel);
+
+        if (tracebackEditDistance >= 0 &&
+            (0 != *o_addFrontClipping || genomeLocation + dataLength + netIndel <= contig->beginningLocation + contig->length - genome->getChromosomePadding())) {
+            *o_editDistance = tracebackEditDistance;
+            return;
+        }
+    }
+
+    //
+    // LandauVishkin reads up to MAX_K past dataLength, so that much has to be unpacked for a packed genome.
+    //
+    char *unpackBuffer = genome->isPacked() ? lv->getScratch(Genome::getUnpackBufferSize(dataLength, 0, MAX_K)) : NULL;
+    const char *reference = genome->getSubstring(genomeLocation, dataLength, unpackBuffer, 0, MAX_K);
     if (NULL == reference) {
         //
         // Fell off the end of the contig.
@@ -1398,7 +1458,7 @@ SAMFormat::computeCigar(
         (int)(dataLength - *o_extraBasesClippedAfter + MAX_K), // Add space incase of indels.  We know there's enough, because the reference is padded.
         data,
         (int)(dataLength - *o_extraBasesClippedAfter),
-        MAX_K - 1,
+        CigarEditDistanceLimit((int)(dataLength - *o_extraBasesClippedAfter)),
         cigarBuf,
         cigarBufLen,
         useM,
@@ -1434,7 +1494,7 @@ SAMFormat::computeCigar(
             (int)(dataLength - *o_extraBasesClippedAfter + MAX_K), // Add space incase of indels.  We know there's enough, because the reference is padded.
             data,
             (int)(dataLength - *o_extraBasesClippedAfter),
-            MAX_K - 1,
+            CigarEditDistanceLimit((int)(dataLength - *o_extraBasesClippedAfter)),
             cigarBuf,
             cigarBufLen,
             useM,
@@ -1473,7 +1533,8 @@ SAMFormat::computeCigarString(
     Direction                   direction,
 	bool						useM,
     int *                       o_editDistance,
-    int *                       o_addFrontClipping
+    int *                       o_addFrontClipping,
+    const AlignmentTraceback *  traceback
 )
 {
     GenomeDistance extraBasesClippedAfter;
@@ -1481,7 +1542,7 @@ SAMFormat::computeCigarString(
 
     computeCigar(COMPACT_CIGAR_STRING, genome, lv, cigarBuf, cigarBufLen, data, dataLength, basesClippedBefore,
         extraBasesClippedBefore, basesClippedAfter, &extraBasesClippedAfter, genomeLocation, useM,
-        o_editDistance, &cigarBufUsed, o_addFrontClipping);
+        o_editDistance, &cigarBufUsed, o_addFrontClipping, traceback);
 
     if (*o_addFrontClipping != 0) {
         return NULL;
@@ -1517,7 +1578,7 @@ SAMFormat::computeCigarString(
         }
         snprintf(cigarBufWithClipping, cigarBufWithClippingLen, "%s%s%s%s%s", hardClipBefore, clipBefore, cigarBuf, clipAfter, hardClipAfter);
 
-		validateCigarString(genome, cigarBufWithClipping, cigarBufWithClippingLen, 
+		validateCigarString(genome, lv, cigarBufWithClipping, cigarBufWithClippingLen, 
 			data - basesClippedBefore, dataLength + (basesClippedBefore + basesClippedAfter), genomeLocation + extraBasesClippedBefore, direction, useM);
 
         return cigarBufWithClipping;
@@ -1527,11 +1588,12 @@ SAMFormat::computeCigarString(
 #ifdef _DEBUG
 	void 
 SAMFormat::validateCigarString(
-	const Genome *genome, const char * cigarBuf, int cigarBufLen, const char *data, GenomeDistance dataLength, GenomeLocation genomeLocation, Direction direction, bool useM)
+	const Genome *genome, LandauVishkinWithCigar * lv, const char * cigarBuf, int cigarBufLen, const char *data, GenomeDistance dataLength, GenomeLocation genomeLocation, Direction direction, bool useM)
 {
 	const char *nextChunkOfCigar = cigarBuf;
 	GenomeDistance offsetInData = 0;
-	const char *reference = genome->getSubstring(genomeLocation, dataLength);
+	char *unpackBuffer = genome->isPacked() ? lv->getScratch(Genome::getUnpackBufferSize(dataLength, 0, MAX_K)) : NULL;
+	const char *reference = genome->getSubstring(genomeLocation, dataLength, unpackBuffer, 0, MAX_K);
 	if (NULL == reference) {
 		WriteErrorMessage("validateCigarString: couldn't look up genome data for location %lld\n", genomeLocation);
 		soft_exit(1);
@@ -51,7 +51,7 @@ const int SAM_SUPPLEMENTARY      = 0x800; // Supplementary alignment
 
 class SAMReader : public ReadReader {
 public:
-        virtual ~SAMReader() {}
+        virtual ~SAMReader() { delete data; }
 
         SAMReader(DataReader* i_data, const ReaderContext& i_context);
 
@@ -167,7 +167,7 @@ public:
         int mapQuality, GenomeLocation genomeLocation, Direction direction, bool secondaryAlignment, int* o_addFrontClipping,
         bool hasMate = false, bool firstInPair = false, Read * mate = NULL, 
         AlignmentResult mateResult = NotFound, GenomeLocation mateLocation = 0, Direction mateDirection = FORWARD,
-        bool alignedAsPair = false) const; 
+        bool alignedAsPair = false, const AlignmentTraceback *traceback = NULL) const;
 
     // calculate data needed to write SAM/BAM record
     // very long argument list since this was extracted from
@@ -216,19 +216,21 @@ public:
         char * cigarBuf, int cigarBufLen,
         const char * data, GenomeDistance dataLength, unsigned basesClippedBefore, GenomeDistance extraBasesClippedBefore, unsigned basesClippedAfter,
         GenomeDistance *o_extraBasesClippedAfter, 
-        GenomeLocation genomeLocation, bool useM, int * o_editDistance, int *o_cigarBufUsed, int * o_addFrontClipping);
+        GenomeLocation genomeLocation, bool useM, int * o_editDistance, int *o_cigarBufUsed, int * o_addFrontClipping,
+        const AlignmentTraceback *traceback);
 
 private:
     static const char * computeCigarString(const Genome * genome, LandauVishkinWithCigar * lv,
         char * cigarBuf, int cigarBufLen, char * cigarBufWithClipping, int cigarBufWithClippingLen,
         const char * data, GenomeDistance dataLength, unsigned basesClippedBefore, GenomeDistance extraBasesClippedBefore, unsigned basesClippedAfter, 
         unsigned frontHardClipped, unsigned backHardClipped,
-        GenomeLocation genomeLocation, Direction direction, bool useM, int * o_editDistance, int * o_addFrontClipping);
+        GenomeLocation genomeLocation, Direction direction, bool useM, int * o_editDistance, int * o_addFrontClipping,
+        const AlignmentTraceback *traceback);
 
 #ifdef _DEBUG
-	static void validateCigarString(const Genome *genome, const char * cigarBuf, int cigarBufLen, const char *data, GenomeDistance dataLength, GenomeLocation genomeLocation, Direction direction, bool useM);
+	static void validateCigarString(const Genome *genome, LandauVishkinWithCigar * lv, const char * cigarBuf, int cigarBufLen, const char *data, GenomeDistance dataLength, GenomeLocation genomeLocation, Direction direction, bool useM);
 #else	// DEBUG
-	inline static void validateCigarString(const Genome *genome, const char * cigarBuf, int cigarBufLen, const char *data, GenomeDistance dataLength, GenomeLocation genomeLocation, Direction direction, bool useM) {}
+	inline static void validateCigarString(const Genome *genome, LandauVishkinWithCigar * lv, const char * cigarBuf, int cigarBufLen, const char *data, GenomeDistance dataLength, GenomeLocation genomeLocation, Direction direction, bool useM) {}
 #endif // DEBUG
 
 
@@ -0,0 +1,127 @@
+/*++
+
+Module Name:
+
+    SeedPopularity.cpp
+
+Abstract:
+
+    A compact sketch of seed popularity for ordering seed lookups.
+
+Environment:
+
+    User mode service.
+
+--*/
+
+#include "stdafx.h"
+#include "SeedPopularity.h"
+#include "BigAlloc.h"
+#include "GenericFile.h"
+#include "Error.h"
+
+SeedPopularity::SeedPopularity(_uint64 nSeedsToRecord, unsigned i_seedLen) : seedLen(i_seedLen)
+{
+    //
+    // Four bytes (eight nibbles) per recorded seed, so that about a quarter of the nibbles are in use and a seed that
+    // was never recorded has both of its nibbles set by other seeds only a few percent of the time.
+    //
+    nLines = __max((_uint64)1, (nSeedsToRecord * 4 + LineSize - 1) / LineSize);
+    lines = (BYTE *)BigAlloc(nLines * LineSize);
+    memset(lines, 0, nLines * LineSize);
+}
+
+SeedPopularity::~SeedPopularity()
+{
+    if (NULL != lines) {
+        BigDealloc(lines);
+        lines = NULL;
+    }
+}
+
+    _uint64
+SeedPopularity::reverseComplementBases(_uint64 bases, unsigned seedLen)
+{
+    _uint64 reverseComplement = 0;
+    for (unsigned i = 0; i < seedLen; i++) {
+        reverseComplement = (reverseComplement << 2) | ((bases & 0x3) ^ 0x3);
+        bases >>= 2;
+    }
+    return reverseComplement;
+}
+
+    void
+SeedPopularity::record(_uint64 bases, _int64 nHits)
+{
+    if (nHits < MinHitsToRecord) {
+        return;
+    }
+
+    _uint64 hashValue = hash(__min(bases, reverseComplementBases(bases, seedLen)));
+    BYTE *line = lines + (hashValue % nLines) * LineSize;
+    unsigned popularityClass = classForHits(nHits);
+
+    for (unsigned which = 0; which < 2; which++) {
+        unsigned nibble = whichNibble(hashValue, which);
+        if (getNibble(line, nibble) < popularityClass) {
+            unsigned shift = 4 * (nibble % 2);
+            line[nibble / 2] = (BYTE)((line[nibble / 2] & ~(0xf << shift)) | (popularityClass << shift));
+        }
+    }
+}
+
+//
+// The file is the number of lines and the seed length (as _uint64s) followed by the lines.
+//
+    bool
+SeedPopularity::saveToFile(const char *fileName) const
+{
+    FILE *file = fopen(fileName, "wb");
+    if (NULL == file) {
+        WriteErrorMessage("Unable to open seed popularity file '%s' for write\n", fileName);
+        return false;
+    }
+
+    _uint64 header[2] = {nLines, seedLen};
+    if (1 != fwrite(header, sizeof(header), 1, file) || 1 != fwrite(lines, nLines * LineSize, 1, file)) {
+        WriteErrorMessage("Failed to write seed popularity file '%s', %d\n", fileName, errno);
+        fclose(file);
+        return false;
+    }
+
+    fclose(file);
+    return true;
+}
+
+    SeedPopularity *
+SeedPopularity::loadFromFile(const char *fileName, unsigned seedLen)
+{
+    GenericFile *file = GenericFile::open(fileName, GenericFile::ReadOnly);
+    if (NULL == file) {
+        return NULL;
+    }
+
+    _uint64 header[2];
+    if (file->read(header, sizeof(header)) != sizeof(header) || header[1] != seedLen || 0 == header[0] ||
+        QueryFileSize(fileName) != (_int64)(sizeof(header) + header[0] * LineSize)) {
+        WriteErrorMessage("Seed popularity file '%s' is corrupt or for a different index; ignoring it.\n", fileName);
+        file->close();
+        delete file;
+        return NULL;
+    }
+
+    SeedPopularity *sketch = new SeedPopularity();
+    sketch->nLines = header[0];
+    sketch->seedLen = seedLen;
+    sketch->lines = (BYTE *)BigAlloc(sketch->nLines * LineSize);
+
+    if (file->read(sketch->lines, sketch->nLines * LineSize) != sketch->nLines * LineSize) {
+        WriteErrorMessage("Failed to read seed popularity file '%s'; ignoring it.\n", fileName);
+        delete sketch;
+        sketch = NULL;
+    }
+
+    file->close();
+    delete file;
+    return sketch;
+}
@@ -0,0 +1,118 @@
+/*++
+
+Module Name:
+
+    SeedPopularity.h
+
+Abstract:
+
+    A compact sketch of how many times each seed occurs in the genome, so that the aligner can tell which of a read's
+    seeds are likely to be selective before it spends a cache miss looking any of them up.
+
+Environment:
+
+    User mode service.
+
+--*/
+
+#pragma once
+
+#include "Compat.h"
+#include "Seed.h"
+
+//
+// The sketch holds a four bit popularity class for each seed that occurs more than a few times: ceil(log2) of the
+// most hits that the seed has in either direction, so class c means at most 2^c hits.  Seeds that occur only a
+// few times aren't recorded and come back as class 0.
+//
+// It's a count-min style sketch blocked into cache lines: a seed hashes to one 64 byte line and to two nibbles within
+// it, each of which holds the largest class of any seed that hashed there.  A lookup takes the smaller of the two,
+// so collisions can only make a seed look more popular than it is, and it costs a single cache miss.
+//
+// The sketch is built along with the index and saved in its own file in the index directory.  Indices built before it
+// existed simply don't have one.
+//
+class SeedPopularity {
+public:
+    static const unsigned MaxClass = 15;
+    static const _int64 MinHitsToRecord = 5;    // Anything less is class 2 or below, which isn't worth the space
+
+    //
+    // Make an empty sketch sized for nSeedsToRecord seeds.
+    //
+    SeedPopularity(_uint64 nSeedsToRecord, unsigned i_seedLen);
+    ~SeedPopularity();
+
+    //
+    // Record a seed (in either direction, given as its packed bases) with nHits hits.
+    //
+    void record(_uint64 bases, _int64 nHits);
+
+    bool saveToFile(const char *fileName) const;
+
+    //
+    // Returns NULL if the file isn't there (or is for a different seed length).
+    //
+    static SeedPopularity *loadFromFile(const char *fileName, unsigned seedLen);
+
+    inline void prefetch(Seed seed) const {
+        _mm_prefetch((const char *)getLine(hash(canonicalBases(seed))), _MM_HINT_T2);
+    }
+
+    inline unsigned getClass(Seed seed) const {
+        _uint64 hashValue = hash(canonicalBases(seed));
+        const BYTE *line = getLine(hashValue);
+        return __min(getNibble(line, whichNibble(hashValue, 0)), getNibble(line, whichNibble(hashValue, 1)));
+    }
+
+    static inline unsigned classForHits(_int64 nHits) {
+        unsigned popularityClass = 0;
+        while (popularityClass < MaxClass && ((_int64)1 << popularityClass) < nHits) {
+            popularityClass++;
+        }
+        return popularityClass;
+    }
+
+    static _uint64 reverseComplementBases(_uint64 bases, unsigned seedLen);
+
+    _int64 getSizeInBytes() const {return (_int64)(nLines * LineSize);}
+
+private:
+    static const unsigned LineSize = 64;
+    static const unsigned NibblesPerLine = LineSize * 2;
+
+    SeedPopularity() : lines(NULL) {}
+
+    static inline _uint64 canonicalBases(Seed seed) {
+        return __min(seed.getBases(), seed.getRCBases());
+    }
+
+    static inline _uint64 hash(_uint64 key) {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdull;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ull;
+        key ^= key >> 33;
+        return key;
+    }
+
+    inline const BYTE *getLine(_uint64 hashValue) const {
+        return lines + (hashValue % nLines) * LineSize;
+    }
+
+    //
+    // The line comes from the hash modulo the number of lines, so take the nibbles from the top bits, which that
+    // doesn't use up.
+    //
+    static inline unsigned whichNibble(_uint64 hashValue, unsigned which) {
+        return (unsigned)(hashValue >> (64 - 7 * (which + 1))) % NibblesPerLine;
+    }
+
+    static inline unsigned getNibble(const BYTE *line, unsigned whichNibble) {
+        return (line[whichNibble / 2] >> (4 * (whichNibble % 2))) & 0xf;
+    }
+
+    BYTE       *lines;
+    _uint64     nLines;
+    unsigned    seedLen;
+};
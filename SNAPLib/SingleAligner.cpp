@@ -41,7 +41,7 @@ using namespace std;
 using util::stringEndsWith;
 
 SingleAlignerContext::SingleAlignerContext(AlignerExtension* i_extension)
-    : AlignerContext(0, NULL, NULL, i_extension)
+    : AlignerContext(0, NULL, NULL, i_extension), alignmentCache(NULL)
 {
 }
 
@@ -86,6 +86,7 @@ SingleAlignerContext::runIterationThread()
             result.mapq = 0;
             result.score = 0;
             result.location = InvalidGenomeLocation;
+            result.traceback.clear();
             if (options->passFilter(read, NotFound, read->getDataLength() < minReadLength || read->countOfNs() > maxDist, false)) {
                 stats->notFound++;
                 if (NULL != readWriter) {
@@ -137,6 +138,13 @@ SingleAlignerContext::runIterationThread()
 
     aligner->setExplorePopularSeeds(options->explorePopularSeeds);
     aligner->setStopOnFirstHit(options->stopOnFirstHit);
+    aligner->setSeedLookupBatchSize(options->seedLookupBatchSize);
+    aligner->setRankSeedsByPopularity(options->seedRanking);
+    aligner->setUseExactMatchTier(!options->noExactMatchTier);
+    TracebackBuffer *tracebackBuffer = options->reuseTracebacks ? new TracebackBuffer : NULL;
+    if (NULL != tracebackBuffer) {
+        aligner->setTracebackBuffer(tracebackBuffer);
+    }
 
 #ifdef  _MSC_VER
     if (options->useTimingBarrier) {
@@ -162,42 +170,43 @@ SingleAlignerContext::runIterationThread()
             lastReportTime = timeInMillis();
         }
 
-        // Skip the read if it has too many Ns or trailing 2 quality scores.
-        if (read->getDataLength() < minReadLength || read->countOfNs() > maxDist) {
-            if (!options->passFilter(read, NotFound, true, false)) {
-                stats->filtered++;
-            } else {
-                if (NULL != readWriter) {
-                    SingleAlignmentResult result;
-                    result.status = NotFound;
-                    result.location = InvalidGenomeLocation;
-                    result.mapq = 0;
-                    result.direction = FORWARD;
-                    readWriter->writeReads(readerContext, read, &result, 1, true);
-                }
-                stats->uselessReads++;
-            }
+        if (handleUnalignableRead(read)) {
+            continue;
+        }
+
+        int nSecondaryResults = 0;
+        AlignmentCacheKey cacheKey;
+        if (lookupInAlignmentCache(read, &cacheKey, alignmentResults)) {
+            writeAlignedRead(read, alignmentResults, nSecondaryResults);
             continue;
         }
 
 #if     TIME_HISTOGRAM
         _int64 startTime = timeInNanos();
+#else   // TIME_HISTOGRAM
+        _int64 startTime = (NULL != alignmentCache) ? timeInNanos() : 0;
 #endif // TIME_HISTOGRAM
 
-        int nSecondaryResults = 0;
-
 #ifdef LONG_READS
         int oldMaxK = aligner->getMaxK();
         if (options->maxDistFraction > 0.0) {
-            aligner->setMaxK(min(MAX_K, (int)(read->getDataLength() * options->maxDistFraction)));
+            aligner->setMaxK((int)(read->getDataLength() * options->maxDistFraction));   // Past MAX_K goes to BitParallelEditDistance
         }
 #endif
 
+        if (NULL != tracebackBuffer) {
+            tracebackBuffer->clear();
+        }
+
         aligner->AlignRead(read, alignmentResults, maxSecondaryAlignmentAdditionalEditDistance, alignmentResultBufferCount - 1, &nSecondaryResults, maxSecondaryAlignments, alignmentResults + 1);
 #ifdef LONG_READS
         aligner->setMaxK(oldMaxK);
 #endif
 
+        if (NULL != alignmentCache) {
+            insertInAlignmentCache(cacheKey, alignmentResults, nSecondaryResults, timeInNanos() - startTime);
+        }
+
 #if     TIME_HISTOGRAM
         _int64 runTime = timeInNanos() - startTime;
         int timeBucket = min(30, cheezyLogBase2(runTime));
@@ -207,50 +216,160 @@ SingleAlignerContext::runIterationThread()
 
         allocator->checkCanaries();
 
-        bool containsPrimary = true;
-        if (NULL != readWriter) {
-            //
-            // Remove any reads that don't pass the filter, then send the remainder down to the writer.
-            //
-            for (int i = 0; i <= nSecondaryResults; i++) {
-                if (!options->passFilter(read, alignmentResults[i].status, false, i != 0 || !containsPrimary)) {
-                    if (i == 0) {
-                        containsPrimary = false;
-                    }
-                    //
-                    // Copy the last result here.
-                    //
-                    alignmentResults[i] = alignmentResults[nSecondaryResults];
-                    nSecondaryResults--;
-
-                    //
-                    // And back up so it gets checked.
-                    //
-                    i--;
-                }
-            } // For each result
+        writeAlignedRead(read, alignmentResults, nSecondaryResults);
+    }
 
-            stats->extraAlignments += nSecondaryResults + (containsPrimary ? 0 : 1);    // If it doesn't contain the primary, then it's a secondary.
-            readWriter->writeReads(readerContext, read, alignmentResults, nSecondaryResults + 1, containsPrimary);
+    stats->seedLookups += aligner->getNSeedsLookedUp();
+    stats->unusedSeedLookups += aligner->getNSeedsLookedUp() - aligner->getNHashTableLookups();
+    stats->seedLookupBatches += aligner->getNSeedLookupBatches();
+    stats->seedsInTimedLookupBatches += aligner->getNSeedsInTimedBatches();
+    stats->nanosInTimedLookupBatches += aligner->getNanosInTimedBatches();
+    stats->seedLookupsPastExactMatch += aligner->getNSeedsLookedUpPastExactMatch();
+    stats->exactMatchTierReads += aligner->getNReadsFinishedByExactMatchTier();
+    stats->fullSearchReads += aligner->getNReadsFinishedByFullSearch();
 
-        }
+    aligner->~BaseAligner(); // This calls the destructor without calling operator delete, allocator owns the memory.
+    delete tracebackBuffer;
+ 
+    if (supplier != NULL) {
+        delete supplier;
+    }
 
-        if (containsPrimary) {
-            updateStats(stats, read, alignmentResults[0].status, alignmentResults[0].score, alignmentResults[0].mapq);
-        } else {
-            stats->filtered++;
+    delete allocator;   // This is what actually frees the memory.
+}
+
+    bool
+SingleAlignerContext::handleUnalignableRead(
+    Read                    *read)
+/*++
+
+Routine Description:
+
+    Skip the read if it has too many Ns or trailing 2 quality scores, writing it out as unaligned if the filter allows.
+
+Return Value:
+
+    true if the read was unalignable and has been dealt with, false if it should be aligned.
+
+--*/
+{
+    if (read->getDataLength() >= minReadLength && read->countOfNs() <= maxDist) {
+        return false;
+    }
+
+    if (!options->passFilter(read, NotFound, true, false)) {
+        stats->filtered++;
+    } else {
+        if (NULL != readWriter) {
+            SingleAlignmentResult result;
+            result.status = NotFound;
+            result.location = InvalidGenomeLocation;
+            result.mapq = 0;
+            result.direction = FORWARD;
+            result.traceback.clear();
+            readWriter->writeReads(readerContext, read, &result, 1, true);
         }
+        stats->uselessReads++;
+    }
+
+    return true;
+}
+
+    bool
+SingleAlignerContext::lookupInAlignmentCache(
+    Read                    *read,
+    AlignmentCacheKey       *key,
+    SingleAlignmentResult   *alignmentResult)
+/*++
+
+Routine Description:
+
+    Look a read up in the alignment cache, if there is one.
+
+Arguments:
 
+    read            - the read to look up
+    key             - returns the read's cache key, for inserting its alignment if it misses
+    alignmentResult - returns the cached alignment on a hit
 
+Return Value:
+
+    true if the read hit in the cache and alignmentResult is its (primary and only) alignment.
+
+--*/
+{
+    if (NULL == alignmentCache) {
+        return false;
     }
 
-    aligner->~BaseAligner(); // This calls the destructor without calling operator delete, allocator owns the memory.
- 
-    if (supplier != NULL) {
-        delete supplier;
+    key->computeFor(read);
+    stats->alignmentCacheLookups++;
+
+    _int64 nanosToAlign;
+    if (!alignmentCache->lookup(*key, alignmentResult, &nanosToAlign)) {
+        return false;
     }
 
-    delete allocator;   // This is what actually frees the memory.
+    stats->alignmentCacheHits++;
+    stats->alignmentCacheNanosSaved += nanosToAlign;
+    alignmentResult->traceback.clear();     // It was in the traceback buffer for the read that was cached, which is long gone
+    return true;
+}
+
+    void
+SingleAlignerContext::insertInAlignmentCache(
+    const AlignmentCacheKey &key,
+    SingleAlignmentResult   *alignmentResults,
+    int                      nSecondaryResults,
+    _int64                   nanosToAlign)
+{
+    //
+    // This has to happen before writeAlignedRead, which filters the results in place.
+    //
+    if (0 == nSecondaryResults) {
+        alignmentCache->insert(key, alignmentResults[0], nanosToAlign);
+    }
+}
+
+    void
+SingleAlignerContext::writeAlignedRead(
+    Read                    *read,
+    SingleAlignmentResult   *alignmentResults,
+    int                      nSecondaryResults)
+{
+    bool containsPrimary = true;
+    if (NULL != readWriter) {
+        //
+        // Remove any reads that don't pass the filter, then send the remainder down to the writer.
+        //
+        for (int i = 0; i <= nSecondaryResults; i++) {
+            if (!options->passFilter(read, alignmentResults[i].status, false, i != 0 || !containsPrimary)) {
+                if (i == 0) {
+                    containsPrimary = false;
+                }
+                //
+                // Copy the last result here.
+                //
+                alignmentResults[i] = alignmentResults[nSecondaryResults];
+                nSecondaryResults--;
+
+                //
+                // And back up so it gets checked.
+                //
+                i--;
+            }
+        } // For each result
+
+        stats->extraAlignments += nSecondaryResults + (containsPrimary ? 0 : 1);    // If it doesn't contain the primary, then it's a secondary.
+        readWriter->writeReads(readerContext, read, alignmentResults, nSecondaryResults + 1, containsPrimary);
+
+    }
+
+    if (containsPrimary) {
+        updateStats(stats, read, alignmentResults[0].status, alignmentResults[0].score, alignmentResults[0].mapq);
+    } else {
+        stats->filtered++;
+    }
 }
 
     void
@@ -301,6 +420,14 @@ SingleAlignerContext::typeSpecificBeginIteration()
     readerContext.headerBytes = context->headerBytes;
     readerContext.headerLength = context->headerLength;
     readerContext.headerMatchesIndex = context->headerMatchesIndex;
+
+    //
+    // The cache lives for one run rather than the whole process, since in daemon mode the next run may have a different
+    // index or options, and so different alignments for the same reads.
+    //
+    if (options->alignmentCacheMegabytes > 0) {
+        alignmentCache = new AlignmentCache<SingleAlignmentResult>((size_t)options->alignmentCacheMegabytes * 1024 * 1024);
+    }
 }
     void 
 SingleAlignerContext::typeSpecificNextIteration()
@@ -313,6 +440,9 @@ SingleAlignerContext::typeSpecificNextIteration()
     }
     delete readSupplierGenerator;
     readSupplierGenerator = NULL;
+
+    delete alignmentCache;
+    alignmentCache = NULL;
 }
 
  
@@ -28,6 +28,8 @@ Revision History:
 #include "AlignerStats.h"
 #include "ReadSupplierQueue.h"
 #include "AlignmentResult.h"
+#include "BaseAligner.h"
+#include "AlignmentCache.h"
 
 class SingleAlignerContext : public AlignerContext
 {
@@ -53,10 +55,17 @@ protected:
 
     virtual void updateStats(AlignerStats* stats, Read* read, AlignmentResult result, int score, int mapq);
 
+    bool handleUnalignableRead(Read *read);
+    bool lookupInAlignmentCache(Read *read, AlignmentCacheKey *key, SingleAlignmentResult *alignmentResult);
+    void insertInAlignmentCache(const AlignmentCacheKey &key, SingleAlignmentResult *alignmentResults, int nSecondaryResults, _int64 nanosToAlign);
+    void writeAlignedRead(Read *read, SingleAlignmentResult *alignmentResults, int nSecondaryResults);
+
     //RangeSplittingReadSupplierGenerator   *readSupplierGenerator;
 
     ReadSupplierGenerator *readSupplierGenerator;
 
+    AlignmentCache<SingleAlignmentResult> *alignmentCache;     // NULL unless -ac
+
 	friend class AlignerContext2;
 
     bool isPaired() {return false;}
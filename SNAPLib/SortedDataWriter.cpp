@@ -55,23 +55,23 @@ typedef VariableSizeVector<SortEntry,150,true> SortVector;
 struct SortBlock
 {
 #ifdef VALIDATE_SORT
-    SortBlock() : start(0), bytes(0), location(0), length(0), reader(NULL), minLocation(0), maxLocation(0) {}
+    SortBlock() : start(0), bytes(0), firstSample(0), nSamples(0), inRunsFile(false), merged(false), minLocation(0), maxLocation(0) {}
 #else
-    SortBlock() : start(0), bytes(0), location(0), length(0), reader(NULL) {}
+    SortBlock() : start(0), bytes(0), firstSample(0), nSamples(0), inRunsFile(false), merged(false) {}
 #endif
 	SortBlock(const SortBlock& other) { *this = other; }
     void operator=(const SortBlock& other);
 
     size_t      start;
     size_t      bytes;
+    // samples of (location, file offset) within the block, in SortedDataFilterSupplier::samples
+    size_t      firstSample;
+    size_t      nSamples;
+    bool        inRunsFile; // a run written by a merge pass, rather than a block spilled by a writer
+    bool        merged; // already merged into a run, so not part of the final merge
 #ifdef VALIDATE_SORT
 	GenomeLocation	minLocation, maxLocation;
 #endif
-    // for mergesort phase
-    DataReader* reader;
-    GenomeLocation    location; // genome location of current read
-    char*       data; // read data in read buffer
-    GenomeDistance    length; // length in bytes
 };
 
     void
@@ -80,9 +80,10 @@ SortBlock::operator=(
 {
     start = other.start;
     bytes = other.bytes;
-    location = other.location;
-    length = other.length;
-    reader = other.reader;
+    firstSample = other.firstSample;
+    nSamples = other.nSamples;
+    inRunsFile = other.inRunsFile;
+    merged = other.merged;
 #ifdef VALIDATE_SORT
 	minLocation = other.minLocation;
 	maxLocation = other.maxLocation;
@@ -90,6 +91,32 @@ SortBlock::operator=(
 }
 
 typedef VariableSizeVector<SortBlock> SortBlockVector;
+
+//
+// The merge runs in parallel by splitting the output into partitions, each a range of genome locations.  A merge
+// thread takes the next partition, reads just that range from each block (finding where it starts using the samples
+// taken as the blocks were written), and merges it into a buffer of its own.  Partitions are written to the output
+// strictly in order: each one waits for turn, which is set once the partition before it has been completely written.
+// A partition that outgrows its thread's buffer waits for its turn and then writes directly, so memory stays bounded.
+//
+struct MergePartition
+{
+    GenomeLocation  minLocation;    // inclusive
+    GenomeLocation  limitLocation;  // exclusive, unless isLast
+    bool            isLast;
+    EventObject     turn;
+};
+
+// per-thread merge state for one block
+struct MergeCursor
+{
+    MergeCursor() : reader(NULL), data(NULL), location(0), length(0) {}
+
+    DataReader*     reader;
+    char*           data; // read data in read buffer
+    GenomeLocation  location; // genome location of current read
+    GenomeDistance  length; // length in bytes
+};
     
 class SortedDataFilterSupplier;
 
@@ -97,7 +124,7 @@ class SortedDataFilter : public DataWriter::Filter
 {
 public:
     SortedDataFilter(SortedDataFilterSupplier* i_parent)
-        : Filter(DataWriter::CopyFilter), parent(i_parent), locations(10000000)
+        : Filter(DataWriter::CopyFilter), parent(i_parent), locations(10000000), samples(), unwrittenBlocks(), nBatches(0)
     {}
 
     virtual ~SortedDataFilter() {}
@@ -109,6 +136,16 @@ public:
 private:
     SortedDataFilterSupplier*   parent;
     SortVector                  locations;
+    SortVector                  samples; // (location, file offset) every SampleSpacing bytes in the block being written
+
+    // blocks that may still be in flight to the temp file, with the batch number that wrote them
+    struct UnwrittenBlock
+    {
+        _int64  block;
+        _int64  batch;
+    };
+    VariableSizeVector<UnwrittenBlock> unwrittenBlocks;
+    _int64                      nBatches;
 };
 
 class SortedDataFilterSupplier : public DataWriter::FilterSupplier
@@ -123,6 +160,9 @@ public:
         DataWriter::FilterSupplier* i_sortedFilterSupplier,
         size_t i_bufferSize,
         size_t i_bufferSpace,
+        int i_numThreads,
+        int i_tempBufferCount,
+        unsigned i_mergeFanIn,
         FileEncoder* i_encoder = NULL)
         :
         format(i_fileFormat),
@@ -134,14 +174,29 @@ public:
         sortedFilterSupplier(i_sortedFilterSupplier),
         bufferSize(i_bufferSize),
         bufferSpace(i_bufferSpace),
-        blocks()
+        blocks(),
+        numThreads(max(1, i_numThreads)),
+        samples(),
+        partitions(NULL),
+        nPartitions(0),
+        tempBufferCount(i_tempBufferCount),
+        mergeFanIn(i_mergeFanIn),
+        runsFileName(NULL),
+        runsFile(NULL),
+        runsFileSize(0),
+        nBackgroundMerges(0),
+        backgroundMergeBytes(0)
     {
         InitializeExclusiveLock(&lock);
+        if (mergeFanIn > 0) {
+            startBackgroundMerge();
+        }
     }
 
     virtual ~SortedDataFilterSupplier()
     {
         DestroyExclusiveLock(&lock);
+        delete [] runsFileName;
     }
 
     virtual DataWriter::Filter* getFilter();
@@ -153,14 +208,59 @@ public:
     { headerSize = bytes; }
 
 #ifndef VALIDATE_SORT
-	void addBlock(size_t start, size_t bytes);
+	_int64 addBlock(size_t start, size_t bytes, SortVector& blockSamples);
 #else
-    void addBlock(size_t start, size_t bytes, GenomeLocation minLocation, GenomeLocation maxLocation);
+    _int64 addBlock(size_t start, size_t bytes, SortVector& blockSamples, GenomeLocation minLocation, GenomeLocation maxLocation);
 #endif
 
+    // a block from addBlock is now completely written to the temp file, so the background merge can read it
+    void blockWritten(_int64 whichBlock);
+
+    int getTempBufferCount() const
+    { return tempBufferCount; }
+
+    // take a (location, offset) sample at least this often within a block
+    static const size_t SampleSpacing = 64 * 1024;
+
+    // the final merge never has more blocks than this open at once
+    static const size_t MaxMergeReaders = 256;
+
 private:
     bool mergeSort();
 
+    void choosePartitions(size_t partitionBytes);
+
+    void findPartitionInBlock(const SortBlock& block, const MergePartition& partition, size_t* o_start, size_t* o_end);
+
+    bool fetchRecord(MergeCursor* cursor);
+
+    static void MergeThreadMain(void* param);
+
+    void mergeThread();
+
+    void mergePartition(int whichPartition, MergeCursor* cursors, char* chunk, size_t chunkSize, VariableSizeVector<GenomeDistance>& chunkLengths);
+
+    void writeRecord(char* data, GenomeDistance length);
+
+    void openRunsFile();
+
+    void dropMergedBlocks();
+
+    void mergeInPasses();
+
+    void startBackgroundMerge();
+
+    void stopBackgroundMerge();
+
+    static void BackgroundMergeThreadMain(void* param);
+
+    void backgroundMergeThread();
+
+    void mergeRun(SortBlock* inputs, _int64* inputIndices, int nInputs, int tier);
+
+    const char* blockFileName(const SortBlock& block) const
+    { return block.inRunsFile ? runsFileName : tempFileName; }
+
     const Genome*                   genome;
     const FileFormat*               format;
     const char*                     tempFileName;
@@ -172,6 +272,36 @@ private:
     SortBlockVector                 blocks;
     size_t                          bufferSize;
     size_t                          bufferSpace;
+    int                             numThreads;
+    SortVector                      samples;
+
+    // for the parallel merge
+    DataWriter*                     mergeWriter;
+    MergePartition*                 partitions;
+    int                             nPartitions;
+    volatile int                    nextPartition;
+    volatile int                    nMergeThreadsRunning;
+    SingleWaiterObject              mergeThreadsDone;
+    size_t                          mergeReadBufferSpace; // for each block, in each merge thread
+    volatile _int64                 mergeTotal;
+
+    //
+    // For merging in the background while aligning.  Blocks that are safely on disk go into tier 0.  Whenever a tier
+    // has mergeFanIn members, the background thread merges them into a single run (appended to the runs file) in the
+    // next tier up, and so on like an LSM tree, so at the end only a few runs per tier are left for the final merge.
+    //
+    static const int                MaxTiers = 16;
+    int                             tempBufferCount; // how many buffers the temp file writers have
+    unsigned                        mergeFanIn; // 0 means no background merge
+    char*                           runsFileName;
+    FILE*                           runsFile;
+    size_t                          runsFileSize;
+    VariableSizeVector<_int64>      tiers[MaxTiers];
+    bool                            stopBackgroundMergeRequested;
+    EventObject                     backgroundMergeWork;
+    SingleWaiterObject              backgroundMergeDone;
+    int                             nBackgroundMerges;
+    size_t                          backgroundMergeBytes;
 
 	friend class SortedDataFilter;
 };
@@ -218,7 +348,12 @@ SortedDataFilter::onNextBatch(
     }
     size_t target = 0;
 	GenomeLocation previous = 0;
+    size_t nextSample = 0;
     for (VariableSizeVector<SortEntry>::iterator i = locations.begin(); i != locations.end(); i++) {
+        if (target >= nextSample && (offset > 0 || i != locations.begin())) { // the header isn't merged, so don't sample it
+            samples.push_back(SortEntry(offset + target, 0, i->location));
+            nextSample = target + SortedDataFilterSupplier::SampleSpacing;
+        }
 #ifdef VALIDATE_SORT
 		if (locations.size() > 1) { // skip header block
             GenomeLocation loc;
@@ -243,11 +378,30 @@ SortedDataFilter::onNextBatch(
 #ifdef VALIDATE_SORT
 	GenomeLocation minLocation = locations.size() > first ? locations[first].location : 0;
     GenomeLocation maxLocation = locations.size() > first ? locations[locations.size() - 1].location : UINT32_MAX;
-    parent->addBlock(offset + header, bytes - header, minLocation, maxLocation);
+    _int64 whichBlock = parent->addBlock(offset + header, bytes - header, samples, minLocation, maxLocation);
 #else
-    parent->addBlock(offset + header, bytes - header);
+    _int64 whichBlock = parent->addBlock(offset + header, bytes - header, samples);
 #endif
     locations.clear();
+    samples.clear();
+
+    //
+    // The writer starts writing this block as soon as we return, and only waits for the write when it next needs the
+    // buffer.  It has tempBufferCount buffers, so once it has gone through that many more batches, the block is on disk.
+    //
+    if (parent->mergeFanIn > 0) {
+        if (whichBlock >= 0) {
+            UnwrittenBlock unwritten;
+            unwritten.block = whichBlock;
+            unwritten.batch = nBatches;
+            unwrittenBlocks.push_back(unwritten);
+        }
+        while (unwrittenBlocks.size() > 0 && unwrittenBlocks[0].batch + parent->getTempBufferCount() <= nBatches) {
+            parent->blockWritten(unwrittenBlocks[0].block);
+            unwrittenBlocks.erase(0);
+        }
+    }
+    nBatches++;
 
     return target;
 }
@@ -262,13 +416,23 @@ SortedDataFilterSupplier::getFilter()
 SortedDataFilterSupplier::onClosed(
     DataWriterSupplier* supplier)
 {
-    if (blocks.size() == 1 && sortedFilterSupplier == NULL) {
+    if (mergeFanIn > 0) {
+        stopBackgroundMerge();
+        dropMergedBlocks();
+    }
+    if ((size_t)blocks.size() > MaxMergeReaders) {
+        mergeInPasses();
+    }
+    if (blocks.size() == 1 && ! blocks[0].inRunsFile && sortedFilterSupplier == NULL) {
         // just rename/move temp file to real file, we're done
         DeleteSingleFile(sortedFileName); // if it exists
         if (! MoveSingleFile(tempFileName, sortedFileName)) {
             WriteErrorMessage( "unable to move temp file %s to final sorted file %s\n", tempFileName, sortedFileName);
             soft_exit(1);
         }
+        if (runsFileName != NULL) {
+            DeleteSingleFile(runsFileName);
+        }
         return;
     }
     // merge sort into final file
@@ -278,10 +442,11 @@ SortedDataFilterSupplier::onClosed(
     }
 }
 
-    void
+    _int64
 SortedDataFilterSupplier::addBlock(
     size_t start,
-    size_t bytes
+    size_t bytes,
+    SortVector& blockSamples
 #ifdef VALIDATE_SORT
 	, GenomeLocation minLocation
 	, GenomeLocation maxLocation
@@ -298,13 +463,21 @@ SortedDataFilterSupplier::addBlock(
         SortBlock block;
         block.start = start;
         block.bytes = bytes;
+        block.firstSample = samples.size();
+        block.nSamples = blockSamples.size();
+        for (SortVector::iterator i = blockSamples.begin(); i != blockSamples.end(); i++) {
+            samples.push_back(*i);
+        }
 #if VALIDATE_SORT
 		block.minLocation = minLocation;
 		block.maxLocation = maxLocation;
 #endif
+        _int64 whichBlock = blocks.size();
         blocks.push_back(block);
         ReleaseExclusiveLock(&lock);
+        return whichBlock;
     }
+    return -1;
 }
 
     bool
@@ -328,17 +501,9 @@ SortedDataFilterSupplier::mergeSort()
         WriteErrorMessage( "open sorted file for write failed\n");
         return false;
     }
-    DataSupplier* readerSupplier = DataSupplier::Default; // autorelease
-    // setup - open all files, read first block, begin read for second
     if (blocks.size() > 5000) {
         WriteErrorMessage("warning: merging %d blocks could be slow, try increasing sort memory with -sm option\n", blocks.size());
     }
-    for (SortBlockVector::iterator i = blocks.begin(); i != blocks.end(); i++) {
-        i->reader = readerSupplier->getDataReader(1, MAX_READ_LENGTH * 8, 0.0,
-            min(1UL << 23, max(1UL << 17, bufferSpace / blocks.size()))); // 128kB to 8MB buffer space per block
-        i->reader->init(tempFileName);
-        i->reader->reinit(i->start, i->bytes);
-    }
 
     // write out header
     if (headerSize > 0xffffffff) {
@@ -346,16 +511,18 @@ SortedDataFilterSupplier::mergeSort()
         soft_exit(1);
     }
     if (headerSize > 0) {
-        blocks[0].reader->reinit(0, headerSize);
+        DataReader* headerReader = DataSupplier::Default->getDataReader(1, MAX_READ_LENGTH * 8, 0.0, 1UL << 17);
+        headerReader->init(tempFileName);
+        headerReader->reinit(0, headerSize);
 		writer->inHeader(true);
         char* rbuffer;
         _int64 rbytes;
         char* wbuffer;
         size_t wbytes;
 		for (size_t left = headerSize; left > 0; ) {
-			if ((! blocks[0].reader->getData(&rbuffer, &rbytes)) || rbytes == 0) {
-				blocks[0].reader->nextBatch();
-				if (! blocks[0].reader->getData(&rbuffer, &rbytes)) {
+			if ((! headerReader->getData(&rbuffer, &rbytes)) || rbytes == 0) {
+				headerReader->nextBatch();
+				if (! headerReader->getData(&rbuffer, &rbytes)) {
 					WriteErrorMessage( "read header failed\n");
 					soft_exit(1);
 				}
@@ -370,99 +537,55 @@ SortedDataFilterSupplier::mergeSort()
 			size_t xfer = min(left, min((size_t) rbytes, wbytes));
 			_ASSERT(xfer > 0 && xfer <= UINT32_MAX);
 			memcpy(wbuffer, rbuffer, xfer);
-			blocks[0].reader->advance(xfer);
+			headerReader->advance(xfer);
 			writer->advance((unsigned) xfer);
 			left -= xfer;
 		}
-        blocks[0].reader->reinit(blocks[0].start, blocks[0].bytes);
+        delete headerReader;
 		writer->nextBatch();
 		writer->inHeader(false);
     }
 
-    // merge temp blocks into output
-    _int64 total = 0;
-    // get initial merge sort data
-    typedef PriorityQueue<GenomeLocation, _int64> BlockQueue;
-    BlockQueue queue;
-    for (SortBlockVector::iterator b = blocks.begin(); b != blocks.end(); b++) {
-        _int64 bytes;
-        b->reader->getData(&b->data, &bytes);
-        format->getSortInfo(genome, b->data, bytes, &b->location, &b->length);
-        queue.add((_uint32) (b - blocks.begin()), b->location); 
-    }
-    GenomeLocation current = 0; // current location for validation
-	int lastRefID = -1, lastPos = 0;
-    while (queue.size() > 0) {
-#if VALIDATE_SORT
-        GenomeLocation check;
-		queue.peek(&check);
-		_ASSERT(check >= current);
-#endif
-        GenomeLocation secondLocation;
-        _int64 smallestIndex = queue.pop();
-        _int64 secondIndex = queue.size() > 0 ? queue.peek(&secondLocation) : -1;
-        GenomeLocation limit = secondIndex != -1 ? secondLocation : InvalidGenomeLocation;
-        SortBlock* b = &blocks[smallestIndex];
-        char* writeBuffer;
-        size_t writeBytes;
-        writer->getBuffer(&writeBuffer, &writeBytes);
-        const int NBLOCKS = 20;
-        SortBlock oldBlocks[NBLOCKS];
-        int oldBlockIndex = 0;
-        while (b->location <= limit) {
-#if VALIDATE_SORT
-			_ASSERT(b->location >= b->minLocation && b->location <= b->maxLocation);
-#endif
-            if (writeBytes < (size_t)b->length) {
-                writer->nextBatch();
-                writer->getBuffer(&writeBuffer, &writeBytes);
-                if (writeBytes < (size_t)b->length) {
-                    WriteErrorMessage( "mergeSort: buffer size too small\n");
-                    return false;
-                }
-            }
-            memcpy(writeBuffer, b->data, b->length);
-#ifdef VALIDATE_BAM
-            if (format == FileFormat::BAM[0] || format == FileFormat::BAM[1]) {
-                ((BAMAlignment*)b->data)->validate();
-            }
-#endif
-#if VALIDATE_SORT
-			int refID, pos;
-			format->getSortInfo(genome, b->data, b->length, NULL, NULL, &refID, &pos);
-			_ASSERT(refID == -1 || refID > lastRefID || (refID == lastRefID && pos >= lastPos));
-			if (refID != -1) {
-				lastRefID = refID;
-				lastPos = pos;
-			}
-#endif
-			total++;
-            writer->advance(b->length);
-            writeBytes -= b->length;
-            writeBuffer += b->length;
-            oldBlocks[oldBlockIndex] = *b;
-            oldBlockIndex = (oldBlockIndex + 1) % NBLOCKS;
-            b->reader->advance(b->length);
-            _ASSERT(b->location >= current);
-            current = b->location;
-            _int64 readBytes;
-            if (! b->reader->getData(&b->data, &readBytes)) {
-                b->reader->nextBatch();
-                if (! b->reader->getData(&b->data, &readBytes)) {
-                    _ASSERT(b->reader->isEOF());
-                    delete b->reader;
-                    b->reader = NULL;
-                    break;
-                }
-            }
-            GenomeLocation previous = b->location;
-            format->getSortInfo(genome, b->data, readBytes, &b->location, &b->length);
-            _ASSERT(b->length <= readBytes && b->location >= previous);
-        }
-        if (b->reader != NULL) {
-            queue.add(smallestIndex, b->location);
+    //
+    // Split the merge into partitions.  Half of the sort memory goes to the merge threads' output buffers, and the
+    // partitions are sized to fit in one, but made small enough that there are several per thread to balance the load.
+    // The other half is read buffers, one per block per thread, split evenly among all of them.  Each needs at least
+    // MinMergeReadBufferSpace and holds its block's file open, so use fewer threads rather than go over the memory or
+    // open more than MaxMergeReaders readers.  With a single thread this is the same as a serial merge.
+    //
+    size_t totalBytes = 0;
+    for (SortBlockVector::iterator i = blocks.begin(); i != blocks.end(); i++) {
+        totalBytes += i->bytes;
+    }
+    size_t chunkSize = max((size_t)MAX_READ_LENGTH * 8, bufferSpace / (2 * numThreads));
+    choosePartitions(max((size_t)SampleSpacing, min(chunkSize, totalBytes / (4 * numThreads))));
+
+    const size_t MinMergeReadBufferSpace = (size_t)1 << 17;
+    size_t readSpace = bufferSpace / 2;
+    size_t nBlocks = max((size_t)blocks.size(), (size_t)1);
+    size_t maxThreads = min(readSpace / (nBlocks * MinMergeReadBufferSpace), MaxMergeReaders / nBlocks);
+    int nMergeThreads = (int)max((size_t)1, min((size_t)min(numThreads, nPartitions), maxThreads));
+    mergeReadBufferSpace = min((size_t)1 << 23, max(MinMergeReadBufferSpace, readSpace / (nMergeThreads * nBlocks))); // 128kB to 8MB
+
+    mergeWriter = writer;
+    mergeTotal = 0;
+    nextPartition = 0;
+    nMergeThreadsRunning = nMergeThreads;
+    CreateSingleWaiterObject(&mergeThreadsDone);
+    AllowEventWaitersToProceed(&partitions[0].turn);
+    for (int i = 0; i < nMergeThreads; i++) {
+        if (! StartNewThread(MergeThreadMain, this)) {
+            WriteErrorMessage("SortedDataFilterSupplier: unable to start merge thread\n");
+            soft_exit(1);
         }
     }
+    WaitForSingleWaiterObject(&mergeThreadsDone);
+    DestroySingleWaiterObject(&mergeThreadsDone);
+    for (int i = 0; i < nPartitions; i++) {
+        DestroyEventObject(&partitions[i].turn);
+    }
+    delete [] partitions;
+    partitions = NULL;
     
     // close everything
     writer->close();
@@ -472,12 +595,18 @@ SortedDataFilterSupplier::mergeSort()
     if (! DeleteSingleFile(tempFileName)) {
         WriteErrorMessage( "warning: failure deleting temp file %s\n", tempFileName);
     }
+    if (runsFileName != NULL && ! DeleteSingleFile(runsFileName)) {
+        WriteErrorMessage( "warning: failure deleting temp file %s\n", runsFileName);
+    }
 
 #if USE_DEVTEAM_OPTIONS
-    WriteStatusMessage("sorted %lld reads in %u blocks, %lld s\n"
+    if (mergeFanIn > 0) {
+        WriteStatusMessage("merged %lld MB in %d runs in the background while aligning\n", (_int64)(backgroundMergeBytes >> 20), nBackgroundMerges);
+    }
+    WriteStatusMessage("sorted %lld reads in %u blocks, %d partitions on %d threads, %lld s\n"
         "read wait align %.3f s + merge %.3f s, read release align %.3f s + merge %.3f s\n"
         "write wait %.3f s align + %.3f s merge, write filter %.3f s align + %.3f s merge\n",
-        total, blocks.size(), (timeInMillis() - start)/1000,
+        mergeTotal, blocks.size(), nPartitions, nMergeThreads, (timeInMillis() - start)/1000,
         startReadWaitTime * 1e-9, (DataReader::ReadWaitTime - startReadWaitTime) * 1e-9,
         startReleaseWaitTime * 1e-9, (DataReader::ReleaseWaitTime - startReleaseWaitTime) * 1e-9,
         startWriteWaitTime * 1e-9, (DataWriter::WaitTime - startWriteWaitTime) * 1e-9,
@@ -486,6 +615,467 @@ SortedDataFilterSupplier::mergeSort()
     return true;
 }
 
+    void
+SortedDataFilterSupplier::choosePartitions(
+    size_t partitionBytes)
+{
+    //
+    // Each sample stands for about SampleSpacing bytes of its block, so walking all of them in location order and
+    // cutting every partitionBytes gives partitions of about that size.  Cuts only go between distinct locations,
+    // so all the reads at one location land in the same partition.
+    //
+    SortVector sorted;
+    for (SortVector::iterator i = samples.begin(); i != samples.end(); i++) {
+        sorted.push_back(*i);
+    }
+    std::sort(sorted.begin(), sorted.end(), SortEntry::comparator);
+
+    VariableSizeVector<GenomeLocation> cuts;
+    size_t bytesSinceCut = 0;
+    for (SortVector::iterator i = sorted.begin(); i != sorted.end(); i++) {
+        if (bytesSinceCut >= partitionBytes && (cuts.size() == 0 || i->location > cuts[cuts.size() - 1])) {
+            cuts.push_back(i->location);
+            bytesSinceCut = 0;
+        }
+        bytesSinceCut += SampleSpacing;
+    }
+
+    nPartitions = (int)cuts.size() + 1;
+    partitions = new MergePartition[nPartitions];
+    for (int i = 0; i < nPartitions; i++) {
+        partitions[i].minLocation = i == 0 ? 0 : cuts[i - 1];
+        partitions[i].isLast = i == nPartitions - 1;
+        partitions[i].limitLocation = partitions[i].isLast ? 0 : cuts[i];
+        CreateEventObject(&partitions[i].turn);
+    }
+}
+
+    void
+SortedDataFilterSupplier::findPartitionInBlock(
+    const SortBlock& block,
+    const MergePartition& partition,
+    size_t* o_start,
+    size_t* o_end)
+{
+    //
+    // Start at the last sample before the partition (everything ahead of it is smaller), and end at the first sample
+    // at or past its limit (everything from there on is at least as big).  The merge skips the few reads in between
+    // that are outside the partition.
+    //
+    if (block.nSamples == 0) {
+        *o_start = block.start;
+        *o_end = block.start + block.bytes;
+        return;
+    }
+    const SortEntry* first = &samples[block.firstSample];
+    const SortEntry* end = first + block.nSamples;
+    const SortEntry* startSample = std::lower_bound(first, end, SortEntry(0, 0, partition.minLocation), SortEntry::comparator);
+    *o_start = startSample == first ? block.start : (startSample - 1)->offset;
+    const SortEntry* limitSample = partition.isLast ? end : std::lower_bound(startSample, end, SortEntry(0, 0, partition.limitLocation), SortEntry::comparator);
+    *o_end = limitSample == end ? block.start + block.bytes : limitSample->offset;
+}
+
+    bool
+SortedDataFilterSupplier::fetchRecord(
+    MergeCursor* cursor)
+{
+    _int64 readBytes;
+    if ((! cursor->reader->getData(&cursor->data, &readBytes)) || readBytes == 0) {
+        cursor->reader->nextBatch();
+        if ((! cursor->reader->getData(&cursor->data, &readBytes)) || readBytes == 0) {
+            return false;
+        }
+    }
+    format->getSortInfo(genome, cursor->data, readBytes, &cursor->location, &cursor->length);
+    _ASSERT(cursor->length <= readBytes);
+    return true;
+}
+
+    void
+SortedDataFilterSupplier::MergeThreadMain(
+    void* param)
+{
+    ((SortedDataFilterSupplier*)param)->mergeThread();
+}
+
+    void
+SortedDataFilterSupplier::mergeThread()
+{
+    MergeCursor* cursors = new MergeCursor[blocks.size()];
+    for (_int64 i = 0; i < blocks.size(); i++) {
+        cursors[i].reader = DataSupplier::Default->getDataReader(1, MAX_READ_LENGTH * 8, 0.0, mergeReadBufferSpace);
+        cursors[i].reader->init(blockFileName(blocks[i]));
+    }
+    size_t chunkSize = max((size_t)MAX_READ_LENGTH * 8, bufferSpace / (2 * numThreads));
+    char* chunk = (char*) BigAlloc(chunkSize);
+    VariableSizeVector<GenomeDistance> chunkLengths;
+
+    for (;;) {
+        int whichPartition = InterlockedIncrementAndReturnNewValue(&nextPartition) - 1;
+        if (whichPartition >= nPartitions) {
+            break;
+        }
+        mergePartition(whichPartition, cursors, chunk, chunkSize, chunkLengths);
+    }
+
+    BigDealloc(chunk);
+    for (_int64 i = 0; i < blocks.size(); i++) {
+        delete cursors[i].reader;
+    }
+    delete [] cursors;
+
+    if (0 == InterlockedDecrementAndReturnNewValue(&nMergeThreadsRunning)) {
+        SignalSingleWaiterObject(&mergeThreadsDone);
+    }
+}
+
+    void
+SortedDataFilterSupplier::mergePartition(
+    int whichPartition,
+    MergeCursor* cursors,
+    char* chunk,
+    size_t chunkSize,
+    VariableSizeVector<GenomeDistance>& chunkLengths)
+{
+    MergePartition* partition = &partitions[whichPartition];
+
+    // get initial merge sort data
+    typedef PriorityQueue<GenomeLocation, _int64> BlockQueue;
+    BlockQueue queue;
+    for (_int64 i = 0; i < blocks.size(); i++) {
+        size_t rangeStart, rangeEnd;
+        findPartitionInBlock(blocks[i], *partition, &rangeStart, &rangeEnd);
+        if (rangeStart >= rangeEnd) {
+            continue;
+        }
+        MergeCursor* c = &cursors[i];
+        c->reader->reinit(rangeStart, rangeEnd - rangeStart);
+        bool any = fetchRecord(c);
+        while (any && c->location < partition->minLocation) {
+            c->reader->advance(c->length);
+            any = fetchRecord(c);
+        }
+        if (any && (partition->isLast || c->location < partition->limitLocation)) {
+            queue.add(i, c->location);
+        }
+    }
+
+    // merge into the chunk until it's full, then wait for our turn and write directly
+    size_t chunkUsed = 0;
+    bool direct = false;
+    _int64 total = 0;
+    chunkLengths.clear();
+    while (queue.size() > 0) {
+        GenomeLocation secondLocation;
+        _int64 smallestIndex = queue.pop();
+        _int64 secondIndex = queue.size() > 0 ? queue.peek(&secondLocation) : -1;
+        GenomeLocation limit = secondIndex != -1 ? secondLocation : InvalidGenomeLocation;
+        MergeCursor* c = &cursors[smallestIndex];
+        bool more = true;
+        while (c->location <= limit || secondIndex == -1) {
+            if (! direct && chunkUsed + c->length > chunkSize) {
+                WaitForEvent(&partition->turn);
+                for (_int64 i = 0, offset = 0; i < chunkLengths.size(); offset += chunkLengths[i], i++) {
+                    writeRecord(chunk + offset, chunkLengths[i]);
+                }
+                direct = true;
+            }
+            if (direct) {
+                writeRecord(c->data, c->length);
+            } else {
+                memcpy(chunk + chunkUsed, c->data, c->length);
+                chunkUsed += c->length;
+                chunkLengths.push_back(c->length);
+            }
+			total++;
+            c->reader->advance(c->length);
+            GenomeLocation previous = c->location;
+            if (! fetchRecord(c) || ((! partition->isLast) && c->location >= partition->limitLocation)) {
+                more = false;
+                break;
+            }
+            _ASSERT(c->location >= previous);
+        }
+        if (more) {
+            queue.add(smallestIndex, c->location);
+        }
+    }
+
+    if (! direct) {
+        WaitForEvent(&partition->turn);
+        for (_int64 i = 0, offset = 0; i < chunkLengths.size(); offset += chunkLengths[i], i++) {
+            writeRecord(chunk + offset, chunkLengths[i]);
+        }
+    }
+    InterlockedAdd64AndReturnNewValue(&mergeTotal, total);
+    if (! partition->isLast) {
+        AllowEventWaitersToProceed(&partitions[whichPartition + 1].turn);
+    }
+}
+
+    void
+SortedDataFilterSupplier::writeRecord(
+    char* data,
+    GenomeDistance length)
+{
+    // only called by the thread whose turn it is
+    char* writeBuffer;
+    size_t writeBytes;
+    mergeWriter->getBuffer(&writeBuffer, &writeBytes);
+    if (writeBytes < (size_t)length) {
+        mergeWriter->nextBatch();
+        mergeWriter->getBuffer(&writeBuffer, &writeBytes);
+        if (writeBytes < (size_t)length) {
+            WriteErrorMessage( "mergeSort: buffer size too small\n");
+            soft_exit(1);
+        }
+    }
+    memcpy(writeBuffer, data, length);
+#ifdef VALIDATE_BAM
+    if (format == FileFormat::BAM[0] || format == FileFormat::BAM[1]) {
+        ((BAMAlignment*)data)->validate();
+    }
+#endif
+    mergeWriter->advance(length);
+}
+
+    void
+SortedDataFilterSupplier::openRunsFile()
+{
+    // runs are appended, so reopening after the background merge has closed it keeps the runs it wrote
+    if (runsFileName == NULL) {
+        size_t len = strlen(tempFileName);
+        runsFileName = new char[len + 6];
+        strcpy(runsFileName, tempFileName);
+        strcpy(runsFileName + len, ".runs");
+    }
+    runsFile = fopen(runsFileName, runsFileSize == 0 ? "wb" : "ab");
+    if (runsFile == NULL) {
+        WriteErrorMessage("unable to open temp file %s for merge\n", runsFileName);
+        soft_exit(1);
+    }
+}
+
+    void
+SortedDataFilterSupplier::dropMergedBlocks()
+{
+    // drop the blocks that have been merged into runs, the final merge only needs what's left
+    SortBlockVector unmerged;
+    for (SortBlockVector::iterator i = blocks.begin(); i != blocks.end(); i++) {
+        if (! i->merged) {
+            unmerged.push_back(*i);
+        }
+    }
+    blocks.clear();
+    for (SortBlockVector::iterator i = unmerged.begin(); i != unmerged.end(); i++) {
+        blocks.push_back(*i);
+    }
+}
+
+    void
+SortedDataFilterSupplier::mergeInPasses()
+{
+    //
+    // Every block in the final merge has a reader (with its own buffers and open file) in each merge thread, so when
+    // there are too many blocks, first merge them into runs MaxMergeReaders at a time, just like the background merge,
+    // until only MaxMergeReaders are left.  Each pass takes just enough blocks to land on MaxMergeReaders exactly.
+    //
+    openRunsFile();
+    SortBlock* inputs = new SortBlock[MaxMergeReaders];
+    _int64* inputIndices = new _int64[MaxMergeReaders];
+    while ((size_t)blocks.size() > MaxMergeReaders) {
+        int nInputs = (int)min(MaxMergeReaders, (size_t)blocks.size() - MaxMergeReaders + 1);
+        for (int i = 0; i < nInputs; i++) {
+            inputIndices[i] = i;
+            inputs[i] = blocks[i];
+        }
+        mergeRun(inputs, inputIndices, nInputs, 0);
+        dropMergedBlocks();
+    }
+    delete [] inputs;
+    delete [] inputIndices;
+    fclose(runsFile);
+    runsFile = NULL;
+}
+
+    void
+SortedDataFilterSupplier::startBackgroundMerge()
+{
+    openRunsFile();
+    stopBackgroundMergeRequested = false;
+    CreateEventObject(&backgroundMergeWork);
+    CreateSingleWaiterObject(&backgroundMergeDone);
+    if (! StartNewThread(BackgroundMergeThreadMain, this)) {
+        WriteErrorMessage("SortedDataFilterSupplier: unable to start background merge thread\n");
+        soft_exit(1);
+    }
+}
+
+    void
+SortedDataFilterSupplier::stopBackgroundMerge()
+{
+    // lets a merge in progress finish, but doesn't start any more
+    AcquireExclusiveLock(&lock);
+    stopBackgroundMergeRequested = true;
+    AllowEventWaitersToProceed(&backgroundMergeWork);
+    ReleaseExclusiveLock(&lock);
+    WaitForSingleWaiterObject(&backgroundMergeDone);
+    DestroySingleWaiterObject(&backgroundMergeDone);
+    DestroyEventObject(&backgroundMergeWork);
+    fclose(runsFile);
+    runsFile = NULL;
+}
+
+    void
+SortedDataFilterSupplier::blockWritten(
+    _int64 whichBlock)
+{
+    AcquireExclusiveLock(&lock);
+    tiers[0].push_back(whichBlock);
+    if (tiers[0].size() >= mergeFanIn) {
+        AllowEventWaitersToProceed(&backgroundMergeWork);
+    }
+    ReleaseExclusiveLock(&lock);
+}
+
+    void
+SortedDataFilterSupplier::BackgroundMergeThreadMain(
+    void* param)
+{
+    ((SortedDataFilterSupplier*)param)->backgroundMergeThread();
+}
+
+    void
+SortedDataFilterSupplier::backgroundMergeThread()
+{
+    SortBlock* inputs = new SortBlock[mergeFanIn];
+    _int64* inputIndices = new _int64[mergeFanIn];
+    for (;;) {
+        AcquireExclusiveLock(&lock);
+        int tier;
+        for (tier = 0; tier < MaxTiers && tiers[tier].size() < mergeFanIn; tier++) {
+            // This loop body intentionally left blank.
+        }
+        if (tier == MaxTiers) {
+            if (stopBackgroundMergeRequested) {
+                ReleaseExclusiveLock(&lock);
+                break;
+            }
+            PreventEventWaitersFromProceeding(&backgroundMergeWork);
+            ReleaseExclusiveLock(&lock);
+            WaitForEvent(&backgroundMergeWork);
+            continue;
+        }
+        if (stopBackgroundMergeRequested) {
+            // the final merge is waiting on us, leave the rest to it
+            ReleaseExclusiveLock(&lock);
+            break;
+        }
+        // copy the inputs out, since blocks can grow (and move) while we merge
+        for (unsigned i = 0; i < mergeFanIn; i++) {
+            inputIndices[i] = tiers[tier][0];
+            inputs[i] = blocks[inputIndices[i]];
+            tiers[tier].erase(0);
+        }
+        ReleaseExclusiveLock(&lock);
+
+        mergeRun(inputs, inputIndices, mergeFanIn, min(tier + 1, MaxTiers - 1));
+    }
+    delete [] inputs;
+    delete [] inputIndices;
+    SignalSingleWaiterObject(&backgroundMergeDone);
+}
+
+    void
+SortedDataFilterSupplier::mergeRun(
+    SortBlock* inputs,
+    _int64* inputIndices,
+    int nInputs,
+    int tier)
+{
+    // the whole background merge gets a quarter of the sort memory for read buffers
+    size_t readerBufferSpace = min((size_t)1 << 23, max((size_t)1 << 17, bufferSpace / (4 * nInputs))); // 128kB to 8MB buffer space per block
+    MergeCursor* cursors = new MergeCursor[nInputs];
+    typedef PriorityQueue<GenomeLocation, _int64> BlockQueue;
+    BlockQueue queue;
+    for (int i = 0; i < nInputs; i++) {
+        cursors[i].reader = DataSupplier::Default->getDataReader(1, MAX_READ_LENGTH * 8, 0.0, readerBufferSpace);
+        cursors[i].reader->init(blockFileName(inputs[i]));
+        cursors[i].reader->reinit(inputs[i].start, inputs[i].bytes);
+        if (fetchRecord(&cursors[i])) {
+            queue.add(i, cursors[i].location);
+        }
+    }
+
+    const size_t outputSize = 1 << 22;
+    char* output = (char*) BigAlloc(outputSize);
+    size_t outputUsed = 0;
+    size_t runStart = runsFileSize;
+    size_t runBytes = 0;
+    size_t nextSample = 0;
+    SortVector runSamples;
+    while (queue.size() > 0) {
+        GenomeLocation secondLocation;
+        _int64 smallestIndex = queue.pop();
+        _int64 secondIndex = queue.size() > 0 ? queue.peek(&secondLocation) : -1;
+        MergeCursor* c = &cursors[smallestIndex];
+        bool more = true;
+        while (secondIndex == -1 || c->location <= secondLocation) {
+            if (outputUsed + c->length > outputSize) {
+                if (outputUsed != fwrite(output, 1, outputUsed, runsFile)) {
+                    WriteErrorMessage("background merge: write to %s failed, %d\n", runsFileName, errno);
+                    soft_exit(1);
+                }
+                outputUsed = 0;
+            }
+            if (runBytes >= nextSample) {
+                runSamples.push_back(SortEntry(runStart + runBytes, 0, c->location));
+                nextSample = runBytes + SampleSpacing;
+            }
+            memcpy(output + outputUsed, c->data, c->length);
+            outputUsed += c->length;
+            runBytes += c->length;
+            c->reader->advance(c->length);
+            if (! fetchRecord(c)) {
+                more = false;
+                break;
+            }
+        }
+        if (more) {
+            queue.add(smallestIndex, c->location);
+        }
+    }
+    if (outputUsed != fwrite(output, 1, outputUsed, runsFile) || 0 != fflush(runsFile)) {  // flush so the run can be mapped
+        WriteErrorMessage("background merge: write to %s failed, %d\n", runsFileName, errno);
+        soft_exit(1);
+    }
+    runsFileSize += runBytes;
+    BigDealloc(output);
+    for (int i = 0; i < nInputs; i++) {
+        delete cursors[i].reader;
+    }
+    delete [] cursors;
+
+    AcquireExclusiveLock(&lock);
+    SortBlock run;
+    run.start = runStart;
+    run.bytes = runBytes;
+    run.inRunsFile = true;
+    run.firstSample = samples.size();
+    run.nSamples = runSamples.size();
+    for (SortVector::iterator i = runSamples.begin(); i != runSamples.end(); i++) {
+        samples.push_back(*i);
+    }
+    for (int i = 0; i < nInputs; i++) {
+        blocks[inputIndices[i]].merged = true;
+    }
+    tiers[tier].push_back(blocks.size());
+    blocks.push_back(run);
+    nBackgroundMerges++;
+    backgroundMergeBytes += runBytes;
+    ReleaseExclusiveLock(&lock);
+}
+
     DataWriterSupplier*
 DataWriterSupplier::sorted(
     const FileFormat* format,
@@ -496,12 +1086,14 @@ DataWriterSupplier::sorted(
     const char* sortedFileName,
     DataWriter::FilterSupplier* sortedFilterSuppler,
     size_t maxBufferSize,
+    unsigned backgroundMergeFanIn,
     FileEncoder* encoder)
 {
     const int bufferCount = 3;
     const size_t bufferSpace = tempBufferMemory > 0 ? tempBufferMemory : (numThreads * (size_t)1 << 30);
     const size_t bufferSize = bufferSpace / (bufferCount * numThreads);
     DataWriter::FilterSupplier* filterSupplier =
-        new SortedDataFilterSupplier(format, genome, tempFileName, sortedFileName, sortedFilterSuppler, bufferSize, bufferSpace, encoder);
+        new SortedDataFilterSupplier(format, genome, tempFileName, sortedFileName, sortedFilterSuppler, bufferSize, bufferSpace, numThreads,
+            bufferCount, backgroundMergeFanIn, encoder);
     return DataWriterSupplier::create(tempFileName, bufferSize, filterSupplier, NULL, bufferCount);
 }
@@ -0,0 +1,691 @@
+/*++
+
+Module Name:
+
+    SpeculativeInflate.cpp
+
+Abstract:
+
+    A deflate decoder that can start in the middle of a gzip stream, for decompressing one gzip member on several
+    threads.  See SpeculativeInflate.h.
+
+    The output is kept as 16 bit symbols as well as bytes until there have been WindowSize bytes of output in a row that
+    didn't come from the unknown window, since after that nothing can refer to it any more.  Symbols below 256 are
+    bytes, and 256 + i is byte i of the window.
+
+Environment:
+
+    User mode service.
+
+--*/
+
+#include "stdafx.h"
+#include "SpeculativeInflate.h"
+#include "BigAlloc.h"
+
+static const unsigned LengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const unsigned LengthExtraBits[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const unsigned DistanceBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577};
+static const unsigned DistanceExtraBits[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+static const BYTE CodeLengthOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+static const unsigned MaxLitLenSymbols = 288;
+static const unsigned MaxDistSymbols = 32;
+static const unsigned MaxCodeLength = 15;
+
+//
+// A real block never decodes to anything like this much, so a candidate block start that does is garbage.
+//
+static const _int64 MaxTrialBlockOutput = 8 * 1024 * 1024;
+
+    static inline _uint64
+LoadLittleEndian64(const BYTE *p)
+{
+    _uint64 value;
+    memcpy(&value, p, sizeof(value));   // x86 is little endian
+    return value;
+}
+
+//
+// Reads the input a bit at a time, least significant bit first.  Reading past the end of the input gives zeroes,
+// and overrun() says whether that happened.
+//
+struct SpeculativeInflater::BitReader {
+    const BYTE  *start;
+    const BYTE  *next;
+    const BYTE  *end;
+    _uint64     bits;
+    unsigned    bitCount;
+    _int64      padBytes;       // Zero bytes supplied after the end of the input
+
+    BitReader(const BYTE *input, _int64 inputBytes, _int64 bitOffset) {
+        seek(input, inputBytes, bitOffset);
+    }
+
+    void seek(const BYTE *input, _int64 inputBytes, _int64 bitOffset) {
+        start = input;
+        end = input + inputBytes;
+        next = input + __min(bitOffset / 8, inputBytes);
+        bits = 0;
+        bitCount = 0;
+        padBytes = bitOffset / 8 - (next - input);
+        refill();
+        consume((unsigned)(bitOffset % 8));
+    }
+
+    //
+    // Afterward there are at least 56 bits, which is enough for a length and a distance with their extra bits.
+    //
+    inline void refill() {
+        if (end - next >= 8) {
+            bits |= LoadLittleEndian64(next) << bitCount;
+            next += (63 - bitCount) >> 3;
+            bitCount |= 56;
+        } else {
+            while (bitCount <= 56) {
+                if (next < end) {
+                    bits |= (_uint64)*next++ << bitCount;
+                } else {
+                    padBytes++;
+                }
+                bitCount += 8;
+            }
+        }
+    }
+
+    inline unsigned peek(unsigned n) { return (unsigned)(bits & (((_uint64)1 << n) - 1)); }
+    inline void consume(unsigned n) { bits >>= n; bitCount -= n; }
+    inline unsigned get(unsigned n) { unsigned value = peek(n); consume(n); return value; }
+
+    inline _int64 position() { return (next - start + padBytes) * 8 - bitCount; }
+    inline bool overrun() { return position() > (end - start) * 8; }
+};
+
+//
+// Decoding tables for a canonical Huffman code.  Codes are looked up by their first rootBits bits (which, because
+// deflate packs Huffman codes most significant bit first, are the low bits of the bit buffer).  Codes longer than
+// that go through a subtable for all of the codes that share those first bits.
+//
+struct SpeculativeInflater::HuffmanTable {
+    static const _uint32 SubtableFlag = 0x80000000;
+    static const _uint32 InvalidEntry = 0xffff;     // Length 0 and a symbol no code has
+
+    static const unsigned MaxEntries = 1024 + MaxLitLenSymbols * 32;
+
+    unsigned    rootBits;
+    _uint32     entries[MaxEntries];
+
+    //
+    // Returns false if the lengths don't describe a complete prefix code.  If allowSingleCode is set, a code with only
+    // one symbol (or none) is allowed too, as zlib does for the literal/length and distance codes.
+    //
+    bool build(const BYTE *lengths, unsigned nSymbols, unsigned i_rootBits, bool allowSingleCode) {
+        rootBits = i_rootBits;
+
+        unsigned count[MaxCodeLength + 1];
+        memset(count, 0, sizeof(count));
+        for (unsigned i = 0; i < nSymbols; i++) {
+            count[lengths[i]]++;
+        }
+        count[0] = 0;
+
+        unsigned maxLength = 0;
+        int left = 1;
+        for (unsigned length = 1; length <= MaxCodeLength; length++) {
+            left = (left << 1) - (int)count[length];
+            if (left < 0) {
+                return false;   // Oversubscribed
+            }
+            if (count[length] != 0) {
+                maxLength = length;
+            }
+        }
+        if (left > 0 && !(allowSingleCode && maxLength <= 1)) {
+            return false;   // Incomplete
+        }
+
+        //
+        // The symbols in canonical order, by length and then by symbol.
+        //
+        unsigned offsets[MaxCodeLength + 2];
+        offsets[1] = 0;
+        for (unsigned length = 1; length <= MaxCodeLength; length++) {
+            offsets[length + 1] = offsets[length] + count[length];
+        }
+        _uint16 sorted[MaxLitLenSymbols];
+        for (unsigned i = 0; i < nSymbols; i++) {
+            if (0 != lengths[i]) {
+                sorted[offsets[lengths[i]]++] = (_uint16)i;
+            }
+        }
+        unsigned nCodes = 0;
+        for (unsigned length = 1; length <= MaxCodeLength; length++) {
+            nCodes += count[length];
+        }
+
+        unsigned rootSize = 1 << rootBits;
+        unsigned rootMask = rootSize - 1;
+        for (unsigned i = 0; i < rootSize; i++) {
+            entries[i] = InvalidEntry;
+        }
+
+        //
+        // Assign the codes in canonical order, reversing each so it can be looked up by the low bits of the buffer.
+        //
+        unsigned code = 0;
+        unsigned codeLength = 0;
+        unsigned nextSubtable = rootSize;
+        unsigned currentPrefix = rootSize;      // Not a prefix
+        unsigned subtableStart = 0, subtableBits = 0;
+        for (unsigned i = 0; i < nCodes; i++) {
+            unsigned symbol = sorted[i];
+            unsigned length = lengths[symbol];
+            code <<= (length - codeLength);
+            codeLength = length;
+
+            unsigned reversed = 0;
+            for (unsigned bit = 0; bit < length; bit++) {
+                reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+            }
+
+            if (length <= rootBits) {
+                for (unsigned j = reversed; j < rootSize; j += 1 << length) {
+                    entries[j] = symbol | (length << 16);
+                }
+            } else {
+                unsigned prefix = reversed & rootMask;
+                if (prefix != currentPrefix) {
+                    //
+                    // The codes that share these first bits are all together in canonical order, and the last of them
+                    // is the longest, so it sets the size of the subtable.
+                    //
+                    unsigned last = i;
+                    unsigned lastCode = code;
+                    unsigned lastLength = length;
+                    while (last + 1 < nCodes) {
+                        unsigned nextLength = lengths[sorted[last + 1]];
+                        unsigned nextCode = (lastCode + 1) << (nextLength - lastLength);
+                        if ((nextCode >> (nextLength - rootBits)) != (code >> (length - rootBits))) {
+                            break;
+                        }
+                        last++;
+                        lastCode = nextCode;
+                        lastLength = nextLength;
+                    }
+
+                    currentPrefix = prefix;
+                    subtableBits = lastLength - rootBits;
+                    subtableStart = nextSubtable;
+                    nextSubtable += 1 << subtableBits;
+                    if (nextSubtable > MaxEntries) {
+                        return false;
+                    }
+                    for (unsigned j = subtableStart; j < nextSubtable; j++) {
+                        entries[j] = InvalidEntry;
+                    }
+                    entries[prefix] = SubtableFlag | (subtableBits << 16) | subtableStart;
+                }
+                for (unsigned j = reversed >> rootBits; j < (1u << subtableBits); j += 1 << (length - rootBits)) {
+                    entries[subtableStart + j] = symbol | (length << 16);
+                }
+            }
+            code++;
+        }
+        return true;
+    }
+
+    //
+    // Returns InvalidEntry for bits that aren't a code.  The bit buffer must hold at least 15 bits.
+    //
+    inline unsigned decode(BitReader *in) const {
+        _uint32 entry = entries[in->bits & ((1 << rootBits) - 1)];
+        if (entry & SubtableFlag) {
+            unsigned subtableBits = (entry >> 16) & 0xff;
+            entry = entries[(entry & 0xffff) + ((unsigned)(in->bits >> rootBits) & ((1 << subtableBits) - 1))];
+        }
+        in->consume((entry >> 16) & 0xff);
+        return entry & 0xffff;
+    }
+};
+
+SpeculativeInflater::SpeculativeInflater() :
+    output(NULL), symbols(NULL), outputCapacity(0), outputBytes(0), symbolBytes(0), lastWindowReference(-1),
+    trackingWindow(true), ended(false)
+{
+    fixedLitLen = new HuffmanTable;
+    fixedDist = new HuffmanTable;
+    litLen = new HuffmanTable;
+    dist = new HuffmanTable;
+    codeLengths = new HuffmanTable;
+
+    BYTE lengths[MaxLitLenSymbols];
+    for (unsigned i = 0; i < MaxLitLenSymbols; i++) {
+        lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    }
+    fixedLitLen->build(lengths, MaxLitLenSymbols, 10, false);
+    for (unsigned i = 0; i < MaxDistSymbols; i++) {
+        lengths[i] = 5;
+    }
+    fixedDist->build(lengths, MaxDistSymbols, 8, false);
+
+    growOutput(4 * 1024 * 1024);
+}
+
+SpeculativeInflater::~SpeculativeInflater()
+{
+    BigDealloc(output);
+    BigDealloc(symbols);
+    delete fixedLitLen;
+    delete fixedDist;
+    delete litLen;
+    delete dist;
+    delete codeLengths;
+}
+
+    void
+SpeculativeInflater::growOutput(_int64 needed)
+{
+    if (needed <= outputCapacity) {
+        return;
+    }
+
+    _int64 newCapacity = __max(needed, outputCapacity * 2);
+    BYTE *newOutput = (BYTE *)BigAlloc(newCapacity);
+    _uint16 *newSymbols = (_uint16 *)BigAlloc(newCapacity * sizeof(_uint16));
+    if (NULL != output) {
+        memcpy(newOutput, output, outputBytes);
+        memcpy(newSymbols, symbols, symbolBytes * sizeof(_uint16));
+        BigDealloc(output);
+        BigDealloc(symbols);
+    }
+    output = newOutput;
+    symbols = newSymbols;
+    outputCapacity = newCapacity;
+}
+
+    bool
+SpeculativeInflater::readDynamicTables(BitReader *in, bool strict)
+{
+    in->refill();
+    unsigned nLitLen = in->get(5) + 257;
+    unsigned nDist = in->get(5) + 1;
+    unsigned nCodeLengths = in->get(4) + 4;
+    if (nLitLen > 286 || nDist > 30) {
+        return false;
+    }
+
+    BYTE lengths[MaxLitLenSymbols + MaxDistSymbols];
+    memset(lengths, 0, 19);
+    for (unsigned i = 0; i < nCodeLengths; i++) {
+        if (in->bitCount < 3) {
+            in->refill();
+        }
+        lengths[CodeLengthOrder[i]] = (BYTE)in->get(3);
+    }
+    if (!codeLengths->build(lengths, 19, 7, false)) {
+        return false;
+    }
+
+    //
+    // Keep track of how much of the literal/length code space is used as the lengths come in, so that a code that's
+    // oversubscribed (as random bits nearly always are) can be given up on early.
+    //
+    unsigned nLengths = nLitLen + nDist;
+    unsigned i = 0;
+    unsigned litLenCodeSpace = 0;   // In units of 2^-15
+    while (i < nLengths) {
+        in->refill();
+        unsigned symbol = codeLengths->decode(in);
+        if (symbol < 16) {
+            if (i < nLitLen && 0 != symbol) {
+                litLenCodeSpace += 1 << (MaxCodeLength - symbol);
+                if (litLenCodeSpace > (1 << MaxCodeLength)) {
+                    return false;
+                }
+            }
+            lengths[i++] = (BYTE)symbol;
+            continue;
+        }
+
+        unsigned repeat;
+        BYTE value = 0;
+        if (16 == symbol) {
+            if (0 == i) {
+                return false;
+            }
+            value = lengths[i - 1];
+            repeat = 3 + in->get(2);
+        } else if (17 == symbol) {
+            repeat = 3 + in->get(3);
+        } else if (18 == symbol) {
+            repeat = 11 + in->get(7);
+        } else {
+            return false;
+        }
+        if (i + repeat > nLengths) {
+            return false;
+        }
+        memset(lengths + i, value, repeat);
+        i += repeat;
+    }
+
+    if (0 == lengths[256]) {
+        return false;   // No end of block code
+    }
+    return litLen->build(lengths, nLitLen, 10, !strict) && dist->build(lengths + nLitLen, nDist, 8, !strict);
+}
+
+    bool
+SpeculativeInflater::inflateBlock(BitReader *in, const HuffmanTable *litLenTable, const HuffmanTable *distTable, _int64 outputLimit)
+{
+    _int64 p = outputBytes;
+    for (;;) {
+        if (p + 258 + 8 > outputCapacity) {
+            if (p + 258 + 8 > outputLimit) {
+                return false;
+            }
+            outputBytes = p;
+            if (trackingWindow) {
+                symbolBytes = p;
+            }
+            growOutput(p + 258 + 8);
+        }
+
+        in->refill();
+        if (in->padBytes > 8) {
+            return false;   // Well past the end of the input
+        }
+
+        unsigned symbol = litLenTable->decode(in);
+        if (symbol < 256) {
+            output[p] = (BYTE)symbol;
+            if (trackingWindow) {
+                symbols[p] = (_uint16)symbol;
+            }
+            p++;
+            continue;
+        }
+        if (256 == symbol) {
+            break;
+        }
+
+        symbol -= 257;
+        if (symbol >= 29) {
+            return false;
+        }
+        unsigned length = LengthBase[symbol] + in->get(LengthExtraBits[symbol]);
+        unsigned distSymbol = distTable->decode(in);
+        if (distSymbol >= 30) {
+            return false;
+        }
+        unsigned distance = DistanceBase[distSymbol] + in->get(DistanceExtraBits[distSymbol]);
+
+        _int64 source = p - distance;
+        if (trackingWindow) {
+            for (unsigned i = 0; i < length; i++) {
+                _int64 from = source + i;
+                _uint16 value = from >= 0 ? symbols[from] : (_uint16)(256 + WindowSize + from);
+                symbols[p + i] = value;
+                output[p + i] = (BYTE)value;
+                if (value >= 256) {
+                    lastWindowReference = p + i;
+                }
+            }
+            p += length;
+            if (p - lastWindowReference > WindowSize) {
+                trackingWindow = false;
+                symbolBytes = p;
+            }
+        } else if (distance >= 8) {
+            //
+            // Eight bytes at a time is fine even when the copy overlaps itself, since each eight come from bytes that
+            // are already there.  The slack at the end of the buffer covers the overshoot.
+            //
+            BYTE *to = output + p;
+            const BYTE *from = output + source;
+            for (unsigned i = 0; i < length; i += 8) {
+                memcpy(to + i, from + i, 8);
+            }
+            p += length;
+        } else {
+            for (unsigned i = 0; i < length; i++) {
+                output[p + i] = output[source + i];
+            }
+            p += length;
+        }
+    }
+
+    outputBytes = p;
+    if (trackingWindow) {
+        symbolBytes = p;
+        if (p - lastWindowReference > WindowSize) {
+            trackingWindow = false;
+        }
+    }
+    return !in->overrun();
+}
+
+    bool
+SpeculativeInflater::inflateStoredBlock(BitReader *in, _int64 outputLimit)
+{
+    in->consume(in->bitCount & 7);     // To a byte boundary
+    in->refill();
+    unsigned length = in->get(16);
+    unsigned complement = in->get(16);
+    if ((length ^ 0xffff) != complement) {
+        return false;
+    }
+
+    _int64 inputOffset = in->position() / 8;
+    _int64 inputBytes = in->end - in->start;
+    if (inputOffset + length > inputBytes || outputBytes + length > outputLimit) {
+        return false;
+    }
+    growOutput(outputBytes + length + 8);
+    memcpy(output + outputBytes, in->start + inputOffset, length);
+    if (trackingWindow) {
+        for (unsigned i = 0; i < length; i++) {
+            symbols[outputBytes + i] = in->start[inputOffset + i];
+        }
+    }
+    outputBytes += length;
+    if (trackingWindow) {
+        symbolBytes = outputBytes;
+        if (outputBytes - lastWindowReference > WindowSize) {
+            trackingWindow = false;
+        }
+    }
+
+    in->seek(in->start, inputBytes, (inputOffset + length) * 8);
+    return true;
+}
+
+//
+// Parses the gzip header at the (byte aligned) current position.  If there isn't one, that's the end of the stream,
+// as long as the input is the rest of the file.
+//
+    bool
+SpeculativeInflater::readMemberHeader(BitReader *in, bool inputIsComplete, bool *o_streamEnded)
+{
+    const BYTE *input = in->start;
+    _int64 inputBytes = in->end - in->start;
+    _int64 offset = in->position() / 8;
+    *o_streamEnded = false;
+
+    if (offset + 10 > inputBytes) {
+        if (inputIsComplete) {
+            *o_streamEnded = true;
+            return true;
+        }
+        return false;
+    }
+    if (input[offset] != 0x1f || input[offset + 1] != 0x8b) {
+        //
+        // Something other than another member follows, such as padding.  Like gzip, ignore it.
+        //
+        *o_streamEnded = true;
+        return true;
+    }
+    if (input[offset + 2] != 8) {
+        return false;   // Not deflate
+    }
+
+    BYTE flags = input[offset + 3];
+    offset += 10;
+    if (flags & 0x04) {         // FEXTRA
+        if (offset + 2 > inputBytes) {
+            return false;
+        }
+        offset += 2 + (input[offset] | (input[offset + 1] << 8));
+    }
+    for (int field = 0x08; field <= 0x10; field <<= 1) {      // FNAME and FCOMMENT, zero terminated
+        if (flags & field) {
+            while (offset < inputBytes && 0 != input[offset]) {
+                offset++;
+            }
+            offset++;
+        }
+    }
+    if (flags & 0x02) {         // FHCRC
+        offset += 2;
+    }
+    if (offset > inputBytes) {
+        return false;
+    }
+
+    in->seek(input, inputBytes, offset * 8);
+    return true;
+}
+
+    bool
+SpeculativeInflater::inflate(const BYTE *input, _int64 inputBytes, InflateBoundary start, _int64 stopBit, bool inputIsComplete)
+{
+    outputBytes = 0;
+    symbolBytes = 0;
+    lastWindowReference = -1;
+    trackingWindow = true;
+    ended = false;
+    memberEnds.clear();
+
+    BitReader in(input, inputBytes, start.bit);
+    bool atMemberStart = start.memberStart;
+    for (;;) {
+        _int64 position = in.position();
+        if (position >= stopBit) {
+            end = InflateBoundary(position, atMemberStart);
+            return true;
+        }
+
+        if (atMemberStart) {
+            if (!readMemberHeader(&in, inputIsComplete, &ended)) {
+                return false;
+            }
+            if (ended) {
+                end = InflateBoundary(position, true);
+                return true;
+            }
+            atMemberStart = false;
+            continue;
+        }
+
+        in.refill();
+        bool finalBlock = 0 != in.get(1);
+        unsigned blockType = in.get(2);
+        bool ok;
+        if (0 == blockType) {
+            ok = inflateStoredBlock(&in, INT64_MAX);
+        } else if (1 == blockType) {
+            ok = inflateBlock(&in, fixedLitLen, fixedDist, INT64_MAX);
+        } else if (2 == blockType) {
+            ok = readDynamicTables(&in, false) && inflateBlock(&in, litLen, dist, INT64_MAX);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            return false;
+        }
+
+        if (finalBlock) {
+            //
+            // The member trailer: the CRC and length of its data.
+            //
+            in.consume(in.bitCount & 7);
+            in.refill();
+            InflateMemberEnd memberEnd;
+            memberEnd.outputOffset = outputBytes;
+            memberEnd.crc = in.get(32);
+            in.refill();
+            memberEnd.size = in.get(32);
+            if (in.overrun()) {
+                return false;
+            }
+            memberEnds.push_back(memberEnd);
+            atMemberStart = true;
+        }
+    }
+}
+
+    _int64
+SpeculativeInflater::findBlockStart(const BYTE *input, _int64 inputBytes, _int64 firstBit, _int64 limitBit)
+{
+    limitBit = __min(limitBit, inputBytes * 8);
+    for (_int64 bit = firstBit; bit < limitBit; bit++) {
+        //
+        // Quickly rule out almost everything: the header has to say a dynamic block that isn't the last one, the
+        // counts of codes have to be in range, and the lengths of the code length code have to make a complete code.
+        //
+        _int64 byteOffset = bit / 8;
+        if (byteOffset + 16 > inputBytes) {
+            break;      // Not enough left for a block anyway
+        }
+        _uint64 header = LoadLittleEndian64(input + byteOffset) >> (bit % 8);
+        if ((header & 7) != 4 || ((header >> 3) & 31) > 29 || ((header >> 8) & 31) > 29) {
+            continue;
+        }
+
+        unsigned nCodeLengths = (unsigned)((header >> 13) & 15) + 4;
+        _uint64 codeLengthBits = LoadLittleEndian64(input + (bit + 17) / 8) >> ((bit + 17) % 8);
+        unsigned kraft = 0;     // In units of 2^-7
+        for (unsigned i = 0; i < nCodeLengths; i++) {
+            unsigned length = (unsigned)(codeLengthBits >> (3 * i)) & 7;
+            if (0 != length) {
+                kraft += 128 >> length;
+            }
+        }
+        if (kraft != 128) {
+            continue;
+        }
+
+        //
+        // Now do it for real: the whole block has to decode, and be followed by something that could be a block.
+        //
+        outputBytes = 0;
+        symbolBytes = 0;
+        lastWindowReference = -1;
+        trackingWindow = true;
+
+        BitReader in(input, inputBytes, bit + 3);
+        if (readDynamicTables(&in, true) && inflateBlock(&in, litLen, dist, MaxTrialBlockOutput)) {
+            in.refill();
+            if (!in.overrun() && 3 != ((in.bits >> 1) & 3)) {
+                return bit;
+            }
+        }
+    }
+    return -1;
+}
+
+    void
+SpeculativeInflater::resolve(const BYTE *window, _int64 begin, _int64 resolveEnd)
+{
+    resolveEnd = __min(resolveEnd, symbolBytes);
+    for (_int64 i = begin; i < resolveEnd; i++) {
+        _uint16 symbol = symbols[i];
+        output[i] = symbol < 256 ? (BYTE)symbol : window[symbol - 256];
+    }
+}
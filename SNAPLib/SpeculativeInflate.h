@@ -0,0 +1,113 @@
+/*++
+
+Module Name:
+
+    SpeculativeInflate.h
+
+Abstract:
+
+    A deflate decoder that can start in the middle of a gzip stream, for decompressing one gzip member on several
+    threads.  Each thread looks for the start of a deflate block somewhere in its piece of the compressed data and
+    decodes from there without knowing the 32KB of output that came before it.  Back references into that unknown
+    window come out as markers saying which byte of the window they meant, and once the thread before has finished
+    and the window is known, a cheap second pass replaces them.
+
+Environment:
+
+    User mode service.
+
+--*/
+
+#pragma once
+
+#include "Compat.h"
+#include "BigAlloc.h"
+#include "VariableSizeVector.h"
+
+//
+// A place in the compressed data where decoding can start: either a deflate block header or (after the trailer of
+// the member before) a gzip member header.
+//
+struct InflateBoundary {
+    _int64      bit;            // Offset from the start of the input in bits
+    bool        memberStart;
+
+    InflateBoundary() : bit(0), memberStart(false) {}
+    InflateBoundary(_int64 i_bit, bool i_memberStart) : bit(i_bit), memberStart(i_memberStart) {}
+
+    bool operator==(const InflateBoundary& o) const { return bit == o.bit && memberStart == o.memberStart; }
+    bool operator!=(const InflateBoundary& o) const { return !(*this == o); }
+};
+
+//
+// The end of a gzip member within the output, with what its trailer says the CRC and length of the member were.
+//
+struct InflateMemberEnd {
+    _int64      outputOffset;
+    _uint32     crc;
+    _uint32     size;           // Mod 2^32
+};
+
+class SpeculativeInflater {
+public:
+    static const int WindowSize = 32768;
+
+    SpeculativeInflater();
+    ~SpeculativeInflater();
+
+    //
+    // Returns the first bit offset in [firstBit, limitBit) where a dynamic Huffman block starts that decodes cleanly
+    // and is followed by a plausible block header, or -1 if there isn't one.  Stored and fixed Huffman blocks are too
+    // easy to mistake for random bits to look for.  This uses the output buffer.
+    //
+    _int64 findBlockStart(const BYTE *input, _int64 inputBytes, _int64 firstBit, _int64 limitBit);
+
+    //
+    // Decodes from start until reaching a boundary at or past stopBit, or the end of the gzip stream.  The output
+    // starts at the beginning of the output buffer.  inputIsComplete says whether input runs all the way to the end of
+    // the file, so that running out of it between members is the end of the stream rather than an error.  Returns false
+    // if the data is corrupt, or if it runs out of input first.
+    //
+    bool inflate(const BYTE *input, _int64 inputBytes, InflateBoundary start, _int64 stopBit, bool inputIsComplete);
+
+    //
+    // Replaces the references to the window in output bytes [begin, end) with what they refer to.  window holds the
+    // WindowSize bytes of output that came before the start (zeroes for any that don't exist).
+    //
+    void resolve(const BYTE *window, _int64 begin, _int64 end);
+
+    BYTE *getOutput() { return output; }
+    _int64 getOutputBytes() { return outputBytes; }
+
+    // Past here the output doesn't depend on the window, so resolve() has nothing to do.
+    _int64 getWindowDependentBytes() { return symbolBytes; }
+
+    InflateBoundary getEnd() { return end; }
+    bool streamEnded() { return ended; }
+    VariableSizeVector<InflateMemberEnd> *getMemberEnds() { return &memberEnds; }
+
+private:
+    struct BitReader;
+    struct HuffmanTable;
+
+    bool readDynamicTables(BitReader *in, bool strict);
+    bool inflateBlock(BitReader *in, const HuffmanTable *litLen, const HuffmanTable *dist, _int64 outputLimit);
+    bool inflateStoredBlock(BitReader *in, _int64 outputLimit);
+    bool readMemberHeader(BitReader *in, bool inputIsComplete, bool *o_streamEnded);
+    void growOutput(_int64 needed);
+
+    BYTE            *output;
+    _uint16         *symbols;       // Output with window references, for the first symbolBytes bytes
+    _int64          outputCapacity;
+    _int64          outputBytes;
+    _int64          symbolBytes;
+    _int64          lastWindowReference;    // The last output byte that came from the window
+    bool            trackingWindow;
+
+    InflateBoundary end;
+    bool            ended;
+    VariableSizeVector<InflateMemberEnd> memberEnds;
+
+    HuffmanTable    *fixedLitLen, *fixedDist;
+    HuffmanTable    *litLen, *dist, *codeLengths;
+};
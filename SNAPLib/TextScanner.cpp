@@ -0,0 +1,116 @@
+/*++
+
+Module Name:
+
+    TextScanner.cpp
+
+Abstract:
+
+    Finds the line ends (and for SAM, the field separators) in text input 64 bytes at a time, so that the FASTQ and
+    SAM parsers can go straight from one to the next rather than looking at every byte.
+
+Environment:
+
+    User mode service.
+
+--*/
+
+#include "stdafx.h"
+#include "TextScanner.h"
+#ifdef SIMD_KERNELS_AVAILABLE
+#include <immintrin.h>
+#endif
+
+static SIMDLevel scannerKernel = GetProcessorSIMDLevel();
+
+    SIMDLevel
+GetTextScannerKernel()
+{
+    return scannerKernel;
+}
+
+    void
+SetTextScannerKernel(SIMDLevel kernel)
+{
+    scannerKernel = __min(kernel, GetProcessorSIMDLevel());
+}
+
+static inline bool IsStructural(char c, bool fieldSeparatorsToo)
+{
+    return '\n' == c || '\0' == c || (fieldSeparatorsToo && ('\t' == c || '\r' == c));
+}
+
+static _uint64 ScanTextBlockScalar(const char *text, unsigned begin, unsigned length, bool fieldSeparatorsToo)
+{
+    _uint64 matches = 0;
+    for (unsigned i = begin; i < length; i++) {
+        if (IsStructural(text[i], fieldSeparatorsToo)) {
+            matches |= (_uint64)1 << i;
+        }
+    }
+    return matches;
+}
+
+#ifdef SIMD_KERNELS_AVAILABLE
+//
+// Only SSE2 compares, but it's chosen along with the rest of the SSE4.1 kernels.  The bytes past a whole number of
+// vectors at the end of the text are done a byte at a time rather than reading past the end of the buffer.
+//
+SIMD_TARGET("sse2") static _uint64 ScanTextBlockSSE2(const char *text, unsigned length, bool fieldSeparatorsToo)
+{
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i zero = _mm_setzero_si128();
+
+    _uint64 matches = 0;
+    unsigned i;
+    for (i = 0; i + 16 <= length; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i found = _mm_or_si128(_mm_cmpeq_epi8(bytes, newline), _mm_cmpeq_epi8(bytes, zero));
+        if (fieldSeparatorsToo) {
+            found = _mm_or_si128(found, _mm_or_si128(_mm_cmpeq_epi8(bytes, tab), _mm_cmpeq_epi8(bytes, cr)));
+        }
+        matches |= (_uint64)(unsigned)_mm_movemask_epi8(found) << i;
+    }
+
+    return matches | ScanTextBlockScalar(text, i, length, fieldSeparatorsToo);
+}
+
+SIMD_TARGET("avx2") static _uint64 ScanTextBlockAVX2(const char *text, unsigned length, bool fieldSeparatorsToo)
+{
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i zero = _mm256_setzero_si256();
+
+    _uint64 matches = 0;
+    unsigned i;
+    for (i = 0; i + 32 <= length; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *)(text + i));
+        __m256i found = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, newline), _mm256_cmpeq_epi8(bytes, zero));
+        if (fieldSeparatorsToo) {
+            found = _mm256_or_si256(found, _mm256_or_si256(_mm256_cmpeq_epi8(bytes, tab), _mm256_cmpeq_epi8(bytes, cr)));
+        }
+        matches |= (_uint64)(unsigned)_mm256_movemask_epi8(found) << i;
+    }
+
+    return matches | ScanTextBlockScalar(text, i, length, fieldSeparatorsToo);
+}
+#endif // SIMD_KERNELS_AVAILABLE
+
+    _uint64
+ScanTextBlock(const char *text, unsigned length, bool fieldSeparatorsToo)
+{
+    _ASSERT(length <= 64);
+#ifdef SIMD_KERNELS_AVAILABLE
+    if (scannerKernel >= SIMDLevelAVX2) {
+        return ScanTextBlockAVX2(text, length, fieldSeparatorsToo);
+    }
+    if (scannerKernel >= SIMDLevelSSE41) {
+        return ScanTextBlockSSE2(text, length, fieldSeparatorsToo);
+    }
+#endif // SIMD_KERNELS_AVAILABLE
+
+    return ScanTextBlockScalar(text, 0, length, fieldSeparatorsToo);
+}
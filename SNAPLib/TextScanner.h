@@ -0,0 +1,67 @@
+/*++
+
+Module Name:
+
+    TextScanner.h
+
+Abstract:
+
+    Finds the line ends (and for SAM, the field separators) in text input 64 bytes at a time, so that the FASTQ and
+    SAM parsers can go straight from one to the next rather than looking at every byte.
+
+Environment:
+
+    User mode service.
+
+--*/
+
+#pragma once
+
+#include "Compat.h"
+
+//
+// Returns a mask with bit i set if text[i] is a newline or a NUL, or if fieldSeparatorsToo is set, a tab or a CR.
+// length must be at most 64.  NULs are included because the parsers have always treated them as the end of the text.
+//
+_uint64 ScanTextBlock(const char *text, unsigned length, bool fieldSeparatorsToo);
+
+//
+// Hands out the offsets of the characters that ScanTextBlock() looks for in order, scanning a block whenever it runs
+// out.  next() returns length once there are no more.
+//
+class TextScanner {
+public:
+    TextScanner(const char *i_text, size_t i_length, bool i_fieldSeparatorsToo) :
+        text(i_text), length(i_length), fieldSeparatorsToo(i_fieldSeparatorsToo), blockStart(0), matches(0), scanned(0) {}
+
+    inline size_t next() {
+        while (0 == matches) {
+            if (scanned >= length) {
+                return length;
+            }
+            blockStart = scanned;
+            unsigned blockLength = (unsigned)__min((size_t)64, length - scanned);
+            matches = ScanTextBlock(text + blockStart, blockLength, fieldSeparatorsToo);
+            scanned += blockLength;
+        }
+
+        unsigned long bit;
+        CountTrailingZeroes(matches, bit);
+        matches &= matches - 1;
+        return blockStart + bit;
+    }
+
+private:
+    const char  *text;
+    size_t      length;
+    bool        fieldSeparatorsToo;
+    size_t      blockStart;
+    _uint64     matches;    // The ones in the current block that next() hasn't returned yet
+    size_t      scanned;
+};
+
+//
+// Which kernel ScanTextBlock() uses.  It defaults to the best one the processor supports; tests use this to compare them.
+//
+SIMDLevel GetTextScannerKernel();
+void SetTextScannerKernel(SIMDLevel kernel);
@@ -0,0 +1,158 @@
+#include "stdafx.h"
+#include "Compat.h"
+#include "TestLib.h"
+#include "DataReader.h"
+
+#ifdef SNAP_IO_URING
+#include <unistd.h>
+
+static const _int64 TestOverflowBytes = 1000;
+static const size_t TestBufferSpace = 6 * 2 * 20000;   // 20000 byte buffers, so a little over 16K of each can begin a read
+
+//
+// Reads [start, start + amount) of the file through the reader the way the parsers do, and checks that the bytes that
+// may begin a read are exactly that range and that each buffer has the file's bytes past them as overflow.
+//
+static void checkRange(DataSupplier *supplier, const char *fileName, const char *contents, _int64 fileSize, _int64 start, _int64 amount)
+{
+    DataReader *reader = supplier->getDataReader(2, TestOverflowBytes, 0.0, TestBufferSpace);
+    ASSERT(reader->init(fileName));
+    reader->reinit(start, amount);
+
+    _int64 end = amount == 0 ? fileSize : __min(fileSize, start + amount);
+    _int64 position = start;
+    for (;;) {
+        char *buffer;
+        _int64 validBytes, startBytes;
+        if (!reader->getData(&buffer, &validBytes, &startBytes)) {
+            break;
+        }
+
+        ASSERT(startBytes <= validBytes);
+        ASSERT(position + startBytes <= end);
+        ASSERT(validBytes - startBytes >= __min(TestOverflowBytes, fileSize - (position + startBytes)));
+        ASSERT(position + validBytes <= fileSize);
+        ASSERT(0 == memcmp(buffer, contents + position, validBytes));
+
+        position += startBytes;
+        reader->advance(startBytes);
+        if (reader->isEOF()) {
+            break;
+        }
+        reader->nextBatch();
+    }
+    ASSERT_EQ(end, position);
+
+    delete reader;
+}
+
+TEST("io_uring data reader returns every byte of the file once") {
+    char fileName[] = "/tmp/snapDataReaderTestXXXXXX";
+    int fd = mkstemp(fileName);
+    ASSERT(fd >= 0);
+
+    const _int64 fileSize = 1000 * 1000 + 123;
+    char *contents = new char[fileSize];
+    _uint64 randomState = 1;
+    for (_int64 i = 0; i < fileSize; i++) {
+        randomState = randomState * 6364136223846793005ull + 1442695040888963407ull;
+        contents[i] = (char)(randomState >> 56);
+    }
+    ASSERT_EQ(fileSize, (_int64)write(fd, contents, fileSize));
+    close(fd);
+
+    checkRange(DataSupplier::IoUring, fileName, contents, fileSize, 0, 0);
+    checkRange(DataSupplier::IoUring, fileName, contents, fileSize, 12345, 300000);      // Starts and ends unaligned
+    checkRange(DataSupplier::IoUring, fileName, contents, fileSize, 4096 * 100, fileSize);
+    checkRange(DataSupplier::IoUring, fileName, contents, fileSize, fileSize - 10, 0);
+
+    unlink(fileName);
+    delete[] contents;
+}
+#endif // SNAP_IO_URING
+
+#ifndef _MSC_VER
+#include <unistd.h>
+#include "Bam.h"
+#include "zlib.h"
+#include <vector>
+
+//
+// Appends one BGZF block holding text[begin, end).
+//
+static void appendBgzfBlock(std::vector<char> *file, const char *text, size_t begin, size_t end)
+{
+    static const unsigned char header[] = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0, 0, 0};
+    z_stream zstream;
+    memset(&zstream, 0, sizeof(zstream));
+    ASSERT_EQ(Z_OK, deflateInit2(&zstream, 6, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY));
+    std::vector<char> block(sizeof(header) + deflateBound(&zstream, (uLong)(end - begin)) + 8);
+    memcpy(&block[0], header, sizeof(header));
+    zstream.next_in = (Bytef *)(text + begin);
+    zstream.avail_in = (uInt)(end - begin);
+    zstream.next_out = (Bytef *)&block[sizeof(header)];
+    zstream.avail_out = (uInt)(block.size() - sizeof(header));
+    ASSERT_EQ(Z_STREAM_END, deflate(&zstream, Z_FINISH));
+    size_t blockBytes = sizeof(header) + zstream.total_out + 8;
+    deflateEnd(&zstream);
+
+    *(_uint16 *)&block[16] = (_uint16)(blockBytes - 1);
+    *(_uint32 *)&block[blockBytes - 8] = (_uint32)crc32(0, (const Bytef *)(text + begin), (uInt)(end - begin));
+    *(_uint32 *)&block[blockBytes - 4] = (_uint32)(end - begin);
+    file->insert(file->end(), block.begin(), block.begin() + blockBytes);
+}
+
+//
+// Ranges that start and end in the middle of blocks each hand out the text of the blocks that start in them, so that
+// between them they have all of it once.
+//
+TEST("BGZF ranges return each block once") {
+    const size_t textBytes = 1000 * 1000;
+    char *text = new char[textBytes];
+    _uint64 randomState = 1;
+    for (size_t i = 0; i < textBytes; i++) {
+        randomState = randomState * 6364136223846793005ull + 1442695040888963407ull;
+        text[i] = "ACGT"[(randomState >> 33) & 3];
+    }
+    std::vector<char> file;
+    for (size_t begin = 0; begin < textBytes; begin += 40001) {
+        appendBgzfBlock(&file, text, begin, __min(begin + 40001, textBytes));
+    }
+    appendBgzfBlock(&file, text, 0, 0);
+
+    ASSERT_EQ((_int64)-1, BgzfHeader::findBlock(text, 200000, 200000));
+    ASSERT(BgzfHeader::isWholeBlock(&file[0], file.size()));
+    _int64 second = BgzfHeader::findBlock(&file[1], file.size() - 1, file.size() - 1) + 1;
+    ASSERT_EQ((_int64)((BgzfHeader *)&file[0])->BSIZE() + 1, second);
+
+    char fileName[] = "/tmp/snapDataReaderTestXXXXXX";
+    int fd = mkstemp(fileName);
+    ASSERT(fd >= 0);
+    ASSERT_EQ((ssize_t)file.size(), write(fd, &file[0], file.size()));
+    close(fd);
+
+    const int nRanges = 4;
+    size_t position = 0;
+    for (int range = 0; range < nRanges; range++) {
+        _int64 start = (_int64)file.size() * range / nRanges;
+        _int64 amount = (_int64)file.size() * (range + 1) / nRanges - start;
+        DataReader *reader = DataSupplier::GzipBamDefault->getDataReader(2, 1000, 3.0 * DataSupplier::ExpansionFactor, 0);
+        ASSERT(reader->init(fileName));
+        reader->reinit(start, amount);
+        char *buffer;
+        _int64 validBytes, startBytes;
+        while (reader->getData(&buffer, &validBytes, &startBytes)) {
+            ASSERT(position + startBytes <= textBytes);
+            ASSERT(0 == memcmp(buffer, text + position, __min(validBytes, (_int64)(textBytes - position))));
+            position += startBytes;
+            reader->advance(startBytes);
+            reader->nextBatch();
+        }
+        delete reader;
+    }
+    ASSERT_EQ(textBytes, position);
+
+    unlink(fileName);
+    delete[] text;
+}
+#endif // _MSC_VER
@@ -0,0 +1,72 @@
+#include "stdafx.h"
+#include "Compat.h"
+#include "TestLib.h"
+#include "FASTQ.h"
+
+TEST("FASTQ record start skips quality lines that look like headers") {
+    char fastq[] =
+        "ACGT\n"
+        "@@@@\n"
+        "@read1\n"
+        "ACGTN\n"
+        "+\n"
+        "@@@@@\n";
+    ASSERT_EQ((_int64)10, FASTQReader::findRecordStart(fastq, strlen(fastq)));
+
+    // Not enough of the record to tell
+    ASSERT_EQ((_int64)-1, FASTQReader::findRecordStart(fastq, 20));
+}
+
+#ifndef _MSC_VER
+#include <unistd.h>
+
+TEST("FASTQ chunks parse every read exactly once") {
+    char fileName[] = "/tmp/snapFASTQTestXXXXXX";
+    int fd = mkstemp(fileName);
+    ASSERT(fd >= 0);
+    FILE *file = fdopen(fd, "w");
+
+    //
+    // Enough reads to span several batches, with quality lines that start with '@' to make finding records harder.
+    //
+    const unsigned nReads = 40000;
+    char bases[200], quality[200];
+    _uint64 randomState = 1;
+    for (unsigned i = 0; i < nReads; i++) {
+        randomState = randomState * 6364136223846793005ull + 1442695040888963407ull;
+        unsigned length = 30 + (unsigned)(randomState >> 33) % 120;
+        for (unsigned j = 0; j < length; j++) {
+            bases[j] = "ACGT"[(randomState >> (j % 60)) & 3];
+            quality[j] = j == 0 && i % 3 == 0 ? '@' : (char)('!' + j % 40);
+        }
+        fprintf(file, "@read%u\n%.*s\n+\n%.*s\n", i, length, bases, length, quality);
+    }
+    fclose(file);
+
+    ReaderContext context;
+    memset(&context, 0, sizeof(context));
+    context.clipping = NoClipping;
+    context.defaultReadGroup = "";
+
+    FASTQReader *reader = FASTQReader::create(DataSupplier::Default, fileName, 4, 0, QueryFileSize(fileName), context);
+    ReadChunk chunk;
+    Read read;
+    unsigned nextRead = 0;
+    while (reader->getNextChunk(8000, &chunk)) {
+        while (reader->getReadFromChunk(&chunk, &read)) {
+            char expectedId[20];
+            sprintf(expectedId, "read%u", nextRead);
+            ASSERT_EQ(strlen(expectedId), (size_t)read.getIdLength());
+            ASSERT(0 == memcmp(expectedId, read.getId(), read.getIdLength()));
+            ASSERT(read.getBatch() == chunk.batch);
+            nextRead++;
+        }
+        ASSERT_EQ(chunk.bytes, chunk.offset);
+        reader->releaseBatch(chunk.batch);
+    }
+    ASSERT_EQ(nReads, nextRead);
+
+    delete reader;
+    unlink(fileName);
+}
+#endif // _MSC_VER
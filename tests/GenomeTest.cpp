@@ -0,0 +1,78 @@
+#include "stdafx.h"
+#include "Compat.h"
+#include "TestLib.h"
+#include "Genome.h"
+
+//
+// Checks that a genome loaded packed unpacks to exactly the bases of the same genome loaded normally,
+// including the 'n' padding between contigs, runs of N and IUPAC codes.
+//
+struct PackedGenomeTest {
+    static const unsigned padding = 50;
+
+    const Genome *unpacked;
+    const Genome *packed;
+    const char *fileName;
+
+    PackedGenomeTest() : fileName("PackedGenomeTest.genome") {
+        Genome *genome = new Genome(100000, 100000, padding);
+        unsigned seed = 12345;
+        char buffer[1000];
+        for (int contig = 0; contig < 5; contig++) {
+            char name[20];
+            sprintf(name, "chr%d", contig);
+            genome->startContig(name);
+            int contigLength = 300 + 4567 * contig % 997;
+            for (int i = 0; i < contigLength; i++) {
+                seed = seed * 1103515245 + 12345;
+                buffer[i % sizeof(buffer)] = "ACGT"[(seed >> 16) % 4];
+                if ((seed >> 8) % 97 == 0) {
+                    buffer[i % sizeof(buffer)] = 'R';
+                }
+                if (contig == 2 && i >= 100 && i < 230) {
+                    buffer[i % sizeof(buffer)] = 'N';
+                }
+                if (i % sizeof(buffer) == sizeof(buffer) - 1 || i == contigLength - 1) {
+                    genome->addData(buffer, i % sizeof(buffer) + 1);
+                }
+            }
+            for (unsigned i = 0; i < padding; i++) {
+                genome->addData("n");
+            }
+        }
+        genome->saveToFile(fileName);
+        delete genome;
+
+        unpacked = Genome::loadFromFile(fileName, padding);
+        packed = Genome::loadFromFile(fileName, padding, 0, 0, false, true);
+    }
+
+    ~PackedGenomeTest() {
+        delete unpacked;
+        delete packed;
+        DeleteSingleFile(fileName);
+    }
+};
+
+TEST_F(PackedGenomeTest, "packed genome unpacks to the same bases") {
+    ASSERT(NULL != unpacked && NULL != packed);
+    ASSERT(packed->isPacked());
+    ASSERT_EQ(unpacked->getCountOfBases(), packed->getCountOfBases());
+
+    const GenomeDistance maxK = 10;
+    const GenomeDistance lengths[] = {1, 31, 64, 100, 257};
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        GenomeDistance length = lengths[l];
+        char *unpackBuffer = new char[Genome::getUnpackBufferSize(length, maxK, maxK)];
+        for (GenomeLocation location = 0; location < unpacked->getCountOfBases(); location += 1) {
+            const char *expected = unpacked->getSubstring(location, length);
+            const char *actual = packed->getSubstring(location, length, unpackBuffer, maxK, maxK);
+            ASSERT_EQ(NULL == expected, NULL == actual);
+            if (NULL == expected) {
+                continue;
+            }
+            ASSERT_EQ(0, memcmp(expected - maxK, actual - maxK, maxK + length + maxK));
+        }
+        delete [] unpackBuffer;
+    }
+}
@@ -0,0 +1,105 @@
+#include "stdafx.h"
+#include "Compat.h"
+#include "TestLib.h"
+#include "HashTable.h"
+#include "GenericFile.h"
+
+//
+// Fills a table in each layout with the same pseudorandom keys, enough that plenty of buckets overflow, and checks
+// that both find exactly the keys that were inserted.
+//
+struct HashTableTest {
+    static const unsigned nKeys = 20000;
+    static const _uint64 invalidValue = 0xffffffff;
+
+    SNAPHashTable *linear;
+    SNAPHashTable *bucketed;
+    _uint64 keys[nKeys];
+
+    HashTableTest() {
+        linear = new SNAPHashTable(nKeys * 11 / 10, 5, 4, 2, invalidValue, SNAPHashTable::LinearProbingLayout);
+        bucketed = new SNAPHashTable(nKeys * 11 / 10, 5, 4, 2, invalidValue, SNAPHashTable::BucketedLayout);
+
+        _uint64 seed = 12345;
+        for (unsigned i = 0; i < nKeys; i++) {
+            seed = seed * 6364136223846793005 + 1442695040888963407;
+            keys[i] = (seed >> 20) & 0xffffffffff;  // 5 byte keys
+            if (i % 100 == 0) {
+                keys[i] = i / 100 + 1;              // Including some small ones
+            }
+        }
+    }
+
+    ~HashTableTest() {
+        delete linear;
+        delete bucketed;
+    }
+
+    bool inserted(_uint64 key, unsigned nInserted) {
+        for (unsigned i = 0; i < nInserted; i++) {
+            if (keys[i] == key) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+TEST_F(HashTableTest, "bucketed and linear layouts find the same keys") {
+    for (unsigned i = 0; i < nKeys; i++) {
+        SNAPHashTable::ValueType values[2] = {i, nKeys - i};
+        ASSERT(linear->Insert(keys[i], values));
+        ASSERT(bucketed->Insert(keys[i], values));
+    }
+    ASSERT_EQ(linear->GetUsedElementCount(), bucketed->GetUsedElementCount());
+
+    for (unsigned i = 0; i < nKeys; i++) {
+        SNAPHashTable::ValueType linearValues[2], bucketedValues[2];
+        ASSERT(linear->Lookup(keys[i], 2, linearValues));
+        ASSERT(bucketed->Lookup(keys[i], 2, bucketedValues));
+        ASSERT_EQ(linearValues[0], bucketedValues[0]);
+        ASSERT_EQ(linearValues[1], bucketedValues[1]);
+    }
+
+    for (_uint64 key = 1000000; key < 1010000; key++) {
+        bool shouldBeThere = inserted(key, nKeys);
+        ASSERT_EQ(shouldBeThere, NULL != bucketed->GetFirstValueForKey(key));
+        ASSERT_EQ(shouldBeThere, NULL != bucketed->SlowLookup(key));
+    }
+}
+
+TEST_F(HashTableTest, "bucketed layout survives save and load") {
+    for (unsigned i = 0; i < nKeys; i++) {
+        SNAPHashTable::ValueType values[2] = {i, nKeys - i};
+        ASSERT(bucketed->Insert(keys[i], values));
+    }
+
+    const char *fileName = "HashTableTest.table";
+    FILE *saveFile = fopen(fileName, "wb");
+    ASSERT(NULL != saveFile);
+    fwrite("x", 1, 1, saveFile);    // So the table doesn't start out aligned in the file
+    size_t bytesWritten;
+    ASSERT(bucketed->saveToFile(saveFile, &bytesWritten));
+    fclose(saveFile);
+
+    GenericFile *loadFile = GenericFile::open(fileName, GenericFile::ReadOnly);
+    ASSERT(NULL != loadFile);
+    char skip;
+    loadFile->read(&skip, 1);
+    SNAPHashTable *loaded = SNAPHashTable::loadFromGenericFile(loadFile);
+    loadFile->close();
+    delete loadFile;
+    DeleteSingleFile(fileName);
+
+    ASSERT(SNAPHashTable::BucketedLayout == loaded->GetLayout());
+    ASSERT_EQ(bucketed->GetTableSize(), loaded->GetTableSize());
+    ASSERT_EQ(bucketed->GetUsedElementCount(), loaded->GetUsedElementCount());
+    for (unsigned i = 0; i < nKeys; i++) {
+        SNAPHashTable::ValueType values[2], loadedValues[2];
+        ASSERT(bucketed->Lookup(keys[i], 2, values));
+        ASSERT(loaded->Lookup(keys[i], 2, loadedValues));
+        ASSERT_EQ(values[0], loadedValues[0]);
+        ASSERT_EQ(values[1], loadedValues[1]);
+    }
+    delete loaded;
+}
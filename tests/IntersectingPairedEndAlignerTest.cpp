@@ -0,0 +1,149 @@
+#include "stdafx.h"
+#include "TestLib.h"
+#include "IntersectingPairedEndAligner.h"
+
+//
+// Differential tests and a microbenchmark for the galloping hit list search.  Every kernel must find the same hit as a
+// linear scan.
+//
+struct HitSearchTest {
+    static const int maxHits = 20000;
+    static const _int64 genomeSize = 3000000000ll;    // About the size of the human genome
+
+    unsigned hits32[maxHits];
+    GenomeLocation hits64[maxHits];
+    _uint64 randomState;
+
+    HitSearchTest() : randomState(42) {}
+
+    unsigned random() {
+        randomState = randomState * 6364136223846793005ull + 1442695040888963407ull;
+        return (unsigned)(randomState >> 33);
+    }
+
+    //
+    // Fill in a hit list sorted from largest to smallest, the way the index returns them, with about the spacing
+    // that a seed with nHits occurrences would have in a human sized genome.
+    //
+    void makeHits(int nHits) {
+        _int64 meanGap = genomeSize / nHits;
+        _int64 location = genomeSize;
+        for (int i = 0; i < nHits; i++) {
+            location -= 1 + (_int64)((((_uint64)random() << 16) | (random() & 0xffff)) % (2 * meanGap));
+            if (location < 0) {
+                location = 0;
+            }
+            hits64[i] = location;
+            hits32[i] = (unsigned)location;
+        }
+    }
+
+    template<class GL> static _int64 linearSearch(const GL *hits, _int64 start, _int64 nHits, GL maxToFind) {
+        while (start < nHits && hits[start] > maxToFind) {
+            start++;
+        }
+        return start;
+    }
+
+    //
+    // The binary search that findFirstHitAtOrBelow replaced, for the benchmark.
+    //
+    template<class GL> static _int64 binarySearch(const GL *hits, _int64 start, _int64 nHits, GL maxToFind) {
+        _int64 limit[2] = {start, nHits - 1};
+        while (limit[0] <= limit[1]) {
+            _int64 probe = (limit[0] + limit[1]) / 2;
+            if (hits[probe] <= maxToFind && (probe == 0 || hits[probe - 1] > maxToFind)) {
+                return probe;
+            }
+            if (hits[probe] > maxToFind) {
+                limit[0] = probe + 1;
+            } else {
+                limit[1] = probe - 1;
+            }
+        }
+        return nHits;
+    }
+
+    void compareKernel(SIMDLevel kernel, int nHits) {
+        makeHits(nHits);
+        for (int i = 0; i < 2000; i++) {
+            _int64 start = random() % (nHits + 1);
+            _int64 maxToFind;
+            switch (random() % 3) {
+            case 0: maxToFind = GenomeLocationAsInt64(hits64[random() % nHits]); break;       // Exactly on a hit
+            case 1: maxToFind = GenomeLocationAsInt64(hits64[random() % nHits]) - 1; break;   // Just below one
+            default: maxToFind = (_int64)(((_uint64)random() << 32 | random()) % (genomeSize + 10)); break;
+            }
+            ASSERT_EQ(linearSearch<unsigned>(hits32, start, nHits, (unsigned)maxToFind),
+                      IntersectingPairedEndAligner::findFirstHitAtOrBelow(kernel, hits32, start, nHits, (unsigned)maxToFind));
+            ASSERT_EQ(linearSearch<GenomeLocation>(hits64, start, nHits, maxToFind),
+                      IntersectingPairedEndAligner::findFirstHitAtOrBelow(kernel, hits64, start, nHits, maxToFind));
+        }
+    }
+
+    //
+    // Walk down a hit list the way the intersection does: each target is a little below the last, by about the
+    // spacing of hits in a list with otherListHits entries, and each search starts where the last one stopped.
+    // Returns ns per search.
+    //
+    double timeWalk(SIMDLevel kernel, bool useBinarySearch, int nHits, int otherListHits) {
+        makeHits(nHits);
+        const int nWalks = 200;
+        _int64 nSearches = 0;
+        volatile _int64 total = 0;
+        _int64 start = timeInNanos();
+        for (int walk = 0; walk < nWalks; walk++) {
+            _int64 current = 0;
+            _int64 target = genomeSize;
+            _int64 meanStep = genomeSize / otherListHits;
+            while (current < nHits && target > 0) {
+                if (useBinarySearch) {
+                    current = binarySearch<unsigned>(hits32, current, nHits, (unsigned)target);
+                } else {
+                    current = IntersectingPairedEndAligner::findFirstHitAtOrBelow(kernel, hits32, current, nHits, (unsigned)target);
+                }
+                total += current;
+                nSearches++;
+                target -= 1 + (_int64)((((_uint64)random() << 16) | (random() & 0xffff)) % (2 * meanStep));
+            }
+        }
+        return (double)(timeInNanos() - start) / __max(nSearches, (_int64)1);
+    }
+};
+
+TEST_F(HitSearchTest, "galloping search matches linear scan") {
+    static const int sizes[] = {1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 100, 1000, maxHits};
+    for (int kernel = SIMDLevelScalar; kernel <= GetProcessorSIMDLevel(); kernel++) {
+        for (int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+            compareKernel((SIMDLevel)kernel, sizes[i]);
+        }
+    }
+}
+
+TEST_F(HitSearchTest, "galloping search at the top of the 32 bit range") {
+    for (int i = 0; i < 100; i++) {
+        hits32[i] = 0xfffffff0 - i * 1000;
+    }
+    for (int kernel = SIMDLevelScalar; kernel <= GetProcessorSIMDLevel(); kernel++) {
+        ASSERT_EQ(0, IntersectingPairedEndAligner::findFirstHitAtOrBelow((SIMDLevel)kernel, hits32, 0, 100, 0xffffffff));
+        ASSERT_EQ(100, IntersectingPairedEndAligner::findFirstHitAtOrBelow((SIMDLevel)kernel, hits32, 0, 100, hits32[99] - 1));
+        ASSERT_EQ(100, IntersectingPairedEndAligner::findFirstHitAtOrBelow((SIMDLevel)kernel, hits32, 100, 100, 0xffffffff));
+    }
+}
+
+//
+// The list sizes run from a moderately repetitive seed up to the intersecting aligner's default -mhp limit of 2000 hits; the other
+// list sizes cover both the case where this is the list with more hits and the one where it has fewer.
+//
+TEST_F(HitSearchTest, "galloping search microbenchmark") {
+    static const int sizes[][2] = {{16, 4}, {100, 16}, {300, 300}, {2000, 50}, {2000, 2000}};
+    static const char *names[] = {"scalar", "sse4.1", "avx2"};
+    for (int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+        std::cout << std::endl << "    " << sizes[i][0] << " hits vs " << sizes[i][1] << ": binary " << (int)timeWalk(SIMDLevelScalar, true, sizes[i][0], sizes[i][1]);
+        for (int kernel = SIMDLevelScalar; kernel <= GetProcessorSIMDLevel(); kernel++) {
+            std::cout << ", " << names[kernel] << " " << (int)timeWalk((SIMDLevel)kernel, false, sizes[i][0], sizes[i][1]);
+        }
+        std::cout << " ns/search";
+    }
+    std::cout << std::endl << "   " << std::flush;
+}
@@ -1,6 +1,7 @@
 #include "stdafx.h"
 #include "TestLib.h"
 #include "LandauVishkin.h"
+#include "BitParallelEditDistance.h"
 
 // Test fixture for all the Landau-Viskhin Tests
 struct LandauVishkinTest {
@@ -127,3 +128,506 @@ TEST_F(LandauVishkinTest, "CIGAR strings") {
     lvc.computeEditDistance("abc", 3, "abXde", 5, 3, cigarBuf, bufLen, true);
     ASSERT_STREQ("5M", cigarBuf);
 }
+
+//
+// The CIGAR strings from the tracebacks that the aligners keep (-rt), put together the way BaseAligner does it: the part
+// of the read before the seed backward, the seed and then the part after it forward.
+//
+TEST_F(LandauVishkinTest, "CIGAR strings from tracebacks") {
+    initializeLVProbabilitiesToPhredPlus33();
+    LandauVishkin<1> forward;
+    LandauVishkin<-1> backward;
+    TracebackBuffer tracebacks;
+    char cigarBuf[1024];
+    int bufLen = sizeof(cigarBuf);
+    double matchProbability;
+    const char *quality = "IIIIIIIIIIIIIIIIIIIIIIIIIIIIIIII";
+
+    //                   before seed  seed  after seed
+    const char text[] = "AACCGGTTAC" "GTCA" "TTGCAACGTA";
+    const char *reversedBefore = "CATTGXGCCAA";     // AACCGXGTTAC, backward
+    const char *after = "TTGCAAGTX";
+
+    ASSERT_EQ(1, backward.computeEditDistance(text + 10, 10, reversedBefore, quality, 11, 3, &matchProbability));
+    ASSERT_EQ(2, forward.computeEditDistance(text + 14, 10, after, quality, 9, 3, &matchProbability));
+
+    tracebacks.start();
+    ASSERT(backward.appendTraceback(&tracebacks));
+    tracebacks.append('=', 4);
+    ASSERT(forward.appendTraceback(&tracebacks));
+    AlignmentTraceback traceback = tracebacks.finish();
+
+    // It has an insertion and a deletion, so LandauVishkinWithCigar might place them differently
+    ASSERT_EQ(-1, LandauVishkinWithCigar::computeCigarFromTraceback(&traceback, 24, cigarBuf, bufLen, false));
+
+    // One substitution is fine
+    const char *reversedBeforeWithSNP = "CATTGXCCAA";   // AACCXGTTAC, backward
+    const char *afterExact = "TTGCAACGTA";
+    ASSERT_EQ(1, backward.computeEditDistance(text + 10, 10, reversedBeforeWithSNP, quality, 10, 3, &matchProbability));
+    ASSERT_EQ(0, forward.computeEditDistance(text + 14, 10, afterExact, quality, 10, 3, &matchProbability));
+
+    tracebacks.start();
+    ASSERT(backward.appendTraceback(&tracebacks));
+    tracebacks.append('=', 4);
+    ASSERT(forward.appendTraceback(&tracebacks));
+    traceback = tracebacks.finish();
+
+    ASSERT_EQ(1, LandauVishkinWithCigar::computeCigarFromTraceback(&traceback, 24, cigarBuf, bufLen, false));
+    ASSERT_STREQ("4=1X19=", cigarBuf);
+    ASSERT_EQ(1, LandauVishkinWithCigar::computeCigarFromTraceback(&traceback, 24, cigarBuf, bufLen, true));
+    ASSERT_STREQ("24M", cigarBuf);
+
+    // A traceback that doesn't cover the read is no good
+    ASSERT_EQ(-1, LandauVishkinWithCigar::computeCigarFromTraceback(&traceback, 25, cigarBuf, bufLen, true));
+
+    // Without a match probability LandauVishkin doesn't trace back
+    ASSERT_EQ(2, forward.computeEditDistance(text + 14, 10, after, 9, 3));
+    tracebacks.start();
+    ASSERT(!forward.appendTraceback(&tracebacks));
+
+    // Long runs are split into counts that fit in a byte
+    tracebacks.clear();
+    tracebacks.start();
+    tracebacks.append('=', 300);
+    tracebacks.append('X', 0);
+    tracebacks.append('X', 1);
+    traceback = tracebacks.finish();
+    ASSERT_EQ(6, traceback.opsLength);
+    ASSERT_EQ(1, LandauVishkinWithCigar::computeCigarFromTraceback(&traceback, 301, cigarBuf, bufLen, false));
+    ASSERT_STREQ("300=1X", cigarBuf);
+}
+
+//
+// -rt must not change the output, so whenever computeCigarFromTraceback takes a traceback that was put together the
+// way BaseAligner::scoreLocation and recordTraceback do it, it has to give the same CIGAR string and edit distance as
+// the computeEditDistanceNormalized call that the writer would otherwise make.  The reads have random substitutions
+// and indels on both sides of the seed, in text made of only two bases so that indels often have more than one place
+// to go.
+//
+TEST_F(LandauVishkinTest, "CIGAR strings from tracebacks match the ones computed again") {
+    initializeLVProbabilitiesToPhredPlus33();
+    LandauVishkin<1> forward;
+    LandauVishkin<-1> backward;
+    TracebackBuffer tracebacks;
+    static const int textLen = 400;
+    static const int padding = 64;
+    static const int seedLen = 20;
+    static const int seedStart = 200;       // In the text
+    char textSpace[textLen + 2 * padding];
+    char *text = textSpace + padding;
+    char read[200 + padding], reversedRead[200 + padding], quality[200 + padding];
+    char writerCigar[1024], tracebackCigar[1024];
+    _uint64 randomState = 1;
+    int nUsed = 0, nRefused = 0;
+
+    memset(quality, 'I', sizeof(quality));
+
+    for (int trial = 0; trial < 4000; trial++) {
+        memset(textSpace, 'N', sizeof(textSpace));
+        for (int i = 0; i < textLen; i++) {
+            randomState = randomState * 6364136223846793005ull + 1442695040888963407ull;
+            text[i] = (trial % 2 ? "ACGT" : "AAAC")[(randomState >> 33) & 3];
+        }
+
+        //
+        // The read is about 40 bases before the seed and 40 after it, each with up to two edits.
+        //
+        int readLen = 0;
+        int seedOffset = 0;
+        for (int side = 0; side < 2; side++) {
+            int textOffset = 0 == side ? seedStart - 40 : seedStart + seedLen;
+            int textEnd = textOffset + 40;
+            randomState = randomState * 6364136223846793005ull + 1442695040888963407ull;
+            int nEdits = (int)((randomState >> 33) % 3);
+            int editAt[2];
+            for (int i = 0; i < nEdits; i++) {
+                randomState = randomState * 6364136223846793005ull + 1442695040888963407ull;
+                editAt[i] = textOffset + 1 + (int)((randomState >> 33) % 38);
+            }
+
+            while (textOffset < textEnd) {
+                int edit = -1;
+                for (int i = 0; i < nEdits; i++) {
+                    if (editAt[i] == textOffset) {
+                        randomState = randomState * 6364136223846793005ull + 1442695040888963407ull;
+                        edit = (int)((randomState >> 33) % 3);
+                    }
+                }
+
+                if (0 == edit) {            // Substitution
+                    read[readLen++] = 'A' == text[textOffset] ? 'G' : 'A';
+                    textOffset++;
+                } else if (1 == edit) {     // Insertion
+                    read[readLen++] = text[textOffset];
+                } else if (2 == edit) {     // Deletion
+                    textOffset++;
+                } else {
+                    read[readLen++] = text[textOffset++];
+                }
+            }
+
+            if (0 == side) {
+                seedOffset = readLen;
+                memcpy(read + readLen, text + seedStart, seedLen);
+                readLen += seedLen;
+            }
+        }
+
+        for (int i = 0; i < readLen; i++) {
+            reversedRead[i] = read[readLen - 1 - i];
+        }
+
+        //
+        // Score it the way BaseAligner does.
+        //
+        const char *data = text + seedStart - seedOffset;
+        int tailStart = seedOffset + seedLen;
+        double matchProbability;
+        int score1 = forward.computeEditDistance(data + tailStart, readLen - tailStart + MAX_K, read + tailStart, quality, readLen - tailStart, 8,
+            &matchProbability);
+        if (-1 == score1) {
+            continue;
+        }
+
+        int genomeLocationOffset;
+        int score2 = backward.computeEditDistance(data + seedOffset, seedOffset + MAX_K, reversedRead + readLen - seedOffset, quality, seedOffset,
+            8 - score1, &matchProbability, &genomeLocationOffset);
+        if (-1 == score2) {
+            continue;
+        }
+
+        tracebacks.clear();
+        tracebacks.start();
+        ASSERT(backward.appendTraceback(&tracebacks));
+        tracebacks.append('=', seedLen);
+        ASSERT(forward.appendTraceback(&tracebacks));
+        AlignmentTraceback traceback = tracebacks.finish();
+
+        const char *location = data + genomeLocationOffset;
+        for (int useM = 0; useM < 2; useM++) {
+            int tracebackAddFrontClipping = 0;
+            int tracebackEditDistance = LandauVishkinWithCigar::computeCigarFromTraceback(&traceback, readLen, tracebackCigar,
+                sizeof(tracebackCigar), 0 != useM, COMPACT_CIGAR_STRING, NULL, &tracebackAddFrontClipping);
+            if (tracebackEditDistance < 0) {
+                nRefused++;
+                continue;
+            }
+
+            int writerAddFrontClipping = 0;
+            int writerEditDistance = lvc.computeEditDistanceNormalized(location, readLen + MAX_K, read, readLen, MAX_K - 1, writerCigar,
+                sizeof(writerCigar), 0 != useM, COMPACT_CIGAR_STRING, NULL, &writerAddFrontClipping);
+
+            ASSERT_EQ(writerEditDistance, tracebackEditDistance);
+            ASSERT_EQ(writerAddFrontClipping, tracebackAddFrontClipping);
+            ASSERT_STREQ(writerCigar, tracebackCigar);
+            nUsed++;
+        }
+    }
+
+    ASSERT(nUsed > 1000 && nRefused > 1000);
+}
+
+//
+// Differential tests and a microbenchmark for the vector match kernels.  Each kernel must give exactly the same
+// score, net indel and match probability as the scalar one, in both text directions.
+//
+struct LandauVishkinKernelTest {
+    static const int textLen = 400;
+    static const int padding = 64;
+
+    char textSpace[textLen + 2 * padding];
+    char *text;
+    char pattern[textLen + padding];
+    char quality[textLen + padding];
+    _uint64 randomState;
+
+    LandauVishkinKernelTest() : randomState(42) {
+        initializeLVProbabilitiesToPhredPlus33();
+        memset(textSpace, 'N', sizeof(textSpace));
+        text = textSpace + padding;
+        for (int i = 0; i < textLen; i++) {
+            text[i] = "ACGT"[random() % 4];
+        }
+    }
+
+    unsigned random() {
+        randomState = randomState * 6364136223846793005ull + 1442695040888963407ull;
+        return (unsigned)(randomState >> 33);
+    }
+
+    //
+    // Copies patternLen bases of the text starting at textOffset (running backward if direction is -1) into
+    // pattern, applying about nEdits random substitutions, insertions and deletions.
+    //
+    int makePattern(int textOffset, int direction, int patternLen, int nEdits) {
+        int len = 0;
+        int t = textOffset;
+        while (len < patternLen) {
+            char base = direction == 1 ? text[t] : text[t - 1];
+            t += direction;
+            if ((int)(random() % patternLen) < nEdits) {
+                switch (random() % 3) {
+                case 0: base = "ACGT"[(random() % 3 + (base == 'A' ? 1 : 0)) % 4]; break;   // Substitution (sometimes a no-op)
+                case 1: pattern[len++] = "ACGT"[random() % 4]; break;                       // Insertion
+                case 2: continue;                                                            // Deletion
+                }
+            }
+            if (len < patternLen) {
+                pattern[len++] = base;
+            }
+        }
+        for (int i = 0; i < patternLen; i++) {
+            quality[i] = (char)(33 + 2 + random() % 38);
+        }
+        memset(pattern + patternLen, 'n', padding);
+        return len;
+    }
+
+    template<int DIRECTION> void compareKernels(SIMDLevel kernel, int iterations) {
+        LandauVishkin<DIRECTION> scalar, vector;
+        scalar.setKernel(SIMDLevelScalar);
+        vector.setKernel(kernel);
+        for (int i = 0; i < iterations; i++) {
+            int patternLen = 20 + random() % 230;
+            int nEdits = random() % 12;
+            int textOffset = DIRECTION == 1 ? random() % (textLen - patternLen) : patternLen + random() % (textLen - patternLen);
+            makePattern(textOffset, DIRECTION, patternLen, nEdits);
+            int availText = DIRECTION == 1 ? textLen - textOffset : textOffset;
+            int k = random() % (MAX_K - 1);
+
+            double scalarProbability, vectorProbability;
+            int scalarIndel, vectorIndel;
+            int scalarScore = scalar.computeEditDistance(text + textOffset, availText, pattern, quality, patternLen, k, &scalarProbability, &scalarIndel);
+            int vectorScore = vector.computeEditDistance(text + textOffset, availText, pattern, quality, patternLen, k, &vectorProbability, &vectorIndel);
+            ASSERT_EQ(scalarScore, vectorScore);
+            ASSERT_EQ(scalarIndel, vectorIndel);
+            ASSERT_EQ(scalarProbability, vectorProbability);
+            ASSERT_EQ(scalar.computeEditDistance(text + textOffset, availText, pattern, patternLen, k),
+                      vector.computeEditDistance(text + textOffset, availText, pattern, patternLen, k));
+        }
+    }
+
+    template<int DIRECTION> _int64 timeKernel(SIMDLevel kernel, int iterations, int nEdits = 4) {
+        LandauVishkin<DIRECTION> lv;
+        lv.setKernel(kernel);
+        randomState = 42;
+        int patternLen = 150;
+        int textOffset = DIRECTION == 1 ? 100 : 250;
+        makePattern(textOffset, DIRECTION, patternLen, nEdits);
+        double matchProbability;
+        volatile int total = 0;
+        _int64 start = timeInNanos();
+        for (int i = 0; i < iterations; i++) {
+            total += lv.computeEditDistance(text + textOffset, patternLen + 20, pattern, quality, patternLen, 20, &matchProbability);
+        }
+        return (timeInNanos() - start) / iterations;
+    }
+};
+
+TEST_F(LandauVishkinKernelTest, "vector kernels match scalar") {
+    for (int kernel = SIMDLevelSSE41; kernel <= GetProcessorSIMDLevel(); kernel++) {
+        compareKernels<1>((SIMDLevel)kernel, 20000);
+        compareKernels<-1>((SIMDLevel)kernel, 20000);
+    }
+}
+
+TEST_F(LandauVishkinKernelTest, "exact matches across vector boundaries") {
+    LandauVishkin<> scalar, vector;
+    scalar.setKernel(SIMDLevelScalar);
+    for (int kernel = SIMDLevelSSE41; kernel <= GetProcessorSIMDLevel(); kernel++) {
+        vector.setKernel((SIMDLevel)kernel);
+        for (int patternLen = 1; patternLen <= 100; patternLen++) {
+            memcpy(pattern, text, patternLen);
+            ASSERT_EQ(0, vector.computeEditDistance(text, textLen, pattern, patternLen, 5));
+            for (int mismatch = 0; mismatch < patternLen; mismatch++) {
+                pattern[mismatch] = pattern[mismatch] == 'A' ? 'C' : 'A';
+                ASSERT_EQ(scalar.computeEditDistance(text, textLen, pattern, patternLen, 5),
+                          vector.computeEditDistance(text, textLen, pattern, patternLen, 5));
+                pattern[mismatch] = text[mismatch];
+            }
+        }
+    }
+}
+
+TEST_F(LandauVishkinKernelTest, "kernel microbenchmark") {
+    const int iterations = 200000;
+    for (int kernel = SIMDLevelScalar; kernel <= GetProcessorSIMDLevel(); kernel++) {
+        static const char *names[] = {"scalar", "sse4.1", "avx2"};
+        std::cout << names[kernel] << " " << timeKernel<1>((SIMDLevel)kernel, iterations) << "/" <<
+            timeKernel<-1>((SIMDLevel)kernel, iterations) << " ns per call (forward/backward) " << std::flush;
+    }
+}
+
+//
+// Per-call latency as the number of edits grows, which is when the state that each call touches grows.  The patterns
+// with 40 edits are past k, so those calls fail.
+//
+TEST_F(LandauVishkinKernelTest, "edit distance microbenchmark") {
+    const int iterations = 100000;
+    static const int edits[] = {0, 4, 12, 40};
+    for (int i = 0; i < 4; i++) {
+        std::cout << edits[i] << " edits " << timeKernel<1>(lv_kernel, iterations, edits[i]) << "/" <<
+            timeKernel<-1>(lv_kernel, iterations, edits[i]) << " ns, " << std::flush;
+    }
+    std::cout << "per call (forward/backward) " << std::flush;
+}
+
+//
+// The bit-parallel engine has to agree with plain dynamic programming (all of the pattern against the best prefix of
+// the text) for any k, including ones past MAX_K, and its CIGAR strings have to describe an alignment with that
+// many edits.
+//
+struct BitParallelEditDistanceTest {
+    static const int textLen = 40000;
+    static const int padding = 64;
+
+    char textSpace[textLen + 2 * padding];
+    char *text;
+    char pattern[2 * textLen];
+    char quality[2 * textLen];
+    std::vector<int> previousRow, currentRow;
+    _uint64 randomState;
+
+    BitParallelEditDistanceTest() : randomState(17) {
+        initializeLVProbabilitiesToPhredPlus33();
+        memset(textSpace, 'N', sizeof(textSpace));
+        text = textSpace + padding;
+        for (int i = 0; i < textLen; i++) {
+            text[i] = "ACGT"[random() % 4];
+        }
+    }
+
+    unsigned random() {
+        randomState = randomState * 6364136223846793005ull + 1442695040888963407ull;
+        return (unsigned)(randomState >> 33);
+    }
+
+    //
+    // Copies the text starting at textOffset (running backward if direction is -1) into patternLen bases of
+    // pattern, with about nEdits random substitutions, insertions and deletions.
+    //
+    void makePattern(int textOffset, int direction, int patternLen, int nEdits) {
+        int len = 0;
+        for (int t = textOffset; len < patternLen; t += direction) {
+            char base = direction == 1 ? text[t] : text[t - 1];
+            if ((int)(random() % patternLen) < nEdits) {
+                switch (random() % 3) {
+                case 0: base = "ACGT"[random() % 4]; break;
+                case 1: pattern[len++] = "ACGT"[random() % 4]; break;
+                case 2: continue;
+                }
+            }
+            if (len < patternLen) {
+                pattern[len++] = base;
+            }
+        }
+        for (int i = 0; i < patternLen; i++) {
+            quality[i] = (char)(33 + 2 + random() % 38);
+        }
+    }
+
+    int referenceDistance(const char *t, int availText, int direction, int patternLen) {
+        previousRow.resize(availText + 1);
+        currentRow.resize(availText + 1);
+        for (int j = 0; j <= availText; j++) {
+            previousRow[j] = j;
+        }
+        for (int i = 1; i <= patternLen; i++) {
+            currentRow[0] = i;
+            for (int j = 1; j <= availText; j++) {
+                char textBase = direction == 1 ? t[j - 1] : t[-j];
+                currentRow[j] = __min(previousRow[j - 1] + (pattern[i - 1] == textBase ? 0 : 1), __min(previousRow[j], currentRow[j - 1]) + 1);
+            }
+            previousRow.swap(currentRow);
+        }
+        int best = previousRow[0];
+        for (int j = 1; j <= availText; j++) {
+            best = __min(best, previousRow[j]);
+        }
+        return best;
+    }
+
+    //
+    // Walks the expanded CIGAR string and checks that it's an alignment of the whole pattern with score edits.
+    //
+    void checkCigar(const char *cigar, int patternLen, int score, int textUsed) {
+        int p = 0, t = 0, nEdits = 0;
+        for (const char *op = cigar; *op != '\0'; op++) {
+            switch (*op) {
+            case '=': ASSERT(pattern[p] == text[t]); p++; t++; break;
+            case 'X': ASSERT(pattern[p] != text[t]); p++; t++; nEdits++; break;
+            case 'I': p++; nEdits++; break;
+            case 'D': t++; nEdits++; break;
+            default: FAIL("unexpected CIGAR operation");
+            }
+        }
+        ASSERT_EQ(patternLen, p);
+        ASSERT_EQ(textUsed, t);
+        ASSERT_EQ(score, nEdits);
+    }
+
+    template<int DIRECTION> void compareWithReference(int iterations) {
+        BitParallelEditDistance<DIRECTION> bitParallel;
+        LandauVishkin<DIRECTION> lv;
+        for (int i = 0; i < iterations; i++) {
+            int patternLen = 1 + random() % 400;
+            int nEdits = random() % (patternLen / 4 + 1);
+            int textOffset = DIRECTION == 1 ? random() % (textLen - 2 * patternLen) : 2 * patternLen + random() % (textLen - 2 * patternLen);
+            makePattern(textOffset, DIRECTION, patternLen, nEdits);
+            int availText = __min(patternLen + 100, DIRECTION == 1 ? textLen - textOffset : textOffset);
+            int k = random() % 200;
+
+            int reference = referenceDistance(text + textOffset, availText, DIRECTION, patternLen);
+            int expected = reference <= k ? reference : -1;
+
+            double matchProbability;
+            int netIndel;
+            ASSERT_EQ(expected, bitParallel.computeEditDistance(text + textOffset, availText, pattern, patternLen, k));
+            ASSERT_EQ(expected, bitParallel.computeEditDistance(text + textOffset, availText, pattern, quality, patternLen, k, &matchProbability, &netIndel));
+            if (expected >= 0) {
+                ASSERT(matchProbability > 0.0 && matchProbability <= 1.0);
+                ASSERT(abs(netIndel) <= expected);
+            }
+            if (k < MAX_K - 1) {
+                ASSERT_EQ(expected, lv.computeEditDistance(text + textOffset, availText, pattern, patternLen, k));
+            }
+        }
+    }
+};
+
+TEST_F(BitParallelEditDistanceTest, "agrees with dynamic programming and LandauVishkin") {
+    compareWithReference<1>(3000);
+    compareWithReference<-1>(3000);
+}
+
+TEST_F(BitParallelEditDistanceTest, "CIGAR strings") {
+    BitParallelEditDistance<> bitParallel;
+    char cigarBuf[4 * textLen];
+    int textUsed;
+
+    bitParallel.computeEditDistance("abcde", 5, "abcde", 5, 2, cigarBuf, sizeof(cigarBuf), false);
+    ASSERT_STREQ("5=", cigarBuf);
+    bitParallel.computeEditDistance("abcde", 5, "abde", 4, 2, cigarBuf, sizeof(cigarBuf), false);
+    ASSERT_STREQ("2=1D2=", cigarBuf);
+    bitParallel.computeEditDistance("abcde", 5, "abcXde", 6, 2, cigarBuf, sizeof(cigarBuf), true);
+    ASSERT_STREQ("3M1I2M", cigarBuf);
+    bitParallel.computeEditDistance("abcde", 5, "abXXe", 5, 2, cigarBuf, sizeof(cigarBuf), true);
+    ASSERT_STREQ("5M", cigarBuf);
+
+    //
+    // Long enough, and with enough edits, that the traceback has to recompute the columns from checkpoints.
+    //
+    static const int patternLens[] = {100, 1000, 5000, 25000};
+    for (int i = 0; i < 4; i++) {
+        int patternLen = patternLens[i];
+        makePattern(0, 1, patternLen, patternLen / 8);
+        int availText = __min(textLen, patternLen + patternLen / 4);
+        int score = bitParallel.computeEditDistance(text, availText, pattern, patternLen, patternLen / 4, cigarBuf, sizeof(cigarBuf), false,
+                                                    EXPANDED_CIGAR_STRING, NULL, &textUsed);
+        ASSERT(score > MAX_K || patternLen < 1000);
+        if (patternLen <= 5000) {
+            ASSERT_EQ(referenceDistance(text, availText, 1, patternLen), score);
+        }
+        checkCigar(cigarBuf, patternLen, score, textUsed);
+    }
+}
@@ -9,62 +9,113 @@ struct ProbabilityDistanceTest {
     double prob;
     
     ProbabilityDistanceTest(): dist(0.1, 0.01, 0.2) {}
+
+    //
+    // compute() looks at the reference up to maxShift bases before and after the read, so give it Ns there rather
+    // than whatever happens to be next to the string constant.
+    //
+    char referenceSpace[ProbabilityDistance::MAX_SHIFT + 64 + ProbabilityDistance::MAX_SHIFT];
+    const char *padded(const char *reference) {
+        memset(referenceSpace, 'N', sizeof(referenceSpace));
+        memcpy(referenceSpace + ProbabilityDistance::MAX_SHIFT, reference, strlen(reference));
+        return referenceSpace + ProbabilityDistance::MAX_SHIFT;
+    }
 };
 
 
 TEST_F(ProbabilityDistanceTest, "basic probabilities") {
-    dist.compute("A", "A", "I", 1, 0, 0, &prob);
+    dist.compute(padded("A"), "A", "I", 1, 0, 0, &prob);
     ASSERT_NEAR(0.9, prob);
 
-    dist.compute("A", "C", "I", 1, 0, 0, &prob);
+    dist.compute(padded("A"), "C", "I", 1, 0, 0, &prob);
     ASSERT_NEAR(0.1, prob);
 
     char quality10[2] = {43, 0};
-    dist.compute("A", "C", quality10, 1, 0, 0, &prob);
+    dist.compute(padded("A"), "C", quality10, 1, 0, 0, &prob);
     ASSERT_NEAR(0.19, prob);   // 1 - (1 - 0.9) * (1 - 0.9)
 
     // Check that allowing a shift at the start doesn't change it
-    dist.compute("A", "A", "I", 1, 1, 2, &prob);
+    dist.compute(padded("A"), "A", "I", 1, 1, 2, &prob);
     ASSERT_NEAR(0.9, prob);
 
-    dist.compute("A", "C", "I", 1, 1, 2, &prob);
+    dist.compute(padded("A"), "C", "I", 1, 1, 2, &prob);
     ASSERT_NEAR(0.1, prob);
 
-    dist.compute("A", "C", quality10, 1, 1, 2, &prob);
+    dist.compute(padded("A"), "C", quality10, 1, 1, 2, &prob);
     ASSERT_NEAR(0.19, prob);   // 1 - (1 - 0.9) * (1 - 0.9)
 
-    dist.compute("AAAAA", "AAAAA", "IIIII", 5, 1, 2, &prob);
+    dist.compute(padded("AAAAA"), "AAAAA", "IIIII", 5, 1, 2, &prob);
     ASSERT_NEAR(pow(0.9, 5), prob);
 
-    dist.compute("AAAAA", "AACAA", "IIIII", 5, 1, 2, &prob);
+    dist.compute(padded("AAAAA"), "AACAA", "IIIII", 5, 1, 2, &prob);
     ASSERT_NEAR(pow(0.9, 4) * 0.1, prob);
 }
 
 
 TEST_F(ProbabilityDistanceTest, "indels") {
-    dist.compute("ACGTA", "ACGGTA", "IIIIII", 6, 1, 2, &prob);
+    dist.compute(padded("ACGTA"), "ACGGTA", "IIIIII", 6, 1, 2, &prob);
     ASSERT_NEAR(pow(0.9, 5) * 0.01, prob);
 
     // Here it's better to count things as two substitutions than an indel and two mismatches
-    dist.compute("ACGTA", "ACTA", "IIII", 4, 1, 2, &prob);
+    dist.compute(padded("ACGTA"), "ACTA", "IIII", 4, 1, 2, &prob);
     ASSERT_NEAR(pow(0.9, 2) * pow(0.1, 2), prob);
 
-    dist.compute("ACGTACGT", "ACGTTACGT", "IIIIIIIII", 9, 1, 2, &prob);
+    dist.compute(padded("ACGTACGT"), "ACGTTACGT", "IIIIIIIII", 9, 1, 2, &prob);
     ASSERT_NEAR(pow(0.9, 8) * 0.01, prob);
 
-    dist.compute("ACGTACGT", "ACGACGT", "IIIIIII", 7, 1, 2, &prob);
+    dist.compute(padded("ACGTACGT"), "ACGACGT", "IIIIIII", 7, 1, 2, &prob);
     ASSERT_NEAR(pow(0.9, 7) * 0.01, prob);
 
-    dist.compute("ACGTACGT", "ACTACGT", "IIIIIII", 7, 0, 2, &prob);
+    dist.compute(padded("ACGTACGT"), "ACTACGT", "IIIIIII", 7, 0, 2, &prob);
     ASSERT_NEAR(pow(0.9, 7) * 0.01, prob);
 
     // Here we can start at shift 1 and get a better probability with substitutions than indels
-    dist.compute("ACGTACGT", "ACTACGT", "IIIIIII", 7, 1, 2, &prob);
+    dist.compute(padded("ACGTACGT"), "ACTACGT", "IIIIIII", 7, 1, 2, &prob);
     ASSERT_NEAR(pow(0.9, 5) * pow(0.1, 2), prob);
 
-    dist.compute("ACGTACGT", "ACGTTTACGT", "IIIIIIIIII", 10, 1, 2, &prob);
+    dist.compute(padded("ACGTACGT"), "ACGTTTACGT", "IIIIIIIIII", 10, 1, 2, &prob);
     ASSERT_NEAR(pow(0.9, 8) * 0.01 * 0.2, prob);
 
-    dist.compute("ACGTTTACGT", "ACGTACGT", "IIIIIIII", 8, 1, 2, &prob);
+    dist.compute(padded("ACGTTTACGT"), "ACGTACGT", "IIIIIIII", 8, 1, 2, &prob);
     ASSERT_NEAR(pow(0.9, 8) * 0.01 * 0.2, prob);
 }
+
+
+TEST_F(ProbabilityDistanceTest, "kernels agree") {
+    const int refLen = 200;
+    const int padding = ProbabilityDistance::MAX_SHIFT;
+    char refBuffer[padding + refLen + padding];
+    char read[refLen];
+    char quality[refLen];
+    _uint64 randomState = 11;
+    for (int i = 0; i < padding + refLen + padding; i++) {
+        randomState = randomState * 6364136223846793005ull + 1442695040888963407ull;
+        refBuffer[i] = "ACGT"[(randomState >> 33) % 4];
+    }
+    const char *reference = refBuffer + padding;
+
+    for (int trial = 0; trial < 200; trial++) {
+        int readLen = 0;
+        int refPos = 0;
+        while (readLen < refLen - 20 && refPos < refLen) {
+            randomState = randomState * 6364136223846793005ull + 1442695040888963407ull;
+            unsigned r = (unsigned)(randomState >> 33);
+            quality[readLen] = (char)(35 + r % 39);
+            switch (r / 41 % 40) {
+            case 0:     read[readLen++] = "ACGT"[r / 1640 % 4]; break;                  // Insertion
+            case 1:     refPos++; break;                                                // Deletion
+            case 2:     read[readLen++] = "ACGT"[r / 1640 % 4]; refPos++; break;        // Substitution
+            default:    read[readLen++] = reference[refPos++]; break;
+            }
+        }
+        int maxShift = trial % (ProbabilityDistance::MAX_SHIFT - 1) + 1;
+        int maxStartShift = trial % (maxShift + 1);
+
+        double scalarProb, vectorProb;
+        dist.setKernel(SIMDLevelScalar);
+        dist.compute(reference, read, quality, readLen, maxStartShift, maxShift, &scalarProb);
+        dist.setKernel(SIMDLevelAVX2);
+        dist.compute(reference, read, quality, readLen, maxStartShift, maxShift, &vectorProb);
+        ASSERT_NEAR(-log(scalarProb), -log(vectorProb));
+    }
+}
@@ -0,0 +1,91 @@
+#include "stdafx.h"
+#include "Compat.h"
+#include "TestLib.h"
+#include "ReadPreprocessing.h"
+#include "Seed.h"
+#include "Tables.h"
+
+static const unsigned TestSeedLen = 20;
+static const unsigned MaxTestReadLen = 150;
+
+//
+// Preprocess the read with the given kernel, and check everything against building it a base at a time.
+//
+static void checkPreprocessing(const char *data, const char *quality, unsigned readLen, SIMDLevel kernel)
+{
+    char rcData[MaxTestReadLen], rcQuality[MaxTestReadLen], reversedData[MaxTestReadLen], reversedRCData[MaxTestReadLen];
+    Seed seeds[MaxTestReadLen];
+
+    PreprocessedRead output;
+    output.rcData = rcData;
+    output.rcQuality = rcQuality;
+    output.reversedData = reversedData;
+    output.reversedRCData = reversedRCData;
+    output.seeds = seeds;
+    output.seedLen = TestSeedLen;
+
+    SIMDLevel oldKernel = GetReadPreprocessingKernel();
+    SetReadPreprocessingKernel(kernel);
+    PreprocessRead(data, quality, readLen, &output);
+    SetReadPreprocessingKernel(oldKernel);
+
+    unsigned nNs = 0, nNonACGTBases = 0;
+    for (unsigned i = 0; i < readLen; i++) {
+        char complement = BASE_VALUE[(unsigned char)data[i]] < 4 ? COMPLEMENT[(unsigned char)data[i]] : 'N';
+        nNs += 'N' == data[i];
+        nNonACGTBases += BASE_VALUE[(unsigned char)data[i]] >= 4;
+
+        ASSERT_EQ(complement, rcData[readLen - i - 1]);
+        ASSERT_EQ(quality[i], rcQuality[readLen - i - 1]);
+        ASSERT_EQ(data[i], reversedData[readLen - i - 1]);
+        ASSERT_EQ(complement, reversedRCData[i]);
+    }
+    ASSERT_EQ(nNs, output.nNs);
+    ASSERT_EQ(nNonACGTBases, output.nNonACGTBases);
+
+    for (unsigned i = 0; i + TestSeedLen <= readLen; i++) {
+        if (Seed::DoesTextRepresentASeed(data + i, TestSeedLen)) {
+            Seed seed(data + i, TestSeedLen);
+            ASSERT_EQ(seed.getBases(), seeds[i].getBases());
+            ASSERT_EQ(seed.getRCBases(), seeds[i].getRCBases());
+        }
+    }
+}
+
+TEST("read preprocessing matches a base at a time") {
+    char data[MaxTestReadLen], quality[MaxTestReadLen];
+    _uint64 randomState = 1;
+
+    for (unsigned readLen = 0; readLen <= MaxTestReadLen; readLen++) {
+        for (unsigned i = 0; i < readLen; i++) {
+            randomState = randomState * 6364136223846793005ull + 1442695040888963407ull;
+            unsigned r = (unsigned)(randomState >> 33);
+            data[i] = r % 50 == 0 ? "NNQXa"[r / 50 % 5] : "ACGT"[r / 50 % 4];
+            quality[i] = (char)(35 + r / 1000 % 39);
+        }
+
+        checkPreprocessing(data, quality, readLen, SIMDLevelScalar);
+        checkPreprocessing(data, quality, readLen, SIMDLevelSSE41);
+    }
+}
+
+TEST("upcasing a read reports whether anything changed") {
+    const char *mixed = "ACGTacgtNn.ACGTACGTACGTACGTxACGT";
+    unsigned length = (unsigned)strlen(mixed);
+    char upcased[64];
+
+    SIMDLevel oldKernel = GetReadPreprocessingKernel();
+    for (int kernel = SIMDLevelScalar; kernel <= SIMDLevelSSE41; kernel++) {
+        SetReadPreprocessingKernel((SIMDLevel)kernel);
+        ASSERT(UpcaseReadData(mixed, length, upcased));
+        for (unsigned i = 0; i < length; i++) {
+            ASSERT_EQ(TO_UPPER_CASE_DOT_TO_N[(unsigned char)mixed[i]], upcased[i]);
+        }
+
+        // The lower case base is in the vector part for one and the scalar tail for the other.
+        ASSERT(!UpcaseReadData("ACGTACGTACGTACGTNACGT", 21, upcased));
+        ASSERT(UpcaseReadData("ACGTACGTACGTACGTNACGt", 21, upcased));
+        ASSERT(UpcaseReadData("ACGTACGTACGTACGt", 16, upcased));
+    }
+    SetReadPreprocessingKernel(oldKernel);
+}
@@ -0,0 +1,199 @@
+#include "stdafx.h"
+#include "Compat.h"
+#include "TestLib.h"
+#include "SeedPopularity.h"
+#include "GenomeIndex.h"
+#include "BaseAligner.h"
+#include "AlignerOptions.h"
+#include "Read.h"
+
+//
+// Records a set of random seeds with random hit counts and checks what the sketch says about them and about seeds
+// it never saw.
+//
+struct SeedPopularityTest {
+    static const unsigned seedLen = 20;
+    static const unsigned nSeeds = 5000;
+
+    char bases[nSeeds][seedLen];
+    _int64 nHits[nSeeds];
+    _uint64 randomState;
+
+    SeedPopularityTest() : randomState(7) {
+        for (unsigned i = 0; i < nSeeds; i++) {
+            makeSeed(bases[i]);
+            nHits[i] = SeedPopularity::MinHitsToRecord + random() % 5000;
+        }
+    }
+
+    unsigned random() {
+        randomState = randomState * 6364136223846793005ull + 1442695040888963407ull;
+        return (unsigned)(randomState >> 33);
+    }
+
+    void makeSeed(char *seedBases) {
+        for (unsigned i = 0; i < seedLen; i++) {
+            seedBases[i] = "ACGT"[random() % 4];
+        }
+    }
+};
+
+TEST_F(SeedPopularityTest, "reverse complement of packed bases") {
+    Seed seed(bases[0], seedLen);
+    ASSERT_EQ(seed.getRCBases(), SeedPopularity::reverseComplementBases(seed.getBases(), seedLen));
+    ASSERT_EQ(seed.getBases(), SeedPopularity::reverseComplementBases(seed.getRCBases(), seedLen));
+}
+
+TEST_F(SeedPopularityTest, "sketch never underestimates and doesn't care about direction") {
+    SeedPopularity sketch(nSeeds, seedLen);
+    for (unsigned i = 0; i < nSeeds; i++) {
+        Seed seed(bases[i], seedLen);
+        sketch.record(i % 2 ? seed.getBases() : seed.getRCBases(), nHits[i]);
+    }
+
+    for (unsigned i = 0; i < nSeeds; i++) {
+        Seed seed(bases[i], seedLen);
+        ASSERT(sketch.getClass(seed) >= SeedPopularity::classForHits(nHits[i]));
+        ASSERT_EQ(sketch.getClass(seed), sketch.getClass(~seed));
+    }
+
+    unsigned nUnrecordedWithClass = 0;
+    for (unsigned i = 0; i < nSeeds; i++) {
+        char unrecorded[seedLen];
+        makeSeed(unrecorded);
+        if (sketch.getClass(Seed(unrecorded, seedLen)) != 0) {
+            nUnrecordedWithClass++;
+        }
+    }
+    ASSERT(nUnrecordedWithClass < nSeeds / 10);
+}
+
+//
+// Builds a small index over a random genome with a repeat pasted into it many times, the way the repetitive parts of a
+// real genome look to the aligner, and aligns reads that are mostly repeat.  Some copies overwrite others, so the
+// repeat's seeds have about maxHits hits, and the ones under it bring in the other copies as candidates.
+//
+struct SeedRankingTest {
+    static const unsigned genomeSize = 300000;
+    static const unsigned repeatSize = 300;
+    static const unsigned nRepeatCopies = 300;
+    static const unsigned readLen = 100;
+
+    char genomeBases[genomeSize + 1];
+    unsigned repeatStarts[nRepeatCopies];
+    char indexDir[32];
+    char fastaFileName[40];
+    GenomeIndex *index;
+    AlignerOptions options;
+    _uint64 randomState;
+
+    SeedRankingTest() : index(NULL), options("SeedRankingTest"), randomState(11) {
+        for (unsigned i = 0; i < genomeSize; i++) {
+            genomeBases[i] = "ACGT"[random() % 4];
+        }
+        genomeBases[genomeSize] = '\0';
+
+        char repeat[repeatSize];
+        for (unsigned i = 0; i < repeatSize; i++) {
+            repeat[i] = "ACGT"[random() % 4];
+        }
+        for (unsigned i = 0; i < nRepeatCopies; i++) {
+            repeatStarts[i] = readLen + random() % (genomeSize - repeatSize - readLen);     // The reads start a bit before it
+            memcpy(genomeBases + repeatStarts[i], repeat, repeatSize);
+        }
+
+        strcpy(indexDir, "/tmp/snapSeedRankingTestXXXXXX");
+        if (NULL == mkdtemp(indexDir)) {
+            return;
+        }
+        sprintf(fastaFileName, "%s.fa", indexDir);
+        FILE *fastaFile = fopen(fastaFileName, "w");
+        if (NULL == fastaFile) {
+            return;
+        }
+        fprintf(fastaFile, ">chr0\n");
+        for (unsigned i = 0; i < genomeSize; i += 60) {
+            fprintf(fastaFile, "%.*s\n", __min(60, genomeSize - i), genomeBases + i);
+        }
+        fclose(fastaFile);
+
+        const char *indexerArgs[] = {fastaFileName, indexDir, "-t1"};
+        GenomeIndex::runIndexer(sizeof(indexerArgs) / sizeof(indexerArgs[0]), indexerArgs);
+        index = GenomeIndex::loadFromDirectory(indexDir, false, false);
+    }
+
+    ~SeedRankingTest() {
+        delete index;
+        const char *fileNames[] = {"Genome", "GenomeIndex", "GenomeIndexHash", "OverflowTable", "SeedPopularity"};
+        for (size_t i = 0; i < sizeof(fileNames) / sizeof(fileNames[0]); i++) {
+            char fileName[64];
+            sprintf(fileName, "%s/%s", indexDir, fileNames[i]);
+            DeleteSingleFile(fileName);
+        }
+        rmdir(indexDir);
+        DeleteSingleFile(fastaFileName);
+    }
+
+    unsigned random() {
+        randomState = randomState * 6364136223846793005ull + 1442695040888963407ull;
+        return (unsigned)(randomState >> 33);
+    }
+
+    //
+    // Set up the way SingleAligner does it.
+    //
+    BaseAligner *newAligner() {
+        BaseAligner *aligner = new BaseAligner(index, options.maxHits, options.maxDist, readLen, options.numSeedsFromCommandLine,
+            options.seedCoverage, options.minWeightToCheck, options.extraSearchDepth, false, false, false, options.maxSecondaryAlignmentsPerContig);
+        aligner->setSeedLookupBatchSize(options.seedLookupBatchSize);
+        aligner->setRankSeedsByPopularity(options.seedRanking);
+        aligner->setUseExactMatchTier(!options.noExactMatchTier);
+        return aligner;
+    }
+
+    void align(BaseAligner *aligner, const char *bases, SingleAlignmentResult *result) {
+        char quality[readLen + 16];
+        memset(quality, 'I', sizeof(quality));
+        Read read;
+        read.init("read", 4, bases, quality, readLen);
+        int nSecondaryResults;
+        aligner->AlignRead(&read, result, -1, 0, &nSecondaryResults, 0, NULL);
+    }
+};
+
+TEST_F(SeedRankingTest, "reads that are mostly repeat get the same alignment and MAPQ as with seeds in read order") {
+    ASSERT(NULL != index);
+    ASSERT(NULL != index->getSeedPopularity());
+
+    //
+    // Ranking the seeds lets some of these reads finish before they look up the repeat seeds that find their second
+    // best candidates, which raises their MAPQ (45 to 70, say), so it has to stay off unless asked for.
+    //
+    BaseAligner *aligner = newAligner();
+    BaseAligner *readOrderAligner = newAligner();
+    readOrderAligner->setRankSeedsByPopularity(false);
+
+    for (unsigned i = 0; i < nRepeatCopies; i++) {
+        for (unsigned overlap = 50; overlap < readLen; overlap++) {
+            //
+            // Start in the unique sequence before the copy, sometimes with a change or two.
+            //
+            char bases[readLen + 16];   // The edit distance code reads a word at a time, so it can look past the end
+            memcpy(bases, genomeBases + repeatStarts[i] - (readLen - overlap), readLen);
+            memset(bases + readLen, 'N', sizeof(bases) - readLen);
+            for (unsigned j = 0; j < i % 3; j++) {
+                bases[random() % readLen] = "ACGT"[random() % 4];
+            }
+
+            SingleAlignmentResult result, readOrderResult;
+            align(aligner, bases, &result);
+            align(readOrderAligner, bases, &readOrderResult);
+            ASSERT_EQ(readOrderResult.status, result.status);
+            ASSERT_EQ(readOrderResult.mapq, result.mapq);
+            ASSERT_EQ(GenomeLocationAsInt64(readOrderResult.location), GenomeLocationAsInt64(result.location));
+        }
+    }
+
+    delete aligner;
+    delete readOrderAligner;
+}
@@ -0,0 +1,119 @@
+#include "stdafx.h"
+#include "Compat.h"
+#include "TestLib.h"
+#include "Genome.h"
+#include "FileFormat.h"
+#include "DataWriter.h"
+#include <vector>
+
+//
+// Writes SAM records at random locations through a sorted writer with buffers small enough that they spill into many
+// blocks, and checks that the merged file has the header and then every record once, in location order.
+//
+struct SortedDataWriterTest {
+    static const unsigned padding = 50;
+    static const int contigLength = 1000000;
+
+    const Genome *genome;
+    const char *genomeFileName;
+    const char *tempFileName;
+    const char *sortedFileName;
+
+    SortedDataWriterTest() : genomeFileName("SortedDataWriterTest.genome"), tempFileName("SortedDataWriterTest.sam.tmp"),
+        sortedFileName("SortedDataWriterTest.sam")
+    {
+        Genome *newGenome = new Genome(contigLength + 2 * padding, contigLength + 2 * padding, padding);
+        newGenome->startContig("chr1");
+        char buffer[1000];
+        for (int i = 0; i < contigLength; i += sizeof(buffer)) {
+            for (unsigned j = 0; j < sizeof(buffer); j++) {
+                buffer[j] = "ACGT"[(i + j) % 4];
+            }
+            newGenome->addData(buffer, sizeof(buffer));
+        }
+        for (unsigned i = 0; i < padding; i++) {
+            newGenome->addData("n");
+        }
+        newGenome->saveToFile(genomeFileName);
+        delete newGenome;
+
+        genome = Genome::loadFromFile(genomeFileName, padding);
+    }
+
+    ~SortedDataWriterTest() {
+        delete genome;
+        DeleteSingleFile(genomeFileName);
+        DeleteSingleFile(sortedFileName);
+    }
+
+    void writeAndCheck(int nRecords, size_t sortMemory, unsigned mergeFanIn) {
+        static const char header[] = "@HD\tVN:1.4\tSO:coordinate\n@SQ\tSN:chr1\tLN:1000000\n";
+        DataWriterSupplier *supplier = DataWriterSupplier::sorted(FileFormat::SAM[0], genome, tempFileName, sortMemory, 1,
+            sortedFileName, NULL, sortMemory, mergeFanIn);
+        DataWriter *writer = supplier->getWriter();
+
+        char *buffer;
+        size_t size;
+        ASSERT(writer->getBuffer(&buffer, &size));
+        writer->inHeader(true);
+        memcpy(buffer, header, sizeof(header) - 1);
+        writer->advance(sizeof(header) - 1, 0);
+        writer->nextBatch();
+        writer->inHeader(false);
+
+        std::vector<int> positions(nRecords);
+        _uint64 randomState = 1;
+        for (int i = 0; i < nRecords; i++) {
+            randomState = randomState * 6364136223846793005ull + 1442695040888963407ull;
+            positions[i] = 1 + (int)((randomState >> 33) % contigLength);
+
+            char record[200];
+            int length = sprintf(record, "r%d\t0\tchr1\t%d\t60\t10M\t*\t0\t0\tACGTACGTAC\tIIIIIIIIII\n", i, positions[i]);
+            ASSERT(writer->getBuffer(&buffer, &size));
+            if (size < (size_t)length) {
+                writer->nextBatch();
+                ASSERT(writer->getBuffer(&buffer, &size));
+                ASSERT(size >= (size_t)length);
+            }
+            memcpy(buffer, record, length);
+            writer->advance(length, genome->getContigs()[0].beginningLocation + positions[i] - 1);
+        }
+        writer->close();
+        delete writer;
+        supplier->close();
+        delete supplier;
+
+        FILE *sorted = fopen(sortedFileName, "r");
+        ASSERT(NULL != sorted);
+        char line[200];
+        ASSERT(NULL != fgets(line, sizeof(line), sorted) && 0 == strncmp(line, "@HD", 3));
+        ASSERT(NULL != fgets(line, sizeof(line), sorted) && 0 == strncmp(line, "@SQ", 3));
+        std::vector<bool> seen(nRecords, false);
+        int nSeen = 0;
+        int previousPosition = 0;
+        while (NULL != fgets(line, sizeof(line), sorted)) {
+            int id, position;
+            ASSERT_EQ(2, sscanf(line, "r%d\t0\tchr1\t%d\t", &id, &position));
+            ASSERT(id >= 0 && id < nRecords && !seen[id]);
+            ASSERT_EQ(positions[id], position);
+            ASSERT(position >= previousPosition);
+            seen[id] = true;
+            nSeen++;
+            previousPosition = position;
+        }
+        fclose(sorted);
+        ASSERT_EQ(nRecords, nSeen);
+    }
+};
+
+TEST_F(SortedDataWriterTest, "sorted merge of many blocks keeps every record in order") {
+    writeAndCheck(100000, 3 * 64 * 1024, 0);
+}
+
+TEST_F(SortedDataWriterTest, "sorted merge of many blocks with background merges keeps every record in order") {
+    writeAndCheck(100000, 3 * 64 * 1024, 4);
+}
+
+TEST_F(SortedDataWriterTest, "sorted merge of more blocks than it reads at once keeps every record in order") {
+    writeAndCheck(400000, 3 * 32 * 1024, 0);
+}
@@ -0,0 +1,138 @@
+#include "stdafx.h"
+#include "Compat.h"
+#include "TestLib.h"
+#include "SpeculativeInflate.h"
+#include "zlib.h"
+#include <vector>
+
+//
+// FASTQ-like text, gzipped with zlib as one or more members.
+//
+struct SpeculativeInflateTest {
+    std::vector<BYTE> text;
+    std::vector<BYTE> compressed;
+
+    SpeculativeInflateTest() {
+        _uint64 randomState = 7;
+        char line[400];
+        for (unsigned i = 0; i < 60000; i++) {
+            int n = sprintf(line, "@read%u\n", i);
+            for (unsigned j = 0; j < 150; j++) {
+                randomState = randomState * 6364136223846793005ull + 1442695040888963407ull;
+                line[n + j] = "ACGT"[(randomState >> 33) & 3];
+                line[n + 150 + 3 + j] = (char)('!' + (randomState >> 40) % 41);
+            }
+            memcpy(line + n + 150, "\n+\n", 3);
+            line[n + 303] = '\n';
+            text.insert(text.end(), line, line + n + 304);
+        }
+    }
+
+    void compress(unsigned nMembers) {
+        compressed.clear();
+        size_t memberBytes = text.size() / nMembers + 1;
+        for (size_t begin = 0; begin < text.size(); begin += memberBytes) {
+            size_t bytes = __min(memberBytes, text.size() - begin);
+            z_stream zstream;
+            memset(&zstream, 0, sizeof(zstream));
+            ASSERT_EQ(Z_OK, deflateInit2(&zstream, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY));
+            std::vector<BYTE> member(deflateBound(&zstream, (uLong)bytes));
+            zstream.next_in = &text[begin];
+            zstream.avail_in = (uInt)bytes;
+            zstream.next_out = &member[0];
+            zstream.avail_out = (uInt)member.size();
+            ASSERT_EQ(Z_STREAM_END, deflate(&zstream, Z_FINISH));
+            compressed.insert(compressed.end(), member.begin(), member.begin() + zstream.total_out);
+            deflateEnd(&zstream);
+        }
+    }
+};
+
+TEST_F(SpeculativeInflateTest, "inflating from the start matches zlib") {
+    for (unsigned nMembers = 1; nMembers <= 3; nMembers += 2) {
+        compress(nMembers);
+        SpeculativeInflater inflater;
+        ASSERT(inflater.inflate(&compressed[0], compressed.size(), InflateBoundary(0, true), compressed.size() * 8, true));
+        ASSERT(inflater.streamEnded() || inflater.getEnd().bit == (_int64)compressed.size() * 8);
+        ASSERT_EQ((_int64)text.size(), inflater.getOutputBytes());
+        ASSERT_EQ((_int64)nMembers, inflater.getMemberEnds()->size());
+
+        BYTE window[SpeculativeInflater::WindowSize];
+        memset(window, 0, sizeof(window));
+        inflater.resolve(window, 0, inflater.getOutputBytes());
+        ASSERT(0 == memcmp(&text[0], inflater.getOutput(), text.size()));
+
+        InflateMemberEnd firstMember = (*inflater.getMemberEnds())[0];
+        ASSERT_EQ((_uint32)crc32(0, &text[0], (uInt)firstMember.outputOffset), firstMember.crc);
+        ASSERT_EQ((_uint32)__min(text.size(), text.size() / nMembers + 1), firstMember.size);
+    }
+}
+
+//
+// Start in the middle, and after resolving the window references against the real preceding output, get the rest of
+// the text.  Decoding from the start up to where the block was found says how much output came before it.
+//
+TEST_F(SpeculativeInflateTest, "inflating from a block found in the middle matches once resolved") {
+    compress(1);
+    SpeculativeInflater prefix, chunk;
+    _int64 inputBytes = compressed.size();
+    for (int piece = 1; piece < 4; piece++) {
+        _int64 start = chunk.findBlockStart(&compressed[0], inputBytes, inputBytes * 8 * piece / 4, inputBytes * 8);
+        ASSERT(start > 0);
+
+        ASSERT(prefix.inflate(&compressed[0], inputBytes, InflateBoundary(0, true), start, true));
+        ASSERT(prefix.getEnd() == InflateBoundary(start, false));
+        _int64 before = prefix.getOutputBytes();
+        ASSERT(before > SpeculativeInflater::WindowSize);
+
+        ASSERT(chunk.inflate(&compressed[0], inputBytes, InflateBoundary(start, false), inputBytes * 8, true));
+        ASSERT(chunk.getWindowDependentBytes() > 0);
+        ASSERT_EQ((_int64)text.size() - before, chunk.getOutputBytes());
+        chunk.resolve(&text[before - SpeculativeInflater::WindowSize], 0, chunk.getOutputBytes());
+        ASSERT(0 == memcmp(&text[before], chunk.getOutput(), chunk.getOutputBytes()));
+    }
+}
+
+TEST_F(SpeculativeInflateTest, "no block starts in text that isn't compressed") {
+    SpeculativeInflater inflater;
+    ASSERT_EQ((_int64)-1, inflater.findBlockStart(&text[0], 200000, 0, 200000 * 8));
+}
+
+#ifndef _MSC_VER
+#include <unistd.h>
+#include "DataReader.h"
+
+//
+// Several batches of the reader's worth, so chunks start in the middle of members and blocks span batches.
+//
+TEST_F(SpeculativeInflateTest, "parallel gzip reader returns the text") {
+    int oldThreadCount = DataSupplier::ThreadCount;
+    DataSupplier::ThreadCount = 4;
+    for (unsigned nMembers = 1; nMembers <= 3; nMembers += 2) {
+        compress(nMembers);
+        char fileName[] = "/tmp/snapSpeculativeInflateTestXXXXXX";
+        int fd = mkstemp(fileName);
+        ASSERT(fd >= 0);
+        ASSERT_EQ((ssize_t)compressed.size(), write(fd, &compressed[0], compressed.size()));
+        close(fd);
+
+        DataReader *reader = DataSupplier::GzipDefault->getDataReader(2, 1000, 0.0, 0);
+        ASSERT(reader->init(fileName));
+        reader->reinit(0, 0);
+        size_t position = 0;
+        char *buffer;
+        _int64 validBytes, startBytes;
+        while (reader->getData(&buffer, &validBytes, &startBytes)) {
+            ASSERT(position + validBytes <= text.size());
+            ASSERT(0 == memcmp(buffer, &text[position], validBytes));
+            position += startBytes;
+            reader->advance(startBytes);
+            reader->nextBatch();
+        }
+        ASSERT_EQ(text.size(), position);
+        delete reader;
+        unlink(fileName);
+    }
+    DataSupplier::ThreadCount = oldThreadCount;
+}
+#endif // _MSC_VER
@@ -0,0 +1,163 @@
+#include "stdafx.h"
+#include "Compat.h"
+#include "TestLib.h"
+#include "TextScanner.h"
+#include "FASTQ.h"
+#include "SAM.h"
+
+static const char *kernelNames[] = {"scalar", "sse4.1", "avx2"};
+
+TEST("text scanner kernels match a byte at a time") {
+    char text[64];
+    _uint64 randomState = 1;
+    SIMDLevel oldKernel = GetTextScannerKernel();
+
+    for (unsigned trial = 0; trial < 2000; trial++) {
+        for (unsigned i = 0; i < sizeof(text); i++) {
+            randomState = randomState * 6364136223846793005ull + 1442695040888963407ull;
+            unsigned r = (unsigned)(randomState >> 33);
+            text[i] = r % 8 == 0 ? "\n\t\r\0"[r / 8 % 4] : (char)('!' + r / 32 % 90);
+        }
+
+        for (unsigned length = 0; length <= sizeof(text); length++) {
+            for (int fieldSeparatorsToo = 0; fieldSeparatorsToo < 2; fieldSeparatorsToo++) {
+                _uint64 expected = 0;
+                for (unsigned i = 0; i < length; i++) {
+                    if ('\n' == text[i] || '\0' == text[i] || (fieldSeparatorsToo && ('\t' == text[i] || '\r' == text[i]))) {
+                        expected |= (_uint64)1 << i;
+                    }
+                }
+
+                for (int kernel = SIMDLevelScalar; kernel <= GetProcessorSIMDLevel(); kernel++) {
+                    SetTextScannerKernel((SIMDLevel)kernel);
+                    ASSERT_EQ(expected, ScanTextBlock(text, length, 0 != fieldSeparatorsToo));
+                }
+            }
+        }
+    }
+    SetTextScannerKernel(oldKernel);
+}
+
+TEST("text scanner hands out every newline across blocks") {
+    char text[1000];
+    for (unsigned i = 0; i < sizeof(text); i++) {
+        text[i] = i % 37 == 36 || i == 63 || i == 64 ? '\n' : 'A';
+    }
+
+    TextScanner scanner(text, sizeof(text), false);
+    for (unsigned i = 0; i < sizeof(text); i++) {
+        if ('\n' == text[i]) {
+            ASSERT_EQ((size_t)i, scanner.next());
+        }
+    }
+    ASSERT_EQ(sizeof(text), scanner.next());
+    ASSERT_EQ(sizeof(text), scanner.next());
+}
+
+//
+// parseLine() is protected.
+//
+struct SAMLineParser : public SAMReader {
+    static bool parse(char *line, char *endOfBuffer, char *fields[], size_t *lineLength, size_t fieldLengths[]) {
+        return parseLine(line, endOfBuffer, fields, lineLength, fieldLengths);
+    }
+};
+
+TEST("SAM lines split on runs of tabs and CRs") {
+    char line[] = "  read1\t0\tchr1\t100\t60\t4M\t*\t0\t\t0\tACGT\t\tIIII\tNM:i:0\tRG:Z:x\r\nnext";
+    char *fields[12];
+    size_t fieldLengths[12], lineLength;
+    ASSERT(SAMLineParser::parse(line, line + strlen(line), fields, &lineLength, fieldLengths));
+    ASSERT_EQ((size_t)(strchr(line, '\n') + 1 - line), lineLength);
+
+    static const char *expected[] = {"read1", "0", "chr1", "100", "60", "4M", "*", "0", "0", "ACGT", "IIII", "NM:i:0\tRG:Z:x\r"};
+    for (unsigned i = 0; i < 12; i++) {
+        ASSERT_EQ(strlen(expected[i]), fieldLengths[i]);
+        ASSERT(0 == memcmp(expected[i], fields[i], fieldLengths[i]));
+    }
+
+    // No optional fields, even with a separator before the newline
+    char noOptional[] = "r\t0\t*\t0\t0\t*\t*\t0\t0\tA\tI\t\r\n";
+    ASSERT(SAMLineParser::parse(noOptional, noOptional + strlen(noOptional), fields, &lineLength, fieldLengths));
+    ASSERT(NULL == fields[11]);
+    ASSERT_EQ(strlen(noOptional), lineLength);
+
+    // Too few fields, no newline, and a NUL before the newline
+    char tooFew[] = "r\t0\t*\t0\t0\t*\t*\t0\t0\tA\n";
+    ASSERT(!SAMLineParser::parse(tooFew, tooFew + strlen(tooFew), fields, &lineLength, fieldLengths));
+    char noNewline[] = "r\t0\t*\t0\t0\t*\t*\t0\t0\tA\tI\tXX:i:1";
+    ASSERT(!SAMLineParser::parse(noNewline, noNewline + strlen(noNewline), fields, &lineLength, fieldLengths));
+    char withNul[] = "r\t0\t*\t0\t0\t*\t*\t0\t0\tA\tI\tXX:i:1\0\n";
+    ASSERT(!SAMLineParser::parse(withNul, withNul + sizeof(withNul) - 1, fields, &lineLength, fieldLengths));
+}
+
+#ifndef _MSC_VER
+#include <unistd.h>
+
+//
+// Parser throughput for each kernel: reads per second through FASTQReader::getNextRead() from a file in the page
+// cache, and lines per second through the SAM line splitter.
+//
+TEST("parser throughput benchmark") {
+    char fileName[] = "/tmp/snapTextScannerTestXXXXXX";
+    int fd = mkstemp(fileName);
+    ASSERT(fd >= 0);
+    FILE *file = fdopen(fd, "w");
+
+    const unsigned nReads = 200000;
+    const unsigned readLength = 150;
+    char bases[readLength + 1], quality[readLength + 1];
+    _uint64 randomState = 1;
+    for (unsigned i = 0; i < nReads; i++) {
+        for (unsigned j = 0; j < readLength; j++) {
+            randomState = randomState * 6364136223846793005ull + 1442695040888963407ull;
+            bases[j] = "ACGT"[(randomState >> 33) & 3];
+            quality[j] = (char)('!' + (randomState >> 40) % 41);
+        }
+        fprintf(file, "@machine:run:flowcell:1:%u:%u:%u 1:N:0:ACGT\n%.*s\n+\n%.*s\n", i % 4, i, i * 7 % 30000,
+            readLength, bases, readLength, quality);
+    }
+    fclose(file);
+
+    ReaderContext context;
+    memset(&context, 0, sizeof(context));
+    context.clipping = NoClipping;
+    context.defaultReadGroup = "";
+
+    char samLine[1024];
+    snprintf(samLine, sizeof(samLine), "machine:run:flowcell:1:0:1:7\t0\tchr1\t1000\t60\t150M\t*\t0\t0\t%.*s\t%.*s\tNM:i:0\tRG:Z:x\n",
+        readLength, bases, readLength, quality);
+    size_t samLineLength = strlen(samLine);
+
+    SIMDLevel oldKernel = GetTextScannerKernel();
+    for (int kernel = SIMDLevelScalar; kernel <= GetProcessorSIMDLevel(); kernel++) {
+        SetTextScannerKernel((SIMDLevel)kernel);
+
+        FASTQReader *reader = FASTQReader::create(DataSupplier::Default, fileName, 4, 0, QueryFileSize(fileName), context);
+        Read read;
+        unsigned readsParsed = 0;
+        _int64 start = timeInNanos();
+        while (reader->getNextRead(&read)) {
+            readsParsed++;
+        }
+        _int64 fastqNanos = timeInNanos() - start;
+        delete reader;
+        ASSERT_EQ(nReads, readsParsed);
+
+        const unsigned samIterations = 200000;
+        char *fields[12];
+        size_t fieldLengths[12], lineLength;
+        start = timeInNanos();
+        for (unsigned i = 0; i < samIterations; i++) {
+            SAMLineParser::parse(samLine, samLine + samLineLength, fields, &lineLength, fieldLengths);
+        }
+        _int64 samNanos = timeInNanos() - start;
+
+        std::cout << kernelNames[kernel] << " " << (_int64)nReads * 1000000000 / __max(fastqNanos, (_int64)1) << " FASTQ reads/s, " <<
+            (_int64)samIterations * 1000000000 / __max(samNanos, (_int64)1) << " SAM lines/s " << std::flush;
+    }
+    SetTextScannerKernel(oldKernel);
+
+    unlink(fileName);
+}
+#endif // _MSC_VER
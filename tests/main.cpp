@@ -1,6 +1,9 @@
 #include "TestLib.h"
+#include "SeedSequencer.h"
 
 int main(int argc, char **argv) {
+    InitializeSeedSequencers();     // As snap-aligner does at startup, for the tests that run an aligner
+
     // Allow passing in a substring to search for in test names
     char *filter = (argc == 2 ? argv[1] : NULL);
     return test::runAllTests(filter);